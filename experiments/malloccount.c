@@ -0,0 +1,24 @@
+/*
+ * Counts calls to malloc, which operator new goes through, and prints the
+ * count when the program exits. See experiments/callframes.kiwi.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static atomic_ulong allocations;
+static void* (*next_malloc)(size_t);
+
+void* malloc(size_t size) {
+  if (!next_malloc) {
+    next_malloc = (void* (*)(size_t))dlsym(RTLD_NEXT, "malloc");
+  }
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return next_malloc(size);
+}
+
+__attribute__((destructor)) static void report(void) {
+  fprintf(stderr, "allocations: %lu\n", atomic_load(&allocations));
+}
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include "builtins/argv_handler.h"
+#include "builtins/channel_handler.h"
 #include "builtins/console_handler.h"
 #include "builtins/core_handler.h"
 #include "builtins/encoder_handler.h"
@@ -43,26 +44,42 @@ class BuiltinDispatch {
   static KValue execute(const Token& token, const KName& builtin,
                         const std::vector<KValue>& args,
                         const std::unordered_map<k_string, k_string>& cliArgs) {
-    if (FileIOBuiltIns.is_builtin(builtin)) {
-      return FileIOBuiltinHandler::execute(token, builtin, args);
-    } else if (TimeBuiltins.is_builtin(builtin)) {
-      return TimeBuiltinHandler::execute(token, builtin, args);
-    } else if (MathBuiltins.is_builtin(builtin)) {
-      return MathBuiltinHandler::execute(token, builtin, args);
-    } else if (EnvBuiltins.is_builtin(builtin)) {
-      return EnvBuiltinHandler::execute(token, builtin, args);
-    } else if (EncoderBuiltins.is_builtin(builtin)) {
-      return EncoderBuiltinHandler::execute(token, builtin, args);
-    } else if (ArgvBuiltins.is_builtin(builtin)) {
-      return ArgvBuiltinHandler::execute(token, builtin, args, cliArgs);
-    } else if (ConsoleBuiltins.is_builtin(builtin)) {
-      return ConsoleBuiltinHandler::execute(token, builtin, args);
-    } else if (SysBuiltins.is_builtin(builtin)) {
-      return SysBuiltinHandler::execute(token, builtin, args);
-    } else if (HttpBuiltins.is_builtin(builtin)) {
-      return HttpBuiltinHandler::execute(token, builtin, args);
-    } else if (LoggingBuiltins.is_builtin(builtin)) {
-      return LoggingBuiltinHandler::execute(token, builtin, args);
+    switch (KBuiltinTable::getFamily(builtin)) {
+      case KBuiltinFamily::FileIO:
+        return FileIOBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Time:
+        return TimeBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Math:
+        return MathBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Env:
+        return EnvBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Encoder:
+        return EncoderBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Argv:
+        return ArgvBuiltinHandler::execute(token, builtin, args, cliArgs);
+
+      case KBuiltinFamily::Console:
+        return ConsoleBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Sys:
+        return SysBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Http:
+        return HttpBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Logging:
+        return LoggingBuiltinHandler::execute(token, builtin, args);
+
+      case KBuiltinFamily::Channel:
+        return ChannelBuiltinHandler::execute(token, builtin, args);
+
+      default:
+        break;
     }
 
     throw UnknownBuiltinError(token, token.getText());
@@ -70,7 +87,8 @@ class BuiltinDispatch {
 
   static KValue execute(const Token& token, const KName& builtin,
                         const KValue& value, const std::vector<KValue>& args) {
-    if (KiwiBuiltins.is_builtin(builtin)) {
+    auto family = KBuiltinTable::getFamily(builtin);
+    if (family == KBuiltinFamily::Kiwi || family == KBuiltinFamily::List) {
       return CoreBuiltinHandler::execute(token, builtin, value, args);
     }
 
@@ -42,7 +42,7 @@ class ArgvBuiltinHandler {
       throw BuiltinUnexpectedArgumentError(token, ArgvBuiltins.GetArgv);
     }
 
-    auto argv = std::make_shared<List>();
+    auto argv = make_ref<List>();
     auto& elements = argv->elements;
 
     for (const auto& pair : cliArgs) {
@@ -0,0 +1,169 @@
+#ifndef KIWI_BUILTINS_CHANNELHANDLER_H
+#define KIWI_BUILTINS_CHANNELHANDLER_H
+
+#include "math/functions.h"
+#include "parsing/builtins.h"
+#include "parsing/tokens.h"
+#include "typing/value.h"
+#include "concurrency/channel.h"
+
+class ChannelBuiltinHandler {
+ public:
+  static KValue execute(const Token& token, const KName& builtin,
+                        const std::vector<KValue>& args) {
+    switch (builtin) {
+      case KName::Builtin_Channel_Close:
+        return executeClose(token, args);
+
+      case KName::Builtin_Channel_Create:
+        return executeCreate(token, args);
+
+      case KName::Builtin_Channel_Receive:
+        return executeReceive(token, args);
+
+      case KName::Builtin_Channel_Select:
+        return executeSelect(token, args);
+
+      case KName::Builtin_Channel_Send:
+        return executeSend(token, args);
+
+      case KName::Builtin_Channel_TryReceive:
+        return executeTryReceive(token, args);
+
+      default:
+        break;
+    }
+    throw InvalidOperationError(token, "Come back later.");
+  }
+
+ private:
+  // The channel stays usable for as long as the handle is in scope.
+  static KChannelTable::Handle get_channel(const Token& token,
+                                           const KValue& value) {
+    auto channel = value.isInteger()
+                       ? KChannelTable::instance().find(value.getInteger())
+                       : KChannelTable::Handle();
+    if (channel.get() == nullptr) {
+      throw ChannelError(token, "Invalid channel identifier: " +
+                                    Serializer::serialize(value));
+    }
+
+    return channel;
+  }
+
+  static KValue executeCreate(const Token& token,
+                              const std::vector<KValue>& args) {
+    if (args.size() > 1) {
+      throw BuiltinUnexpectedArgumentError(token,
+                                           ChannelBuiltins.ChannelCreate);
+    }
+
+    auto capacity = args.empty() ? 0 : get_integer(token, args.at(0));
+    if (capacity < 0) {
+      throw ChannelError(token, "A channel capacity cannot be negative.");
+    }
+
+    return KValue::createInteger(
+        KChannelTable::instance().create(static_cast<size_t>(capacity)));
+  }
+
+  // The receiver gets its own copy of a container. Flat lists and hashmaps
+  // share their storage with the sender until either side changes them, so
+  // sending one does not copy its elements. A lambda is copied too, so that
+  // it does not keep a frame the sender's thread is still using.
+  static KValue executeSend(const Token& token,
+                            const std::vector<KValue>& args) {
+    if (args.size() != 2) {
+      throw BuiltinUnexpectedArgumentError(token, ChannelBuiltins.ChannelSend);
+    }
+
+    auto channel = get_channel(token, args.at(0));
+    const auto& value = args.at(1);
+    if (value.isNull()) {
+      throw ChannelError(token, "Cannot send null over a channel.");
+    }
+
+    auto sent = value.isList() || value.isHashmap() || value.isObject() ||
+                        value.isLambda()
+                    ? clone_value(value)
+                    : value;
+    if (!channel.get()->send(std::move(sent))) {
+      throw ChannelError(token, "Cannot send over a closed channel.");
+    }
+
+    return {};
+  }
+
+  static KValue executeReceive(const Token& token,
+                               const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token,
+                                           ChannelBuiltins.ChannelReceive);
+    }
+
+    KValue value;
+    if (!get_channel(token, args.at(0)).get()->receive(value)) {
+      return KValue::createNull();
+    }
+    return value;
+  }
+
+  static KValue executeTryReceive(const Token& token,
+                                  const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token,
+                                           ChannelBuiltins.ChannelTryReceive);
+    }
+
+    KValue value;
+    if (!get_channel(token, args.at(0)).get()->tryReceive(value)) {
+      return KValue::createNull();
+    }
+    return value;
+  }
+
+  static KValue executeSelect(const Token& token,
+                              const std::vector<KValue>& args) {
+    if (args.size() != 1 && args.size() != 2) {
+      throw BuiltinUnexpectedArgumentError(token,
+                                           ChannelBuiltins.ChannelSelect);
+    }
+
+    if (!args.at(0).isList()) {
+      throw ChannelError(token, "Expected a list of channel identifiers.");
+    }
+
+    const auto& ids = args.at(0).getList()->elements;
+    std::vector<KChannelTable::Handle> handles;
+    std::vector<KChannel*> channels;
+    handles.reserve(ids.size());
+    for (const auto& id : ids) {
+      handles.push_back(get_channel(token, id));
+      channels.push_back(handles.back().get());
+    }
+
+    auto timeoutMs = args.size() == 2 ? get_integer(token, args.at(1)) : -1;
+    KValue value;
+    auto index = KChannel::select(channels, value, timeoutMs);
+    if (index < 0) {
+      return KValue::createNull();
+    }
+
+    auto received = make_ref<Hashmap>();
+    received->add(KValue::createString("channel"), ids.at(index));
+    received->add(KValue::createString("value"), value);
+    return KValue::createHashmap(received);
+  }
+
+  static KValue executeClose(const Token& token,
+                             const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token, ChannelBuiltins.ChannelClose);
+    }
+
+    get_channel(token, args.at(0)).get()->close();
+    return {};
+  }
+};
+
+#endif
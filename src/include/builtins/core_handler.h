@@ -22,7 +22,8 @@ class CoreBuiltinHandler {
  public:
   static KValue execute(const Token& token, const KName& builtin,
                         const KValue& value, const std::vector<KValue>& args) {
-    if (KiwiBuiltins.is_builtin(builtin)) {
+    auto family = KBuiltinTable::getFamily(builtin);
+    if (family == KBuiltinFamily::Kiwi || family == KBuiltinFamily::List) {
       return executeKiwiBuiltin(token, builtin, value, args);
     }
 
@@ -261,7 +262,7 @@ class CoreBuiltinHandler {
       tokens.emplace_back(KValue::createString(token.getText()));
     }
 
-    return KValue::createList(std::make_shared<List>(tokens));
+    return KValue::createList(make_ref<List>(tokens));
   }
 
   static KValue executeTruthy(const Token& token, const KValue& value,
@@ -283,7 +284,7 @@ class CoreBuiltinHandler {
         return KValue::createBoolean(value.getBoolean());
 
       case KValueType::_STRING:
-        return KValue::createBoolean(!value.getString().empty());
+        return KValue::createBoolean(!value.getStringView().empty());
 
       case KValueType::_LIST:
         return KValue::createBoolean(!value.getList()->elements.empty());
@@ -352,7 +353,7 @@ class CoreBuiltinHandler {
       return value;
     } else if (value.isList()) {
       const auto& index = get_integer(token, args.at(0));
-      auto& elements = value.getList()->elements;
+      auto& elements = value.getList()->mutableElements();
       if (index < 0 || index >= static_cast<k_int>(elements.size())) {
         throw RangeError(token, "List index out of range.");
       }
@@ -374,7 +375,7 @@ class CoreBuiltinHandler {
     if (value.isList()) {
       auto firstIndex = get_integer(token, args.at(0));
       auto secondIndex = get_integer(token, args.at(1));
-      auto& elements = value.getList()->elements;
+      auto& elements = value.getList()->mutableElements();
       if (firstIndex < 0 || firstIndex >= static_cast<k_int>(elements.size())) {
         throw RangeError(token, "The first parameter for " + KiwiBuiltins.Swap +
                                     " is out of range.");
@@ -447,7 +448,7 @@ class CoreBuiltinHandler {
       throw BuiltinUnexpectedArgumentError(token, KiwiBuiltins.Chars);
     }
 
-    auto newList = std::make_shared<List>();
+    auto newList = make_ref<List>();
     auto stringValue = get_string(token, value);
     auto& elements = newList->elements;
 
@@ -518,7 +519,7 @@ class CoreBuiltinHandler {
 
     if (value.isString()) {
       return KValue::createInteger(
-          static_cast<k_int>(value.getString().length()));
+          static_cast<k_int>(value.getStringView().size()));
     } else if (value.isList()) {
       return KValue::createInteger(
           static_cast<k_int>(value.getList()->elements.size()));
@@ -548,7 +549,7 @@ class CoreBuiltinHandler {
           token, "Expected a list value for byte to string conversion.");
     }
 
-    auto& elements = value.getList()->elements;
+    const auto& elements = value.getList()->elements;
 
     if (elements.empty()) {
       throw EmptyListError(token);
@@ -591,7 +592,7 @@ class CoreBuiltinHandler {
     if (value.isString()) {
       auto stringValue = value.getString();
       std::vector<uint8_t> bytes(stringValue.begin(), stringValue.end());
-      auto byteList = std::make_shared<List>();
+      auto byteList = make_ref<List>();
       auto& elements = byteList->elements;
       elements.reserve(bytes.size());
 
@@ -602,7 +603,7 @@ class CoreBuiltinHandler {
       return KValue::createList(byteList);
     } else if (value.isList()) {
       auto listElements = value.getList()->elements;
-      auto byteList = std::make_shared<List>();
+      auto byteList = make_ref<List>();
       auto& elements = byteList->elements;
 
       for (const auto& item : listElements) {
@@ -851,7 +852,7 @@ class CoreBuiltinHandler {
 
     k_string input = get_string(token, value);
     auto delimiter = get_string(token, args.at(0));
-    auto newList = std::make_shared<List>();
+    auto newList = make_ref<List>();
     auto& elements = newList->elements;
 
     if (delimiter.empty()) {
@@ -880,7 +881,7 @@ class CoreBuiltinHandler {
 
     k_string input = get_string(token, value);
     auto delimiter = get_string(token, args.at(0));
-    auto newList = std::make_shared<List>();
+    auto newList = make_ref<List>();
     auto& elements = newList->elements;
     k_int limit = -1;
 
@@ -1012,21 +1013,26 @@ class CoreBuiltinHandler {
     }
 
     return KValue::createBoolean(String::beginsWith(
-        get_string(token, value), get_string(token, args.at(0))));
+        get_string_view(token, value), get_string_view(token, args.at(0))));
   }
 
   static KValue executeStringContains(const Token& token, const KValue& value,
                                       const KValue& arg) {
     return KValue::createBoolean(
-        String::contains(get_string(token, value), get_string(token, arg)));
+        String::contains(get_string_view(token, value),
+                         get_string_view(token, arg)));
   }
 
   static KValue executeListContains(const KValue& value, const KValue& arg) {
-    auto list = value.getList();
-    auto& elements = list->elements;
+    const auto& elements = value.getList()->elements;
+
+    if (const auto* range = elements.range()) {
+      return KValue::createBoolean(arg.isInteger() &&
+                                   range->indexOf(arg.getInteger()) >= 0);
+    }
 
     for (const auto& item : elements) {
-      if (same_value(item.getValue(), arg.getValue())) {
+      if (same_value(item, arg)) {
         return KValue::createBoolean(true);
       }
     }
@@ -1056,7 +1062,7 @@ class CoreBuiltinHandler {
     }
 
     return KValue::createBoolean(String::endsWith(
-        get_string(token, value), get_string(token, args.at(0))));
+        get_string_view(token, value), get_string_view(token, args.at(0))));
   }
 
   static KValue executeIsA(const Token& token, const KValue& value,
@@ -1143,11 +1149,10 @@ class CoreBuiltinHandler {
       std::reverse(s.begin(), s.end());
       return KValue::createString(s);
     } else if (value.isList()) {
-      auto v = value.getList()->elements;
-      std::reverse(v.begin(), v.end());
-      auto list = std::make_shared<List>();
-      list->elements = v;
-      return KValue::createList(list);
+      const auto& elements = value.getList()->elements;
+      return KValue::createList(make_ref<List>(
+          std::vector<KValue>(elements.items().rbegin(),
+                              elements.items().rend())));
     }
 
     throw InvalidOperationError(token,
@@ -1162,10 +1167,10 @@ class CoreBuiltinHandler {
     }
 
     if (value.isString()) {
-      return KValue::createInteger(
-          String::indexOf(value.getString(), get_string(token, args.at(0))));
+      return KValue::createInteger(String::indexOf(
+          value.getStringView(), get_string_view(token, args.at(0))));
     } else if (value.isList()) {
-      return indexof_listvalue(value.getList(), args.at(0).getValue());
+      return indexof_listvalue(value.getList(), args.at(0));
     }
 
     throw InvalidOperationError(token,
@@ -1181,9 +1186,9 @@ class CoreBuiltinHandler {
 
     if (value.isString()) {
       return KValue::createInteger(String::lastIndexOf(
-          value.getString(), get_string(token, args.at(0))));
+          value.getStringView(), get_string_view(token, args.at(0))));
     } else if (value.isList()) {
-      return lastindexof_listvalue(value.getList(), args.at(0).getValue());
+      return lastindexof_listvalue(value.getList(), args.at(0));
     }
 
     throw InvalidOperationError(token,
@@ -1217,11 +1222,11 @@ class CoreBuiltinHandler {
 
     bool isEmpty = false;
     if (value.isString()) {
-      isEmpty = value.getString().empty();
+      isEmpty = value.getStringView().empty();
     } else if (value.isList()) {
       isEmpty = value.getList()->elements.empty();
     } else if (value.isHashmap()) {
-      isEmpty = value.getHashmap()->keys.empty();
+      isEmpty = value.getHashmap()->empty();
     } else if (value.isInteger()) {
       isEmpty = value.getInteger() == 0;
     } else if (value.isFloat()) {
@@ -1258,7 +1263,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Push + "`.");
     }
 
-    value.getList()->elements.push_back(args.at(0));
+    value.getList()->mutableElements().push_back(args.at(0));
     return KValue::createBoolean(true);
   }
 
@@ -1273,7 +1278,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Pop + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
 
     if (elements.empty()) {
       return {};
@@ -1295,7 +1300,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Enqueue + "`.");
     }
 
-    value.getList()->elements.push_back(args.at(0));
+    value.getList()->mutableElements().push_back(args.at(0));
     return KValue::createBoolean(true);
   }
 
@@ -1310,7 +1315,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Dequeue + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
 
     if (elements.empty()) {
       return {};
@@ -1332,7 +1337,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Shift + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
 
     if (elements.empty()) {
       return {};
@@ -1354,7 +1359,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Unshift + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
     elements.insert(elements.begin(), args.at(0));
     return value;
   }
@@ -1370,7 +1375,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Concat + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
     const auto& concat = args.at(0).getList()->elements;
     elements.insert(elements.end(), concat.begin(), concat.end());
     return value;
@@ -1387,7 +1392,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Insert + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
     size_t index = get_integer(token, args.at(1));
 
     if (index > elements.size()) {
@@ -1410,7 +1415,7 @@ class CoreBuiltinHandler {
       hash->remove(args.at(0));
       return value;
     } else if (value.isList()) {
-      auto& elements = value.getList()->elements;
+      auto& elements = value.getList()->mutableElements();
       auto it = std::find(elements.begin(), elements.end(), args.at(0));
 
       if (it != elements.end()) {
@@ -1436,7 +1441,7 @@ class CoreBuiltinHandler {
                                              KiwiBuiltins.RemoveAt + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
     size_t index = get_integer(token, args.at(0));
 
     if (index >= elements.size()) {
@@ -1459,7 +1464,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Rotate + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    auto& elements = value.getList()->mutableElements();
     auto rotation = args.at(0).getInteger();
 
     if (elements.empty()) {
@@ -1493,11 +1498,11 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Unique + "`.");
     }
 
-    auto& elements = value.getList()->elements;
-    std::unordered_set<k_value> seen;
+    auto& elements = value.getList()->mutableElements();
+    std::unordered_set<KValue> seen;
     auto newEnd = std::remove_if(elements.begin(), elements.end(),
                                  [&seen](const KValue& item) {
-                                   return !seen.insert(item.getValue()).second;
+                                   return !seen.insert(item).second;
                                  });
     elements.erase(newEnd, elements.end());
     return value;
@@ -1510,8 +1515,8 @@ class CoreBuiltinHandler {
     }
 
     if (value.isString()) {
-      const auto& needle = get_string(token, args.at(0));
-      const auto& haystack = value.getString();
+      auto needle = get_string_view(token, args.at(0));
+      auto haystack = value.getStringView();
       return KValue::createInteger(String::count(haystack, needle));
     } else if (value.isList()) {
       const auto& elements = value.getList()->elements;
@@ -1535,7 +1540,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Flatten + "`.");
     }
 
-    auto flattened = std::make_shared<List>();
+    auto flattened = make_ref<List>();
     std::function<void(const KValue&)> flattenElement;
     flattenElement = [&flattened, &flattenElement](const KValue& element) {
       if (element.isList()) {
@@ -1567,11 +1572,11 @@ class CoreBuiltinHandler {
 
     const auto& elements1 = value.getList()->elements;
     const auto& elements2 = args.at(0).getList()->elements;
-    auto zipped = std::make_shared<List>();
+    auto zipped = make_ref<List>();
     auto win_min = (elements1.size() < elements2.size()) ? elements1.size()
                                                          : elements2.size();
     for (size_t i = 0; i < win_min; ++i) {
-      auto pair = std::make_shared<List>();
+      auto pair = make_ref<List>();
       pair->elements.push_back(elements1.at(i));
       pair->elements.push_back(elements2.at(i));
       zipped->elements.push_back(KValue::createList(pair));
@@ -1591,7 +1596,7 @@ class CoreBuiltinHandler {
           token, "Expected a list for builtin `" + KiwiBuiltins.Slice + "`.");
     }
 
-    auto& elements = value.getList()->elements;
+    const auto& elements = value.getList()->elements;
     auto start = static_cast<size_t>(get_integer(token, args.at(0)));
     auto end = static_cast<size_t>(get_integer(token, args.at(1)));
 
@@ -1600,7 +1605,7 @@ class CoreBuiltinHandler {
           token, "Invalid start or end index for `slice` operation.");
     }
 
-    auto slicedList = std::make_shared<List>();
+    auto slicedList = make_ref<List>();
     auto& slice = slicedList->elements;
     slice.insert(slice.begin(), elements.begin() + start,
                  elements.begin() + end);
@@ -1614,12 +1619,10 @@ class CoreBuiltinHandler {
     }
 
     if (value.isList()) {
-      value.getList()->elements.clear();
+      value.getList()->mutableElements().clear();
       return value;
     } else if (value.isHashmap()) {
-      auto& hash = value.getHashmap();
-      hash->keys.clear();
-      hash->kvp.clear();
+      value.getHashmap()->clear();
       return value;
     }
 
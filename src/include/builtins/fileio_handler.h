@@ -164,7 +164,7 @@ class FileIOBuiltinHandler {
     }
 
     auto path = get_string(token, args.at(0));
-    auto list = std::make_shared<List>();
+    auto list = make_ref<List>();
     auto& elements = list->elements;
     const auto& listing = File::listDirectory(token, path);
     elements.reserve(listing.size());
@@ -329,7 +329,7 @@ class FileIOBuiltinHandler {
 
     auto glob = get_string(token, args.at(0));
     auto matchedFiles = File::expandGlob(token, glob);
-    auto matchList = std::make_shared<List>();
+    auto matchList = make_ref<List>();
     auto& elements = matchList->elements;
     elements.reserve(matchedFiles.size());
 
@@ -382,7 +382,7 @@ class FileIOBuiltinHandler {
     auto fileName = get_string(token, args.at(0));
     auto lines = File::readLines(token, fileName);
 
-    auto list = std::make_shared<List>();
+    auto list = make_ref<List>();
     auto& elements = list->elements;
     elements.reserve(lines.size());
 
@@ -400,7 +400,7 @@ class FileIOBuiltinHandler {
     }
 
     auto fileName = get_string(token, args.at(0));
-    auto list = std::make_shared<List>();
+    auto list = make_ref<List>();
     auto& elements = list->elements;
 
     if (args.size() == 1) {
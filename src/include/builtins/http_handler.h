@@ -156,17 +156,16 @@ class HttpBuiltinHandler {
   static httplib::Headers getHeaders(const k_hashmap& headersHash) {
     httplib::Headers headers;
 
-    for (const auto& key : headersHash->keys) {
-      const auto& value = headersHash->kvp[key];
-      headers.insert(
-          {Serializer::serialize(key), Serializer::serialize(value)});
+    for (const auto& entry : *headersHash) {
+      headers.insert({Serializer::serialize(entry.key),
+                      Serializer::serialize(entry.value)});
     }
 
     return headers;
   }
 
   static KValue getResponseHash(const httplib::Result& res) {
-    auto resHash = std::make_shared<Hashmap>();
+    auto resHash = make_ref<Hashmap>();
 
     if (res) {
       resHash->add(KValue::createString("status"),
@@ -174,7 +173,7 @@ class HttpBuiltinHandler {
       resHash->add(KValue::createString("body"),
                    KValue::createString(res->body));
 
-      auto headersHash = std::make_shared<Hashmap>();
+      auto headersHash = make_ref<Hashmap>();
       for (const auto& pair : res->headers) {
         headersHash->add(KValue::createString(pair.first),
                          KValue::createString(pair.second));
@@ -188,7 +187,7 @@ class HttpBuiltinHandler {
           KValue::createString("body"),
           KValue::createString("Request failed or no response received"));
       resHash->add(KValue::createString("headers"),
-                   KValue::createHashmap(std::make_shared<Hashmap>()));
+                   KValue::createHashmap(make_ref<Hashmap>()));
     }
 
     return KValue::createHashmap(resHash);
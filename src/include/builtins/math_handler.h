@@ -568,7 +568,7 @@ class MathBuiltinHandler {
     }
 
     auto primes = PrimeGenerator::listPrimes(args.at(0).getInteger());
-    auto list = std::make_shared<List>();
+    auto list = make_ref<List>();
     auto& elements = list->elements;
     elements.reserve(primes.size());
 
@@ -618,7 +618,7 @@ class MathBuiltinHandler {
     }
 
     const auto& divisors = MathImpl.__divisors__(args.at(0).getInteger());
-    auto list = std::make_shared<List>();
+    auto list = make_ref<List>();
     auto& elements = list->elements;
     elements.reserve(divisors.size());
 
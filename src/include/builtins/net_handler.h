@@ -121,7 +121,7 @@ class NetBuiltinHandler {
     auto client_sock_id =
         sockmgr.accept(token, sockId, client_address, client_port);
 
-    auto hash = std::make_shared<Hashmap>();
+    auto hash = make_ref<Hashmap>();
     hash->add(KValue::createString("client_sock_id"), client_sock_id);
     hash->add(KValue::createString("client_address"),
               KValue::createString(client_address));
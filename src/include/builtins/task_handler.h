@@ -12,12 +12,21 @@ class TaskBuiltinHandler {
   static KValue execute(TaskManager& taskmgr, const Token& token,
                         const KName& builtin, const std::vector<KValue>& args) {
     switch (builtin) {
+      case KName::Builtin_Task_Await:
+        return executeAwait(taskmgr, token, args);
+
       case KName::Builtin_Task_Busy:
         return executeBusy(taskmgr, token, args);
 
+      case KName::Builtin_Task_Cancel:
+        return executeCancel(taskmgr, token, args);
+
       case KName::Builtin_Task_List:
         return executeList(taskmgr, token, args);
 
+      case KName::Builtin_Task_Priority:
+        return executePriority(taskmgr, token, args);
+
       case KName::Builtin_Task_Result:
         return executeResult(taskmgr, token, args);
 
@@ -27,6 +36,12 @@ class TaskBuiltinHandler {
       case KName::Builtin_Task_Status:
         return executeStatus(taskmgr, token, args);
 
+      case KName::Builtin_Task_WaitAll:
+        return executeWaitAll(taskmgr, token, args);
+
+      case KName::Builtin_Task_WaitAny:
+        return executeWaitAny(taskmgr, token, args);
+
       default:
         break;
     }
@@ -34,6 +49,75 @@ class TaskBuiltinHandler {
   }
 
  private:
+  static k_int get_task_id(const Token& token, const KValue& value) {
+    if (!value.isInteger()) {
+      throw TaskError(token, "Invalid task identifier: " +
+                                 Serializer::serialize(value));
+    }
+
+    return value.getInteger();
+  }
+
+  static std::vector<k_int> get_task_ids(const Token& token,
+                                         const KValue& value) {
+    if (!value.isList()) {
+      throw TaskError(token, "Expected a list of task identifiers.");
+    }
+
+    std::vector<k_int> ids;
+    for (const auto& id : value.getList()->elements) {
+      ids.push_back(get_task_id(token, id));
+    }
+    return ids;
+  }
+
+  static KValue executeAwait(TaskManager& taskmgr, const Token& token,
+                             const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token, TaskBuiltins.TaskAwait);
+    }
+
+    return taskmgr.awaitTask(token, get_task_id(token, args.at(0)));
+  }
+
+  static KValue executeWaitAll(TaskManager& taskmgr, const Token& token,
+                               const std::vector<KValue>& args) {
+    if (args.size() > 1) {
+      throw BuiltinUnexpectedArgumentError(token, TaskBuiltins.TaskWaitAll);
+    }
+
+    if (args.empty()) {
+      taskmgr.awaitAll();
+      return {};
+    }
+
+    std::vector<KValue> results;
+    for (auto id : get_task_ids(token, args.at(0))) {
+      results.push_back(taskmgr.awaitTask(token, id));
+    }
+
+    return KValue::createList(make_ref<List>(results));
+  }
+
+  static KValue executeWaitAny(TaskManager& taskmgr, const Token& token,
+                               const std::vector<KValue>& args) {
+    if (args.size() != 1 && args.size() != 2) {
+      throw BuiltinUnexpectedArgumentError(token, TaskBuiltins.TaskWaitAny);
+    }
+
+    auto timeoutMs = args.size() == 2 ? get_integer(token, args.at(1)) : -1;
+    auto id = taskmgr.awaitAny(get_task_ids(token, args.at(0)), timeoutMs);
+    if (id < 0) {
+      return KValue::createNull();
+    }
+
+    auto finished = make_ref<Hashmap>();
+    finished->add(KValue::createString("id"), KValue::createInteger(id));
+    finished->add(KValue::createString("result"),
+                  taskmgr.getTaskResult(token, id));
+    return KValue::createHashmap(finished);
+  }
+
   static KValue executeBusy(TaskManager& taskmgr, const Token& token,
                             const std::vector<KValue>& args) {
     if (args.size() != 0) {
@@ -51,8 +135,31 @@ class TaskBuiltinHandler {
 
     auto ms = get_integer(token, args.at(0));
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    KTaskPool::instance().block([ms]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    });
+
+    return {};
+  }
+
+  static KValue executeCancel(TaskManager& taskmgr, const Token& token,
+                              const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token, TaskBuiltins.TaskCancel);
+    }
+
+    return KValue::createBoolean(
+        taskmgr.cancelTask(get_task_id(token, args.at(0))));
+  }
+
+  static KValue executePriority(TaskManager& taskmgr, const Token& token,
+                                const std::vector<KValue>& args) {
+    if (args.size() != 1) {
+      throw BuiltinUnexpectedArgumentError(token, TaskBuiltins.TaskPriority);
+    }
 
+    taskmgr.setNextPriority(
+        static_cast<int>(get_integer(token, args.at(0))));
     return {};
   }
 
@@ -68,7 +175,7 @@ class TaskBuiltinHandler {
       activeTasks.push_back(KValue::create(task.first));
     }
 
-    return KValue::createList(std::make_shared<List>(activeTasks));
+    return KValue::createList(make_ref<List>(activeTasks));
   }
 
   static KValue executeResult(TaskManager& taskmgr, const Token& token,
@@ -151,12 +151,12 @@ class TimeBuiltinHandler {
     }
 
     try {
-      year = get_integer(token, dateValue->instanceVariables["year"]);
-      month = get_integer(token, dateValue->instanceVariables["month"]);
-      day = get_integer(token, dateValue->instanceVariables["day"]);
-      hour = get_integer(token, dateValue->instanceVariables["hour"]);
-      minute = get_integer(token, dateValue->instanceVariables["minute"]);
-      second = get_integer(token, dateValue->instanceVariables["second"]);
+      year = get_integer(token, dateValue->variable("year"));
+      month = get_integer(token, dateValue->variable("month"));
+      day = get_integer(token, dateValue->variable("day"));
+      hour = get_integer(token, dateValue->variable("hour"));
+      minute = get_integer(token, dateValue->variable("minute"));
+      second = get_integer(token, dateValue->variable("second"));
     } catch (const std::exception& e) {
       throw InvalidOperationError(token, "Expected a DateTime object.");
     }
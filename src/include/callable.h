@@ -5,6 +5,7 @@
 #include <unordered_set>
 #include "parsing/ast.h"
 #include "typing/value.h"
+#include "vm/bytecode.h"
 
 enum class KCallableType {
   Builtin,
@@ -18,6 +19,13 @@ class KCallable {
   KCallableType type;
   std::vector<std::pair<k_string, KValue>> parameters;
   std::unordered_set<k_string> defaultParameters;
+  // The syntax tree the callable was declared in. Parsed code is never
+  // changed, so every copy of a callable shares it.
+  std::shared_ptr<const ASTNode> tree;
+  // Compiled body, built on first call. It only refers to nodes in `tree`, so
+  // `clone()` shares it too. A lambda can be called from several tasks at
+  // once, so it is read and written with the atomic `shared_ptr` functions.
+  mutable std::shared_ptr<KChunk> chunk;
   KCallable(KCallableType type) : type(type) {}
   virtual ~KCallable() = default;
   virtual const std::vector<std::unique_ptr<ASTNode>>& getBody() const = 0;
@@ -49,18 +57,16 @@ class KBuiltin : public KCallable {
 class KFunction : public KCallable {
  public:
   k_string name;
-  std::unique_ptr<FunctionDeclarationNode> decl;
+  const FunctionDeclarationNode* decl;
   bool isStatic = false;
   bool isPrivate = false;
   bool isCtor = false;
   std::unordered_map<k_string, KName> typeHints;
   KName returnTypeHint = KName::Types_Any;
 
-  KFunction(std::unique_ptr<ASTNode> node)
-      : KCallable(KCallableType::Function) {
-    std::unique_ptr<FunctionDeclarationNode> nodeptr(
-        dynamic_cast<FunctionDeclarationNode*>(node->clone().release()));
-    decl = std::move(nodeptr);
+  KFunction(std::shared_ptr<const FunctionDeclarationNode> node)
+      : KCallable(KCallableType::Function), decl(node.get()) {
+    tree = std::move(node);
   }
 
   const std::vector<std::unique_ptr<ASTNode>>& getBody() const override {
@@ -68,9 +74,9 @@ class KFunction : public KCallable {
   }
 
   std::unique_ptr<KFunction> clone() {
-    std::unique_ptr<FunctionDeclarationNode> nodeptr(
-        dynamic_cast<FunctionDeclarationNode*>(decl->clone().release()));
-    auto cloned = std::make_unique<KFunction>(std::move(nodeptr));
+    auto cloned = std::make_unique<KFunction>(
+        std::shared_ptr<const FunctionDeclarationNode>(tree, decl));
+    cloned->chunk = chunk;
     cloned->name = name;
     cloned->isStatic = isStatic;
     cloned->isPrivate = isPrivate;
@@ -85,30 +91,18 @@ class KFunction : public KCallable {
 
 class KLambda : public KCallable {
  public:
-  std::unique_ptr<LambdaNode> decl;
+  const LambdaNode* decl;
   std::unordered_map<k_string, KName> typeHints;
   KName returnTypeHint = KName::Types_Any;
 
-  KLambda(std::unique_ptr<ASTNode> node) : KCallable(KCallableType::Lambda) {
-    std::unique_ptr<LambdaNode> nodeptr(
-        dynamic_cast<LambdaNode*>(node->clone().release()));
-    decl = std::move(nodeptr);
+  KLambda(std::shared_ptr<const LambdaNode> node)
+      : KCallable(KCallableType::Lambda), decl(node.get()) {
+    tree = std::move(node);
   }
 
   const std::vector<std::unique_ptr<ASTNode>>& getBody() const override {
     return decl->body;
   }
-
-  std::unique_ptr<KLambda> clone() {
-    std::unique_ptr<LambdaNode> nodeptr(
-        dynamic_cast<LambdaNode*>(decl->clone().release()));
-    auto cloned = std::make_unique<KLambda>(std::move(nodeptr));
-    cloned->parameters = parameters;
-    cloned->defaultParameters = defaultParameters;
-    cloned->typeHints = typeHints;
-    cloned->returnTypeHint = returnTypeHint;
-    return cloned;
-  }
 };
 
 class KStruct {
@@ -133,18 +127,17 @@ class KStruct {
 
 class KPackage {
  public:
-  std::unique_ptr<PackageNode> decl;
+  // The syntax tree the package was declared in, shared like a callable's.
+  std::shared_ptr<const ASTNode> tree;
+  const PackageNode* decl;
 
-  KPackage(std::unique_ptr<ASTNode> node) {
-    std::unique_ptr<PackageNode> nodeptr(
-        dynamic_cast<PackageNode*>(node->clone().release()));
-    decl = std::move(nodeptr);
+  KPackage(std::shared_ptr<const PackageNode> node) : decl(node.get()) {
+    tree = std::move(node);
   }
 
   std::unique_ptr<KPackage> clone() const {
-    std::unique_ptr<PackageNode> nodeptr(
-        dynamic_cast<PackageNode*>(decl->clone().release()));
-    return std::make_unique<KPackage>(std::move(nodeptr));
+    return std::make_unique<KPackage>(
+        std::shared_ptr<const PackageNode>(tree, decl));
   }
 };
 
@@ -15,6 +15,9 @@
 #include "host.h"
 
 bool SAFEMODE = false;
+bool TREEWALKMODE = false;
+bool NOCACHEMODE = false;
+bool NOOPTIMIZEMODE = false;
 const Token cliToken = Token::createExternal();
 
 class KiwiCLI {
@@ -26,7 +29,7 @@ class KiwiCLI {
   static bool createMinified(Host& host, const k_string& path);
   static bool processOption(k_string& opt, Host& host);
   static bool tokenize(Host& host, const k_string& path);
-  static bool printAST(Host& host, const k_string& path);
+  static bool printAST(Host& host, const k_string& path, bool optimized);
 
   static int printVersion();
   static int printHelp();
@@ -77,9 +80,21 @@ int KiwiCLI::run(std::vector<k_string>& v) {
         host.registerParseRequest(v.at(++i));
       } else if (String::isCLIFlag(v.at(i), "s", "safemode")) {
         SAFEMODE = true;
+      } else if (String::isCLIFlag(v.at(i), "tw", "treewalk")) {
+        TREEWALKMODE = true;
+      } else if (String::isCLIFlag(v.at(i), "nc", "no-cache")) {
+        NOCACHEMODE = true;
+      } else if (String::isCLIFlag(v.at(i), "no", "no-optimize")) {
+        NOOPTIMIZEMODE = true;
       } else if (String::isCLIFlag(v.at(i), "a", "ast")) {
         if (i + 1 < size) {
-          return KiwiCLI::printAST(host, v.at(++i));
+          return KiwiCLI::printAST(host, v.at(++i), false);
+        }
+
+        help = true;
+      } else if (String::isCLIFlag(v.at(i), "ao", "ast-optimized")) {
+        if (i + 1 < size) {
+          return KiwiCLI::printAST(host, v.at(++i), true);
         }
 
         help = true;
@@ -170,14 +185,14 @@ bool KiwiCLI::createNewFile(const k_string& path) {
   return File::createFile(cliToken, filePath);
 }
 
-bool KiwiCLI::printAST(Host& host, const k_string& path) {
+bool KiwiCLI::printAST(Host& host, const k_string& path, bool optimized) {
   if (!File::fileExists(cliToken, path)) {
     std::cout << "The input file does not exists." << std::endl;
     return false;
   }
 
   auto filePath = File::getAbsolutePath(cliToken, path);
-  host.printAST(filePath);
+  host.printAST(filePath, optimized);
   return true;
 }
 
@@ -232,7 +247,12 @@ int KiwiCLI::printHelp() {
       {"-p, --parse <kiwi_code>", "parse kiwi code as an argument"},
       {"-s, --safemode", "run in safemode"},
       {"-ns, --no-stdlib", "run without standard library"},
+      {"-tw, --treewalk", "run without the bytecode VM"},
+      {"-nc, --no-cache", "run without cached syntax trees"},
+      {"-no, --no-optimize", "run without the syntax tree optimizer"},
       {"-a, --ast <input_file_path>", "print syntax tree of `.🥝` file"},
+      {"-ao, --ast-optimized <input_file_path>",
+       "print optimized syntax tree of `.🥝` file"},
       {"-m, --minify <input_file_path>", "create a `.min.🥝` file"},
       {"-t, --tokenize <input_file_path>", "tokenize a file with the lexer"},
       {"-<key>=<value>", "specify an argument as a key-value pair"}};
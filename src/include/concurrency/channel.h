@@ -0,0 +1,600 @@
+#ifndef KIWI_CONCURRENCY_CHANNEL_H
+#define KIWI_CONCURRENCY_CHANNEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "concurrency/pool.h"
+#include "typing/value.h"
+
+/*
+ * A fixed-size queue that any number of threads can push to and pop from
+ * without taking a lock.
+ *
+ * Each cell carries a sequence number that says whose turn it is. Position
+ * `p` lands in cell `p % capacity`; the cell is free for the producer of `p`
+ * when its sequence is `2p`, holds the value for the consumer of `p` when it
+ * is `2p + 1`, and is handed back for position `p + capacity` by the consumer.
+ * A thread claims a position by advancing the head or tail with a CAS, so a
+ * push or pop is a couple of atomic operations when it does not contend.
+ */
+class KRing {
+ public:
+  explicit KRing(size_t capacity)
+      : cells(std::max<size_t>(1, capacity)), capacity(cells.size()) {
+    for (size_t i = 0; i < cells.size(); ++i) {
+      cells[i].sequence.store(2 * i, std::memory_order_relaxed);
+    }
+  }
+
+  // Moves `value` into the ring. Fails, leaving `value` alone, when full.
+  bool push(KValue& value) {
+    auto position = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& cell = cells[position % capacity];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto turn = static_cast<intptr_t>(sequence - 2 * position);
+
+      if (turn == 0) {
+        if (tail.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(2 * position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (turn < 0) {
+        return false;
+      } else {
+        position = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Moves the oldest value out of the ring. Fails when empty.
+  bool pop(KValue& value) {
+    auto position = head.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& cell = cells[position % capacity];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto turn = static_cast<intptr_t>(sequence - (2 * position + 1));
+
+      if (turn == 0) {
+        if (head.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.value = {};
+          cell.sequence.store(2 * (position + capacity),
+                              std::memory_order_release);
+          return true;
+        }
+      } else if (turn < 0) {
+        return false;
+      } else {
+        position = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t getCapacity() const { return capacity; }
+
+  size_t size() const {
+    auto used = tail.load(std::memory_order_acquire) -
+                head.load(std::memory_order_acquire);
+    return std::min(static_cast<size_t>(used), capacity);
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    KValue value;
+  };
+
+  std::vector<Cell> cells;
+  const size_t capacity;
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+};
+
+/*
+ * A channel that passes values between tasks, in the order each sender sent
+ * them. Any number of tasks may send and receive.
+ *
+ * A bounded channel is a ring of its capacity, and a sender waits while it is
+ * full. An unbounded channel is a ring that spills into a locked queue while
+ * it is full. Once anything has spilled, new values go to the spill queue
+ * too, and a receiver that finds the ring empty moves a batch back into it,
+ * so a value never overtakes one sent before it. Values only take the lock
+ * while receivers fall behind.
+ *
+ * A task that has to wait registers a `Waiter` with each channel it waits on.
+ * Senders and receivers only take the channel's lock to wake waiters when
+ * there are some.
+ *
+ * The ring is allocated by the first send, so a channel that is created and
+ * closed without carrying anything costs a few words.
+ */
+class KChannel {
+ public:
+  // Wakes a task that waits on one or more channels.
+  struct Waiter {
+    std::mutex lock;
+    std::condition_variable signal;
+    bool woken = false;
+
+    void wake() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        woken = true;
+      }
+      signal.notify_one();
+    }
+
+    // Waits to be woken, for at most `timeoutMs` unless it is negative.
+    // Returns false if the time ran out.
+    bool wait(k_int timeoutMs) {
+      return KTaskPool::instance().block([&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        auto isWoken = [this]() { return woken; };
+        auto result = true;
+        if (timeoutMs < 0) {
+          signal.wait(guard, isWoken);
+        } else {
+          result = signal.wait_for(guard, std::chrono::milliseconds(timeoutMs),
+                                   isWoken);
+        }
+        woken = false;
+        return result;
+      });
+    }
+  };
+
+  static constexpr size_t UnboundedRingSize = 1024;
+
+  // A capacity of zero makes an unbounded channel.
+  explicit KChannel(size_t capacity) { open(capacity); }
+
+  ~KChannel() { delete ring.load(std::memory_order_relaxed); }
+
+  KChannel(const KChannel&) = delete;
+  KChannel& operator=(const KChannel&) = delete;
+
+  // Makes a reset channel ready to be used again. Nothing may use the channel
+  // while it is opened or reset.
+  void open(size_t capacity) {
+    this->capacity = capacity;
+    bounded = capacity > 0;
+    closed.store(false, std::memory_order_release);
+  }
+
+  // Closes the channel and frees its values and ring.
+  void reset() {
+    closed.store(true, std::memory_order_release);
+    delete ring.exchange(nullptr, std::memory_order_acq_rel);
+    spill.clear();
+    spilled.store(0, std::memory_order_relaxed);
+  }
+
+  bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+  // Queues a value, waiting for room if the channel is bounded and full.
+  // Returns false if the channel is closed.
+  bool send(KValue value) {
+    if (trySend(value)) {
+      return true;
+    }
+
+    Waiter waiter;
+    Registration registration(*this, waiter, senders, sendersWaiting);
+    while (!isClosed()) {
+      if (trySend(value)) {
+        return true;
+      }
+      waiter.wait(-1);
+    }
+    return false;
+  }
+
+  // Queues a value if there is room. Fails if the channel is closed or full.
+  bool trySend(KValue& value) {
+    if (isClosed()) {
+      return false;
+    }
+
+    if (bounded) {
+      if (!sendRing().push(value)) {
+        return false;
+      }
+    } else if (spilled.load(std::memory_order_seq_cst) > 0 ||
+               !sendRing().push(value)) {
+      std::lock_guard<std::mutex> guard(spillLock);
+      spill.push_back(std::move(value));
+      spilled.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    wakeAll(receivers, receiversWaiting);
+    return true;
+  }
+
+  // Takes the oldest value without waiting. Fails if there is none.
+  bool tryReceive(KValue& value) {
+    auto* current = ring.load(std::memory_order_acquire);
+    if ((current != nullptr && current->pop(value)) ||
+        (!bounded && refill(value))) {
+      if (bounded) {
+        wakeAll(senders, sendersWaiting);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // Takes the oldest value, waiting until one is sent. Fails once the channel
+  // is closed and empty.
+  bool receive(KValue& value) {
+    std::vector<KChannel*> channels = {this};
+    return select(channels, value, -1) == 0;
+  }
+
+  // Takes a value from the first of `channels` to have one, waiting for at
+  // most `timeoutMs` unless it is negative. Returns the index of the channel,
+  // or -1 if the time ran out or every channel is closed and empty.
+  static int select(const std::vector<KChannel*>& channels, KValue& value,
+                    k_int timeoutMs) {
+    auto index = trySelect(channels, value);
+    if (index >= 0 || timeoutMs == 0) {
+      return index;
+    }
+
+    Waiter waiter;
+    std::vector<std::unique_ptr<Registration>> registrations;
+    for (auto* channel : channels) {
+      registrations.push_back(std::make_unique<Registration>(
+          *channel, waiter, channel->receivers, channel->receiversWaiting));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(std::max<k_int>(0, timeoutMs));
+    for (;;) {
+      // Closing is checked before the values, so that a value sent just
+      // before the channel closed is still received.
+      auto allClosed = std::all_of(
+          channels.begin(), channels.end(),
+          [](const KChannel* channel) { return channel->isClosed(); });
+
+      index = trySelect(channels, value);
+      if (index >= 0 || allClosed) {
+        return index;
+      }
+
+      auto remainingMs = timeoutMs;
+      if (timeoutMs > 0) {
+        remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          deadline - std::chrono::steady_clock::now())
+                          .count();
+        if (remainingMs <= 0) {
+          return trySelect(channels, value);
+        }
+      }
+      waiter.wait(remainingMs);
+    }
+  }
+
+  // Stops the channel from taking new values and wakes everyone waiting on
+  // it. Values already sent can still be received.
+  void close() {
+    closed.store(true, std::memory_order_seq_cst);
+    std::lock_guard<std::mutex> guard(waitLock);
+    for (auto* waiter : receivers) {
+      waiter->wake();
+    }
+    for (auto* waiter : senders) {
+      waiter->wake();
+    }
+  }
+
+  size_t size() {
+    auto* current = ring.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> guard(spillLock);
+    return (current != nullptr ? current->size() : 0) + spill.size();
+  }
+
+ private:
+  // Keeps a waiter registered with a channel for as long as it is in scope.
+  struct Registration {
+    KChannel& channel;
+    Waiter& waiter;
+    std::vector<Waiter*>& waiters;
+    std::atomic<size_t>& count;
+
+    Registration(KChannel& channel, Waiter& waiter,
+                 std::vector<Waiter*>& waiters, std::atomic<size_t>& count)
+        : channel(channel), waiter(waiter), waiters(waiters), count(count) {
+      std::lock_guard<std::mutex> guard(channel.waitLock);
+      waiters.push_back(&waiter);
+      count.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    ~Registration() {
+      std::lock_guard<std::mutex> guard(channel.waitLock);
+      waiters.erase(std::find(waiters.begin(), waiters.end(), &waiter));
+      count.fetch_sub(1, std::memory_order_seq_cst);
+    }
+  };
+
+  std::atomic<KRing*> ring{nullptr};
+  size_t capacity = 0;
+  bool bounded = false;
+  std::atomic<bool> closed{false};
+
+  std::mutex spillLock;
+  std::deque<KValue> spill;
+  std::atomic<size_t> spilled{0};
+
+  std::mutex waitLock;
+  std::vector<Waiter*> receivers;
+  std::vector<Waiter*> senders;
+  std::atomic<size_t> receiversWaiting{0};
+  std::atomic<size_t> sendersWaiting{0};
+
+  static int trySelect(const std::vector<KChannel*>& channels,
+                       KValue& value) {
+    for (size_t i = 0; i < channels.size(); ++i) {
+      if (channels[i]->tryReceive(value)) {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
+
+  // The ring, allocated by whichever sender gets here first.
+  KRing& sendRing() {
+    auto* current = ring.load(std::memory_order_acquire);
+    if (current == nullptr) {
+      auto* created = new KRing(bounded ? capacity : UnboundedRingSize);
+      if (ring.compare_exchange_strong(current, created,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        current = created;
+      } else {
+        delete created;
+      }
+    }
+    return *current;
+  }
+
+  // Takes the oldest spilled value, and moves the ones after it into the ring
+  // while there is room.
+  bool refill(KValue& value) {
+    if (spilled.load(std::memory_order_seq_cst) == 0) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard(spillLock);
+    if (spill.empty()) {
+      return false;
+    }
+
+    value = std::move(spill.front());
+    spill.pop_front();
+    auto& target = sendRing();
+    while (!spill.empty() && target.push(spill.front())) {
+      spill.pop_front();
+    }
+    spilled.store(spill.size(), std::memory_order_seq_cst);
+    return true;
+  }
+
+  void wakeAll(std::vector<Waiter*>& waiters, std::atomic<size_t>& count) {
+    // Pairs with the fence in `Registration`: either the waiter sees the
+    // value, or the count it has added is seen here.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (count.load(std::memory_order_seq_cst) == 0) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard(waitLock);
+    for (auto* waiter : waiters) {
+      waiter->wake();
+    }
+  }
+};
+
+/*
+ * Every channel in the process, by identifier, so that a channel can be
+ * passed to a task as a plain integer.
+ *
+ * An identifier holds a slot index in its low 32 bits and the slot's
+ * generation above them. Once a channel is closed and drained, its slot moves
+ * to the next generation and is reused by a later `create`. An identifier from
+ * an older generation then finds a channel that is always closed and empty,
+ * so it behaves exactly as it did just before it was reclaimed, and an
+ * integer that was never handed out is rejected.
+ *
+ * Slots are never freed, so a lookup reads the table without a lock:
+ * indices point into chunks that double in size, and a chunk is never moved
+ * once it is published. A lookup pins the slot instead, and the channel's
+ * values and ring are only freed once the last pin is released.
+ */
+class KChannelTable {
+  struct Slot;
+
+ public:
+  // Keeps a channel from being reclaimed for as long as it is in scope.
+  class Handle {
+   public:
+    Handle() = default;
+    Handle(KChannel* channel, Slot* slot, uint32_t generation)
+        : channel(channel), slot(slot), generation(generation) {}
+
+    Handle(Handle&& other) noexcept
+        : channel(other.channel),
+          slot(other.slot),
+          generation(other.generation) {
+      other.channel = nullptr;
+      other.slot = nullptr;
+    }
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+    Handle& operator=(Handle&&) = delete;
+
+    ~Handle() {
+      if (slot != nullptr) {
+        KChannelTable::instance().release(*slot, generation);
+      }
+    }
+
+    KChannel* get() const { return channel; }
+
+   private:
+    KChannel* channel = nullptr;
+    Slot* slot = nullptr;
+    uint32_t generation = 0;
+  };
+
+  static KChannelTable& instance() {
+    static KChannelTable* table = new KChannelTable();
+    return *table;
+  }
+
+  k_int create(size_t capacity) {
+    std::lock_guard<std::mutex> guard(createLock);
+    Slot* slot = nullptr;
+    if (!freeSlots.empty()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+      slot->channel.open(capacity);
+    } else {
+      auto index = count.load(std::memory_order_relaxed);
+      auto& chunk = chunks[chunkOf(index)];
+      if (chunk.load(std::memory_order_relaxed) == nullptr) {
+        chunk.store(
+            new std::atomic<Slot*>[FirstChunkSize << chunkOf(index)](),
+            std::memory_order_release);
+      }
+      slot = new Slot(index, capacity);
+      slotAt(index).store(slot, std::memory_order_release);
+      count.store(index + 1, std::memory_order_release);
+    }
+
+    auto generation = slot->generation.load(std::memory_order_relaxed);
+    return static_cast<k_int>((static_cast<uint64_t>(generation) << 32) |
+                              slot->index);
+  }
+
+  // The channel for `id`, or an empty handle if `id` was never handed out.
+  Handle find(k_int id) {
+    if (id < 0) {
+      return {};
+    }
+
+    auto index = static_cast<size_t>(id & 0xFFFFFFFF);
+    auto generation = static_cast<uint32_t>(static_cast<uint64_t>(id) >> 32);
+    if (generation == 0 || index >= count.load(std::memory_order_acquire)) {
+      return {};
+    }
+
+    auto& slot = *slotAt(index).load(std::memory_order_acquire);
+    slot.state.fetch_add(Pin, std::memory_order_seq_cst);
+    auto current = slot.generation.load(std::memory_order_seq_cst);
+    if (current == generation) {
+      return {&slot.channel, &slot, generation};
+    }
+
+    unpin(slot);
+    if (generation > current) {
+      return {};
+    }
+    return {&reclaimed(), nullptr, 0};
+  }
+
+ private:
+  static constexpr size_t FirstChunkSize = 16;
+  static constexpr size_t ChunkCount = 48;
+  static constexpr uint32_t MaxGeneration = 0x7FFFFFFF;
+
+  // `state` counts pins in steps of `Pin`, and its lowest bit is set once
+  // the slot has moved to a new generation and waits for its pins to go.
+  static constexpr size_t Pin = 2;
+  static constexpr size_t Retired = 1;
+
+  struct Slot {
+    KChannel channel;
+    const uint32_t index;
+    std::atomic<uint32_t> generation{1};
+    std::atomic<size_t> state{0};
+
+    Slot(size_t index, size_t capacity)
+        : channel(capacity), index(static_cast<uint32_t>(index)) {}
+  };
+
+  std::mutex createLock;
+  std::atomic<size_t> count{0};
+  std::atomic<std::atomic<Slot*>*> chunks[ChunkCount] = {};
+  std::vector<Slot*> freeSlots;
+
+  // Stands in for every channel that has been reclaimed.
+  static KChannel& reclaimed() {
+    static KChannel* channel = []() {
+      auto* closed = new KChannel(0);
+      closed->close();
+      return closed;
+    }();
+    return *channel;
+  }
+
+  // Drops a pin taken with the current `generation`. The first holder to
+  // find the channel closed and drained moves the slot to the next
+  // generation, so that no new pins are handed out for it.
+  void release(Slot& slot, uint32_t generation) {
+    if (generation < MaxGeneration && slot.channel.isClosed() &&
+        slot.channel.size() == 0 &&
+        slot.generation.compare_exchange_strong(generation, generation + 1,
+                                                std::memory_order_seq_cst)) {
+      slot.state.fetch_or(Retired, std::memory_order_seq_cst);
+    }
+    unpin(slot);
+  }
+
+  // Drops a pin. Pins taken with an old generation still come and go after a
+  // slot is retired, so it is only reclaimed by the one who finds no pins
+  // left and clears the retired bit.
+  void unpin(Slot& slot) {
+    if (slot.state.fetch_sub(Pin, std::memory_order_seq_cst) !=
+        Pin + Retired) {
+      return;
+    }
+
+    auto retired = Retired;
+    if (slot.state.compare_exchange_strong(retired, 0,
+                                           std::memory_order_seq_cst)) {
+      slot.channel.reset();
+      std::lock_guard<std::mutex> guard(createLock);
+      freeSlots.push_back(&slot);
+    }
+  }
+
+  // Chunk `k` holds indices from `16 * (2^k - 1)` up.
+  static size_t chunkOf(size_t index) {
+    size_t chunk = 0;
+    for (auto n = index / FirstChunkSize + 1; n > 1; n >>= 1) {
+      ++chunk;
+    }
+    return chunk;
+  }
+
+  std::atomic<Slot*>& slotAt(size_t index) {
+    auto chunk = chunkOf(index);
+    auto first = FirstChunkSize * ((size_t(1) << chunk) - 1);
+    return chunks[chunk].load(std::memory_order_acquire)[index - first];
+  }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef KIWI_CONCURRENCY_POOL_H
+#define KIWI_CONCURRENCY_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+ * A work-stealing thread pool with one worker per core, shared by every
+ * interpreter in the process.
+ *
+ * Each worker has its own queue. A worker runs the newest job in its own queue
+ * first and steals the oldest job from another worker when its queue is empty,
+ * so the jobs a task spawns tend to stay on the same core. Jobs submitted from
+ * outside the pool are dealt out to the workers in turn. Jobs with a priority
+ * above zero go to a shared queue that every worker checks first.
+ *
+ * A job that is about to wait on something other than the CPU wraps the wait
+ * in `block()`. While it waits, the pool may start a spare worker so that
+ * queued jobs still run; spare workers exit after a second without work.
+ */
+class KTaskPool {
+ public:
+  using Job = std::function<void()>;
+
+  // The pool is never destroyed, so detached workers that are still running
+  // when the program exits never see it go away.
+  static KTaskPool& instance() {
+    static KTaskPool* pool = new KTaskPool(
+        std::max<size_t>(1, std::thread::hardware_concurrency()));
+    return *pool;
+  }
+
+  size_t size() const { return workers.size(); }
+
+  void submit(Job job, int priority = 0) {
+    if (priority > 0) {
+      std::lock_guard<std::mutex> guard(priorityLock);
+      prioritized.push({priority, nextSequence++, std::move(job)});
+      prioritizedCount.fetch_add(1, std::memory_order_release);
+    } else {
+      auto index = workerIndex < workers.size()
+                       ? workerIndex
+                       : nextWorker.fetch_add(1, std::memory_order_relaxed) %
+                             workers.size();
+      auto& worker = *workers[index];
+      std::lock_guard<std::mutex> guard(worker.lock);
+      worker.jobs.push_back(std::move(job));
+    }
+
+    pending.fetch_add(1, std::memory_order_release);
+    wakeOne();
+
+    if (idle.load(std::memory_order_acquire) == 0) {
+      addSpareIfStarved();
+    }
+  }
+
+  // Runs `wait`, which blocks the calling thread, without holding back queued
+  // jobs when the caller is a worker.
+  template <typename F>
+  auto block(F&& wait) -> decltype(wait()) {
+    if (workerIndex == NotAWorker) {
+      return wait();
+    }
+
+    struct Blocked {
+      std::atomic<size_t>& count;
+      explicit Blocked(std::atomic<size_t>& count) : count(count) {
+        count.fetch_add(1, std::memory_order_acq_rel);
+      }
+      ~Blocked() { count.fetch_sub(1, std::memory_order_acq_rel); }
+    } blocked(blockedCount);
+
+    if (pending.load(std::memory_order_acquire) > 0) {
+      addSpareIfStarved();
+    }
+    return wait();
+  }
+
+ private:
+  static constexpr size_t NotAWorker = static_cast<size_t>(-1);
+  static constexpr size_t SpareWorker = static_cast<size_t>(-2);
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<Job> jobs;
+  };
+
+  struct PrioritizedJob {
+    int priority;
+    uint64_t sequence;
+    Job job;
+
+    // Higher priorities first, then first come first served.
+    bool operator<(const PrioritizedJob& other) const {
+      return priority != other.priority ? priority < other.priority
+                                        : sequence > other.sequence;
+    }
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> nextWorker{0};
+
+  std::mutex priorityLock;
+  std::priority_queue<PrioritizedJob> prioritized;
+  std::atomic<size_t> prioritizedCount{0};
+  uint64_t nextSequence = 0;
+
+  std::mutex sleepLock;
+  std::condition_variable wake;
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> idle{0};
+  std::atomic<size_t> threadCount{0};
+  std::atomic<size_t> blockedCount{0};
+
+  static thread_local size_t workerIndex;
+
+  explicit KTaskPool(size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+      startThread(i);
+    }
+  }
+
+  void startThread(size_t index) {
+    threadCount.fetch_add(1, std::memory_order_acq_rel);
+    std::thread([this, index]() { run(index); }).detach();
+  }
+
+  // Starts a spare worker if fewer threads than cores are free to run jobs.
+  void addSpareIfStarved() {
+    auto threads = threadCount.load(std::memory_order_acquire);
+    auto blocked = blockedCount.load(std::memory_order_acquire);
+    if (threads - blocked < workers.size()) {
+      startThread(SpareWorker);
+    }
+  }
+
+  void wakeOne() {
+    { std::lock_guard<std::mutex> guard(sleepLock); }
+    wake.notify_one();
+  }
+
+  void run(size_t index) {
+    workerIndex = index;
+
+    for (;;) {
+      Job job;
+      if (take(job)) {
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+        job();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> guard(sleepLock);
+      idle.fetch_add(1, std::memory_order_acq_rel);
+      auto hasWork = [this]() {
+        return pending.load(std::memory_order_acquire) > 0;
+      };
+
+      if (index == SpareWorker) {
+        auto woken = wake.wait_for(guard, std::chrono::seconds(1), hasWork);
+        idle.fetch_sub(1, std::memory_order_acq_rel);
+        if (!woken) {
+          threadCount.fetch_sub(1, std::memory_order_acq_rel);
+          return;
+        }
+      } else {
+        wake.wait(guard, hasWork);
+        idle.fetch_sub(1, std::memory_order_acq_rel);
+      }
+    }
+  }
+
+  bool take(Job& job) {
+    if (prioritizedCount.load(std::memory_order_acquire) > 0) {
+      std::lock_guard<std::mutex> guard(priorityLock);
+      if (!prioritized.empty()) {
+        job = std::move(const_cast<PrioritizedJob&>(prioritized.top()).job);
+        prioritized.pop();
+        prioritizedCount.fetch_sub(1, std::memory_order_release);
+        return true;
+      }
+    }
+
+    if (workerIndex < workers.size()) {
+      auto& own = *workers[workerIndex];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.jobs.empty()) {
+        job = std::move(own.jobs.back());
+        own.jobs.pop_back();
+        return true;
+      }
+    }
+
+    auto start = workerIndex < workers.size() ? workerIndex + 1 : 0;
+    for (size_t i = 0; i < workers.size(); ++i) {
+      auto& victim = *workers[(start + i) % workers.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.jobs.empty()) {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+};
+
+thread_local size_t KTaskPool::workerIndex = KTaskPool::NotAWorker;
+
+#endif
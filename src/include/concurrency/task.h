@@ -3,9 +3,15 @@
 
 #include <functional>
 #include <future>
+#include <memory>
 #include <unordered_map>
 #include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
 #include <string>
+#include <vector>
+#include "concurrency/pool.h"
 #include "parsing/tokens.h"
 #include "typing/value.h"
 
@@ -14,32 +20,170 @@ class TaskManager {
   using TaskFunction = std::packaged_task<KValue()>;
 
  private:
+  // A spawned task. It can only be cancelled while it is still queued.
+  struct Task {
+    enum State { Queued, Running, Finished, Cancelled };
+
+    std::atomic<int> state{Queued};
+    KValue result;
+    std::exception_ptr error;
+
+    bool isDone() const {
+      auto current = state.load();
+      return current == Finished || current == Cancelled;
+    }
+  };
+
+  // Signalled whenever one of this manager's tasks finishes or is cancelled.
+  struct Completion {
+    std::mutex lock;
+    std::condition_variable done;
+    size_t active = 0;
+
+    void finish(Task& task, int state) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        task.state = state;
+        --active;
+      }
+      done.notify_all();
+    }
+  };
+
   std::atomic<k_int> nextPromiseId;
-  std::unordered_map<k_int, std::future<KValue>> tasks;
+  std::unordered_map<k_int, std::shared_ptr<Task>> tasks;
+  std::shared_ptr<Completion> completion = std::make_shared<Completion>();
+  int nextPriority = 0;
 
  public:
   TaskManager() : nextPromiseId(0) {}
 
   k_int addTask(TaskFunction func) {
     k_int id = nextPromiseId++;
-    auto future = func.get_future();
-    tasks[id] = std::move(future);
-    std::thread(std::move(func)).detach();  // Run the task in a new thread
+    auto task = std::make_shared<Task>();
+    tasks[id] = task;
+
+    {
+      std::lock_guard<std::mutex> guard(completion->lock);
+      ++completion->active;
+    }
+
+    auto work = std::make_shared<TaskFunction>(std::move(func));
+    KTaskPool::instance().submit(
+        [task, work, completion = completion]() {
+          int queued = Task::Queued;
+          if (!task->state.compare_exchange_strong(queued, Task::Running)) {
+            return;
+          }
+
+          auto future = work->get_future();
+          (*work)();
+          try {
+            task->result = future.get();
+          } catch (...) {
+            task->error = std::current_exception();
+          }
+          completion->finish(*task, Task::Finished);
+        },
+        nextPriority);
+
+    nextPriority = 0;
     return id;
   }
 
-  std::unordered_map<k_int, std::future<KValue>>& getTasks() { return tasks; }
+  // Sets the priority of the next task added. Higher priorities run first.
+  void setNextPriority(int priority) { nextPriority = priority; }
+
+  // Cancels a task that has not started yet.
+  bool cancelTask(k_int id) {
+    auto it = tasks.find(id);
+    if (it == tasks.end()) {
+      return false;
+    }
+
+    auto& task = *it->second;
+    int queued = Task::Queued;
+    if (!task.state.compare_exchange_strong(queued, Task::Running)) {
+      return false;
+    }
+
+    completion->finish(task, Task::Cancelled);
+    return true;
+  }
+
+  bool isTaskCancelled(k_int id) {
+    auto it = tasks.find(id);
+    return it != tasks.end() && it->second->state == Task::Cancelled;
+  }
+
+  // Forgets every task, without waiting for them.
+  void clear() {
+    tasks.clear();
+    completion = std::make_shared<Completion>();
+  }
+
+  std::unordered_map<k_int, std::shared_ptr<Task>>& getTasks() {
+    return tasks;
+  }
 
   bool hasTask(k_int id) { return tasks.find(id) != tasks.end(); }
 
+  // Blocks until the task finishes, then returns its result.
+  KValue awaitTask(const Token& token, k_int id) {
+    auto it = tasks.find(id);
+    if (it == tasks.end()) {
+      return getTaskStatus(token, id);
+    }
+
+    const auto& task = *it->second;
+    block([&task]() { return task.isDone(); });
+    return getTaskResult(token, id);
+  }
+
+  // Blocks until any of the tasks finishes, or until `timeoutMs` has passed
+  // if it is not negative. Returns the task that finished, or -1.
+  k_int awaitAny(const std::vector<k_int>& ids, k_int timeoutMs) {
+    std::vector<std::pair<k_int, const Task*>> waiting;
+    for (auto id : ids) {
+      auto it = tasks.find(id);
+      if (it != tasks.end()) {
+        waiting.emplace_back(id, it->second.get());
+      }
+    }
+
+    k_int finished = -1;
+    auto anyDone = [&waiting, &finished]() {
+      for (const auto& entry : waiting) {
+        if (entry.second->isDone()) {
+          finished = entry.first;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    if (!waiting.empty()) {
+      block(anyDone, timeoutMs);
+    }
+    return finished;
+  }
+
+  // Blocks until every task has finished.
+  void awaitAll() {
+    const auto& current = *completion;
+    block([&current]() { return current.active == 0; });
+  }
+
   KValue getTaskStatus(const Token& token, const k_int& id) {
     const auto& statusKey = KValue::createString("status");
-    auto taskStatus = std::make_shared<Hashmap>();
+    auto taskStatus = make_ref<Hashmap>();
     taskStatus->add(statusKey, KValue::createString("unknown"));
 
     if (hasTask(id)) {
       const auto& taskCompleted = isTaskCompleted(token, id);
-      if (taskCompleted.isBoolean() && taskCompleted.getBoolean()) {
+      if (isTaskCancelled(id)) {
+        taskStatus->add(statusKey, KValue::createString("cancelled"));
+      } else if (taskCompleted.isBoolean() && taskCompleted.getBoolean()) {
         taskStatus->add(statusKey, KValue::createString("complete"));
       } else {
         taskStatus->add(statusKey, KValue::createString("running"));
@@ -50,19 +194,16 @@ class TaskManager {
   }
 
   KValue getTaskResult(const Token& token, k_int id) {
-    if (tasks.find(id) == tasks.end()) {
+    auto it = tasks.find(id);
+    if (it == tasks.end() || it->second->state != Task::Finished) {
       return getTaskStatus(token, id);
     }
 
-    auto& future = tasks.at(id);
-    if (future.valid()) {
-      return future.get();
-    } else {
-      auto status = std::make_shared<Hashmap>();
-      status->add(KValue::createString("status"),
-                  KValue::createString("running"));
-      return KValue::createHashmap(status);
+    const auto& task = *it->second;
+    if (task.error) {
+      std::rethrow_exception(task.error);
     }
+    return task.result;
   }
 
   KValue isTaskCompleted(const Token& token, k_int id) {
@@ -70,20 +211,30 @@ class TaskManager {
       return getTaskStatus(token, id);
     }
 
-    return KValue::createBoolean(tasks.at(id).wait_for(std::chrono::seconds(
-                                     0)) == std::future_status::ready);
+    return KValue::createBoolean(tasks.at(id)->isDone());
   }
 
   bool hasActiveTasks() {
-    for (auto& activeTask : tasks) {
-      if (activeTask.second.valid() &&
-          activeTask.second.wait_for(std::chrono::seconds(0)) !=
-              std::future_status::ready) {
+    std::lock_guard<std::mutex> guard(completion->lock);
+    return completion->active > 0;
+  }
+
+ private:
+  // Waits on `completion` until `ready` holds, or until `timeoutMs` has
+  // passed if it is not negative.
+  template <typename Predicate>
+  bool block(Predicate ready, k_int timeoutMs = -1) {
+    auto signal = completion;
+    return KTaskPool::instance().block([&]() {
+      std::unique_lock<std::mutex> guard(signal->lock);
+      if (timeoutMs < 0) {
+        signal->done.wait(guard, ready);
         return true;
       }
-    }
 
-    return false;
+      return signal->done.wait_for(
+          guard, std::chrono::milliseconds(timeoutMs), ready);
+    });
   }
 };
 
@@ -2,6 +2,7 @@
 #define KIWI_CONTEXT_H
 
 #include <unordered_map>
+#include <unordered_set>
 #include "callable.h"
 #include "typing/value.h"
 #include "web/httplib.h"
@@ -11,24 +12,22 @@ class KContext {
   std::unordered_map<k_string, std::unique_ptr<KPackage>> packages;
   std::unordered_map<k_string, std::unique_ptr<KFunction>> functions;
   std::unordered_map<k_string, std::unique_ptr<KFunction>> methods;
-  std::unordered_map<k_string, std::unique_ptr<KLambda>> lambdas;
   std::unordered_map<k_string, std::unique_ptr<KStruct>> structs;
-  std::unordered_map<k_string, k_string> lambdaTable;
   std::unordered_map<k_string, KValue> constants;
   httplib::Server server;
-  std::unordered_map<int, k_string> serverHooks;
+  std::unordered_map<int, k_lambda> serverHooks;
+  std::unordered_set<k_string> libraries;
 
  public:
   KContext()
       : packages(),
         functions(),
         methods(),
-        lambdas(),
         structs(),
-        lambdaTable(),
         constants(),
         server(),
-        serverHooks() {}
+        serverHooks(),
+        libraries() {}
 
   std::unique_ptr<KContext> clone() {
     auto cloned = std::make_unique<KContext>();
@@ -45,10 +44,6 @@ class KContext {
       cloned->addMethod(pair.first, pair.second->clone());
     }
 
-    for (const auto& pair : lambdas) {
-      cloned->addLambda(pair.first, pair.second->clone());
-    }
-
     for (const auto& pair : structs) {
       cloned->addStruct(pair.first, pair.second->clone());
     }
@@ -57,8 +52,8 @@ class KContext {
       cloned->constants[pair.first] = pair.second;
     }
 
-    cloned->lambdaTable = lambdaTable;
     cloned->serverHooks = serverHooks;
+    cloned->libraries = libraries;
 
     return cloned;
   }
@@ -109,18 +104,6 @@ class KContext {
     return methods;
   }
 
-  bool hasLambda(const k_string& name) const {
-    return lambdas.find(name) != lambdas.end();
-  }
-
-  void addLambda(const k_string& name, std::unique_ptr<KLambda> lambda) {
-    lambdas[name] = std::move(lambda);
-  }
-
-  std::unordered_map<k_string, std::unique_ptr<KLambda>>& getLambdas() {
-    return lambdas;
-  }
-
   bool hasStruct(const k_string& name) const {
     return structs.find(name) != structs.end();
   }
@@ -134,27 +117,21 @@ class KContext {
     return structs;
   }
 
-  bool hasMappedLambda(const k_string& name) const {
-    return lambdaTable.find(name) != lambdaTable.end();
-  }
-
-  void addMappedLambda(const k_string& name, const k_string& mappedName) {
-    lambdaTable[name] = mappedName;
-  }
-
-  const k_string& getMappedLambda(const k_string& name) {
-    return lambdaTable.at(name);
+  // Records that the library file at `path` has run in this context. Returns
+  // false if it already had.
+  bool addLibrary(const k_string& path) {
+    return libraries.insert(path).second;
   }
 
-  void addWebHook(const k_int& webhookId, const k_string& lambda) {
+  void addWebHook(const k_int& webhookId, const k_lambda& lambda) {
     serverHooks[webhookId] = lambda;
   }
 
-  const k_string& getWebHook(const k_int& webhookId) {
-    return serverHooks[webhookId];
+  const k_lambda& getWebHook(const k_int& webhookId) {
+    return serverHooks.at(webhookId);
   }
 
-  std::unordered_map<int, k_string>& getWebHooks() { return serverHooks; }
+  std::unordered_map<int, k_lambda>& getWebHooks() { return serverHooks; }
 
   httplib::Server& getServer() { return server; }
 };
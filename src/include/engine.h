@@ -4,7 +4,9 @@
 #include <unordered_map>
 #include <vector>
 #include "parsing/lexer.h"
+#include "parsing/optimizer.h"
 #include "parsing/parser.h"
+#include "parsing/snapshot.h"
 #include "parsing/tokens.h"
 #include "tracing/handler.h"
 #include "typing/value.h"
@@ -23,16 +25,13 @@ class Engine {
     interp.setProgramArgs(args);
   }
 
-  int runStreamCollection() {
+  int runProgram() {
     try {
-      auto ast = parser.parseTokenStreamCollection(streamCollection);
       interp.setContext(std::make_unique<KContext>());
-      auto result = interp.interpret(ast.get());
+      KOptimizer::prepare(*program);
+      auto result = interp.interpret(std::shared_ptr<const ASTNode>(program));
 
-      while (interp.hasActiveTasks()) {
-        // avoid busy-waiting
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      }
+      interp.awaitTasks();
 
       if (result.isInteger()) {
         return static_cast<int>(result.getInteger());
@@ -47,11 +46,11 @@ class Engine {
   int interpretKiwi(const k_string& kiwiCode) {
     Lexer lexer(kiwi_arg, kiwiCode);
     auto tokenStream = lexer.getTokenStream();
-    streamCollection.push_back(tokenStream);
-    return runStreamCollection();
+    parser.parseTokenStreamInto(tokenStream, *program);
+    return runProgram();
   }
 
-  void printAST(const k_string& path) {
+  void printAST(const k_string& path, bool optimized) {
     auto content = File::readFile(engineToken, path);
     if (content.empty()) {
       return;
@@ -62,29 +61,22 @@ class Engine {
     auto tokenStream = lexer.getTokenStream();
     auto ast = parser.parseTokenStream(tokenStream);
     auto node = ast.get();
+    if (optimized) {
+      KOptimizer().optimize(*static_cast<ProgramNode*>(node));
+    }
     node->print(0);
 
     return;
   }
 
   int parseScript(const k_string& path) {
-    auto content = File::readFile(engineToken, path);
-    if (content.empty()) {
-      return 1;
-    }
-
-    Lexer lexer(path, content);
-
-    auto tokenStream = lexer.getTokenStream();
-    streamCollection.push_back(tokenStream);
-
-    return 0;
+    return KSnapshot::parseFile(parser, path, *program) ? 0 : 1;
   }
 
  private:
   Parser parser;
   KInterpreter interp;
-  std::vector<k_stream> streamCollection;
+  std::shared_ptr<ProgramNode> program = std::make_shared<ProgramNode>();
 };
 
 #endif
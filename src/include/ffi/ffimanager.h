@@ -408,7 +408,7 @@ KValue FFIManager::processReturnValue(const Token& token, void* retVal,
       ++index;
     }
 
-    return KValue::createList(std::make_shared<List>(strArray));
+    return KValue::createList(make_ref<List>(strArray));
   } else {
     throw FFIError(token, "Unsupported return type: " + retTypeStr);
   }
@@ -5,6 +5,9 @@
 #include <string>
 
 extern bool SAFEMODE;
+extern bool TREEWALKMODE;
+extern bool NOCACHEMODE;
+extern bool NOOPTIMIZEMODE;
 
 extern const std::string kiwi_name = "Kiwi";
 extern const std::string kiwi_version = "2.0.14";
@@ -4,6 +4,7 @@
 #include "util/file.h"
 #include "tracing/error.h"
 #include "engine.h"
+#include "parsing/libraryindex.h"
 #include "repl.h"
 
 const Token hostToken = Token::createExternal();
@@ -78,7 +79,9 @@ class Host {
     return Lexer::minify(script, output);
   }
 
-  void printAST(const std::string& script) { engine.printAST(script); }
+  void printAST(const std::string& script, bool optimized) {
+    engine.printAST(script, optimized);
+  }
 
   bool hasScript() const { return !scripts.empty(); }
 
@@ -96,7 +99,10 @@ class Host {
     auto extras = File::expandGlob(hostToken, path + "/*.kiwi");
     kiwilib.insert(kiwilib.end(), extras.begin(), extras.end());
 
-    for (const auto& script : kiwilib) {
+    // Files that only declare packages and structs are run the first time a
+    // program refers to one of them.
+    auto& index = KLibraryIndex::instance();
+    for (const auto& script : index.addLibrary(path, kiwilib)) {
       loadScript(script);
     }
   }
@@ -160,7 +166,7 @@ class Host {
       File::setCurrentDirectory(executionPath);
     }
 
-    returnCode = engine.runStreamCollection();
+    returnCode = engine.runProgram();
     File::setCurrentDirectory(cwd);
 
     return returnCode;
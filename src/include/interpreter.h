@@ -18,6 +18,9 @@
 #include "math/functions.h"
 #include "parsing/ast.h"
 #include "parsing/builtins.h"
+#include "parsing/libraryindex.h"
+#include "parsing/optimizer.h"
+#include "parsing/snapshot.h"
 #include "stackframe.h"
 #include "tracing/error.h"
 #include "typing/value.h"
@@ -27,18 +30,25 @@
 #include "net/socketmanager.h"
 #include "callable.h"
 #include "context.h"
+#include "vm/bytecode.h"
+#include "vm/compiler.h"
 
 std::atomic<bool> signal_pending(false);
 std::atomic<int> last_received_signal;
 std::mutex signal_mutex;
-std::unordered_map<int, k_string> k_signal_handlers;
+std::unordered_map<int, k_lambda> k_signal_handlers;
 
 class KInterpreter {
  public:
   KInterpreter() : ctx(nullptr), taskmgr(), ffimgr(), sockmgr() {}
+  ~KInterpreter() { unwindFrames(0); }
 
   KValue interpret(const ASTNode* node);
 
+  // Runs a whole syntax tree. Functions, lambdas and packages declared in it
+  // keep a reference to the tree instead of copying their nodes.
+  KValue interpret(const std::shared_ptr<const ASTNode>& root);
+
   void setContext(std::unique_ptr<KContext> context) {
     ctx = std::move(context);
   }
@@ -49,7 +59,40 @@ class KInterpreter {
 
   bool hasActiveTasks() { return taskmgr.hasActiveTasks(); }
 
-  std::stack<k_string> getFuncStack() { return funcStack; }
+  void awaitTasks() { taskmgr.awaitAll(); }
+
+  // Prepares an interpreter owned by a pool thread to run a spawned task.
+  void beginTask(std::unique_ptr<KContext> context,
+                 std::shared_ptr<CallStackFrame> frame) {
+    ctx = std::move(context);
+    pushFrame(frame);
+  }
+
+  // Lets go of everything the last task left behind.
+  void endTask() {
+    unwindFrames(0);
+    ctx.reset();
+    packageStack = {};
+    structStack = {};
+    taskmgr.clear();
+  }
+
+  // The name of every frame on the call stack, the innermost on top.
+  std::stack<k_string> getFuncStack() const {
+    auto frames = callStack;
+    std::vector<k_string> names;
+    names.reserve(frames.size());
+    while (!frames.empty()) {
+      names.push_back(frames.top()->name);
+      frames.pop();
+    }
+
+    std::stack<k_string> stack;
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+      stack.push(*it);
+    }
+    return stack;
+  }
 
  private:
   std::unique_ptr<KContext> ctx;
@@ -59,10 +102,93 @@ class KInterpreter {
   std::stack<std::shared_ptr<CallStackFrame>> callStack;
   std::stack<k_string> packageStack;
   std::stack<k_string> structStack;
-  std::stack<k_string> funcStack;
+
+  // Frames that nothing held once they were dropped, ready for the next call.
+  static constexpr size_t MaxPooledFrames = 64;
+  std::vector<std::shared_ptr<CallStackFrame>> framePool;
+
+  // Dropped frames that lambdas kept. Their cycles are collected once there
+  // are twice as many as were left after the last collection.
+  static constexpr size_t MinKeptFrames = 256;
+  std::vector<std::weak_ptr<CallStackFrame>> keptFrames;
+  size_t nextCycleCollection = MinKeptFrames;
+
+  // Scratch space for each level of `execute`, kept between calls so that
+  // running a chunk does not allocate once its level has been reached before.
+  struct ExecState {
+    std::vector<KValue> registers;
+    std::vector<KValue*> slots;
+    std::vector<bool> localSlots;
+    std::vector<size_t> checkedConstants;
+  };
+  std::vector<std::unique_ptr<ExecState>> execStates;
+  size_t execDepth = 0;
+
+  // Moves whenever code the compiler cannot see through may have changed a
+  // variable or a container: a call, anything handed to the tree walker, or
+  // a builtin that modifies its receiver. A loop-invariant value kept by
+  // `execute` is only used while this has not moved since it was computed.
+  k_int effects = 1;
+
+  struct ExecScope {
+    KInterpreter& interp;
+    ExecState& state;
+
+    ExecScope(KInterpreter& interp, const KChunk& chunk)
+        : interp(interp), state(interp.enterExecState()) {
+      auto names = chunk.names.size();
+      state.registers.resize(chunk.numRegisters);
+      state.slots.assign(names, nullptr);
+      state.localSlots.assign(names, false);
+      state.checkedConstants.assign(names, SIZE_MAX);
+    }
+    ~ExecScope() {
+      state.registers.clear();
+      --interp.execDepth;
+    }
+  };
+
+  ExecState& enterExecState() {
+    if (execDepth == execStates.size()) {
+      execStates.push_back(std::make_unique<ExecState>());
+    }
+    return *execStates[execDepth++];
+  }
   std::unordered_map<k_string, k_string> cliArgs;
 
+  // The syntax tree that holds the code being run, or null if it is not
+  // shared.
+  const std::shared_ptr<const ASTNode>* tree = nullptr;
+
+  // Makes `tree` the one being run until the end of the enclosing scope.
+  struct TreeScope {
+    const std::shared_ptr<const ASTNode>*& current;
+    const std::shared_ptr<const ASTNode>* outer;
+
+    TreeScope(const std::shared_ptr<const ASTNode>*& current,
+              const std::shared_ptr<const ASTNode>& tree)
+        : current(current), outer(current) {
+      current = &tree;
+    }
+    ~TreeScope() { current = outer; }
+  };
+
+  template <typename T>
+  std::shared_ptr<const T> share(const T* node) const;
+
+  // Interpreters that serve web requests, one per server thread. Empty when
+  // the server has one thread, which then uses this interpreter.
+  std::vector<std::unique_ptr<KInterpreter>> webWorkers;
+  std::mutex webWorkersLock;
+  size_t nextWebWorker = 0;
+  // Tells the workers of one `listen` from those of any other, in any
+  // interpreter, so a server thread never keeps a worker that was replaced.
+  uint64_t webWorkersGeneration = 0;
+
   const int SAFEMODE_MAX_ITERATIONS = 1000000;
+  const size_t MIN_PARALLEL_CHUNK = 1024;
+
+  static KInterpreter& poolWorker();
 
   static void k_signal_handler(int signum) {
     std::lock_guard<std::mutex> lock(signal_mutex);
@@ -114,15 +240,25 @@ class KInterpreter {
   KValue visit(const SliceNode* node);
   KValue visit(const SpawnNode* node);
 
+  // Bytecode VM
+  KValue execute(const KChunk& chunk);
+  KValue assignValue(const AssignmentNode* node, const KValue& value);
+  KValue getIndexedValue(const Token& token, const KValue& object,
+                         const KValue& indexValue);
+  void printValue(const PrintNode* node, const KValue& value);
+
   // Stack frame management
   std::shared_ptr<CallStackFrame> createFrame(const k_string& name,
                                               bool isMethodInvocation);
   bool pushFrame(std::shared_ptr<CallStackFrame> frame) {
-    callStack.push(frame);
-    funcStack.push(frame->name);
+    callStack.push(std::move(frame));
+    ++effects;
     return true;
   }
   void dropFrame();
+  void unwindFrames(size_t depth);
+  void releaseFrame(std::shared_ptr<CallStackFrame> frame);
+  void collectKeptFrames();
   bool inTry() {
     if (callStack.empty()) {
       return false;
@@ -131,51 +267,56 @@ class KInterpreter {
     return callStack.top()->isFlagSet(FrameFlags::InTry);
   }
 
-  k_string getTemporaryId();
   k_string id(const ASTNode* node);
 
   void importPackage(const KValue& packageName, const Token& token);
   void importExternal(const k_string& packageName, const Token& token);
+  bool loadLibrary(const k_string& name);
 
-  KCallableType getCallable(const Token& token, const k_string& name) const;
+  KCallableType getCallable(const Token& token, const k_string& name,
+                            const KName& op);
   std::vector<KValue> getMethodCallArguments(
       const std::vector<std::unique_ptr<ASTNode>>& args);
   KValue callBuiltinMethod(const FunctionCallNode* node);
+  KValue callBuiltinMethod(const Token& token, const KName& op,
+                           std::vector<KValue>& args);
   KValue callStructMethod(const MethodCallNode* node, const k_struct& struc);
   KValue callObjectBaseMethod(const MethodCallNode* node,
-                              const std::shared_ptr<Object>& obj,
+                              const k_object& obj,
                               const k_string& baseStruct,
                               const k_string& methodName);
   KValue callObjectMethod(const MethodCallNode* node,
-                          const std::shared_ptr<Object>& obj);
-  KValue callLambda(const Token& token, const k_string& lambdaName,
+                          const k_object& obj);
+  k_lambda findLambda(const k_string& name);
+  std::shared_ptr<CallStackFrame> createLambdaFrame(const k_string& name,
+                                                    const k_lambda& closure);
+  KValue callLambda(const Token& token, const k_lambda& closure,
+                    const k_string& lambdaName,
                     const std::vector<std::unique_ptr<ASTNode>>& arguments,
                     bool& requireDrop);
-  KValue callLambda(const Token& token, const k_string& lambdaName,
+  KValue callLambda(const Token& token, const k_lambda& closure,
+                    const k_string& lambdaName,
                     const std::vector<KValue>& arguments);
-  void prepareLambdaCall(const std::unique_ptr<KLambda>& func,
+  void prepareLambdaCall(const KLambda& func,
                          const std::vector<std::unique_ptr<ASTNode>>& arguments,
-                         std::unordered_set<k_string>& defaultParameters,
-                         const Token& token, k_string& targetLambda,
-                         const std::unordered_map<k_string, KName>& typeHints,
-                         const k_string& lambdaName,
+                         const Token& token, const k_string& lambdaName,
                          std::shared_ptr<CallStackFrame>& lambdaFrame);
   void prepareLambdaVariables(
       const std::unordered_map<k_string, KName>& typeHints,
       const std::pair<k_string, KValue>& param, KValue& argValue,
       const Token& token, size_t i, const k_string& lambdaName,
       std::shared_ptr<CallStackFrame>& lambdaFrame);
-  void prepareLambdaCall(const std::unique_ptr<KLambda>& func,
+  void prepareLambdaCall(const KLambda& func,
                          const std::vector<KValue>& arguments,
-                         std::unordered_set<k_string>& defaultParameters,
-                         const Token& token, k_string& targetLambda,
-                         const std::unordered_map<k_string, KName>& typeHints,
-                         const k_string& lambdaName,
+                         const Token& token, const k_string& lambdaName,
                          std::shared_ptr<CallStackFrame>& lambdaFrame);
   KValue callFunction(const std::unique_ptr<KFunction>& function,
                       const std::vector<std::unique_ptr<ASTNode>>& arguments,
                       const Token& token, const k_string& functionName);
   KValue callFunction(const FunctionCallNode* node, bool& requireDrop);
+  KValue callFunction(const std::unique_ptr<KFunction>& function,
+                      const KValue* args, size_t argCount, const Token& token,
+                      const k_string& functionName);
 
   void prepareFunctionVariables(
       const std::unordered_map<k_string, KName>& typeHints,
@@ -196,21 +337,14 @@ class KInterpreter {
       const FunctionCallNode* node, bool& requireDrop);
   void prepareFunctionCall(const std::unique_ptr<KFunction>& func,
                            const FunctionCallNode* node,
-                           std::unordered_set<k_string>& defaultParameters,
+                           const std::unordered_set<k_string>& defaultParameters,
                            const std::unordered_map<k_string, KName>& typeHints,
                            std::shared_ptr<CallStackFrame>& functionFrame);
-  KValue executeFunctionBody(const std::unique_ptr<KFunction>& function);
+  KValue executeFunctionBody(const KCallable& callable);
 
   KValue handleNestedIndexing(const IndexingNode* indexExpr, KValue baseObj,
                               const KName& op, const KValue& newValue);
 
-  // Scope value propagation
-  bool shouldUpdateFrameVariables(
-      const k_string& varName, const std::shared_ptr<CallStackFrame> nextFrame);
-  void updateVariablesInCallerFrame(
-      const std::unordered_map<k_string, KValue>& variables,
-      std::shared_ptr<CallStackFrame> callerFrame);
-
   // Slices
   SliceIndex getSlice(const SliceNode* node, KValue object);
   KValue doSliceAssignment(const Token& token, KValue& slicedObj,
@@ -243,13 +377,22 @@ class KInterpreter {
   KValue listMin(const Token& token, const k_list& list);
   KValue listMax(const Token& token, const k_list& list);
   KValue listSort(const k_list& list);
-  KValue lambdaEach(std::unique_ptr<KLambda>& lambda, const k_list& list);
-  KValue lambdaNone(std::unique_ptr<KLambda>& lambda, const k_list& list);
-  KValue lambdaMap(std::unique_ptr<KLambda>& lambda, const k_list& list);
-  KValue lambdaReduce(std::unique_ptr<KLambda>& lambda, KValue accumulator,
+  KValue listParallel(const Token& token, const KName& op, const k_list& list,
+                      const std::vector<KValue>& args);
+  std::vector<KValue> runChunks(const KName& op, const k_list& list,
+                                std::shared_ptr<const KLambda> lambda,
+                                size_t chunkSize);
+  KValue runChunk(const KName& op, const KLambda& lambda, const k_list& list,
+                  size_t start, size_t stop);
+  KValue lambdaEach(const KLambda& lambda, const k_list& list,
+                    size_t offset = 0);
+  KValue lambdaNone(const KLambda& lambda, const k_list& list);
+  KValue lambdaMap(const KLambda& lambda, const k_list& list);
+  KValue lambdaReduce(const KLambda& lambda, KValue accumulator,
                       const k_list& list);
-  KValue lambdaSelect(std::unique_ptr<KLambda>& lambda, const k_list& list);
-  KValue lambdaAll(std::unique_ptr<KLambda>& lambda, const k_list& list);
+  KValue lambdaSelect(const KLambda& lambda, const k_list& list,
+                      size_t offset = 0);
+  KValue lambdaAll(const KLambda& lambda, const k_list& list);
 
   // Serialization
   KValue interpolateString(const Token& token, const k_string& input);
@@ -284,6 +427,8 @@ class KInterpreter {
   KValue interpretWebServerPublic(const Token& token,
                                   std::vector<KValue>& args);
   int getNextWebServerHook(const Token& token, KValue& arg);
+  void startWebWorkers(size_t count);
+  KInterpreter& webWorker();
   k_hashmap getWebServerRequestHash(const httplib::Request& req);
   void handleWebServerRequest(int webhookID, k_hashmap requestHash,
                               k_string& redirect, k_string& content,
@@ -292,6 +437,22 @@ class KInterpreter {
                                                  KValue& arg);
 };
 
+KValue KInterpreter::interpret(const std::shared_ptr<const ASTNode>& root) {
+  TreeScope scope(tree, root);
+  return interpret(root.get());
+}
+
+// Returns `node`, kept alive by the tree being run. Code that is not part of a
+// shared tree gets a copy of the node instead.
+template <typename T>
+std::shared_ptr<const T> KInterpreter::share(const T* node) const {
+  if (tree != nullptr && *tree) {
+    return std::shared_ptr<const T>(*tree, node);
+  }
+
+  return std::shared_ptr<const T>(static_cast<T*>(node->clone().release()));
+}
+
 KValue KInterpreter::interpret(const ASTNode* node) {
   if (!node) {
     return {};
@@ -501,17 +662,19 @@ KValue KInterpreter::interpret(const ASTNode* node) {
 
 std::shared_ptr<CallStackFrame> KInterpreter::createFrame(
     const k_string& name, bool isMethodInvocation = false) {
-  std::shared_ptr<CallStackFrame> frame = callStack.top();
-  auto subFrame = std::make_shared<CallStackFrame>();
-  auto& subFrameVariables = subFrame->variables;
+  const auto& frame = callStack.top();
+  std::shared_ptr<CallStackFrame> subFrame;
+  if (framePool.empty()) {
+    subFrame = std::make_shared<CallStackFrame>();
+  } else {
+    subFrame = std::move(framePool.back());
+    framePool.pop_back();
+  }
 
   subFrame->name = name;
 
   if (!isMethodInvocation) {
-    const auto& frameVariables = frame->variables;
-    for (const auto& pair : frameVariables) {
-      subFrameVariables[pair.first] = pair.second;
-    }
+    subFrame->parent = frame;
   }
 
   if (frame->inObjectContext()) {
@@ -535,59 +698,120 @@ void KInterpreter::dropFrame() {
     return;
   }
 
-  if (!funcStack.empty()) {
-    funcStack.pop();
-  }
-
-  auto frame = callStack.top();
+  auto frame = std::move(callStack.top());
   auto returnValue = std::move(frame->returnValue);
-  auto topVariables = std::move(frame->variables);
 
   callStack.pop();
 
   if (!callStack.empty()) {
-    auto callerFrame = callStack.top();
+    const auto& callerFrame = callStack.top();
 
     callerFrame->returnValue = returnValue;
 
     if (callerFrame->isFlagSet(FrameFlags::SubFrame)) {
       callerFrame->setFlag(FrameFlags::Return);
     }
+  }
+
+  releaseFrame(std::move(frame));
+}
+
+// Pops the frames above `depth` without returning from them.
+void KInterpreter::unwindFrames(size_t depth) {
+  while (callStack.size() > depth) {
+    auto frame = std::move(callStack.top());
+    callStack.pop();
+    releaseFrame(std::move(frame));
+  }
+}
+
+// Pools a frame that has left the call stack, unless something still holds
+// it. A frame that a lambda kept looks names up through its caller, so that
+// caller is never pooled either: it could be handed to an unrelated call.
+void KInterpreter::releaseFrame(std::shared_ptr<CallStackFrame> frame) {
+  if (frame->isFlagSet(FrameFlags::Captured)) {
+    frame->releaseClosures();
+    if (frame.use_count() > 1) {
+      if (auto* caller = frame->getParent()) {
+        caller->setFlag(FrameFlags::WeaklyHeld);
+      }
+
+      keptFrames.push_back(frame);
+      if (keptFrames.size() >= nextCycleCollection) {
+        collectKeptFrames();
+      }
+    }
+  }
 
-    updateVariablesInCallerFrame(topVariables, callerFrame);
+  if (frame.use_count() == 1 && !frame->isFlagSet(FrameFlags::WeaklyHeld) &&
+      framePool.size() < MaxPooledFrames) {
+    frame->recycle();
+    framePool.push_back(std::move(frame));
   }
 }
 
+// Frees the kept frames that only reference cycles hold on to.
+void KInterpreter::collectKeptFrames() {
+  {
+    std::vector<std::shared_ptr<CallStackFrame>> frames;
+    for (const auto& kept : keptFrames) {
+      if (auto frame = kept.lock()) {
+        frames.push_back(std::move(frame));
+      }
+    }
+    CallStackFrame::collectCycles(frames);
+  }
+
+  keptFrames.erase(
+      std::remove_if(keptFrames.begin(), keptFrames.end(),
+                     [](const auto& kept) { return kept.expired(); }),
+      keptFrames.end());
+  nextCycleCollection = std::max(MinKeptFrames, keptFrames.size() * 2);
+}
+
 k_string KInterpreter::id(const ASTNode* node) {
   return static_cast<const IdentifierNode*>(node)->name;
 }
 
+// Each pool thread keeps one interpreter and reuses it for every task and
+// parallel list builtin it runs.
+KInterpreter& KInterpreter::poolWorker() {
+  static thread_local KInterpreter worker;
+  return worker;
+}
+
 KValue KInterpreter::visit(const SpawnNode* node) {
   auto frame = std::make_shared<CallStackFrame>();
   auto top = callStack.top();
 
   frame->name = Keywords.Spawn;
 
-  for (const auto& var : top->variables) {
+  for (const auto& var : top->getVisibleVariables()) {
     frame->variables[var.first] = clone_value(var.second);
   }
 
-  auto taskExpr = node->expression->clone();
+  std::shared_ptr<const ASTNode> taskExpr = share(node->expression.get());
 
-  auto interp = std::make_shared<KInterpreter>();
-  interp->setContext(ctx->clone());
-  interp->pushFrame(frame);
+  TaskManager::TaskFunction task([context = ctx->clone(), frame,
+                                  taskExpr = std::move(taskExpr)]() mutable {
+    auto& worker = poolWorker();
+    worker.beginTask(std::move(context), frame);
 
-  TaskManager::TaskFunction task(
-      [interp, frame, taskExpr = std::move(taskExpr)]() {
-        auto result = interp->interpret(taskExpr.get());
+    KValue result;
+    try {
+      result = worker.interpret(taskExpr);
+    } catch (...) {
+      worker.endTask();
+      throw;
+    }
+    worker.endTask();
 
-        if (frame->isFlagSet(FrameFlags::Return)) {
-          result = frame->returnValue;
-        }
+    if (frame->isFlagSet(FrameFlags::Return)) {
+      result = frame->returnValue;
+    }
 
-        return result;
-      });
+    return result;
+  });
 
   auto taskId = taskmgr.addTask(std::move(task));
 
@@ -600,8 +824,13 @@ KValue KInterpreter::visit(const ProgramNode* node) {
     auto programFrame = std::make_shared<CallStackFrame>();
     programFrame->name = kiwi_name;
     programFrame->variables[Keywords.Global] =
-        KValue::createHashmap(std::make_shared<Hashmap>());
+        KValue::createHashmap(make_ref<Hashmap>());
     pushFrame(programFrame);
+
+    if (!TREEWALKMODE) {
+      auto chunk = KCompiler().compileProgram(node);
+      return execute(*chunk);
+    }
   }
 
   KValue result;
@@ -661,13 +890,13 @@ KValue KInterpreter::visit(const ThrowNode* node) {
         auto errorHash = errorValue.getHashmap();
         auto errorKey = KValue::createString("error");
         auto messageKey = KValue::createString("error");
-        if (errorHash->hasKey(errorKey) &&
-            errorHash->kvp[errorKey].isString()) {
-          errorType = errorHash->kvp[errorKey].getString();
+        const auto* errorTypeValue = errorHash->find(errorKey);
+        if (errorTypeValue && errorTypeValue->isString()) {
+          errorType = errorTypeValue->getString();
         }
-        if (errorHash->hasKey(messageKey) &&
-            errorHash->kvp[messageKey].isString()) {
-          errorMessage = errorHash->kvp[messageKey].getString();
+        const auto* messageValue = errorHash->find(messageKey);
+        if (messageValue && messageValue->isString()) {
+          errorMessage = messageValue->getString();
         }
       } else if (errorValue.isString()) {
         errorMessage = errorValue.getString();
@@ -682,7 +911,7 @@ KValue KInterpreter::visit(const ThrowNode* node) {
 
 KValue KInterpreter::visit(const PackageNode* node) {
   auto packageName = id(node->packageName.get());
-  ctx->addPackage(packageName, std::make_unique<KPackage>(node->clone()));
+  ctx->addPackage(packageName, std::make_unique<KPackage>(share(node)));
 
   return {};
 }
@@ -690,22 +919,61 @@ KValue KInterpreter::visit(const PackageNode* node) {
 void KInterpreter::importExternal(const k_string& packageName,
                                   const Token& token) {
   auto packagePath = File::tryGetExtensionless(token, packageName);
-  auto content = File::readFile(token, packagePath);
-  if (content.empty()) {
-    return;
+  if (!File::fileExists(token, packagePath)) {
+    throw FileReadError(token, packagePath);
   }
 
-  Lexer lexer(File::getAbsolutePath(token, packagePath), content);
-
   Parser p(true);
-  auto tokenStream = lexer.getTokenStream();
-  auto ast = p.parseTokenStream(tokenStream, true);
+  auto ast = std::make_shared<ProgramNode>();
+  ast->isScript = true;
+  if (!KSnapshot::parseFile(p, File::getAbsolutePath(token, packagePath),
+                            *ast)) {
+    return;
+  }
 
-  interpret(ast.get());
+  KOptimizer::prepare(*ast);
+  interpret(std::shared_ptr<const ASTNode>(std::move(ast)));
 
   return;
 }
 
+// Runs the library files that declare `name`, or the package it belongs to,
+// unless this context has already run them. Returns true if it ran any.
+bool KInterpreter::loadLibrary(const k_string& name) {
+  auto& index = KLibraryIndex::instance();
+  const auto* paths = index.find(name);
+  if (paths == nullptr) {
+    return false;
+  }
+
+  // A library file is run from the top level, whatever package or struct was
+  // being declared when it was needed.
+  std::stack<k_string> outerPackages;
+  std::stack<k_string> outerStructs;
+  std::swap(packageStack, outerPackages);
+  std::swap(structStack, outerStructs);
+
+  bool loaded = false;
+  try {
+    for (const auto& path : *paths) {
+      if (!ctx->addLibrary(path)) {
+        continue;
+      }
+
+      interpret(index.getProgram(path));
+      loaded = true;
+    }
+  } catch (...) {
+    std::swap(packageStack, outerPackages);
+    std::swap(structStack, outerStructs);
+    throw;
+  }
+
+  std::swap(packageStack, outerPackages);
+  std::swap(structStack, outerStructs);
+  return loaded;
+}
+
 void KInterpreter::importPackage(const KValue& packageName,
                                  const Token& token) {
   if (!packageName.isString()) {
@@ -715,6 +983,10 @@ void KInterpreter::importPackage(const KValue& packageName,
 
   auto packageNameValue = packageName.getString();
 
+  if (!ctx->hasPackage(packageNameValue)) {
+    loadLibrary(packageNameValue);
+  }
+
   if (!ctx->hasPackage(packageNameValue)) {
     // Check if external package.
     if (File::isScript(token, packageNameValue)) {
@@ -725,7 +997,8 @@ void KInterpreter::importPackage(const KValue& packageName,
 
   packageStack.push(packageNameValue);
   const auto& package = ctx->getPackages().at(packageNameValue);
-  const auto& decl = package->decl;
+  const auto* decl = package->decl;
+  TreeScope scope(tree, package->tree);
 
   for (const auto& stmt : decl->body) {
     interpret(stmt.get());
@@ -758,9 +1031,9 @@ KValue KInterpreter::visit(const ParseNode* node) {
 
   Parser p(true);
   auto tokenStream = lexer.getTokenStream();
-  auto ast = p.parseTokenStream(tokenStream, true);
+  std::shared_ptr<const ASTNode> ast = p.parseTokenStream(tokenStream, true);
 
-  interpret(ast.get());
+  interpret(ast);
 
   return {};
 }
@@ -818,13 +1091,13 @@ KValue KInterpreter::handleNestedIndexing(const IndexingNode* indexExpr,
       if (nestedIndexExpr->indexExpression->type == ASTNodeType::INDEX) {
         KValue nestedValue = handleNestedIndexing(
             nestedIndexExpr, listObj->elements[indexValue], op, newValue);
-        listObj->elements[indexValue] = nestedValue;
+        listObj->mutableElements()[indexValue] = nestedValue;
       } else {
         if (op == KName::Ops_Assign) {
-          listObj->elements[indexValue] = newValue;
+          listObj->mutableElements()[indexValue] = newValue;
         } else {
           auto oldValue = listObj->elements[indexValue];
-          listObj->elements[indexValue] =
+          listObj->mutableElements()[indexValue] =
               MathImpl.do_binary_op(indexExpr->token, op, oldValue, newValue);
         }
       }
@@ -865,10 +1138,10 @@ KValue KInterpreter::handleNestedIndexing(const IndexingNode* indexExpr,
     }
 
     if (op == KName::Ops_Assign) {
-      list->elements[listIndex] = newValue;
+      list->mutableElements()[listIndex] = newValue;
     } else {
       auto oldValue = list->elements.at(listIndex);
-      list->elements[listIndex] =
+      list->mutableElements()[listIndex] =
           MathImpl.do_binary_op(indexExpr->token, op, oldValue, newValue);
     }
     return KValue::createList(list);
@@ -886,10 +1159,10 @@ KValue KInterpreter::handleNestedIndexing(const IndexingNode* indexExpr,
       }
 
       if (op == KName::Ops_Assign) {
-        list->elements[listIndex] = newValue;
+        list->mutableElements()[listIndex] = newValue;
       } else {
         auto oldValue = list->elements.at(listIndex);
-        list->elements[listIndex] =
+        list->mutableElements()[listIndex] =
             MathImpl.do_binary_op(indexExpr->token, op, oldValue, newValue);
       }
       return KValue::createList(list);
@@ -945,9 +1218,9 @@ KValue KInterpreter::visit(const PackAssignmentNode* node) {
   for (const auto& lhs : node->left) {
     const auto& identifierName = id(lhs.get());
     if (rhsValues.size() == lhsLength) {
-      frame->variables[identifierName] = rhsValues[rhsPosition++];
+      frame->setVariable(identifierName, rhsValues[rhsPosition++]);
     } else {
-      frame->variables[identifierName] = KValue::createNull();
+      frame->setVariable(identifierName, KValue::createNull());
     }
   }
 
@@ -972,9 +1245,9 @@ KValue KInterpreter::visit(const IndexAssignmentNode* node) {
           identifierName.at(0) == '@' &&
           frame->getObjectContext()->hasVariable(identifierName)) {
         slicedObj =
-            frame->getObjectContext()->instanceVariables[identifierName];
-      } else if (frame->hasVariable(identifierName)) {
-        slicedObj = frame->variables[identifierName];
+            frame->getObjectContext()->variable(identifierName);
+      } else if (auto* variable = frame->findVariable(identifierName)) {
+        slicedObj = *variable;
       } else {
         throw VariableUndefinedError(node->token, identifierName);
       }
@@ -982,7 +1255,7 @@ KValue KInterpreter::visit(const IndexAssignmentNode* node) {
       auto slice = getSlice(sliceExpr, slicedObj);
 
       doSliceAssignment(node->token, slicedObj, slice, newValue);
-      frame->variables[identifierName] = slicedObj;
+      frame->setVariable(identifierName, slicedObj);
     }
   } else if (node->object->type == ASTNodeType::INDEX) {
     auto indexExpr = static_cast<const IndexingNode*>(node->object.get());
@@ -995,9 +1268,9 @@ KValue KInterpreter::visit(const IndexAssignmentNode* node) {
           identifierName.at(0) == '@' &&
           frame->getObjectContext()->hasVariable(identifierName)) {
         indexedObj =
-            frame->getObjectContext()->instanceVariables[identifierName];
-      } else if (frame->hasVariable(identifierName)) {
-        indexedObj = frame->variables[identifierName];
+            frame->getObjectContext()->variable(identifierName);
+      } else if (auto* variable = frame->findVariable(identifierName)) {
+        indexedObj = *variable;
       } else {
         throw VariableUndefinedError(node->token, identifierName);
       }
@@ -1018,18 +1291,18 @@ KValue KInterpreter::visit(const IndexAssignmentNode* node) {
         if (indexExpr->indexExpression->type == ASTNodeType::INDEX) {
           KValue nestedValue = handleNestedIndexing(
               indexExpr, listObj->elements[indexValue], op, newValue);
-          listObj->elements[indexValue] = nestedValue;
+          listObj->mutableElements()[indexValue] = nestedValue;
         } else {
           if (op == KName::Ops_Assign) {
-            listObj->elements[indexValue] = newValue;
+            listObj->mutableElements()[indexValue] = newValue;
           } else {
             auto oldValue = listObj->elements[indexValue];
-            listObj->elements[indexValue] =
+            listObj->mutableElements()[indexValue] =
                 MathImpl.do_binary_op(node->token, op, oldValue, newValue);
           }
         }
 
-        frame->variables[identifierName] = KValue::createList(listObj);
+        frame->setVariable(identifierName, KValue::createList(listObj));
       } else if (indexedObj.isHashmap()) {
         auto hashObj = indexedObj.getHashmap();
 
@@ -1113,8 +1386,12 @@ KValue KInterpreter::visit(const ConstAssignmentNode* node) {
 }
 
 KValue KInterpreter::visit(const AssignmentNode* node) {
+  return assignValue(node, interpret(node->initializer.get()));
+}
+
+KValue KInterpreter::assignValue(const AssignmentNode* node,
+                                 const KValue& value) {
   auto frame = callStack.top();
-  auto value = interpret(node->initializer.get());
   auto type = node->op;
   auto name = node->name;
 
@@ -1123,66 +1400,53 @@ KValue KInterpreter::visit(const AssignmentNode* node) {
       throw IllegalNameError(node->token, name);
     }
 
-    if (value.isLambda()) {
-      // WIP: need to work on this.
-      const auto& lambdaId = value.getLambda()->identifier;
-      ctx->addLambda(name, std::move(ctx->getLambdas().at(lambdaId)));
-      return value;
-    } else {
-      if (frame->inObjectContext() &&
-          (node->left->type == ASTNodeType::SELF || name.at(0) == '@')) {
-        auto& obj = frame->getObjectContext();
-        obj->instanceVariables[name] = value;
-        return obj->instanceVariables[name];
-      }
-
-      if (value.isObject()) {
-        auto& obj = value.getObject();
-        obj->identifier = name;
-      }
+    if (frame->inObjectContext() &&
+        (node->left->type == ASTNodeType::SELF || name.at(0) == '@')) {
+      auto& variable = frame->getObjectContext()->variable(name, node->cache);
+      variable = value;
+      return variable;
+    }
 
-      frame->variables[name] = value;
+    if (value.isObject()) {
+      auto& obj = value.getObject();
+      obj->identifier = name;
     }
+
+    return frame->setVariable(name, value);
   } else {
     if (ctx->hasConstant(name)) {
       throw IllegalNameError(node->token, name);
     }
 
-    if (frame->hasVariable(name)) {
-      auto oldValue = frame->variables[name];
-
+    if (auto* variable = frame->findVariable(name)) {
       if (type == KName::Ops_BitwiseNotAssign) {
-        frame->variables[name] = MathImpl.do_bitwise_not(node->token, oldValue);
+        *variable = MathImpl.do_bitwise_not(node->token, *variable);
       } else {
-        frame->variables[name] =
-            MathImpl.do_binary_op(node->token, type, oldValue, value);
+        *variable = MathImpl.do_binary_op(node->token, type, *variable, value);
       }
 
-      return frame->variables[name];
+      return *variable;
     } else if (frame->inObjectContext()) {
-      auto& obj = frame->getObjectContext();
+      auto* variable =
+          frame->getObjectContext()->findVariable(name, node->cache);
 
-      if (!obj->hasVariable(name)) {
+      if (!variable) {
         throw VariableUndefinedError(node->token, name);
       }
 
-      auto oldValue = obj->instanceVariables[name];
-
       if (type == KName::Ops_BitwiseNotAssign) {
-        obj->instanceVariables[name] =
-            MathImpl.do_bitwise_not(node->token, oldValue);
+        *variable = MathImpl.do_bitwise_not(node->token, *variable);
       } else {
-        obj->instanceVariables[name] =
-            MathImpl.do_binary_op(node->token, type, oldValue, value);
+        *variable = MathImpl.do_binary_op(node->token, type, *variable, value);
       }
 
-      return obj->instanceVariables[name];
+      return *variable;
     }
 
     throw VariableUndefinedError(node->token, name);
   }
 
-  return frame->variables[name];
+  return value;
 }
 
 SliceIndex KInterpreter::getSlice(const SliceNode* node, KValue object) {
@@ -1196,7 +1460,7 @@ SliceIndex KInterpreter::getSlice(const SliceNode* node, KValue object) {
         static_cast<k_int>(object.getList()->elements.size());
     slice.stopIndex.setValue(listSize);
   } else if (object.isString()) {
-    const auto& stringSize = static_cast<k_int>(object.getString().size());
+    const auto& stringSize = static_cast<k_int>(object.getStringView().size());
     slice.stopIndex.setValue(stringSize);
   }
 
@@ -1225,12 +1489,7 @@ KValue KInterpreter::visit(const SelfNode* node) {
   }
 
   if (!node->name.empty()) {
-    auto name = node->name;
-    auto obj = frame->getObjectContext();
-    if (!obj->hasVariable(name)) {
-      obj->instanceVariables[name] = {};
-    }
-    return obj->instanceVariables[name];
+    return frame->getObjectContext()->variable(node->name, node->cache);
   }
 
   return KValue::createObject(frame->getObjectContext());
@@ -1241,24 +1500,17 @@ KValue KInterpreter::visit(const IdentifierNode* node) {
   const auto& name = node->name;
 
   if (frame->inObjectContext() && name.at(0) == '@') {
-    return frame->getObjectContext()->instanceVariables[name];
+    return frame->getObjectContext()->variable(name, node->cache);
   }
 
-  if (frame->hasVariable(name)) {
-    return frame->variables[name];
+  if (const auto* variable = frame->findVariable(name)) {
+    return *variable;
   } else if (ctx->hasStruct(name)) {
-    return KValue::createStruct(std::make_shared<StructRef>(name));
-  } else if (ctx->hasLambda(name)) {
-    auto lambdaRef = std::make_shared<LambdaRef>(name);
-    return KValue::createLambda(lambdaRef);
-  } else if (ctx->hasMappedLambda(name)) {
-    const auto& mappedId = ctx->getMappedLambda(name);
-    if (ctx->hasLambda(mappedId)) {
-      auto mappedLambdaRef = std::make_shared<LambdaRef>(mappedId);
-      return KValue::createLambda(mappedLambdaRef);
-    }
+    return KValue::createStruct(make_ref<StructRef>(name));
   } else if (ctx->hasConstant(name)) {
     return ctx->getConstants().at(name);
+  } else if (loadLibrary(name) && ctx->hasStruct(name)) {
+    return KValue::createStruct(make_ref<StructRef>(name));
   }
 
   return KValue::createNull();
@@ -1269,13 +1521,17 @@ KValue KInterpreter::visit(const LiteralNode* node) {
 }
 
 KValue KInterpreter::visit(const ListLiteralNode* node) {
+  if (node->constant.isList()) {
+    return clone_value(node->constant);
+  }
+
   std::vector<KValue> elements;
   elements.reserve(node->elements.size());
   for (const auto& element : node->elements) {
     const auto& value = interpret(element.get());
     elements.emplace_back(value);
   }
-  return KValue::createList(std::make_shared<List>(elements));
+  return KValue::createList(make_ref<List>(elements));
 }
 
 KValue KInterpreter::visit(const RangeLiteralNode* node) {
@@ -1286,46 +1542,45 @@ KValue KInterpreter::visit(const RangeLiteralNode* node) {
     throw RangeError(node->token, "Range value must be an integer.");
   }
 
-  auto start = startValue.getInteger();
+  KRange range;
+  range.start = startValue.getInteger();
   auto stop = stopValue.getInteger();
-  auto step = (stop < start) ? -1 : 1;
-  size_t numElements = static_cast<size_t>(std::abs(stop - start)) + 1;
-
-  auto list = std::make_shared<List>();
-  auto& elements = list->elements;
-  elements.reserve(numElements);
-
-  for (auto i = start; i != stop; i += step) {
-    elements.emplace_back(KValue::createInteger(i));
-  }
-
-  elements.emplace_back(KValue::createInteger(stop));
+  range.step = (stop < range.start) ? -1 : 1;
+  range.count = static_cast<size_t>(std::abs(stop - range.start)) + 1;
 
-  return KValue::createList(list);
+  return KValue::createList(make_ref<List>(KElements::fromRange(range)));
 }
 
 KValue KInterpreter::visit(const HashLiteralNode* node) {
-  auto hash = std::make_shared<Hashmap>();
-  std::unordered_map<k_value, KValue> kvps;
+  if (node->constant.isHashmap()) {
+    return clone_value(node->constant);
+  }
+
+  auto hash = make_ref<Hashmap>();
+  std::unordered_map<KValue, KValue> kvps;
   std::vector<KValue> keys;
   keys.reserve(node->elements.size());
 
   for (const auto& pair : node->elements) {
     auto key = interpret(pair.first.get());
     auto value = interpret(pair.second.get());
-    kvps[key.getValue()] = value;
+    kvps[key] = value;
     keys.emplace_back(key);
   }
 
   for (const auto& key : keys) {
-    hash->add(key, kvps[key.getValue()]);
+    hash->add(key, kvps[key]);
   }
 
   return KValue::createHashmap(hash);
 }
 
 KValue KInterpreter::visit(const PrintNode* node) {
-  auto value = interpret(node->expression.get());
+  printValue(node, interpret(node->expression.get()));
+  return {};
+}
+
+void KInterpreter::printValue(const PrintNode* node, const KValue& value) {
   auto serializedValue = Serializer::serialize(value);
   auto printNewLine = node->printNewline;
 
@@ -1342,8 +1597,6 @@ KValue KInterpreter::visit(const PrintNode* node) {
       std::cout << serializedValue << std::flush;
     }
   }
-
-  return {};
 }
 
 KValue KInterpreter::visit(const PrintXyNode* node) {
@@ -1385,6 +1638,15 @@ KValue KInterpreter::visit(const BinaryOperationNode* node) {
     }
   }
   auto right = interpret(node->right.get());
+  if (left.getType() == right.getType() && MathImpl.has_numeric_fast_path(op)) {
+    if (left.isInteger()) {
+      return MathImpl.do_integer_op(node->token, op, left.getInteger(),
+                                    right.getInteger());
+    } else if (left.isFloat()) {
+      return MathImpl.do_float_op(node->token, op, left.getFloat(),
+                                  right.getFloat());
+    }
+  }
   return MathImpl.do_binary_op(node->token, op, left, right);
 }
 
@@ -1428,39 +1690,43 @@ KValue KInterpreter::visit(const IndexingNode* node) {
     auto indexExpr =
         static_cast<const IndexingNode*>(node->indexExpression.get());
     return handleNestedIndexing(indexExpr, object, KName::Ops_Assign, KValue{});
-  } else {
-    if (object.isList()) {
-      auto index = get_integer(node->token, indexValue);
-      auto list = object.getList();
+  }
 
-      if (index < 0 || static_cast<size_t>(index) >= list->elements.size()) {
-        throw RangeError(node->token,
-                         "The index was outside the bounds of the list.");
-      }
+  return getIndexedValue(node->token, object, indexValue);
+}
 
-      return list->elements.at(index);
-    } else if (object.isHashmap()) {
-      auto hash = object.getHashmap();
+KValue KInterpreter::getIndexedValue(const Token& token, const KValue& object,
+                                     const KValue& indexValue) {
+  if (object.isList()) {
+    auto index = get_integer(token, indexValue);
+    auto list = object.getList();
 
-      if (!hash->hasKey(indexValue)) {
-        throw HashKeyError(node->token, Serializer::serialize(indexValue));
-      }
+    if (index < 0 || static_cast<size_t>(index) >= list->elements.size()) {
+      throw RangeError(token, "The index was outside the bounds of the list.");
+    }
+
+    return list->elements.get(index);
+  } else if (object.isHashmap()) {
+    auto hash = object.getHashmap();
 
-      return hash->get(indexValue);
-    } else if (object.isString()) {
-      auto string = object.getString();
-      auto index = get_integer(node->token, indexValue);
+    if (!hash->hasKey(indexValue)) {
+      throw HashKeyError(token, Serializer::serialize(indexValue));
+    }
 
-      if (index < 0 || static_cast<size_t>(index) >= string.size()) {
-        throw RangeError(node->token,
-                         "The index was outside the bounds of the string.");
-      }
+    return hash->get(indexValue);
+  } else if (object.isString()) {
+    auto string = object.getStringView();
+    auto index = get_integer(token, indexValue);
 
-      return KValue::createString(k_string(1, string.at(index)));
+    if (index < 0 || static_cast<size_t>(index) >= string.size()) {
+      throw RangeError(token,
+                       "The index was outside the bounds of the string.");
     }
 
-    throw IndexError(node->token, "Invalid indexing operation.");
+    return KValue::createString(k_string(1, string.at(index)));
   }
+
+  throw IndexError(token, "Invalid indexing operation.");
 }
 
 KValue KInterpreter::visit(const IfNode* node) {
@@ -1515,7 +1781,7 @@ KValue KInterpreter::visit(const CaseNode* node) {
     if (node->testValueAlias) {
       auto alias = id(node->testValueAlias.get());
       auto& frame = callStack.top();
-      frame->variables[alias] = testValue;
+      frame->defineVariable(alias, testValue);
     }
   }
 
@@ -1556,7 +1822,6 @@ KValue KInterpreter::visit(const CaseNode* node) {
 
 KValue KInterpreter::listLoop(const ForLoopNode* node, const k_list& list) {
   auto& frame = callStack.top();
-  auto& variables = frame->variables;
   frame->setFlag(FrameFlags::InLoop);
   const auto& elements = list->elements;
 
@@ -1574,19 +1839,18 @@ KValue KInterpreter::listLoop(const ForLoopNode* node, const k_list& list) {
   bool fallOut = false;
   KValue result;
   ASTNodeType statement = ASTNodeType::NO_OP;
-  KValue iteratorValue, iteratorIndex;
+  LoopVariable iteratorValue(*frame, valueIteratorName);
+  LoopVariable iteratorIndex(*frame, indexIteratorName);
 
   for (size_t i = 0; i < elements.size(); ++i) {
     if (fallOut) {
       break;
     }
 
-    iteratorValue.setValue(elements.at(i));
-    variables[valueIteratorName] = iteratorValue;
+    iteratorValue.set(elements.get(i));
 
     if (hasIndexIterator) {
-      iteratorIndex.setValue(static_cast<k_int>(i));
-      variables[indexIteratorName] = iteratorIndex;
+      iteratorIndex.set(KValue::createInteger(static_cast<k_int>(i)));
     }
 
     for (const auto& stmt : node->body) {
@@ -1627,9 +1891,9 @@ KValue KInterpreter::listLoop(const ForLoopNode* node, const k_list& list) {
     }
   }
 
-  variables.erase(valueIteratorName);
+  frame->eraseVariable(valueIteratorName);
   if (hasIndexIterator) {
-    variables.erase(indexIteratorName);
+    frame->eraseVariable(indexIteratorName);
   }
 
   frame->clearFlag(FrameFlags::InLoop);
@@ -1640,8 +1904,6 @@ KValue KInterpreter::listLoop(const ForLoopNode* node, const k_list& list) {
 KValue KInterpreter::hashLoop(const ForLoopNode* node, const k_hashmap& hash) {
   auto frame = callStack.top();
   frame->setFlag(FrameFlags::InLoop);
-  const auto& keys = hash->keys;
-  const auto& kvp = hash->kvp;
 
   k_string valueIteratorName;
   k_string indexIteratorName;
@@ -1656,16 +1918,22 @@ KValue KInterpreter::hashLoop(const ForLoopNode* node, const k_hashmap& hash) {
 
   bool fallOut = false;
   KValue result;
+  LoopVariable iteratorValue(*frame, valueIteratorName);
+  LoopVariable iteratorIndex(*frame, indexIteratorName);
 
-  for (const auto& key : keys) {
+  // Walk entry positions rather than iterators so the body may add or remove
+  // keys without invalidating the loop.
+  for (auto pos = hash->nextEntry(0); pos < hash->entryEnd();
+       pos = hash->nextEntry(pos + 1)) {
     if (fallOut) {
       break;
     }
 
-    frame->variables[valueIteratorName] = key;
+    const auto& entry = hash->entryAt(pos);
+    iteratorValue.set(entry.key);
 
     if (hasIndexIterator) {
-      frame->variables[indexIteratorName] = kvp.at(key);
+      iteratorIndex.set(entry.value);
     }
 
     for (const auto& stmt : node->body) {
@@ -1705,9 +1973,9 @@ KValue KInterpreter::hashLoop(const ForLoopNode* node, const k_hashmap& hash) {
     }
   }
 
-  frame->variables.erase(valueIteratorName);
+  frame->eraseVariable(valueIteratorName);
   if (hasIndexIterator) {
-    frame->variables.erase(indexIteratorName);
+    frame->eraseVariable(indexIteratorName);
   }
 
   frame->clearFlag(FrameFlags::InLoop);
@@ -1822,7 +2090,6 @@ KValue KInterpreter::visit(const RepeatLoopNode* node) {
   const k_int& count = countValue.getInteger();
   k_string aliasName;
   KValue result;
-  KValue aliasValue;
   bool hasAlias = false;
 
   if (node->alias) {
@@ -1832,8 +2099,8 @@ KValue KInterpreter::visit(const RepeatLoopNode* node) {
 
   auto& frame = callStack.top();
   frame->setFlag(FrameFlags::InLoop);
+  LoopVariable aliasValue(*frame, aliasName);
 
-  auto& variables = frame->variables;
   ASTNodeType statement = ASTNodeType::NO_OP;
 
   auto fallOut = false;
@@ -1843,8 +2110,7 @@ KValue KInterpreter::visit(const RepeatLoopNode* node) {
     }
 
     if (hasAlias) {
-      aliasValue.setValue(i);
-      variables[aliasName] = aliasValue;
+      aliasValue.set(KValue::createInteger(i));
     }
 
     for (const auto& stmt : node->body) {
@@ -1886,7 +2152,7 @@ KValue KInterpreter::visit(const RepeatLoopNode* node) {
   }
 
   if (hasAlias) {
-    variables.erase(aliasName);
+    frame->eraseVariable(aliasName);
   }
 
   frame->clearFlag(FrameFlags::InLoop);
@@ -1929,14 +2195,14 @@ KValue KInterpreter::visit(const TryNode* node) {
       try {
         if (node->errorType) {
           errorTypeName = id(node->errorType.get());
-          catchFrame->variables[errorTypeName] =
-              KValue::createString(e.getError());
+          catchFrame->defineVariable(errorTypeName,
+                                     KValue::createString(e.getError()));
         }
 
         if (node->errorMessage) {
           errorMessageName = id(node->errorMessage.get());
-          catchFrame->variables[errorMessageName] =
-              KValue::createString(e.getMessage());
+          catchFrame->defineVariable(errorMessageName,
+                                     KValue::createString(e.getMessage()));
         }
 
         requireDrop = pushFrame(catchFrame);
@@ -1951,11 +2217,11 @@ KValue KInterpreter::visit(const TryNode* node) {
         }
 
         if (node->errorType) {
-          catchFrame->variables.erase(errorTypeName);
+          catchFrame->eraseVariable(errorTypeName);
         }
 
         if (node->errorMessage) {
-          catchFrame->variables.erase(errorMessageName);
+          catchFrame->eraseVariable(errorMessageName);
         }
 
         dropFrame();
@@ -1993,13 +2259,17 @@ KValue KInterpreter::visit(const TryNode* node) {
 }
 
 KValue KInterpreter::visit(const LambdaCallNode* node) {
-  const auto& nodeValue = interpret(node->lambdaNode.get());
-  const auto& lambdaName = nodeValue.getLambda()->identifier;
+  auto nodeValue = interpret(node->lambdaNode.get());
+  if (!nodeValue.isLambda()) {
+    throw InvalidOperationError(node->token, "Expected a lambda.");
+  }
+
   KValue result;
   bool requireDrop = false;
 
   try {
-    result = callLambda(node->token, lambdaName, node->arguments, requireDrop);
+    result = callLambda(node->token, nodeValue.getLambda(),
+                        TypeNames.LowLambda, node->arguments, requireDrop);
     dropFrame();
   } catch (const KiwiError& e) {
     if (requireDrop && inTry()) {
@@ -2014,7 +2284,6 @@ KValue KInterpreter::visit(const LambdaCallNode* node) {
 KValue KInterpreter::visit(const LambdaNode* node) {
   std::vector<std::pair<k_string, KValue>> parameters;
   std::unordered_set<k_string> defaultParameters;
-  auto tmpId = getTemporaryId();
 
   parameters.reserve(node->parameters.size());
   for (const auto& pair : node->parameters) {
@@ -2029,17 +2298,22 @@ KValue KInterpreter::visit(const LambdaNode* node) {
     parameters.emplace_back(param);
   }
 
-  auto lambda = std::make_unique<KLambda>(node->clone());
+  auto lambda = std::make_shared<KLambda>(share(node));
   lambda->parameters = parameters;
   lambda->defaultParameters = defaultParameters;
   lambda->typeHints = node->typeHints;
   lambda->returnTypeHint = node->returnTypeHint;
 
-  ctx->addLambda(tmpId, std::move(lambda));
-  ctx->addMappedLambda(tmpId, tmpId);
+  // A frame without a caller is at the bottom of the stack, so it is visible
+  // to every call and there is nothing to keep.
+  auto& frame = callStack.top();
+  if (!frame->parent) {
+    return KValue::createLambda(make_ref<LambdaRef>(std::move(lambda)));
+  }
 
-  auto lambdaRef = std::make_shared<LambdaRef>(tmpId);
-  return KValue::createLambda(lambdaRef);
+  frame->setFlag(FrameFlags::Captured);
+  return KValue::createLambda(
+      make_ref<LambdaRef>(std::move(lambda), frame));
 }
 
 KValue KInterpreter::visit(const StructNode* node) {
@@ -2049,6 +2323,10 @@ KValue KInterpreter::visit(const StructNode* node) {
 
   if (!node->baseStruct.empty()) {
     struc->baseStruct = node->baseStruct;
+    if (!ctx->hasStruct(struc->baseStruct)) {
+      loadLibrary(struc->baseStruct);
+    }
+
     if (!ctx->hasStruct(struc->baseStruct)) {
       throw StructUndefinedError(node->token, struc->baseStruct);
     }
@@ -2095,11 +2373,6 @@ KValue KInterpreter::visit(const VariableDeclarationNode* node) {
     // if there is a default value, grab it
     if (hasDefaultValue) {
       value = interpret(pair.second.get());
-      // if the value is a lambda, register to the lambda map
-      if (value.isLambda()) {
-        const auto& lambdaName = value.getLambda()->identifier;
-        ctx->addMappedLambda(name, lambdaName);
-      }
     } else {
       // default to null
       value = KValue::createNull();
@@ -2138,11 +2411,11 @@ KValue KInterpreter::visit(const VariableDeclarationNode* node) {
             break;
 
           case KName::Types_List:
-            value.setValue(std::make_shared<List>());
+            value.setValue(make_ref<List>());
             break;
 
           case KName::Types_Hash:
-            value.setValue(std::make_shared<Hashmap>());
+            value.setValue(make_ref<Hashmap>());
             break;
 
           default:
@@ -2152,7 +2425,7 @@ KValue KInterpreter::visit(const VariableDeclarationNode* node) {
     }
 
     // inject the variable
-    frame->variables[name] = value;
+    frame->defineVariable(name, value);
   }
 
   return {};
@@ -2215,7 +2488,7 @@ std::unique_ptr<KFunction> KInterpreter::createFunction(
     parameters.emplace_back(paramName, paramValue);
   }
 
-  auto function = std::make_unique<KFunction>(node->clone());
+  auto function = std::make_unique<KFunction>(share(node));
   function->name = name;
   function->parameters = parameters;
   function->defaultParameters = defaultParameters;
@@ -2272,16 +2545,9 @@ KValue KInterpreter::executeInstanceMethodFunction(
 
   prepareFunctionCall(func, node, defaultParameters, typeHints, functionFrame);
 
-  requireDrop = pushFrame(functionFrame);
+  requireDrop = pushFrame(std::move(functionFrame));
 
-  const auto& decl = func->getBody();
-  for (const auto& stmt : decl) {
-    result = interpret(stmt.get());
-    if (functionFrame->isFlagSet(FrameFlags::Return)) {
-      result = functionFrame->returnValue;
-      break;
-    }
-  }
+  result = executeFunctionBody(*func);
 
   if (!Serializer::assert_typematch(result, returnTypeHint)) {
     throw TypeError(
@@ -2296,7 +2562,7 @@ KValue KInterpreter::executeInstanceMethodFunction(
 
 void KInterpreter::prepareFunctionCall(
     const std::unique_ptr<KFunction>& func, const FunctionCallNode* node,
-    std::unordered_set<k_string>& defaultParameters,
+    const std::unordered_set<k_string>& defaultParameters,
     const std::unordered_map<k_string, KName>& typeHints,
     std::shared_ptr<CallStackFrame>& functionFrame) {
   const auto& params = func->parameters;
@@ -2325,18 +2591,15 @@ void KInterpreter::prepareFunctionCall(
       }
     }
 
-    if (argValue.isLambda()) {
-      ctx->addMappedLambda(param.first, argValue.getLambda()->identifier);
-    } else {
-      functionFrame->variables[param.first] = argValue;
-    }
+    functionFrame->defineVariable(param.first, argValue);
   }
 }
 
 KValue KInterpreter::visit(const FunctionCallNode* node) {
   KValue result;
 
-  auto callableType = getCallable(node->token, node->functionName);
+  auto callableType =
+      getCallable(node->token, node->functionName, node->op);
   auto requireDrop = false;
 
   try {
@@ -2354,8 +2617,8 @@ KValue KInterpreter::visit(const FunctionCallNode* node) {
         break;
 
       case KCallableType::Lambda:
-        result = callLambda(node->token, node->functionName, node->arguments,
-                            requireDrop);
+        result = callLambda(node->token, findLambda(node->functionName),
+                            node->functionName, node->arguments, requireDrop);
         break;
     }
 
@@ -2378,22 +2641,15 @@ KValue KInterpreter::callFunction(const FunctionCallNode* node,
   const auto& func = ctx->getFunctions().at(functionName);
   const auto& typeHints = func->typeHints;
   const auto& returnTypeHint = func->returnTypeHint;
-  auto defaultParameters = func->defaultParameters;
+  const auto& defaultParameters = func->defaultParameters;
   auto functionFrame = createFrame(functionName);
   KValue result;
 
   prepareFunctionCall(func, node, defaultParameters, typeHints, functionFrame);
 
-  requireDrop = pushFrame(functionFrame);
+  requireDrop = pushFrame(std::move(functionFrame));
 
-  const auto& decl = func->getBody();
-  for (const auto& stmt : decl) {
-    result = interpret(stmt.get());
-    if (functionFrame->isFlagSet(FrameFlags::Return)) {
-      result = functionFrame->returnValue;
-      break;
-    }
-  }
+  result = executeFunctionBody(*func);
 
   if (!Serializer::assert_typematch(result, returnTypeHint)) {
     throw TypeError(
@@ -2406,42 +2662,55 @@ KValue KInterpreter::callFunction(const FunctionCallNode* node,
   return result;
 }
 
-KValue KInterpreter::callLambda(
-    const Token& token, const k_string& lambdaName,
-    const std::vector<std::unique_ptr<ASTNode>>& args, bool& requireDrop) {
-  auto lambdaFrame = createFrame(lambdaName);
-  k_string targetLambda = lambdaName;
-  KValue result;
+// The lambda held by the variable `name`, if it holds one.
+k_lambda KInterpreter::findLambda(const k_string& name) {
+  const auto* variable = callStack.top()->findVariable(name);
+  if (!variable || !variable->isLambda()) {
+    return nullptr;
+  }
 
-  if (!ctx->hasLambda(targetLambda)) {
-    if (ctx->hasMappedLambda(targetLambda)) {
-      targetLambda = ctx->getMappedLambda(targetLambda);
-    } else {
-      throw SystemError(token,
-                        "Could not find target lambda `" + targetLambda + "`");
+  return variable->getLambda();
+}
+
+// A lambda sees the variables of the frame it was created in. While that frame
+// is still visible from the caller, the call is scoped through the caller like
+// any other. Once it is not, as when a lambda is returned from the function
+// that made it, the call is scoped through the frame the lambda kept instead.
+std::shared_ptr<CallStackFrame> KInterpreter::createLambdaFrame(
+    const k_string& name, const k_lambda& closure) {
+  auto lambdaFrame = createFrame(name);
+  const auto& scope = closure->scope;
+
+  if (scope && scope->getParent()) {
+    for (auto* frame = lambdaFrame->parent.get(); frame;
+         frame = frame->parent.get()) {
+      if (frame == scope.get()) {
+        return lambdaFrame;
+      }
     }
+
+    lambdaFrame->parent = scope;
   }
 
-  const auto& func = ctx->getLambdas().at(targetLambda);
-  const auto& typeHints = func->typeHints;
-  const auto& returnTypeHint = func->returnTypeHint;
-  auto defaultParameters = func->defaultParameters;
+  return lambdaFrame;
+}
+
+KValue KInterpreter::callLambda(
+    const Token& token, const k_lambda& closure, const k_string& lambdaName,
+    const std::vector<std::unique_ptr<ASTNode>>& args, bool& requireDrop) {
+  // Keep the lambda alive even if the call reassigns the variable holding it.
+  auto lambda = closure->lambda;
+  auto lambdaFrame = createLambdaFrame(lambdaName, closure);
+  KValue result;
 
-  prepareLambdaCall(func, args, defaultParameters, token, targetLambda,
-                    typeHints, lambdaName, lambdaFrame);
+  prepareLambdaCall(*lambda, args, token, lambdaName, lambdaFrame);
 
   lambdaFrame->setFlag(FrameFlags::InLambda);
-  requireDrop = pushFrame(lambdaFrame);
+  requireDrop = pushFrame(std::move(lambdaFrame));
 
-  const auto& decl = func->getBody();
-  for (const auto& stmt : decl) {
-    result = interpret(stmt.get());
-    if (lambdaFrame->isFlagSet(FrameFlags::Return)) {
-      result = lambdaFrame->returnValue;
-      break;
-    }
-  }
+  result = executeFunctionBody(*lambda);
 
+  const auto& returnTypeHint = lambda->returnTypeHint;
   if (!Serializer::assert_typematch(result, returnTypeHint)) {
     throw TypeError(
         token, "Expected type `" +
@@ -2453,38 +2722,21 @@ KValue KInterpreter::callLambda(
   return result;
 }
 
-KValue KInterpreter::callLambda(const Token& token, const k_string& lambdaName,
+KValue KInterpreter::callLambda(const Token& token, const k_lambda& closure,
+                                const k_string& lambdaName,
                                 const std::vector<KValue>& args) {
-  auto lambdaFrame = createFrame(lambdaName);
-  k_string targetLambda = lambdaName;
+  auto lambda = closure->lambda;
+  auto lambdaFrame = createLambdaFrame(lambdaName, closure);
   KValue result;
 
-  if (!ctx->hasLambda(targetLambda)) {
-    if (ctx->hasMappedLambda(targetLambda)) {
-      targetLambda = ctx->getMappedLambda(targetLambda);
-    }
-  }
-
-  const auto& func = ctx->getLambdas().at(targetLambda);
-  auto defaultParameters = func->defaultParameters;
-  const auto& typeHints = func->typeHints;
-  const auto& returnTypeHint = func->returnTypeHint;
-
-  prepareLambdaCall(func, args, defaultParameters, token, targetLambda,
-                    typeHints, lambdaName, lambdaFrame);
+  prepareLambdaCall(*lambda, args, token, lambdaName, lambdaFrame);
 
   lambdaFrame->setFlag(FrameFlags::InLambda);
-  pushFrame(lambdaFrame);
+  pushFrame(std::move(lambdaFrame));
 
-  const auto& decl = func->getBody();
-  for (const auto& stmt : decl) {
-    result = interpret(stmt.get());
-    if (lambdaFrame->isFlagSet(FrameFlags::Return)) {
-      result = lambdaFrame->returnValue;
-      break;
-    }
-  }
+  result = executeFunctionBody(*lambda);
 
+  const auto& returnTypeHint = lambda->returnTypeHint;
   if (!Serializer::assert_typematch(result, returnTypeHint)) {
     throw TypeError(
         token, "Expected type `" +
@@ -2497,13 +2749,11 @@ KValue KInterpreter::callLambda(const Token& token, const k_string& lambdaName,
 }
 
 void KInterpreter::prepareLambdaCall(
-    const std::unique_ptr<KLambda>& func,
-    const std::vector<std::unique_ptr<ASTNode>>& args,
-    std::unordered_set<k_string>& defaultParameters, const Token& token,
-    k_string& targetLambda,
-    const std::unordered_map<k_string, KName>& typeHints,
-    const k_string& lambdaName, std::shared_ptr<CallStackFrame>& lambdaFrame) {
-  const auto& params = func->parameters;
+    const KLambda& func, const std::vector<std::unique_ptr<ASTNode>>& args,
+    const Token& token, const k_string& lambdaName,
+    std::shared_ptr<CallStackFrame>& lambdaFrame) {
+  const auto& params = func.parameters;
+  const auto& defaultParameters = func.defaultParameters;
   for (size_t i = 0; i < params.size(); ++i) {
     const auto& param = params.at(i);
     KValue argValue = {};
@@ -2512,11 +2762,11 @@ void KInterpreter::prepareLambdaCall(
     } else if (defaultParameters.find(param.first) != defaultParameters.end()) {
       argValue = param.second;
     } else {
-      throw ParameterCountMismatchError(token, targetLambda);
+      throw ParameterCountMismatchError(token, lambdaName);
     }
 
-    prepareLambdaVariables(typeHints, param, argValue, token, i, lambdaName,
-                           lambdaFrame);
+    prepareLambdaVariables(func.typeHints, param, argValue, token, i,
+                           lambdaName, lambdaFrame);
   }
 }
 
@@ -2537,21 +2787,14 @@ void KInterpreter::prepareLambdaVariables(
     }
   }
 
-  if (argValue.isLambda()) {
-    auto lambdaId = argValue.getLambda()->identifier;
-    ctx->addMappedLambda(param.first, lambdaId);
-  } else {
-    lambdaFrame->variables[param.first] = argValue;
-  }
+  lambdaFrame->defineVariable(param.first, argValue);
 }
 
 void KInterpreter::prepareLambdaCall(
-    const std::unique_ptr<KLambda>& func, const std::vector<KValue>& args,
-    std::unordered_set<k_string>& defaultParameters, const Token& token,
-    k_string& targetLambda,
-    const std::unordered_map<k_string, KName>& typeHints,
+    const KLambda& func, const std::vector<KValue>& args, const Token& token,
     const k_string& lambdaName, std::shared_ptr<CallStackFrame>& lambdaFrame) {
-  const auto& params = func->parameters;
+  const auto& params = func.parameters;
+  const auto& defaultParameters = func.defaultParameters;
   for (size_t i = 0; i < params.size(); ++i) {
     const auto& param = params.at(i);
     KValue argValue = {};
@@ -2560,41 +2803,29 @@ void KInterpreter::prepareLambdaCall(
     } else if (defaultParameters.find(param.first) != defaultParameters.end()) {
       argValue = param.second;
     } else {
-      throw ParameterCountMismatchError(token, targetLambda);
-    }
-
-    if (typeHints.find(param.first) != typeHints.end()) {
-      auto expectedType = typeHints.at(param.first);
-      if (!Serializer::assert_typematch(argValue, expectedType)) {
-        throw TypeError(
-            token, "Expected type `" +
-                       Serializer::get_typename_string(expectedType) +
-                       "` for parameter " + std::to_string(1 + i) + " of `" +
-                       lambdaName + "` but received `" +
-                       Serializer::get_value_type_string(argValue) + "`.");
-      }
+      throw ParameterCountMismatchError(token, lambdaName);
     }
 
-    if (argValue.isLambda()) {
-      ctx->addMappedLambda(param.first, argValue.getLambda()->identifier);
-    } else {
-      lambdaFrame->variables[param.first] = argValue;
-    }
+    prepareLambdaVariables(func.typeHints, param, argValue, token, i,
+                           lambdaName, lambdaFrame);
   }
 }
 
 KCallableType KInterpreter::getCallable(const Token& token,
-                                        const k_string& name) const {
+                                        const k_string& name,
+                                        const KName& op) {
   if (ctx->hasFunction(name)) {
     return KCallableType::Function;
-  } else if (ctx->hasLambda(name)) {
-    return KCallableType::Lambda;
-  } else if (KiwiBuiltins.is_builtin_method(name)) {
+  } else if (KBuiltinTable::isBuiltinMethod(op)) {
     return KCallableType::Builtin;
+  } else if (findLambda(name)) {
+    return KCallableType::Lambda;
   }
 
-  if (ctx->hasMappedLambda(name)) {
-    return KCallableType::Lambda;
+  // Library functions are only ever called by their qualified names.
+  if (name.find("::") != k_string::npos && loadLibrary(name) &&
+      ctx->hasFunction(name)) {
+    return KCallableType::Function;
   }
 
   auto frame = callStack.top();
@@ -2628,7 +2859,7 @@ KValue KInterpreter::callFunction(
     const std::unique_ptr<KFunction>& function,
     const std::vector<std::unique_ptr<ASTNode>>& args, const Token& token,
     const k_string& functionName) {
-  auto defaultParameters = function->defaultParameters;
+  const auto& defaultParameters = function->defaultParameters;
   auto functionFrame = createFrame(functionName);
 
   const auto& typeHints = function->typeHints;
@@ -2655,9 +2886,9 @@ KValue KInterpreter::callFunction(
                                functionName, functionFrame);
     }
 
-    requireDrop = pushFrame(functionFrame);
+    requireDrop = pushFrame(std::move(functionFrame));
 
-    result = executeFunctionBody(function);
+    result = executeFunctionBody(*function);
     dropFrame();
   } catch (const KiwiError& e) {
     if (requireDrop && inTry()) {
@@ -2677,6 +2908,58 @@ KValue KInterpreter::callFunction(
   return result;
 }
 
+KValue KInterpreter::callFunction(const std::unique_ptr<KFunction>& function,
+                                  const KValue* args, size_t argCount,
+                                  const Token& token,
+                                  const k_string& functionName) {
+  const auto& defaultParameters = function->defaultParameters;
+  auto functionFrame = createFrame(functionName);
+
+  const auto& typeHints = function->typeHints;
+  const auto& returnTypeHint = function->returnTypeHint;
+
+  KValue result;
+  bool requireDrop = false;
+
+  try {
+    for (size_t i = 0; i < function->parameters.size(); ++i) {
+      const auto& param = function->parameters[i];
+      KValue argValue = {};
+      if (i < argCount) {
+        argValue = args[i];
+      } else if (defaultParameters.find(param.first) !=
+                 defaultParameters.end()) {
+        argValue = param.second;
+      } else {
+        throw ParameterCountMismatchError(token, functionName);
+      }
+
+      prepareFunctionVariables(typeHints, param, argValue, token, i,
+                               functionName, functionFrame);
+    }
+
+    requireDrop = pushFrame(std::move(functionFrame));
+
+    result = executeFunctionBody(*function);
+    dropFrame();
+  } catch (const KiwiError& e) {
+    if (requireDrop && inTry()) {
+      dropFrame();
+    }
+    throw;
+  }
+
+  if (!Serializer::assert_typematch(result, returnTypeHint)) {
+    throw TypeError(token, "Expected type `" +
+                               Serializer::get_typename_string(returnTypeHint) +
+                               "` for return type of `" + functionName +
+                               "` but received `" +
+                               Serializer::get_value_type_string(result) + "`.");
+  }
+
+  return result;
+}
+
 void KInterpreter::prepareFunctionVariables(
     const std::unordered_map<k_string, KName>& typeHints,
     const std::pair<k_string, KValue>& param, KValue& argValue,
@@ -2694,19 +2977,24 @@ void KInterpreter::prepareFunctionVariables(
     }
   }
 
-  if (argValue.isLambda()) {
-    auto lambdaId = argValue.getLambda()->identifier;
-    ctx->addMappedLambda(param.first, lambdaId);
-  } else {
-    functionFrame->variables[param.first] = argValue;
-  }
+  functionFrame->defineVariable(param.first, argValue);
 }
 
-KValue KInterpreter::executeFunctionBody(
-    const std::unique_ptr<KFunction>& function) {
+KValue KInterpreter::executeFunctionBody(const KCallable& callable) {
+  TreeScope scope(tree, callable.tree);
+  if (!TREEWALKMODE) {
+    // Lambdas are shared between tasks, which may both get here first.
+    auto chunk = std::atomic_load(&callable.chunk);
+    if (!chunk) {
+      chunk = KCompiler().compileBody(callable.getBody());
+      std::atomic_store(&callable.chunk, chunk);
+    }
+
+    return execute(*chunk);
+  }
+
   KValue result;
-  const auto& decl = function->decl;
-  for (const auto& stmt : decl->body) {
+  for (const auto& stmt : callable.getBody()) {
     result = interpret(stmt.get());
     if (callStack.top()->isFlagSet(FrameFlags::Return)) {
       result = callStack.top()->returnValue;
@@ -2716,17 +3004,633 @@ KValue KInterpreter::executeFunctionBody(
   return result;
 }
 
-KValue KInterpreter::visit(const MethodCallNode* node) {
+#if defined(__GNUC__)
+#define KIWI_VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+KValue KInterpreter::execute(const KChunk& chunk) {
+  ExecScope scope(*this, chunk);
+  auto& registers = scope.state.registers;
+  auto frame = callStack.top();
+  auto& variables = frame->variables;
+  const auto* code = chunk.code.data();
+  const auto* ip = code;
+
+  // Each slot caches the location of one name in `chunk.names`, which may be
+  // in this frame or in one of its callers. Map nodes are stable across
+  // inserts and callers cannot change while this frame runs, so the cache only
+  // goes stale when this frame's variable version moves.
+  auto& slots = scope.state.slots;
+  auto& localSlots = scope.state.localSlots;
+  auto& checkedConstants = scope.state.checkedConstants;
+  auto version = frame->variableVersion;
+
+  auto syncSlots = [&]() {
+    if (version != frame->variableVersion) {
+      std::fill(slots.begin(), slots.end(), nullptr);
+      version = frame->variableVersion;
+    }
+  };
+
+  auto findSlot = [&](int slot) -> KValue* {
+    syncSlots();
+
+    if (!slots[slot]) {
+      const auto& name = chunk.names[slot];
+      auto it = variables.find(name);
+      if (it != variables.end()) {
+        slots[slot] = &it->second;
+        localSlots[slot] = true;
+      } else if (frame->parent) {
+        slots[slot] = frame->parent->findVariable(name);
+        localSlots[slot] = false;
+      }
+    }
+
+    return slots[slot];
+  };
+
+  // Assignment updates the visible variable, or creates one in this frame.
+  auto bindSlot = [&](int slot) -> KValue& {
+    auto* value = findSlot(slot);
+    if (!value) {
+      value = slots[slot] = &frame->addVariable(chunk.names[slot]);
+      localSlots[slot] = true;
+    }
+    return *value;
+  };
+
+  // Declarations always land in this frame.
+  auto defineSlot = [&](int slot) -> KValue& {
+    syncSlots();
+
+    if (!slots[slot] || !localSlots[slot]) {
+      // A new declaration only shadows its own name, so the other slots stay.
+      slots[slot] = &frame->defineVariable(chunk.names[slot], {});
+      localSlots[slot] = true;
+      version = frame->variableVersion;
+    }
+    return *slots[slot];
+  };
+
+  // Constants are never removed, so a name only needs checking again once the
+  // number of constants changes.
+  auto checkConstant = [&](int slot, const Token& token) {
+    auto count = ctx->getConstants().size();
+    if (checkedConstants[slot] != count) {
+      const auto& name = chunk.names[slot];
+      if (ctx->hasConstant(name)) {
+        throw IllegalNameError(token, name);
+      }
+      checkedConstants[slot] = count;
+    }
+  };
+
+#ifdef KIWI_VM_COMPUTED_GOTO
+#define KIWI_VM_LABEL(name) &&op_##name,
+  static const void* dispatchTable[] = {KIWI_OPCODES(KIWI_VM_LABEL)};
+#undef KIWI_VM_LABEL
+#define VM_CASE(name) op_##name
+#define VM_DISPATCH() goto* dispatchTable[static_cast<size_t>(ip->getOp())]
+#else
+#define VM_CASE(name) case KOpCode::name
+#define VM_DISPATCH() goto dispatch
+#endif
+#define VM_NEXT() \
+  ++ip;           \
+  VM_DISPATCH()
+#define VM_JUMP(target) \
+  ip = code + (target); \
+  VM_DISPATCH()
+
+#ifdef KIWI_VM_COMPUTED_GOTO
+  VM_DISPATCH();
+#else
+dispatch:
+  switch (ip->getOp()) {
+#endif
+
+  VM_CASE(Nop) : {
+    VM_NEXT();
+  }
+
+  VM_CASE(LoadConst) : {
+    registers[ip->a] = chunk.constants[ip->b];
+    VM_NEXT();
+  }
+
+  VM_CASE(LoadCopy) : {
+    registers[ip->a] = clone_value(chunk.constants[ip->b]);
+    VM_NEXT();
+  }
+
+  VM_CASE(LoadVar) : {
+    if (ip->b >= 0) {
+      if (const auto* value = findSlot(ip->b)) {
+        registers[ip->a] = *value;
+        VM_NEXT();
+      }
+    }
+
+    registers[ip->a] = visit(static_cast<const IdentifierNode*>(ip->node));
+    VM_NEXT();
+  }
+
+  VM_CASE(Move) : {
+    registers[ip->a] = registers[ip->b];
+    VM_NEXT();
+  }
+
+  // Register `b` keeps a loop-invariant value and `b + 1` the effect count it
+  // was computed at. While it is being computed, `b + 1` holds that count
+  // negated, so a computation that moves the count is not kept.
+  VM_CASE(CacheLoad) : {
+    auto& stamp = registers[ip->b + 1];
+    if (stamp.getInteger() == effects) {
+      registers[ip->a] = registers[ip->b];
+      VM_JUMP(ip->c);
+    }
+
+    stamp.setValue(-effects);
+    VM_NEXT();
+  }
+
+  VM_CASE(CacheStore) : {
+    auto& stamp = registers[ip->b + 1];
+    const auto& value = registers[ip->a];
+    if (stamp.getInteger() == -effects &&
+        (ip->c != 0 || (!value.isList() && !value.isHashmap()))) {
+      registers[ip->b] = value;
+      stamp.setValue(effects);
+    }
+    VM_NEXT();
+  }
+
+  VM_CASE(Eval) : {
+    ++effects;
+    registers[ip->a] = interpret(ip->node);
+    VM_NEXT();
+  }
+
+  VM_CASE(EvalStmt) : {
+    ++effects;
+    registers[ip->a] = interpret(ip->node);
+
+    if (frame->isFlagSet(FrameFlags::Return)) {
+      if (ip->c < 0) {
+        return frame->returnValue;
+      }
+      VM_JUMP(ip->c);
+    }
+
+    if (ip->b >= 0) {
+      if (frame->isFlagSet(FrameFlags::Break)) {
+        frame->clearFlag(FrameFlags::Break);
+        VM_JUMP(chunk.loops[ip->b].breakTarget);
+      }
+
+      if (frame->isFlagSet(FrameFlags::Next)) {
+        frame->clearFlag(FrameFlags::Next);
+        VM_JUMP(chunk.loops[ip->b].nextTarget);
+      }
+    }
+
+    VM_NEXT();
+  }
+
+  VM_CASE(Assign) : {
+    ++effects;
+    registers[ip->a] = assignValue(
+        static_cast<const AssignmentNode*>(ip->node), registers[ip->b]);
+    VM_NEXT();
+  }
+
+  VM_CASE(StoreVar) : {
+    const auto* node = static_cast<const AssignmentNode*>(ip->node);
+    const auto& value = registers[ip->a];
+
+    if (node->op == KName::Ops_Assign) {
+      if (value.isObject()) {
+        registers[ip->a] = assignValue(node, value);
+        VM_NEXT();
+      }
+
+      checkConstant(ip->b, node->token);
+      bindSlot(ip->b) = value;
+      VM_NEXT();
+    }
+
+    checkConstant(ip->b, node->token);
+    auto* target = findSlot(ip->b);
+    if (!target) {
+      registers[ip->a] = assignValue(node, value);
+      VM_NEXT();
+    }
+
+    auto op = MathImpl.get_compound_fast_path(node->op);
+    if (op != KName::Default && target->getType() == value.getType()) {
+      if (target->isInteger()) {
+        *target = MathImpl.do_integer_op(node->token, op, target->getInteger(),
+                                         value.getInteger());
+        registers[ip->a] = *target;
+        VM_NEXT();
+      } else if (target->isFloat()) {
+        *target = MathImpl.do_float_op(node->token, op, target->getFloat(),
+                                       value.getFloat());
+        registers[ip->a] = *target;
+        VM_NEXT();
+      }
+    }
+
+    if (node->op == KName::Ops_BitwiseNotAssign) {
+      *target = MathImpl.do_bitwise_not(node->token, *target);
+    } else {
+      // Adding to a list or hashmap changes it in place.
+      if (target->isList() || target->isHashmap()) {
+        ++effects;
+      }
+      *target = MathImpl.do_binary_op(node->token, node->op, *target, value);
+    }
+
+    registers[ip->a] = *target;
+    VM_NEXT();
+  }
+
+  VM_CASE(Unary) : {
+    const auto* node = static_cast<const UnaryOperationNode*>(ip->node);
+    registers[ip->a] =
+        MathImpl.do_unary_op(node->token, node->op, registers[ip->b]);
+    VM_NEXT();
+  }
+
+  VM_CASE(Binary) : {
+    const auto* node = static_cast<const BinaryOperationNode*>(ip->node);
+    const auto& left = registers[ip->b];
+    const auto& right = registers[ip->c];
+    auto form = KOpCode::BinaryGeneric;
+    if (left.getType() == right.getType()) {
+      if (left.isString() && node->op == KName::Ops_Add) {
+        form = KOpCode::BinaryConcat;
+      } else if ((left.isInteger() || left.isFloat()) &&
+                 MathImpl.has_numeric_fast_path(node->op)) {
+        form = left.isInteger() ? KOpCode::BinaryInteger : KOpCode::BinaryFloat;
+      }
+    }
+    ip->setOp(form);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(BinaryInteger) : {
+    const auto& left = registers[ip->b];
+    const auto& right = registers[ip->c];
+    if (left.isInteger() && right.isInteger()) {
+      const auto* node = static_cast<const BinaryOperationNode*>(ip->node);
+      registers[ip->a] = MathImpl.do_integer_op(
+          node->token, node->op, left.getInteger(), right.getInteger());
+      VM_NEXT();
+    }
+    ip->setOp(KOpCode::BinaryGeneric);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(BinaryFloat) : {
+    const auto& left = registers[ip->b];
+    const auto& right = registers[ip->c];
+    if (left.isFloat() && right.isFloat()) {
+      const auto* node = static_cast<const BinaryOperationNode*>(ip->node);
+      registers[ip->a] = MathImpl.do_float_op(
+          node->token, node->op, left.getFloat(), right.getFloat());
+      VM_NEXT();
+    }
+    ip->setOp(KOpCode::BinaryGeneric);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(BinaryConcat) : {
+    const auto& left = registers[ip->b];
+    const auto& right = registers[ip->c];
+    if (left.isString() && right.isString()) {
+      registers[ip->a] = MathImpl.do_string_concat(left, right);
+      VM_NEXT();
+    }
+    ip->setOp(KOpCode::BinaryGeneric);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(BinaryGeneric) : {
+    const auto* node = static_cast<const BinaryOperationNode*>(ip->node);
+    if (registers[ip->b].isList() || registers[ip->b].isHashmap()) {
+      ++effects;
+    }
+    registers[ip->a] = MathImpl.do_binary_op(
+        node->token, node->op, registers[ip->b], registers[ip->c]);
+    VM_NEXT();
+  }
+
+  VM_CASE(Index) : {
+    registers[ip->a] = getIndexedValue(ip->node->token, registers[ip->b],
+                                       registers[ip->c]);
+    VM_NEXT();
+  }
+
+  VM_CASE(MakeList) : {
+    auto first = registers.begin() + ip->b;
+    std::vector<KValue> elements(first, first + ip->c);
+    registers[ip->a] =
+        KValue::createList(make_ref<List>(std::move(elements)));
+    VM_NEXT();
+  }
+
+  VM_CASE(Print) : {
+    printValue(static_cast<const PrintNode*>(ip->node), registers[ip->a]);
+    registers[ip->b] = {};
+    VM_NEXT();
+  }
+
+  VM_CASE(Jump) : {
+    VM_JUMP(ip->a);
+  }
+
+  VM_CASE(JumpIfFalse) : {
+    if (!MathImpl.is_truthy(registers[ip->a])) {
+      VM_JUMP(ip->b);
+    }
+    VM_NEXT();
+  }
+
+  VM_CASE(JumpIfTrue) : {
+    if (MathImpl.is_truthy(registers[ip->a])) {
+      VM_JUMP(ip->b);
+    }
+    VM_NEXT();
+  }
+
+  VM_CASE(Loop) : {
+    handlePendingSignals(ip->node->token);
+    VM_JUMP(ip->a);
+  }
+
+  VM_CASE(LoopEnter) : {
+    frame->setFlag(FrameFlags::InLoop);
+    registers[ip->a] = KValue::createInteger(0);
+    registers[0] = {};
+    VM_NEXT();
+  }
+
+  VM_CASE(LoopExit) : {
+    frame->clearFlag(FrameFlags::InLoop);
+    VM_NEXT();
+  }
+
+  VM_CASE(SafeCheck) : {
+    if (SAFEMODE) {
+      auto iterations = registers[ip->a].getInteger() + 1;
+      registers[ip->a].setValue(iterations);
+
+      if (iterations == SAFEMODE_MAX_ITERATIONS) {
+        throw InfiniteLoopError(ip->node->token,
+                                "Detected an infinite loop in safemode.");
+      }
+    }
+    VM_NEXT();
+  }
+
+  VM_CASE(IterPrepare) : {
+    const auto& dataSet = registers[ip->a];
+    if (!dataSet.isList() && !dataSet.isHashmap()) {
+      throw InvalidOperationError(ip->node->token,
+                                  "Expected a list value in for-loop.");
+    }
+
+    frame->setFlag(FrameFlags::InLoop);
+    registers[ip->a + 1] = KValue::createInteger(0);
+    registers[0] = {};
+    VM_NEXT();
+  }
+
+  VM_CASE(IterNext) : {
+    const auto& dataSet = registers[ip->a];
+    auto& counter = registers[ip->a + 1];
+    auto index = counter.getInteger();
+
+    if (dataSet.isList()) {
+      const auto& elements = dataSet.getList()->elements;
+      if (static_cast<size_t>(index) >= elements.size()) {
+        VM_JUMP(ip->c);
+      }
+
+      if (ip->b < 0) {
+        // The iterators are kept in the registers after the counter.
+        registers[ip->a + 2] = elements.get(index);
+        registers[ip->a + 3].setValue(index);
+      } else {
+        defineSlot(ip->b) = elements.get(index);
+
+        if (ip->d >= 0) {
+          defineSlot(ip->d) = KValue::createInteger(index);
+        }
+      }
+    } else {
+      // For hashmaps the counter is an entry position, not a key index.
+      const auto& hash = dataSet.getHashmap();
+      auto pos = hash->nextEntry(static_cast<size_t>(index));
+      if (pos >= hash->entryEnd()) {
+        VM_JUMP(ip->c);
+      }
+
+      const auto& entry = hash->entryAt(pos);
+      if (ip->b < 0) {
+        registers[ip->a + 2] = entry.key;
+        registers[ip->a + 3] = entry.value;
+      } else {
+        defineSlot(ip->b) = entry.key;
+
+        if (ip->d >= 0) {
+          defineSlot(ip->d) = entry.value;
+        }
+      }
+      index = static_cast<k_int>(pos);
+    }
+
+    counter.setValue(index + 1);
+    VM_NEXT();
+  }
+
+  VM_CASE(IterEnd) : {
+    const auto* node = static_cast<const ForLoopNode*>(ip->node);
+    frame->eraseVariable(id(node->valueIterator.get()));
+    if (node->indexIterator) {
+      frame->eraseVariable(id(node->indexIterator.get()));
+    }
+
+    frame->clearFlag(FrameFlags::InLoop);
+    VM_NEXT();
+  }
+
+  VM_CASE(RepeatPrepare) : {
+    if (!registers[ip->a].isInteger()) {
+      throw InvalidOperationError(ip->node->token,
+                                  "Repeat loop count must be an integer.");
+    }
+
+    frame->setFlag(FrameFlags::InLoop);
+    registers[ip->a + 1] = KValue::createInteger(0);
+    registers[0] = {};
+    VM_NEXT();
+  }
+
+  VM_CASE(RepeatNext) : {
+    auto counter = registers[ip->a + 1].getInteger() + 1;
+
+    if (counter > registers[ip->a].getInteger()) {
+      VM_JUMP(ip->c);
+    }
+
+    registers[ip->a + 1].setValue(counter);
+
+    if (ip->b >= 0) {
+      defineSlot(ip->b) = KValue::createInteger(counter);
+    }
+    VM_NEXT();
+  }
+
+  VM_CASE(RepeatEnd) : {
+    const auto* node = static_cast<const RepeatLoopNode*>(ip->node);
+    if (node->alias) {
+      frame->eraseVariable(id(node->alias.get()));
+    }
+
+    frame->clearFlag(FrameFlags::InLoop);
+    VM_NEXT();
+  }
+
+  VM_CASE(CallCheck) : {
+    const auto* node = static_cast<const FunctionCallNode*>(ip->node);
+    const auto& name = node->functionName;
+
+    if (ctx->hasFunction(name) || KBuiltinTable::isBuiltinMethod(node->op)) {
+      VM_NEXT();
+    }
+
+    ++effects;
+    registers[ip->a] = interpret(node);
+    VM_JUMP(ip->b);
+  }
+
+  VM_CASE(Call) : {
+    const auto* node = static_cast<const FunctionCallNode*>(ip->node);
+    const auto& name = node->functionName;
+    const auto* args = registers.data() + ip->b;
+    ++effects;
+
+    if (ctx->hasFunction(name)) {
+      registers[ip->a] = callFunction(ctx->getFunctions().at(name), args,
+                                      ip->c, node->token, name);
+    } else {
+      // A computed goto does not run destructors, so the arguments must go
+      // out of scope before the next instruction is dispatched.
+      std::vector<KValue> builtinArgs(args, args + ip->c);
+      registers[ip->a] =
+          callBuiltinMethod(node->token, node->op, builtinArgs);
+    }
+
+    handlePendingSignals(node->token);
+    VM_NEXT();
+  }
+
+  VM_CASE(MethodCheck) : {
+    const auto* node = static_cast<const MethodCallNode*>(ip->node);
+    const auto& object = registers[ip->b];
+
+    if (object.isObject()) {
+      registers[ip->a] = callObjectMethod(node, object.getObject());
+    } else if (object.isStruct()) {
+      registers[ip->a] = callStructMethod(node, object.getStruct());
+    } else {
+      VM_NEXT();
+    }
+
+    handlePendingSignals(node->token);
+    VM_JUMP(ip->c);
+  }
+
+  VM_CASE(MethodCall) : {
+    const auto* node = static_cast<const MethodCallNode*>(ip->node);
+    auto first = registers.begin() + ip->b + 1;
+    auto& object = registers[ip->b];
+
+    auto family = KBuiltinTable::getFamily(node->op);
+    if (family != KBuiltinFamily::List && family != KBuiltinFamily::Kiwi) {
+      throw UnknownBuiltinError(node->token, node->methodName);
+    }
+
+    // `d` is set for a builtin that only reads.
+    if (ip->d <= 0) {
+      ++effects;
+    }
+
+    // Scoped like the arguments of a call.
+    {
+      std::vector<KValue> args(first, first + ip->c);
+      registers[ip->a] =
+          family == KBuiltinFamily::List
+              ? interpretListBuiltin(node->token, object, node->op, args)
+              : BuiltinDispatch::execute(node->token, node->op, object, args);
+    }
+
+    handlePendingSignals(node->token);
+    VM_NEXT();
+  }
+
+  VM_CASE(Return) : {
+    auto value = ip->a < 0 ? KValue{} : registers[ip->a];
+    frame->setFlag(FrameFlags::Return);
+    frame->returnValue = value;
+    registers[0] = value;
+
+    if (ip->b < 0) {
+      return value;
+    }
+    VM_JUMP(ip->b);
+  }
+
+  VM_CASE(Halt) : {
+    return registers[0];
+  }
+
+#ifndef KIWI_VM_COMPUTED_GOTO
+  }
+#endif
+
+#undef VM_JUMP
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+
+  return registers[0];
+}
+
+#ifdef KIWI_VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#undef KIWI_VM_COMPUTED_GOTO
+#endif
+
+KValue KInterpreter::visit(const MethodCallNode* node) {
   auto object = interpret(node->object.get());
 
   if (object.isObject()) {
     return callObjectMethod(node, object.getObject());
   } else if (object.isStruct()) {
     return callStructMethod(node, object.getStruct());
-  } else if (ListBuiltins.is_builtin(node->op)) {
+  }
+
+  auto family = KBuiltinTable::getFamily(node->op);
+  if (family == KBuiltinFamily::List) {
     return interpretListBuiltin(node->token, object, node->op,
                                 getMethodCallArguments(node->arguments));
-  } else if (KiwiBuiltins.is_builtin(node->op)) {
+  } else if (family == KBuiltinFamily::Kiwi) {
     return BuiltinDispatch::execute(node->token, node->op, object,
                                     getMethodCallArguments(node->arguments));
   }
@@ -2747,7 +3651,7 @@ std::vector<KValue> KInterpreter::getMethodCallArguments(
 }
 
 KValue KInterpreter::callObjectBaseMethod(const MethodCallNode* node,
-                                          const std::shared_ptr<Object>& obj,
+                                          const k_object& obj,
                                           const k_string& baseStruct,
                                           const k_string& methodName) {
   const auto& struc = ctx->getStructs().at(baseStruct);
@@ -2791,7 +3695,7 @@ KValue KInterpreter::callObjectBaseMethod(const MethodCallNode* node,
 }
 
 KValue KInterpreter::callObjectMethod(const MethodCallNode* node,
-                                      const std::shared_ptr<Object>& obj) {
+                                      const k_object& obj) {
   const auto& struc = ctx->getStructs().at(obj->structName);
   auto methodName = node->methodName;
 
@@ -2882,7 +3786,7 @@ KValue KInterpreter::executeStructMethod(
     k_string& methodName, std::shared_ptr<CallStackFrame>& frame,
     const MethodCallNode* node, const k_struct& struc) {
   auto& function = methods[methodName];
-  k_object obj = std::make_shared<Object>();
+  k_object obj = make_ref<Object>();
   bool isCtor = methodName == Keywords.New;
 
   auto oldObjectContext = frame->getObjectContext();
@@ -2923,25 +3827,38 @@ KValue KInterpreter::executeStructMethod(
 
 KValue KInterpreter::callBuiltinMethod(const FunctionCallNode* node) {
   auto args = getMethodCallArguments(node->arguments);
-  auto op = node->op;
+  return callBuiltinMethod(node->token, node->op, args);
+}
+
+KValue KInterpreter::callBuiltinMethod(const Token& token, const KName& op,
+                                       std::vector<KValue>& args) {
+  switch (KBuiltinTable::getFamily(op)) {
+    case KBuiltinFamily::Serializer:
+      return interpretSerializerBuiltin(token, op, args);
 
-  if (SerializerBuiltins.is_builtin(op)) {
-    return interpretSerializerBuiltin(node->token, op, args);
-  } else if (ReflectorBuiltins.is_builtin(op)) {
-    return interpretReflectorBuiltin(node->token, op, args);
-  } else if (WebServerBuiltins.is_builtin(op)) {
-    return interpretWebServerBuiltin(node->token, op, args);
-  } else if (SignalBuiltins.is_builtin(op)) {
-    return interpretSignalBuiltin(node->token, op, args);
-  } else if (FFIBuiltins.is_builtin(op)) {
-    return BuiltinDispatch::execute(ffimgr, node->token, op, args);
-  } else if (SocketBuiltins.is_builtin(op)) {
-    return BuiltinDispatch::execute(sockmgr, node->token, op, args);
-  } else if (TaskBuiltins.is_builtin(op)) {
-    return BuiltinDispatch::execute(taskmgr, node->token, op, args);
+    case KBuiltinFamily::Reflector:
+      return interpretReflectorBuiltin(token, op, args);
+
+    case KBuiltinFamily::WebServer:
+      return interpretWebServerBuiltin(token, op, args);
+
+    case KBuiltinFamily::Signal:
+      return interpretSignalBuiltin(token, op, args);
+
+    case KBuiltinFamily::FFI:
+      return BuiltinDispatch::execute(ffimgr, token, op, args);
+
+    case KBuiltinFamily::Socket:
+      return BuiltinDispatch::execute(sockmgr, token, op, args);
+
+    case KBuiltinFamily::Task:
+      return BuiltinDispatch::execute(taskmgr, token, op, args);
+
+    default:
+      break;
   }
 
-  return BuiltinDispatch::execute(node->token, op, args, cliArgs);
+  return BuiltinDispatch::execute(token, op, args, cliArgs);
 }
 
 KValue KInterpreter::interpretWebServerBuiltin(const Token& token,
@@ -2972,28 +3889,21 @@ void KInterpreter::handleWebServerRequest(int webhookID, k_hashmap requestHash,
                                           k_string& contentType, int& status) {
   KValue result;
   bool requireDrop = false;
+  auto depth = callStack.size();
 
   try {
-    auto webhook = ctx->getWebHook(webhookID);
+    auto lambda = ctx->getWebHook(webhookID)->lambda;
     auto webhookFrame = createFrame(Keywords.Spawn);
 
-    auto& lambda = ctx->getLambdas().at(webhook);
-
     for (const auto& param : lambda->parameters) {
-      webhookFrame->variables[param.first] = KValue::createHashmap(requestHash);
+      webhookFrame->defineVariable(param.first,
+                                   KValue::createHashmap(requestHash));
       break;
     }
 
-    requireDrop = pushFrame(webhookFrame);
+    requireDrop = pushFrame(std::move(webhookFrame));
 
-    const auto& decl = lambda->getBody();
-    for (const auto& stmt : decl) {
-      result = interpret(stmt.get());
-      if (webhookFrame->isFlagSet(FrameFlags::Return)) {
-        result = webhookFrame->returnValue;
-        break;
-      }
-    }
+    result = executeFunctionBody(*lambda);
 
     if (result.isHashmap()) {
       const auto& contentKey = KValue::createString("content");
@@ -3034,10 +3944,62 @@ void KInterpreter::handleWebServerRequest(int webhookID, k_hashmap requestHash,
     if (requireDrop && inTry()) {
       dropFrame();
     }
+
+    // The interpreter serves the next request, so it must not keep the
+    // frames of the handler that failed.
+    unwindFrames(depth);
     throw;
   }
 }
 
+// Gives each server thread an interpreter of its own, with its own copy of
+// the context and of the variables visible here, as a spawned task gets. A
+// server with one thread runs the handlers on this interpreter, which waits
+// in `listen` meanwhile, so they share the program's variables.
+void KInterpreter::startWebWorkers(size_t count) {
+  webWorkers.clear();
+  nextWebWorker = 0;
+  static std::atomic<uint64_t> generations{0};
+  webWorkersGeneration = ++generations;
+  if (count < 2) {
+    return;
+  }
+
+  auto visible = callStack.top()->getVisibleVariables();
+  for (size_t i = 0; i < count; ++i) {
+    auto frame = std::make_shared<CallStackFrame>();
+    frame->name = Keywords.Spawn;
+    for (const auto& var : visible) {
+      frame->variables[var.first] = clone_value(var.second);
+    }
+
+    auto worker = std::make_unique<KInterpreter>();
+    worker->setProgramArgs(cliArgs);
+    worker->beginTask(ctx->clone(), frame);
+    webWorkers.push_back(std::move(worker));
+  }
+}
+
+// Returns the interpreter that serves requests on the calling server thread.
+KInterpreter& KInterpreter::webWorker() {
+  if (webWorkers.empty()) {
+    return *this;
+  }
+
+  struct Assigned {
+    uint64_t generation = 0;
+    KInterpreter* worker = nullptr;
+  };
+
+  static thread_local Assigned assigned;
+  if (assigned.generation != webWorkersGeneration) {
+    std::lock_guard<std::mutex> guard(webWorkersLock);
+    assigned.worker = webWorkers[nextWebWorker++ % webWorkers.size()].get();
+    assigned.generation = webWorkersGeneration;
+  }
+  return *assigned.worker;
+}
+
 int KInterpreter::getNextWebServerHook(const Token& token, KValue& arg) {
   if (!arg.isLambda()) {
     throw InvalidOperationError(token,
@@ -3045,19 +4007,15 @@ int KInterpreter::getNextWebServerHook(const Token& token, KValue& arg) {
                                     WebServerBuiltins.Get + "`.");
   }
 
-  auto lambdaName = arg.getLambda()->identifier;
-  if (!ctx->hasLambda(lambdaName)) {
-    if (ctx->hasMappedLambda(lambdaName)) {
-      lambdaName = ctx->getMappedLambda(lambdaName);
-    }
-  }
   int webhookID = 0;
 
   if (!ctx->getWebHooks().empty()) {
     webhookID = static_cast<int>(ctx->getWebHooks().size());
   }
 
-  ctx->addWebHook(webhookID, lambdaName);
+  // Handlers run on the web workers, so they get a copy that does not keep
+  // this interpreter's frame.
+  ctx->addWebHook(webhookID, clone_value(arg).getLambda());
   return webhookID;
 }
 
@@ -3079,8 +4037,8 @@ KValue KInterpreter::interpretWebServerGet(const Token& token,
           k_string content, redirect;
           k_string contentType = "text/plain";
           int status = 500;
-          handleWebServerRequest(webhookID, requestHash, redirect, content,
-                                 contentType, status);
+          webWorker().handleWebServerRequest(webhookID, requestHash, redirect,
+                                             content, contentType, status);
 
           res.status = status;
           res.set_content(content, contentType);
@@ -3108,8 +4066,8 @@ KValue KInterpreter::interpretWebServerPost(const Token& token,
           k_string content, redirect;
           k_string contentType = "text/plain";
           int status = 500;
-          handleWebServerRequest(webhookID, requestHash, redirect, content,
-                                 contentType, status);
+          webWorker().handleWebServerRequest(webhookID, requestHash, redirect,
+                                             content, contentType, status);
 
           if (!redirect.empty()) {
             res.set_redirect(redirect);
@@ -3125,16 +4083,24 @@ KValue KInterpreter::interpretWebServerPost(const Token& token,
 
 KValue KInterpreter::interpretWebServerListen(const Token& token,
                                               std::vector<KValue>& args) {
-  if (args.size() != 2) {
+  if (args.size() != 2 && args.size() != 3) {
     throw BuiltinUnexpectedArgumentError(token, WebServerBuiltins.Listen);
   }
 
   auto host = get_string(token, args.at(0));
   auto port = get_integer(token, args.at(1));
+  auto workers = args.size() == 3 ? get_integer(token, args.at(2)) : 0;
+  if (workers < 1) {
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  }
 
+  startWebWorkers(static_cast<size_t>(workers));
+  ctx->getServer().new_task_queue = [workers]() {
+    return new httplib::ThreadPool(static_cast<size_t>(workers));
+  };
   ctx->getServer().listen(host, static_cast<int>(port));
 
-  auto hash = std::make_shared<Hashmap>();
+  auto hash = make_ref<Hashmap>();
   hash->add(KValue::createString("host"), KValue::createString(host));
   hash->add(KValue::createString("port"), KValue::createInteger(port));
 
@@ -3186,7 +4152,7 @@ std::vector<k_string> KInterpreter::getWebServerEndpointList(const Token& token,
 }
 
 k_hashmap KInterpreter::getWebServerRequestHash(const httplib::Request& req) {
-  auto requestHash = std::make_shared<Hashmap>();
+  auto requestHash = make_ref<Hashmap>();
   auto headers = req.headers;
   auto params = req.params;
 
@@ -3196,20 +4162,20 @@ k_hashmap KInterpreter::getWebServerRequestHash(const httplib::Request& req) {
                      KValue::createString(x.second));
   }
 
-  auto pathParamsHash = std::make_shared<Hashmap>();
+  auto pathParamsHash = make_ref<Hashmap>();
   for (const auto& pair : req.path_params) {
     pathParamsHash->add(KValue::createString(pair.first),
                         KValue::createString(pair.second));
   }
 
-  auto paramsHash = std::make_shared<Hashmap>();
+  auto paramsHash = make_ref<Hashmap>();
   for (auto it = params.begin(); it != params.end(); ++it) {
     const auto& x = *it;
     paramsHash->add(KValue::createString(x.first),
                     KValue::createString(x.second));
   }
 
-  auto filesHash = std::make_shared<Hashmap>();
+  auto filesHash = make_ref<Hashmap>();
 
   const auto& contentKey = KValue::createString("content");
   const auto& contentTypeKey = KValue::createString("content_type");
@@ -3217,7 +4183,7 @@ k_hashmap KInterpreter::getWebServerRequestHash(const httplib::Request& req) {
   const auto& nameKey = KValue::createString("name");
 
   for (const auto& file : req.files) {
-    auto fileHash = std::make_shared<Hashmap>();
+    auto fileHash = make_ref<Hashmap>();
     fileHash->add(contentKey, KValue::createString(file.second.content));
     fileHash->add(contentTypeKey,
                   KValue::createString(file.second.content_type));
@@ -3246,9 +4212,10 @@ KValue KInterpreter::interpolateString(const Token& token,
   Parser parser(true);
   Lexer lexer(token.getFile(), input);
   auto tempStream = lexer.getTokenStream();
-  auto ast = parser.parseTokenStream(tempStream, true);
+  std::shared_ptr<const ASTNode> ast =
+      parser.parseTokenStream(tempStream, true);
 
-  return interpret(ast.get());
+  return interpret(ast);
 }
 
 KValue KInterpreter::interpretReflectorBuiltin(const Token& token,
@@ -3287,7 +4254,7 @@ KValue KInterpreter::interpretReflectorRFFlags(const Token& token,
     }
   }
 
-  std::stack<std::shared_ptr<CallStackFrame>> tempStack(callStack);
+  auto tempStack = callStack;
 
   if (static_cast<size_t>(fromTop) > tempStack.size()) {
     throw InvalidOperationError(
@@ -3354,7 +4321,7 @@ KValue KInterpreter::interpretReflectorRFFlags(const Token& token,
     tempStack.pop();
   }
 
-  return KValue::createList(std::make_shared<List>(list));
+  return KValue::createList(make_ref<List>(list));
 }
 
 KValue KInterpreter::interpretReflectorRRetVal(const Token& token,
@@ -3372,11 +4339,11 @@ KValue KInterpreter::interpretReflectorRList(const Token& token,
     throw BuiltinUnexpectedArgumentError(token, ReflectorBuiltins.RList);
   }
 
-  auto rlist = std::make_shared<Hashmap>();
-  auto rlistPackages = std::make_shared<List>();
-  auto rlistStructs = std::make_shared<List>();
-  auto rlistFunctions = std::make_shared<List>();
-  auto rlistStack = std::make_shared<List>();
+  auto rlist = make_ref<Hashmap>();
+  auto rlistPackages = make_ref<List>();
+  auto rlistStructs = make_ref<List>();
+  auto rlistFunctions = make_ref<List>();
+  auto rlistStack = make_ref<List>();
 
   const auto& variablesKey = KValue::createString("variables");
   const auto& packagesKey = KValue::createString("packages");
@@ -3401,19 +4368,19 @@ KValue KInterpreter::interpretReflectorRList(const Token& token,
     rlistStructs->elements.emplace_back(KValue::createString(c.first));
   }
 
-  std::stack<std::shared_ptr<CallStackFrame>> tempStack(callStack);
+  auto tempStack = callStack;
 
   while (!tempStack.empty()) {
     const auto& outerFrame = tempStack.top();
-    const auto& frameVariables = outerFrame->variables;
+    const auto& frameVariables = outerFrame->getVisibleVariables();
 
-    auto rlistStackFrame = std::make_shared<Hashmap>();
-    auto rlistStackFrameVariables = std::make_shared<List>();
+    auto rlistStackFrame = make_ref<Hashmap>();
+    auto rlistStackFrameVariables = make_ref<List>();
 
     rlistStackFrameVariables->elements.reserve(frameVariables.size());
 
     for (const auto& v : frameVariables) {
-      auto rlistStackFrameVariable = std::make_shared<Hashmap>();
+      auto rlistStackFrameVariable = make_ref<Hashmap>();
       rlistStackFrameVariable->add(KValue::createString(v.first), v.second);
       rlistStackFrameVariables->elements.emplace_back(
           KValue::createHashmap(rlistStackFrameVariable));
@@ -3431,7 +4398,8 @@ KValue KInterpreter::interpretReflectorRList(const Token& token,
   sort_list(*rlistPackages);
   sort_list(*rlistStructs);
   sort_list(*rlistFunctions);
-  std::reverse(rlistStack->elements.begin(), rlistStack->elements.end());
+  auto& stackFrames = rlistStack->elements.mutate();
+  std::reverse(stackFrames.begin(), stackFrames.end());
 
   rlist->add(packagesKey, KValue::createList(rlistPackages));
   rlist->add(structsKey, KValue::createList(rlistStructs));
@@ -3463,7 +4431,7 @@ KValue KInterpreter::interpretReflectorRStack(const Token& token,
     throw BuiltinUnexpectedArgumentError(token, ReflectorBuiltins.RStack);
   }
 
-  std::stack<k_string> tempStack(funcStack);
+  auto tempStack = getFuncStack();
   std::vector<KValue> stackNames;
   stackNames.reserve(tempStack.size());
 
@@ -3472,7 +4440,7 @@ KValue KInterpreter::interpretReflectorRStack(const Token& token,
     tempStack.pop();
   }
 
-  return KValue::createList(std::make_shared<List>(stackNames));
+  return KValue::createList(make_ref<List>(stackNames));
 }
 
 KValue KInterpreter::interpretSerializerDeserialize(const Token& token,
@@ -3539,7 +4507,7 @@ void KInterpreter::handlePendingSignals(const Token& token) {
   }
 
   int signum = last_received_signal.load(std::memory_order_relaxed);
-  k_string lambda;
+  k_lambda lambda;
 
   {
     std::lock_guard<std::mutex> lock(signal_mutex);
@@ -3554,10 +4522,10 @@ void KInterpreter::handlePendingSignals(const Token& token) {
 
   signal_pending.store(false, std::memory_order_relaxed);
 
-  if (!lambda.empty()) {
+  if (lambda) {
     // Call the lambda
     std::vector<KValue> args;
-    this->callLambda(token, lambda, args);
+    this->callLambda(token, lambda, TypeNames.LowLambda, args);
   }
 }
 
@@ -3575,16 +4543,11 @@ KValue KInterpreter::interpretSignalTrap(const Token& token,
         "Expected a lambda for parameter 2 of `" + SignalBuiltins.Trap + "`.");
   }
 
-  auto lambdaRef = args.at(1).getLambda();
-
-  if (!ctx->hasLambda(lambdaRef->identifier)) {
-    throw InvalidOperationError(
-        token, "Unrecognized lambda '" + lambdaRef->identifier + "'.");
-  }
-
   {
+    // Whichever interpreter notices the signal runs the handler, so it gets a
+    // copy that does not keep this interpreter's frame.
     std::lock_guard<std::mutex> lock(signal_mutex);
-    k_signal_handlers[signum] = lambdaRef->identifier;
+    k_signal_handlers[signum] = clone_value(args.at(1)).getLambda();
   }
 
   struct sigaction sa;
@@ -3663,6 +4626,10 @@ KValue KInterpreter::interpretListBuiltin(const Token& token, KValue& object,
       break;
   }
 
+  if (ListBuiltins.is_parallel(op)) {
+    return listParallel(token, op, list, args);
+  }
+
   if (args.size() == 1) {
     auto arg = args.at(0);
     if (!arg.isLambda()) {
@@ -3670,14 +4637,9 @@ KValue KInterpreter::interpretListBuiltin(const Token& token, KValue& object,
           token, "Expected a lambda in specialized list builtin.");
     }
 
-    const auto& lambdaRef = arg.getLambda();
-
-    if (!ctx->hasLambda(lambdaRef->identifier)) {
-      throw InvalidOperationError(
-          token, "Unrecognized lambda '" + lambdaRef->identifier + "'.");
-    }
-
-    auto& lambda = ctx->getLambdas().at(lambdaRef->identifier);
+    // Keep the lambda alive even if the body reassigns the variable holding it.
+    auto lambdaRef = arg.getLambda()->lambda;
+    const auto& lambda = *lambdaRef;
     const auto isReturnSet = callStack.top()->isFlagSet(FrameFlags::Return);
     KValue result;
 
@@ -3708,7 +4670,7 @@ KValue KInterpreter::interpretListBuiltin(const Token& token, KValue& object,
 
     auto frame = callStack.top();
     if (!isReturnSet && frame->isFlagSet(FrameFlags::Return)) {
-      if (!same_value(frame->returnValue.getValue(), result.getValue())) {
+      if (!same_value(frame->returnValue, result)) {
         frame->returnValue = result;
       }
     }
@@ -3721,16 +4683,9 @@ KValue KInterpreter::interpretListBuiltin(const Token& token, KValue& object,
       throw InvalidOperationError(
           token, "Expected a lambda in specialized list builtin.");
     }
-    auto lambdaRef = arg.getLambda();
-
-    if (!ctx->hasLambda(lambdaRef->identifier)) {
-      throw InvalidOperationError(
-          token, "Unrecognized lambda '" + lambdaRef->identifier + "'.");
-    }
+    auto lambda = arg.getLambda()->lambda;
 
-    auto& lambda = ctx->getLambdas().at(lambdaRef->identifier);
-
-    return lambdaReduce(lambda, args.at(0), list);
+    return lambdaReduce(*lambda, args.at(0), list);
   }
 
   throw InvalidOperationError(token,
@@ -3762,41 +4717,231 @@ KValue KInterpreter::listSort(const k_list& list) {
   return KValue::createList(list);
 }
 
-KValue KInterpreter::lambdaEach(std::unique_ptr<KLambda>& lambda,
-                                const k_list& list) {
-  auto defaultParameters = lambda->defaultParameters;
+// Runs a lambda over a list in chunks on pool workers. Each worker gets its
+// own copy of the context and of the caller's variables, as a spawned task
+// does, and takes chunks until there are none left. The elements are not
+// copied, so the lambda sees the same values the sequential builtin would.
+KValue KInterpreter::listParallel(const Token& token, const KName& op,
+                                  const k_list& list,
+                                  const std::vector<KValue>& args) {
+  const auto isReduce = op == KName::Builtin_List_ParallelReduce;
+  const size_t lambdaIndex = isReduce ? 1 : 0;
+
+  if (args.size() != lambdaIndex + 1 && args.size() != lambdaIndex + 2) {
+    throw InvalidOperationError(
+        token, "Invalid specialized list builtin invocation.");
+  }
+
+  const auto& arg = args.at(lambdaIndex);
+  if (!arg.isLambda()) {
+    throw InvalidOperationError(
+        token, "Expected a lambda in specialized list builtin.");
+  }
+
+  auto lambdaRef = arg.getLambda()->lambda;
+  const auto& lambda = *lambdaRef;
+
+  const auto size = list->elements.size();
+  const auto workers = KTaskPool::instance().size();
+  size_t chunkSize = size;
+
+  if (args.size() == lambdaIndex + 2) {
+    auto requested = get_integer(token, args.at(lambdaIndex + 1));
+    if (requested < 1) {
+      throw InvalidOperationError(token,
+                                  "Chunk size must be a positive integer.");
+    }
+    chunkSize = static_cast<size_t>(requested);
+  } else if (workers > 1) {
+    // A few chunks per worker evens out chunks that take longer than others.
+    chunkSize = std::max(MIN_PARALLEL_CHUNK,
+                         (size + workers * 4 - 1) / (workers * 4));
+  }
+
+  if (size <= chunkSize) {
+    switch (op) {
+      case KName::Builtin_List_ParallelEach:
+        lambdaEach(lambda, list);
+        return {};
+
+      case KName::Builtin_List_ParallelMap:
+        return lambdaMap(lambda, list);
+
+      case KName::Builtin_List_ParallelReduce:
+        return lambdaReduce(lambda, args.at(0), list);
+
+      default:
+        return lambdaSelect(lambda, list);
+    }
+  }
+
+  auto results = runChunks(op, list, lambdaRef, chunkSize);
+
+  switch (op) {
+    case KName::Builtin_List_ParallelEach:
+      return {};
+
+    case KName::Builtin_List_ParallelReduce:
+      return lambdaReduce(lambda, args.at(0), make_ref<List>(results));
+
+    default:
+      break;
+  }
+
+  std::vector<KValue> merged;
+  for (const auto& result : results) {
+    const auto& elements = result.getList()->elements;
+    merged.insert(merged.end(), elements.begin(), elements.end());
+  }
+
+  return KValue::createList(make_ref<List>(merged));
+}
+
+// Returns the result of each chunk, in order. The first error a worker
+// throws is thrown here once every worker has stopped.
+std::vector<KValue> KInterpreter::runChunks(
+    const KName& op, const k_list& list, std::shared_ptr<const KLambda> lambda,
+    size_t chunkSize) {
+  struct Run {
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<bool> failed{false};
+    std::vector<KValue> results;
+    std::exception_ptr error;
+    std::mutex lock;
+    std::condition_variable done;
+    size_t running = 0;
+  };
+
+  auto& pool = KTaskPool::instance();
+  const auto size = list->elements.size();
+  const auto chunks = (size + chunkSize - 1) / chunkSize;
+  const auto workers = std::min(chunks, pool.size());
+  auto frame = callStack.top();
+
+  auto run = std::make_shared<Run>();
+  run->results.resize(chunks);
+  run->running = workers;
+
+  for (size_t i = 0; i < workers; ++i) {
+    pool.submit([this, run, frame, op, list, lambda, chunkSize, chunks,
+                 size]() {
+      auto& worker = poolWorker();
+
+      try {
+        auto workerFrame = std::make_shared<CallStackFrame>();
+        for (const auto& var : frame->getVisibleVariables()) {
+          workerFrame->variables[var.first] = clone_value(var.second);
+        }
+
+        worker.beginTask(ctx->clone(), workerFrame);
+
+        for (;;) {
+          auto chunk = run->nextChunk.fetch_add(1);
+          if (chunk >= chunks || run->failed) {
+            break;
+          }
+
+          auto start = chunk * chunkSize;
+          auto stop = std::min(size, start + chunkSize);
+          run->results[chunk] =
+              worker.runChunk(op, *lambda, list, start, stop);
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(run->lock);
+        if (!run->error) {
+          run->error = std::current_exception();
+        }
+        run->failed = true;
+      }
+
+      worker.endTask();
+
+      {
+        std::lock_guard<std::mutex> guard(run->lock);
+        --run->running;
+      }
+      run->done.notify_all();
+    });
+  }
+
+  pool.block([&run]() {
+    std::unique_lock<std::mutex> guard(run->lock);
+    run->done.wait(guard, [&run]() { return run->running == 0; });
+  });
+
+  if (run->error) {
+    std::rethrow_exception(run->error);
+  }
+
+  return std::move(run->results);
+}
+
+// Runs a parallel list builtin over the elements in [start, stop) on a pool
+// worker. A reduction starts from the first element of the chunk, so the
+// lambda has to be associative.
+KValue KInterpreter::runChunk(const KName& op, const KLambda& lambda,
+                              const k_list& list, size_t start, size_t stop) {
+  std::vector<KValue> values;
+  values.reserve(stop - start);
+  for (auto i = start; i < stop; ++i) {
+    values.push_back(list->elements.get(i));
+  }
+
+  switch (op) {
+    case KName::Builtin_List_ParallelEach:
+      lambdaEach(lambda, make_ref<List>(values), start);
+      return {};
+
+    case KName::Builtin_List_ParallelMap:
+      return lambdaMap(lambda, make_ref<List>(values));
+
+    case KName::Builtin_List_ParallelReduce: {
+      auto accumulator = clone_value(values.front());
+      values.erase(values.begin());
+      return lambdaReduce(lambda, accumulator, make_ref<List>(values));
+    }
+
+    default:
+      return lambdaSelect(lambda, make_ref<List>(values), start);
+  }
+}
+
+KValue KInterpreter::lambdaEach(const KLambda& lambda, const k_list& list,
+                                size_t offset) {
+  auto defaultParameters = lambda.defaultParameters;
   auto frame = callStack.top();
 
   k_string valueVariable;
   k_string indexVariable;
   bool hasIndexVariable = false;
 
-  if (lambda->parameters.empty()) {
+  if (lambda.parameters.empty()) {
     return {};
   }
 
-  for (size_t i = 0; i < lambda->parameters.size(); ++i) {
-    const auto& param = lambda->parameters[i];
+  for (size_t i = 0; i < lambda.parameters.size(); ++i) {
+    const auto& param = lambda.parameters[i];
     if (i == 0) {
       valueVariable = param.first;
-      frame->variables[valueVariable] = {};
+      frame->defineVariable(valueVariable, {});
     } else if (i == 1) {
       indexVariable = param.first;
       hasIndexVariable = true;
-      frame->variables[indexVariable] = {};
+      frame->defineVariable(indexVariable, {});
     }
   }
 
   KValue result, indexValue;
-  const auto& decl = lambda->decl;
+  const auto* decl = lambda.decl;
+  TreeScope scope(tree, lambda.tree);
   const auto& elements = list->elements;
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    frame->variables[valueVariable] = elements.at(i);
+    frame->defineVariable(valueVariable, elements.at(i));
 
     if (hasIndexVariable) {
-      indexValue.setValue(static_cast<k_int>(i));
-      frame->variables[indexVariable] = indexValue;
+      indexValue.setValue(static_cast<k_int>(offset + i));
+      frame->defineVariable(indexVariable, indexValue);
     }
 
     for (const auto& stmt : decl->body) {
@@ -3804,16 +4949,15 @@ KValue KInterpreter::lambdaEach(std::unique_ptr<KLambda>& lambda,
     }
   }
 
-  frame->variables.erase(valueVariable);
+  frame->eraseVariable(valueVariable);
   if (hasIndexVariable) {
-    frame->variables.erase(indexVariable);
+    frame->eraseVariable(indexVariable);
   }
 
   return result;
 }
 
-KValue KInterpreter::lambdaNone(std::unique_ptr<KLambda>& lambda,
-                                const k_list& list) {
+KValue KInterpreter::lambdaNone(const KLambda& lambda, const k_list& list) {
   auto selected = lambdaSelect(lambda, list);
   auto noneFound = KValue::createBoolean(false);
 
@@ -3825,32 +4969,32 @@ KValue KInterpreter::lambdaNone(std::unique_ptr<KLambda>& lambda,
   return noneFound;
 }
 
-KValue KInterpreter::lambdaMap(std::unique_ptr<KLambda>& lambda,
-                               const k_list& list) {
-  auto defaultParameters = lambda->defaultParameters;
+KValue KInterpreter::lambdaMap(const KLambda& lambda, const k_list& list) {
+  auto defaultParameters = lambda.defaultParameters;
   auto frame = callStack.top();
 
   k_string mapVariable;
 
-  if (lambda->parameters.empty()) {
+  if (lambda.parameters.empty()) {
     return KValue::createList(list);
   }
 
-  for (size_t i = 0; i < lambda->parameters.size(); ++i) {
-    const auto& param = lambda->parameters[i];
+  for (size_t i = 0; i < lambda.parameters.size(); ++i) {
+    const auto& param = lambda.parameters[i];
     if (i == 0) {
       mapVariable = param.first;
-      frame->variables[mapVariable] = {};
+      frame->defineVariable(mapVariable, {});
     }
   }
 
-  const auto& decl = lambda->decl;
+  const auto* decl = lambda.decl;
+  TreeScope scope(tree, lambda.tree);
   const auto& elements = list->elements;
   std::vector<KValue> resultList;
   KValue result = {};
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    frame->variables[mapVariable] = elements.at(i);
+    frame->defineVariable(mapVariable, elements.at(i));
 
     for (const auto& stmt : decl->body) {
       result = interpret(stmt.get());
@@ -3861,40 +5005,41 @@ KValue KInterpreter::lambdaMap(std::unique_ptr<KLambda>& lambda,
     }
   }
 
-  frame->variables.erase(mapVariable);
+  frame->eraseVariable(mapVariable);
 
-  return KValue::createList(std::make_shared<List>(resultList));
+  return KValue::createList(make_ref<List>(resultList));
 }
 
-KValue KInterpreter::lambdaReduce(std::unique_ptr<KLambda>& lambda,
-                                  KValue accumulator, const k_list& list) {
-  auto defaultParameters = lambda->defaultParameters;
+KValue KInterpreter::lambdaReduce(const KLambda& lambda, KValue accumulator,
+                                  const k_list& list) {
+  auto defaultParameters = lambda.defaultParameters;
   auto frame = callStack.top();
 
   k_string accumVariable;
   k_string valueVariable;
 
-  if (lambda->parameters.size() != 2) {
+  if (lambda.parameters.size() != 2) {
     return accumulator;
   }
 
-  for (size_t i = 0; i < lambda->parameters.size(); ++i) {
-    const auto& param = lambda->parameters[i];
+  for (size_t i = 0; i < lambda.parameters.size(); ++i) {
+    const auto& param = lambda.parameters[i];
     if (i == 0) {
       accumVariable = param.first;
-      frame->variables[accumVariable] = accumulator;
+      frame->defineVariable(accumVariable, accumulator);
     } else if (i == 1) {
       valueVariable = param.first;
-      frame->variables[valueVariable] = {};
+      frame->defineVariable(valueVariable, {});
     }
   }
 
   const auto& elements = list->elements;
-  const auto& decl = lambda->decl;
+  const auto* decl = lambda.decl;
+  TreeScope scope(tree, lambda.tree);
   KValue result;
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    frame->variables[valueVariable] = elements.at(i);
+    frame->defineVariable(valueVariable, elements.at(i));
 
     for (const auto& stmt : decl->body) {
       result = interpret(stmt.get());
@@ -3903,15 +5048,14 @@ KValue KInterpreter::lambdaReduce(std::unique_ptr<KLambda>& lambda,
 
   result = frame->variables[accumVariable];
 
-  frame->variables.erase(accumVariable);
-  frame->variables.erase(valueVariable);
+  frame->eraseVariable(accumVariable);
+  frame->eraseVariable(valueVariable);
 
   return result;
 }
 
-KValue KInterpreter::lambdaAll(std::unique_ptr<KLambda>& lambda,
-                               const k_list& list) {
-  auto defaultParameters = lambda->defaultParameters;
+KValue KInterpreter::lambdaAll(const KLambda& lambda, const k_list& list) {
+  auto defaultParameters = lambda.defaultParameters;
   auto frame = callStack.top();
 
   k_string valueVariable;
@@ -3921,28 +5065,29 @@ KValue KInterpreter::lambdaAll(std::unique_ptr<KLambda>& lambda,
   const auto& listSize = list->elements.size();
   size_t newListSize = 0;
 
-  for (size_t i = 0; i < lambda->parameters.size(); ++i) {
-    const auto& param = lambda->parameters[i];
+  for (size_t i = 0; i < lambda.parameters.size(); ++i) {
+    const auto& param = lambda.parameters[i];
     if (i == 0) {
       valueVariable = param.first;
-      frame->variables[valueVariable] = {};
+      frame->defineVariable(valueVariable, {});
     } else if (i == 1) {
       indexVariable = param.first;
       hasIndexVariable = true;
-      frame->variables[indexVariable] = {};
+      frame->defineVariable(indexVariable, {});
     }
   }
 
   KValue result, indexValue;
-  const auto& decl = lambda->decl;
+  const auto* decl = lambda.decl;
+  TreeScope scope(tree, lambda.tree);
   const auto& elements = list->elements;
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    frame->variables[valueVariable] = elements.at(i);
+    frame->defineVariable(valueVariable, elements.at(i));
 
     if (hasIndexVariable) {
       indexValue.setValue(static_cast<k_int>(i));
-      frame->variables[indexVariable] = indexValue;
+      frame->defineVariable(indexVariable, indexValue);
     }
 
     for (const auto& stmt : decl->body) {
@@ -3954,46 +5099,47 @@ KValue KInterpreter::lambdaAll(std::unique_ptr<KLambda>& lambda,
     }
   }
 
-  frame->variables.erase(valueVariable);
+  frame->eraseVariable(valueVariable);
   if (hasIndexVariable) {
-    frame->variables.erase(indexVariable);
+    frame->eraseVariable(indexVariable);
   }
 
   return KValue::createBoolean(newListSize == listSize);
 }
 
-KValue KInterpreter::lambdaSelect(std::unique_ptr<KLambda>& lambda,
-                                  const k_list& list) {
-  auto defaultParameters = lambda->defaultParameters;
+KValue KInterpreter::lambdaSelect(const KLambda& lambda, const k_list& list,
+                                  size_t offset) {
+  auto defaultParameters = lambda.defaultParameters;
   auto frame = callStack.top();
 
   k_string valueVariable;
   k_string indexVariable;
   bool hasIndexVariable = false;
 
-  for (size_t i = 0; i < lambda->parameters.size(); ++i) {
-    const auto& param = lambda->parameters[i];
+  for (size_t i = 0; i < lambda.parameters.size(); ++i) {
+    const auto& param = lambda.parameters[i];
     if (i == 0) {
       valueVariable = param.first;
-      frame->variables[valueVariable] = {};
+      frame->defineVariable(valueVariable, {});
     } else if (i == 1) {
       indexVariable = param.first;
       hasIndexVariable = true;
-      frame->variables[indexVariable] = {};
+      frame->defineVariable(indexVariable, {});
     }
   }
 
   KValue result, indexValue;
-  const auto& decl = lambda->decl;
+  const auto* decl = lambda.decl;
+  TreeScope scope(tree, lambda.tree);
   const auto& elements = list->elements;
   std::vector<KValue> resultList;
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    frame->variables[valueVariable] = elements.at(i);
+    frame->defineVariable(valueVariable, elements.at(i));
 
     if (hasIndexVariable) {
-      indexValue.setValue(static_cast<k_int>(i));
-      frame->variables[indexVariable] = indexValue;
+      indexValue.setValue(static_cast<k_int>(offset + i));
+      frame->defineVariable(indexVariable, indexValue);
     }
 
     for (const auto& stmt : decl->body) {
@@ -4005,32 +5151,12 @@ KValue KInterpreter::lambdaSelect(std::unique_ptr<KLambda>& lambda,
     }
   }
 
-  frame->variables.erase(valueVariable);
+  frame->eraseVariable(valueVariable);
   if (hasIndexVariable) {
-    frame->variables.erase(indexVariable);
+    frame->eraseVariable(indexVariable);
   }
 
-  return KValue::createList(std::make_shared<List>(resultList));
-}
-
-bool KInterpreter::shouldUpdateFrameVariables(
-    const k_string& varName, const std::shared_ptr<CallStackFrame> nextFrame) {
-  return nextFrame->hasVariable(varName);
-}
-
-void KInterpreter::updateVariablesInCallerFrame(
-    const std::unordered_map<k_string, KValue>& variables,
-    std::shared_ptr<CallStackFrame> callerFrame) {
-  auto& frameVariables = callerFrame->variables;
-  for (const auto& var : variables) {
-    if (shouldUpdateFrameVariables(var.first, callerFrame)) {
-      frameVariables[var.first] = var.second;
-    }
-  }
-}
-
-k_string KInterpreter::getTemporaryId() {
-  return "temporary_" + RNG::getInstance().random16();
+  return KValue::createList(make_ref<List>(resultList));
 }
 
 void KInterpreter::updateListSlice(const Token& token, bool insertOp,
@@ -4053,7 +5179,7 @@ void KInterpreter::updateListSlice(const Token& token, bool insertOp,
     stop = start;
   }
 
-  auto& elements = targetList->elements;
+  auto& elements = targetList->mutableElements();
   auto& rhsElements = rhsValues->elements;
 
   // Convert negative indices and adjust ranges
@@ -4092,7 +5218,7 @@ void KInterpreter::updateListSlice(const Token& token, bool insertOp,
 
 KValue KInterpreter::stringSlice(const Token& token, SliceIndex& slice,
                                  const k_string& string) {
-  auto list = std::make_shared<List>();
+  auto list = make_ref<List>();
 
   auto& elements = list->elements;
   elements.reserve(string.size());
@@ -4150,7 +5276,7 @@ KValue KInterpreter::listSlice(const Token& token, const SliceIndex& slice,
     stop = -1;
   }
 
-  auto slicedList = std::make_shared<List>();
+  auto slicedList = make_ref<List>();
   auto& slicedElements = slicedList->elements;
 
   if (step < 0) {
@@ -4160,7 +5286,7 @@ KValue KInterpreter::listSlice(const Token& token, const SliceIndex& slice,
         break;
       }
 
-      slicedElements.emplace_back(elements.at(i));
+      slicedElements.emplace_back(elements.get(i));
     }
   } else {
     for (int i = start; i < stop; i += step) {
@@ -4169,7 +5295,7 @@ KValue KInterpreter::listSlice(const Token& token, const SliceIndex& slice,
         break;
       }
 
-      slicedElements.emplace_back(elements.at(i));
+      slicedElements.emplace_back(elements.get(i));
     }
   }
   return KValue::createList(slicedList);
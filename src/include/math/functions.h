@@ -20,6 +20,17 @@ static k_string get_string(
   return arg.getString();
 }
 
+// Like `get_string`, but borrows the characters instead of copying them. The
+// view is valid for as long as `arg` is.
+static std::string_view get_string_view(
+    const Token& token, const KValue& arg,
+    const k_string& message = "Expected a string value.") {
+  if (!arg.isString()) {
+    throw ConversionError(token, message);
+  }
+  return arg.getStringView();
+}
+
 static k_int get_integer(
     const Token& token, const KValue& arg,
     const k_string& message = "Expected an integer value.") {
@@ -88,7 +99,7 @@ struct {
       throw SyntaxError(token, "Cannot multiply an empty list.");
     }
 
-    auto newList = std::make_shared<List>();
+    auto newList = make_ref<List>();
     auto& elements = newList->elements;
     elements.reserve(list->elements.size() * multiplier);
 
@@ -102,7 +113,7 @@ struct {
   }
 
   k_string do_string_multiplication(const KValue& left, const KValue& right) {
-    auto string = left.getString();
+    auto string = left.getStringView();
     auto multiplier = right.getInteger();
 
     if (multiplier <= 0) {
@@ -131,7 +142,7 @@ struct {
         return value.getBoolean();
 
       case KValueType::_STRING:
-        return !value.getString().empty();
+        return !value.getStringView().empty();
 
       case KValueType::_LIST:
         return !value.getList()->elements.empty();
@@ -154,11 +165,121 @@ struct {
   }
 
   bool do_eq_comparison(const KValue& left, const KValue& right) {
-    return same_value(left.getValue(), right.getValue());
+    return same_value(left, right);
+  }
+
+  KValue do_string_concat(const KValue& left, const KValue& right) {
+    auto lhs = left.getStringView();
+    auto rhs = right.getStringView();
+    k_string result;
+    result.reserve(lhs.size() + rhs.size());
+    result.append(lhs).append(rhs);
+    return KValue::createString(result);
+  }
+
+  // Operators that `do_integer_op` and `do_float_op` handle. They give the
+  // same results as `do_binary_op` when both operands have that type.
+  bool has_numeric_fast_path(const KName& op) {
+    switch (op) {
+      case KName::Ops_Add:
+      case KName::Ops_Subtract:
+      case KName::Ops_Multiply:
+      case KName::Ops_Divide:
+      case KName::Ops_Modulus:
+      case KName::Ops_LessThan:
+      case KName::Ops_LessThanOrEqual:
+      case KName::Ops_GreaterThan:
+      case KName::Ops_GreaterThanOrEqual:
+      case KName::Ops_Equal:
+      case KName::Ops_NotEqual:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // The operator that a compound assignment applies, if `do_integer_op` and
+  // `do_float_op` handle it, or `KName::Default`.
+  KName get_compound_fast_path(const KName& op) {
+    switch (op) {
+      case KName::Ops_AddAssign:
+        return KName::Ops_Add;
+      case KName::Ops_SubtractAssign:
+        return KName::Ops_Subtract;
+      case KName::Ops_MultiplyAssign:
+        return KName::Ops_Multiply;
+      case KName::Ops_DivideAssign:
+        return KName::Ops_Divide;
+      case KName::Ops_ModuloAssign:
+        return KName::Ops_Modulus;
+      default:
+        return KName::Default;
+    }
+  }
+
+  KValue do_integer_op(const Token& token, const KName& op, k_int lhs,
+                       k_int rhs) {
+    switch (op) {
+      case KName::Ops_Add:
+        return KValue::createInteger(lhs + rhs);
+      case KName::Ops_Subtract:
+        return KValue::createInteger(lhs - rhs);
+      case KName::Ops_Multiply:
+        return KValue::createInteger(lhs * rhs);
+      case KName::Ops_Divide:
+        return KValue::createInteger(lhs / nonzero(token, rhs));
+      case KName::Ops_Modulus:
+        return KValue::createInteger(lhs % nonzero(token, rhs));
+      case KName::Ops_LessThan:
+        return KValue::createBoolean(lhs < rhs);
+      case KName::Ops_LessThanOrEqual:
+        return KValue::createBoolean(lhs <= rhs);
+      case KName::Ops_GreaterThan:
+        return KValue::createBoolean(lhs > rhs);
+      case KName::Ops_GreaterThanOrEqual:
+        return KValue::createBoolean(lhs >= rhs);
+      case KName::Ops_Equal:
+        return KValue::createBoolean(lhs == rhs);
+      case KName::Ops_NotEqual:
+        return KValue::createBoolean(lhs != rhs);
+      default:
+        throw InvalidOperationError(token, "Unknown binary operation.");
+    }
   }
 
-  k_value get_addition_result(const Token& token, const KValue& left,
-                              const KValue& right, KValueType& type) {
+  KValue do_float_op(const Token& token, const KName& op, double lhs,
+                     double rhs) {
+    switch (op) {
+      case KName::Ops_Add:
+        return KValue::createFloat(lhs + rhs);
+      case KName::Ops_Subtract:
+        return KValue::createFloat(lhs - rhs);
+      case KName::Ops_Multiply:
+        return KValue::createFloat(lhs * rhs);
+      case KName::Ops_Divide:
+        return KValue::createFloat(lhs / nonzero(token, rhs));
+      case KName::Ops_Modulus:
+        return KValue::createFloat(fmod(lhs, nonzero(token, rhs)));
+      case KName::Ops_LessThan:
+        return KValue::createBoolean(lhs < rhs);
+      case KName::Ops_LessThanOrEqual:
+        return KValue::createBoolean(lhs <= rhs);
+      case KName::Ops_GreaterThan:
+        return KValue::createBoolean(lhs > rhs);
+      case KName::Ops_GreaterThanOrEqual:
+        return KValue::createBoolean(lhs >= rhs);
+      case KName::Ops_Equal:
+        return KValue::createBoolean(lhs == rhs);
+      case KName::Ops_NotEqual:
+        return KValue::createBoolean(lhs != rhs);
+      default:
+        throw InvalidOperationError(token, "Unknown binary operation.");
+    }
+  }
+
+  KValue get_addition_result(const Token& token, const KValue& left,
+                             const KValue& right) {
     const auto& leftIsInt = left.isInteger();
     const auto& rightIsInt = right.isInteger();
     const auto& leftIsFloat = left.isFloat();
@@ -167,67 +288,59 @@ struct {
     const auto& rightIsString = right.isString();
 
     if (leftIsInt && rightIsInt) {
-      type = KValueType::_INTEGER;
-      return left.getInteger() + right.getInteger();
+      return KValue::createInteger(left.getInteger() + right.getInteger());
     } else if (leftIsFloat && rightIsFloat) {
-      type = KValueType::_FLOAT;
-      return left.getFloat() + right.getFloat();
+      return KValue::createFloat(left.getFloat() + right.getFloat());
     } else if ((leftIsInt && rightIsFloat) || (leftIsFloat && rightIsInt)) {
-      type = KValueType::_FLOAT;
       double l =
           leftIsInt ? static_cast<double>(left.getInteger()) : left.getFloat();
       double r = rightIsInt ? static_cast<double>(right.getInteger())
                             : right.getFloat();
-      return l + r;
+      return KValue::createFloat(l + r);
     } else if (leftIsString && rightIsString) {
-      type = KValueType::_STRING;
-      return left.getString() + right.getString();
+      return do_string_concat(left, right);
     } else if (leftIsString) {
-      type = KValueType::_STRING;
-      return left.getString() + to_string_value(right);
+      return KValue::createString(k_string(left.getStringView()) +
+                                  to_string_value(right));
     } else if (left.isList()) {
-      type = KValueType::_LIST;
       auto listCopy = left.getList();
+      auto& elements = listCopy->mutableElements();
 
       if (right.isList()) {
         const auto& rhs = right.getList()->elements;
-        listCopy->elements.insert(listCopy->elements.end(), rhs.begin(),
-                                  rhs.end());
+        elements.insert(elements.end(), rhs.begin(), rhs.end());
       } else {
-        listCopy->elements.emplace_back(right);
+        elements.emplace_back(right);
       }
 
-      return listCopy;
+      return KValue::createList(listCopy);
     } else if (rightIsString) {
-      type = KValueType::_STRING;
-      return to_string_value(left) + right.getString();
+      return KValue::createString(to_string_value(left).append(
+          right.getStringView()));
     }
 
     throw ConversionError(token, "Conversion error in addition.");
   }
 
-  k_value get_subtraction_result(const Token& token, const KValue& left,
-                                 const KValue& right, KValueType& type) {
+  KValue get_subtraction_result(const Token& token, const KValue& left,
+                                const KValue& right) {
     if (left.isInteger() && right.isInteger()) {
-      type = KValueType::_INTEGER;
-      return left.getInteger() - right.getInteger();
+      return KValue::createInteger(left.getInteger() - right.getInteger());
     } else if (left.isFloat() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return left.getFloat() - right.getFloat();
+      return KValue::createFloat(left.getFloat() - right.getFloat());
     } else if (left.isInteger() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return static_cast<double>(left.getInteger()) - right.getFloat();
+      return KValue::createFloat(static_cast<double>(left.getInteger()) -
+                                 right.getFloat());
     } else if (left.isFloat() && right.isInteger()) {
-      type = KValueType::_FLOAT;
-      return left.getFloat() - static_cast<double>(right.getInteger());
+      return KValue::createFloat(left.getFloat() -
+                                 static_cast<double>(right.getInteger()));
     } else if (left.isList() && !right.isList()) {
-      type = KValueType::_LIST;
       std::vector<KValue> listValues;
       const auto& leftList = left.getList()->elements;
       bool found = false;
 
       for (const auto& item : leftList) {
-        if (!found && same_value(item.getValue(), right.getValue())) {
+        if (!found && same_value(item, right)) {
           found = true;
           continue;
         }
@@ -235,9 +348,8 @@ struct {
         listValues.emplace_back(item);
       }
 
-      return std::make_shared<List>(listValues);
+      return KValue::createList(make_ref<List>(listValues));
     } else if (left.isList() && right.isList()) {
-      type = KValueType::_LIST;
       std::vector<KValue> listValues;
       const auto& leftList = left.getList()->elements;
       const auto& rightList = right.getList()->elements;
@@ -246,7 +358,7 @@ struct {
         bool found = false;
 
         for (const auto& ritem : rightList) {
-          if (same_value(item.getValue(), ritem.getValue())) {
+          if (same_value(item, ritem)) {
             found = true;
             break;
           }
@@ -257,169 +369,154 @@ struct {
         }
       }
 
-      return std::make_shared<List>(listValues);
+      return KValue::createList(make_ref<List>(listValues));
     }
 
     throw ConversionError(token, "Conversion error in subtraction.");
   }
 
-  k_value get_exponentiation_result(const Token& token, const KValue& left,
-                                    const KValue& right, KValueType& type) {
+  KValue get_exponentiation_result(const Token& token, const KValue& left,
+                                   const KValue& right) {
     if (left.isInteger() && right.isInteger()) {
-      type = KValueType::_INTEGER;
-      return static_cast<k_int>(pow(left.getInteger(), right.getInteger()));
+      return KValue::createInteger(
+          static_cast<k_int>(pow(left.getInteger(), right.getInteger())));
     } else if (left.isFloat() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return pow(left.getFloat(), right.getFloat());
+      return KValue::createFloat(pow(left.getFloat(), right.getFloat()));
     } else if (left.isInteger() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return pow(static_cast<double>(left.getInteger()), right.getFloat());
+      return KValue::createFloat(pow(static_cast<double>(left.getInteger()),
+                                     right.getFloat()));
     } else if (left.isFloat() && right.isInteger()) {
-      type = KValueType::_FLOAT;
-      return pow(left.getFloat(), static_cast<double>(right.getInteger()));
+      return KValue::createFloat(pow(left.getFloat(),
+                                     static_cast<double>(right.getInteger())));
     }
 
     throw ConversionError(token, "Conversion error in exponentiation.");
   }
 
-  k_value get_modulo_result(const Token& token, const KValue& left,
-                            const KValue& right, KValueType& type) {
+  KValue get_modulo_result(const Token& token, const KValue& left,
+                           const KValue& right) {
     if (left.isInteger() && right.isInteger()) {
-      type = KValueType::_INTEGER;
       auto rhs = nonzero(token, right.getInteger());
-      return left.getInteger() % rhs;
+      return KValue::createInteger(left.getInteger() % rhs);
     } else if (left.isFloat() && right.isFloat()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, right.getFloat());
-      return fmod(left.getFloat(), rhs);
+      return KValue::createFloat(fmod(left.getFloat(), rhs));
     } else if (left.isInteger() && right.isFloat()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, right.getFloat());
-      return fmod(left.getInteger(), rhs);
+      return KValue::createFloat(fmod(left.getInteger(), rhs));
     } else if (left.isFloat() && right.isInteger()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, static_cast<double>(right.getInteger()));
-      return fmod(left.getFloat(), rhs);
+      return KValue::createFloat(fmod(left.getFloat(), rhs));
     }
 
     throw ConversionError(token, "Conversion error in modulus.");
   }
 
-  k_value get_division_result(const Token& token, const KValue& left,
-                              const KValue& right, KValueType& type) {
+  KValue get_division_result(const Token& token, const KValue& left,
+                             const KValue& right) {
     if (left.isInteger() && right.isInteger()) {
-      type = KValueType::_INTEGER;
       auto rhs = nonzero(token, right.getInteger());
-      return left.getInteger() / rhs;
+      return KValue::createInteger(left.getInteger() / rhs);
     } else if (left.isFloat() && right.isFloat()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, right.getFloat());
-      return left.getFloat() / rhs;
+      return KValue::createFloat(left.getFloat() / rhs);
     } else if (left.isInteger() && right.isFloat()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, right.getFloat());
-      return static_cast<double>(left.getInteger()) / rhs;
+      return KValue::createFloat(static_cast<double>(left.getInteger()) / rhs);
     } else if (left.isFloat() && right.isInteger()) {
-      type = KValueType::_FLOAT;
       auto rhs = nonzero(token, static_cast<double>(right.getInteger()));
-      return left.getFloat() / rhs;
+      return KValue::createFloat(left.getFloat() / rhs);
     }
 
     throw ConversionError(token, "Conversion error in division.");
   }
 
-  k_value get_multiplication_result(const Token& token, const KValue& left,
-                                    const KValue& right, KValueType& type) {
+  KValue get_multiplication_result(const Token& token, const KValue& left,
+                                   const KValue& right) {
     if (left.isInteger() && right.isInteger()) {
-      type = KValueType::_INTEGER;
-      return left.getInteger() * right.getInteger();
+      return KValue::createInteger(left.getInteger() * right.getInteger());
     } else if (left.isFloat() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return left.getFloat() * right.getFloat();
+      return KValue::createFloat(left.getFloat() * right.getFloat());
     } else if (left.isInteger() && right.isFloat()) {
-      type = KValueType::_FLOAT;
-      return static_cast<double>(left.getInteger()) * right.getFloat();
+      return KValue::createFloat(static_cast<double>(left.getInteger()) *
+                                 right.getFloat());
     } else if (left.isFloat() && right.isInteger()) {
-      type = KValueType::_FLOAT;
-      return left.getFloat() * static_cast<double>(right.getInteger());
+      return KValue::createFloat(left.getFloat() *
+                                 static_cast<double>(right.getInteger()));
     } else if (left.isString() && right.isInteger()) {
-      type = KValueType::_STRING;
-      return do_string_multiplication(left, right);
+      return KValue::createString(do_string_multiplication(left, right));
     } else if (left.isList() && right.isInteger()) {
-      type = KValueType::_LIST;
-      return do_list_multiplication(token, left, right);
+      return KValue::createList(do_list_multiplication(token, left, right));
     }
 
     throw ConversionError(token, "Conversion error in multiplication.");
   }
 
-  k_value get_bitwise_and_result(const Token& token, const KValue& left,
-                                 const KValue& right, KValueType& type) {
+  KValue get_bitwise_and_result(const Token& token, const KValue& left,
+                                const KValue& right) {
     if (left.isInteger()) {
-      type = KValueType::_INTEGER;
       auto lhs = left.getInteger();
 
       if (right.isInteger()) {
-        return lhs & right.getInteger();
+        return KValue::createInteger(lhs & right.getInteger());
       } else if (right.isFloat()) {
-        return lhs & static_cast<k_int>(right.getFloat());
+        return KValue::createInteger(lhs &
+                                     static_cast<k_int>(right.getFloat()));
       } else if (right.isBoolean()) {
         k_int rhs = right.getBoolean() ? 1 : 0;
-        return lhs & rhs;
+        return KValue::createInteger(lhs & rhs);
       }
     }
 
     throw ConversionError(token, "Conversion error in bitwise & operation.");
   }
 
-  k_value get_bitwise_or_result(const Token& token, const KValue& left,
-                                const KValue& right, KValueType& type) {
+  KValue get_bitwise_or_result(const Token& token, const KValue& left,
+                               const KValue& right) {
     if (left.isInteger()) {
-      type = KValueType::_INTEGER;
       auto lhs = left.getInteger();
 
       if (right.isInteger()) {
-        return lhs | right.getInteger();
+        return KValue::createInteger(lhs | right.getInteger());
       } else if (right.isFloat()) {
-        return lhs | static_cast<k_int>(right.getFloat());
+        return KValue::createInteger(lhs |
+                                     static_cast<k_int>(right.getFloat()));
       } else if (right.isBoolean()) {
         k_int rhs = right.getBoolean() ? 1 : 0;
-        return lhs | rhs;
+        return KValue::createInteger(lhs | rhs);
       }
     }
 
     throw ConversionError(token, "Conversion error in bitwise | operation.");
   }
 
-  k_value get_bitwise_xor_result(const Token& token, const KValue& left,
-                                 const KValue& right, KValueType& type) {
+  KValue get_bitwise_xor_result(const Token& token, const KValue& left,
+                                const KValue& right) {
     if (left.isInteger()) {
-      type = KValueType::_INTEGER;
       auto lhs = left.getInteger();
 
       if (right.isInteger()) {
-        return lhs ^ right.getInteger();
+        return KValue::createInteger(lhs ^ right.getInteger());
       } else if (right.isFloat()) {
-        return lhs ^ static_cast<k_int>(right.getFloat());
+        return KValue::createInteger(lhs ^
+                                     static_cast<k_int>(right.getFloat()));
       } else if (right.isBoolean()) {
         k_int rhs = right.getBoolean() ? 1 : 0;
-        return lhs ^ rhs;
+        return KValue::createInteger(lhs ^ rhs);
       }
     }
 
     throw ConversionError(token, "Conversion error in bitwise ^ operation.");
   }
 
-  k_value get_bitwise_not_result(const Token& token, const KValue& left,
-                                 KValueType& type) {
-    type = KValueType::_INTEGER;
-
+  KValue get_bitwise_not_result(const Token& token, const KValue& left) {
     if (left.isInteger()) {
-      return ~left.getInteger();
+      return KValue::createInteger(~left.getInteger());
     } else if (left.isFloat()) {
-      return ~static_cast<k_int>(left.getFloat());
+      return KValue::createInteger(~static_cast<k_int>(left.getFloat()));
     } else if (left.isBoolean()) {
-      return ~static_cast<k_int>(left.getBoolean() ? 1 : 0);
+      return KValue::createInteger(
+          ~static_cast<k_int>(left.getBoolean() ? 1 : 0));
     }
 
     throw ConversionError(token, "Conversion error in bitwise ~ operation.");
@@ -427,132 +524,122 @@ struct {
 
   KValue do_addition(const Token& token, KValue& left, const KValue& right,
                      const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_addition_result(token, left, right, type);
+    auto res = get_addition_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_subtraction(const Token& token, KValue& left, const KValue& right,
                         const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_subtraction_result(token, left, right, type);
+    auto res = get_subtraction_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_exponentiation(const Token& token, KValue& left,
                            const KValue& right, const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_exponentiation_result(token, left, right, type);
+    auto res = get_exponentiation_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_modulus(const Token& token, KValue& left, const KValue& right,
                     const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_modulo_result(token, left, right, type);
+    auto res = get_modulo_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_division(const Token& token, KValue& left, const KValue& right,
                      const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_division_result(token, left, right, type);
+    auto res = get_division_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_multiplication(const Token& token, KValue& left,
                            const KValue& right, const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_multiplication_result(token, left, right, type);
+    auto res = get_multiplication_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_bitwise_and(const Token& token, KValue& left, const KValue& right,
                         const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_bitwise_and_result(token, left, right, type);
+    auto res = get_bitwise_and_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_bitwise_or(const Token& token, KValue& left, const KValue& right,
                        const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_bitwise_or_result(token, left, right, type);
+    auto res = get_bitwise_or_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_bitwise_xor(const Token& token, KValue& left, const KValue& right,
                         const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_bitwise_xor_result(token, left, right, type);
+    auto res = get_bitwise_xor_result(token, left, right);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_bitwise_not(const Token& token, KValue& left,
                         const bool& doAssign = false) {
-    KValueType type;
-    k_value res = get_bitwise_not_result(token, left, type);
+    auto res = get_bitwise_not_result(token, left);
 
     if (doAssign) {
-      left.set(res, type);
+      left = res;
       return left;
     }
 
-    return KValue(res, type);
+    return res;
   }
 
   KValue do_bitwise_lshift(const Token& token, KValue& left,
@@ -561,7 +648,7 @@ struct {
       k_int res = left.getInteger() << right.getInteger();
 
       if (doAssign) {
-        left.set(res, KValueType::_INTEGER);
+        left.setValue(res);
         return left;
       }
 
@@ -589,7 +676,7 @@ struct {
     k_int res = static_cast<k_int>(a_int >> b);
 
     if (doAssign) {
-      left.set(res, KValueType::_INTEGER);
+      left.setValue(res);
       return left;
     }
 
@@ -602,7 +689,7 @@ struct {
       k_int res = left.getInteger() >> right.getInteger();
 
       if (doAssign) {
-        left.set(res, KValueType::_INTEGER);
+        left.setValue(res);
         return left;
       }
 
@@ -633,11 +720,11 @@ struct {
     } else if (right.isFloat()) {
       return KValue::createBoolean(right.getFloat() == 0.0);
     } else if (right.isString()) {
-      return KValue::createBoolean(right.getString().empty());
+      return KValue::createBoolean(right.getStringView().empty());
     } else if (right.isList()) {
       return KValue::createBoolean(right.getList()->elements.empty());
     } else if (right.isHashmap()) {
-      return KValue::createBoolean(right.getHashmap()->keys.empty());
+      return KValue::createBoolean(right.getHashmap()->empty());
     } else {
       return KValue::createBoolean(false);  // Object, Lambda, etc.
     }
@@ -645,29 +732,25 @@ struct {
 
   KValue do_neq_comparison(const KValue& left, const KValue& right) {
     return KValue::createBoolean(
-        !same_value(left.getValue(), right.getValue()));
+        !same_value(left, right));
   }
 
   KValue do_lt_comparison(const KValue& left, const KValue& right) {
-    return KValue::createBoolean(lt_value(left.getValue(), right.getValue()));
+    return KValue::createBoolean(lt_value(left, right));
   }
 
   KValue do_lte_comparison(const KValue& left, const KValue& right) {
-    const auto& leftValue = left.getValue();
-    const auto& rightValue = right.getValue();
-    return KValue::createBoolean(lt_value(leftValue, rightValue) ||
-                                 same_value(leftValue, rightValue));
+    return KValue::createBoolean(lt_value(left, right) ||
+                                 same_value(left, right));
   }
 
   KValue do_gt_comparison(const KValue& left, const KValue& right) {
-    return KValue::createBoolean(gt_value(left.getValue(), right.getValue()));
+    return KValue::createBoolean(gt_value(left, right));
   }
 
   KValue do_gte_comparison(const KValue& left, const KValue& right) {
-    const auto& leftValue = left.getValue();
-    const auto& rightValue = right.getValue();
-    return KValue::createBoolean(gt_value(leftValue, rightValue) ||
-                                 same_value(leftValue, rightValue));
+    return KValue::createBoolean(gt_value(left, right) ||
+                                 same_value(left, right));
   }
 
   double get_double(const Token& token, const KValue& value) {
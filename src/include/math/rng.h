@@ -78,11 +78,11 @@ k_string RNG::randomString(const k_string& chars, size_t length) {
 k_value RNG::randomList(k_list list, size_t length) {
   const auto& elements = list->elements;
   if (elements.empty()) {
-    return std::make_shared<List>();
+    return make_ref<List>();
   }
 
   std::uniform_int_distribution<> distribution(0, elements.size() - 1);
-  auto randomList = std::make_shared<List>();
+  auto randomList = make_ref<List>();
   auto& randomElements = randomList->elements;
   randomElements.reserve(length);
 
@@ -176,7 +176,7 @@ class SocketManager {
 
     int status = getaddrinfo(hostname.c_str(), nullptr, &hints, &res);
     if (status != 0) {
-      return KValue::createList(std::make_shared<List>(ipAddresses));
+      return KValue::createList(make_ref<List>(ipAddresses));
     }
 
     for (ptr = res; ptr != nullptr; ptr = ptr->ai_next) {
@@ -198,7 +198,7 @@ class SocketManager {
     }
 
     freeaddrinfo(res);  // Free the linked list
-    return KValue::createList(std::make_shared<List>(ipAddresses));
+    return KValue::createList(make_ref<List>(ipAddresses));
   }
 
  private:
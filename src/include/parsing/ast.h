@@ -82,6 +82,8 @@ void print_depth(int depth) {
 class ProgramNode : public ASTNode {
  public:
   std::vector<std::unique_ptr<ASTNode>> statements;
+  // The text of the tokens of every source the statements were parsed from.
+  std::vector<k_token_text> text;
   bool isScript = false;
 
   ProgramNode() : ASTNode(ASTNodeType::PROGRAM) {}
@@ -104,7 +106,9 @@ class ProgramNode : public ASTNode {
       clonedStatements.push_back(statement->clone());
     }
 
-    return std::make_unique<ProgramNode>(std::move(clonedStatements));
+    auto program = std::make_unique<ProgramNode>(std::move(clonedStatements));
+    program->text = text;
+    return program;
   }
 };
 
@@ -181,11 +185,16 @@ class LiteralNode : public ASTNode {
 
 class HashLiteralNode : public ASTNode {
  public:
-  std::map<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>> elements;
+  std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>>
+      elements;
   std::vector<k_string> keys;
+  // Set by `KOptimizer` when every key and value is a literal. Each
+  // evaluation returns a copy of it.
+  KValue constant;
 
   HashLiteralNode(
-      std::map<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>> elements,
+      std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>>
+          elements,
       std::vector<k_string> keys)
       : ASTNode(ASTNodeType::HASH_LITERAL),
         elements(std::move(elements)),
@@ -193,7 +202,8 @@ class HashLiteralNode : public ASTNode {
 
   void print(int depth) const override {
     print_depth(depth);
-    std::cout << "HashLiteral:" << std::endl;
+    std::cout << "HashLiteral:" << (constant.isHashmap() ? " (constant)" : "")
+              << std::endl;
     for (const auto& element : elements) {
       element.first->print(1 + depth);
       element.second->print(1 + depth);
@@ -201,18 +211,25 @@ class HashLiteralNode : public ASTNode {
   }
 
   std::unique_ptr<ASTNode> clone() const override {
-    std::map<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>> clonedElements;
+    std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>>
+        clonedElements;
     for (const auto& [key, value] : elements) {
-      clonedElements.emplace(key->clone(), value->clone());
+      clonedElements.emplace_back(key->clone(), value->clone());
     }
 
-    return std::make_unique<HashLiteralNode>(std::move(clonedElements), keys);
+    auto node =
+        std::make_unique<HashLiteralNode>(std::move(clonedElements), keys);
+    node->constant = constant;
+    return node;
   }
 };
 
 class ListLiteralNode : public ASTNode {
  public:
   std::vector<std::unique_ptr<ASTNode>> elements;
+  // Set by `KOptimizer` when every element is a literal. Each evaluation
+  // returns a copy of it.
+  KValue constant;
 
   ListLiteralNode() : ASTNode(ASTNodeType::LIST_LITERAL) {}
   ListLiteralNode(std::vector<std::unique_ptr<ASTNode>> elements)
@@ -220,7 +237,8 @@ class ListLiteralNode : public ASTNode {
 
   void print(int depth) const override {
     print_depth(depth);
-    std::cout << "ListLiteral:" << std::endl;
+    std::cout << "ListLiteral:" << (constant.isList() ? " (constant)" : "")
+              << std::endl;
     for (const auto& element : elements) {
       element->print(1 + depth);
     }
@@ -233,7 +251,9 @@ class ListLiteralNode : public ASTNode {
       clonedElements.push_back(element->clone());
     }
 
-    return std::make_unique<ListLiteralNode>(std::move(clonedElements));
+    auto node = std::make_unique<ListLiteralNode>(std::move(clonedElements));
+    node->constant = constant;
+    return node;
   }
 };
 
@@ -612,6 +632,7 @@ class IdentifierNode : public ASTNode {
  public:
   k_string name;
   k_string package;
+  KInlineCache cache;
 
   IdentifierNode() : ASTNode(ASTNodeType::IDENTIFIER) {}
   IdentifierNode(const k_string& name)
@@ -1500,6 +1521,8 @@ class MemberAccessNode : public ASTNode {
 class SelfNode : public ASTNode {
  public:
   k_string name;
+  KInlineCache cache;
+
   SelfNode() : ASTNode(ASTNodeType::SELF) {}
   SelfNode(const k_string& name) : ASTNode(ASTNodeType::SELF), name(name) {}
 
@@ -1632,6 +1655,7 @@ class AssignmentNode : public ASTNode {
   k_string name;
   KName op;
   std::unique_ptr<ASTNode> initializer;
+  KInlineCache cache;
 
   AssignmentNode() : ASTNode(ASTNodeType::ASSIGNMENT) {}
   AssignmentNode(std::unique_ptr<ASTNode> left, const k_string& name,
@@ -1,25 +1,35 @@
 #ifndef KIWI_PARSING_BUILTINS_H
 #define KIWI_PARSING_BUILTINS_H
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <unordered_set>
 #include "parsing/tokentype.h"
 #include "typing/value.h"
 
 struct {
+  const k_string TaskAwait = "__task_await__";
   const k_string TaskBusy = "__task_busy__";
+  const k_string TaskCancel = "__task_cancel__";
   const k_string TaskList = "__task_list__";
+  const k_string TaskPriority = "__task_priority__";
   const k_string TaskResult = "__task_result__";
   const k_string TaskSleep = "__task_sleep__";
   const k_string TaskStatus = "__task_status__";
+  const k_string TaskWaitAll = "__task_wait_all__";
+  const k_string TaskWaitAny = "__task_wait_any__";
 
-  std::unordered_set<k_string> builtins = {TaskBusy, TaskList, TaskResult,
-                                           TaskSleep, TaskStatus};
+  std::unordered_set<k_string> builtins = {
+      TaskAwait,  TaskBusy,  TaskCancel, TaskList,    TaskPriority,
+      TaskResult, TaskSleep, TaskStatus, TaskWaitAll, TaskWaitAny};
 
   std::unordered_set<KName> st_builtins = {
-      KName::Builtin_Task_Busy, KName::Builtin_Task_List,
-      KName::Builtin_Task_Result, KName::Builtin_Task_Sleep,
-      KName::Builtin_Task_Status};
+      KName::Builtin_Task_Await,    KName::Builtin_Task_Busy,
+      KName::Builtin_Task_Cancel,   KName::Builtin_Task_List,
+      KName::Builtin_Task_Priority, KName::Builtin_Task_Result,
+      KName::Builtin_Task_Sleep,    KName::Builtin_Task_Status,
+      KName::Builtin_Task_WaitAll,  KName::Builtin_Task_WaitAny};
 
   bool is_builtin(const k_string& arg) {
     return builtins.find(arg) != builtins.end();
@@ -30,6 +40,32 @@ struct {
   }
 } TaskBuiltins;
 
+struct {
+  const k_string ChannelClose = "__channel_close__";
+  const k_string ChannelCreate = "__channel_create__";
+  const k_string ChannelReceive = "__channel_receive__";
+  const k_string ChannelSelect = "__channel_select__";
+  const k_string ChannelSend = "__channel_send__";
+  const k_string ChannelTryReceive = "__channel_try_receive__";
+
+  std::unordered_set<k_string> builtins = {
+      ChannelClose, ChannelCreate,     ChannelReceive,
+      ChannelSelect, ChannelSend, ChannelTryReceive};
+
+  std::unordered_set<KName> st_builtins = {
+      KName::Builtin_Channel_Close,  KName::Builtin_Channel_Create,
+      KName::Builtin_Channel_Receive, KName::Builtin_Channel_Select,
+      KName::Builtin_Channel_Send,   KName::Builtin_Channel_TryReceive};
+
+  bool is_builtin(const k_string& arg) {
+    return builtins.find(arg) != builtins.end();
+  }
+
+  bool is_builtin(const KName& arg) {
+    return st_builtins.find(arg) != st_builtins.end();
+  }
+} ChannelBuiltins;
+
 struct {
   // File operations
   const k_string AppendText = "__appendtext__";
@@ -440,17 +476,31 @@ struct {
   const k_string Min = "min";
   const k_string Max = "max";
   const k_string ToH = "to_hashmap";
+  const k_string ParallelEach = "peach";
+  const k_string ParallelMap = "pmap";
+  const k_string ParallelReduce = "preduce";
+  const k_string ParallelSelect = "pselect";
 
   std::unordered_set<k_string> builtins = {
-      All, Each, Map, None, Reduce, Select, Sort, Sum, Min, Max, ToH};
+      All, Each, Map, None, Reduce, Select, Sort, Sum, Min, Max, ToH,
+      ParallelEach, ParallelMap, ParallelReduce, ParallelSelect};
 
   std::unordered_set<KName> st_builtins = {
-      KName::Builtin_List_All,    KName::Builtin_List_Each,
-      KName::Builtin_List_Map,    KName::Builtin_List_None,
-      KName::Builtin_List_Reduce, KName::Builtin_List_Select,
-      KName::Builtin_List_Sort,   KName::Builtin_List_ToH,
-      KName::Builtin_List_Sum,    KName::Builtin_List_Min,
-      KName::Builtin_List_Max};
+      KName::Builtin_List_All,          KName::Builtin_List_Each,
+      KName::Builtin_List_Map,          KName::Builtin_List_None,
+      KName::Builtin_List_Reduce,       KName::Builtin_List_Select,
+      KName::Builtin_List_Sort,         KName::Builtin_List_ToH,
+      KName::Builtin_List_Sum,          KName::Builtin_List_Min,
+      KName::Builtin_List_Max,          KName::Builtin_List_ParallelEach,
+      KName::Builtin_List_ParallelMap,  KName::Builtin_List_ParallelReduce,
+      KName::Builtin_List_ParallelSelect};
+
+  bool is_parallel(const KName& arg) {
+    return arg == KName::Builtin_List_ParallelEach ||
+           arg == KName::Builtin_List_ParallelMap ||
+           arg == KName::Builtin_List_ParallelReduce ||
+           arg == KName::Builtin_List_ParallelSelect;
+  }
 
   bool is_builtin(const k_string& arg) {
     return builtins.find(arg) != builtins.end();
@@ -783,21 +833,93 @@ struct {
            SerializerBuiltins.is_builtin(arg) || FFIBuiltins.is_builtin(arg) ||
            ReflectorBuiltins.is_builtin(arg) ||
            SignalBuiltins.is_builtin(arg) || SocketBuiltins.is_builtin(arg) ||
-           TaskBuiltins.is_builtin(arg);
+           TaskBuiltins.is_builtin(arg) || ChannelBuiltins.is_builtin(arg);
   }
+} KiwiBuiltins;
 
-  bool is_builtin_method(const KName& arg) {
-    return ConsoleBuiltins.is_builtin(arg) || EnvBuiltins.is_builtin(arg) ||
-           ArgvBuiltins.is_builtin(arg) || TimeBuiltins.is_builtin(arg) ||
-           FileIOBuiltIns.is_builtin(arg) || MathBuiltins.is_builtin(arg) ||
-           PackageBuiltins.is_builtin(arg) || SysBuiltins.is_builtin(arg) ||
-           HttpBuiltins.is_builtin(arg) || WebServerBuiltins.is_builtin(arg) ||
-           LoggingBuiltins.is_builtin(arg) || EncoderBuiltins.is_builtin(arg) ||
-           SerializerBuiltins.is_builtin(arg) || FFIBuiltins.is_builtin(arg) ||
-           ReflectorBuiltins.is_builtin(arg) ||
-           SignalBuiltins.is_builtin(arg) || SocketBuiltins.is_builtin(arg) ||
-           TaskBuiltins.is_builtin(arg);
+// The families of builtins, each served by its own handler.
+enum class KBuiltinFamily : uint8_t {
+  None,
+  Argv,
+  Channel,
+  Console,
+  Encoder,
+  Env,
+  FFI,
+  FileIO,
+  Http,
+  Kiwi,
+  List,
+  Logging,
+  Math,
+  Package,
+  Reflector,
+  Serializer,
+  Signal,
+  Socket,
+  Sys,
+  Task,
+  Time,
+  WebServer
+};
+
+/*
+ * Maps every name to the family of builtins it belongs to, so that a call
+ * finds its handler with an array lookup instead of asking each family in
+ * turn. The lexer already gives every builtin token its name, so this is all
+ * a call needs once it has been parsed.
+ */
+class KBuiltinTable {
+ public:
+  static KBuiltinFamily getFamily(KName name) {
+    return instance().families[name];
+  }
+
+  // True for the builtins that are called like functions, such as
+  // `__random__()`, as opposed to methods like `.size()`.
+  static bool isBuiltinMethod(KName name) {
+    auto family = getFamily(name);
+    return family != KBuiltinFamily::None && family != KBuiltinFamily::Kiwi &&
+           family != KBuiltinFamily::List;
+  }
+
+ private:
+  std::array<KBuiltinFamily, KName::Default + 1> families{};
+
+  KBuiltinTable() {
+    add(ArgvBuiltins.st_builtins, KBuiltinFamily::Argv);
+    add(ChannelBuiltins.st_builtins, KBuiltinFamily::Channel);
+    add(ConsoleBuiltins.st_builtins, KBuiltinFamily::Console);
+    add(EncoderBuiltins.st_builtins, KBuiltinFamily::Encoder);
+    add(EnvBuiltins.st_builtins, KBuiltinFamily::Env);
+    add(FFIBuiltins.st_builtins, KBuiltinFamily::FFI);
+    add(FileIOBuiltIns.st_builtins, KBuiltinFamily::FileIO);
+    add(HttpBuiltins.st_builtins, KBuiltinFamily::Http);
+    add(KiwiBuiltins.st_builtins, KBuiltinFamily::Kiwi);
+    add(ListBuiltins.st_builtins, KBuiltinFamily::List);
+    add(LoggingBuiltins.st_builtins, KBuiltinFamily::Logging);
+    add(MathBuiltins.st_builtins, KBuiltinFamily::Math);
+    add(PackageBuiltins.st_builtins, KBuiltinFamily::Package);
+    add(ReflectorBuiltins.st_builtins, KBuiltinFamily::Reflector);
+    add(SerializerBuiltins.st_builtins, KBuiltinFamily::Serializer);
+    add(SignalBuiltins.st_builtins, KBuiltinFamily::Signal);
+    add(SocketBuiltins.st_builtins, KBuiltinFamily::Socket);
+    add(SysBuiltins.st_builtins, KBuiltinFamily::Sys);
+    add(TaskBuiltins.st_builtins, KBuiltinFamily::Task);
+    add(TimeBuiltins.st_builtins, KBuiltinFamily::Time);
+    add(WebServerBuiltins.st_builtins, KBuiltinFamily::WebServer);
+  }
+
+  static const KBuiltinTable& instance() {
+    static const KBuiltinTable table;
+    return table;
+  }
+
+  void add(const std::unordered_set<KName>& names, KBuiltinFamily family) {
+    for (auto name : names) {
+      families[name] = family;
+    }
   }
-} KiwiBuiltins;
+};
 
 #endif
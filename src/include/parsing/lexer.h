@@ -30,7 +30,8 @@ class Lexer {
 
   // Generate token stream from tokenized string input.
   k_stream getTokenStream() {
-    return std::make_shared<TokenStream>(getAllTokens());
+    auto tokens = getAllTokens();
+    return std::make_shared<TokenStream>(std::move(tokens), text);
   }
 
   // Tokenize string input.
@@ -91,6 +92,7 @@ class Lexer {
   int fileId;
   int row;
   int col;
+  std::shared_ptr<KTokenText> text = std::make_shared<KTokenText>();
 
   // String Processing
   void preprocessSource();
@@ -101,8 +103,8 @@ class Lexer {
   // Tokenization
   Token getNextToken();
   Token createToken(KTokenType type, KName name, const k_string& text);
-  Token createToken(KTokenType type, KName name, const k_string& text,
-                    const k_value& value);
+  Token createToken(const k_string& text, k_int value);
+  Token createToken(const k_string& text, double value);
 
   // Identifiers
   Token tokenizeIdentifier(const k_string& identifier);
@@ -153,6 +155,7 @@ class Lexer {
   Token tokenizeEnvBuiltin(const k_string& builtin);
   Token tokenizeFileIOBuiltin(const k_string& builtin);
   Token tokenizeTaskBuiltin(const k_string& builtin);
+  Token tokenizeChannelBuiltin(const k_string& builtin);
   Token tokenizeMathBuiltin(const k_string& builtin);
   Token tokenizePackageBuiltin(const k_string& builtin);
   Token tokenizeSysBuiltin(const k_string& builtin);
@@ -229,6 +232,10 @@ void Lexer::minifyTokenStream(k_stream& stream, bool forStandardOutput,
 /// =========================================================== ///
 
 void Lexer::preprocessSource() {
+  if (source.find("${") == k_string::npos) {
+    return;
+  }
+
   std::regex re(R"(\$\{([^}]+)\})");
   k_string output;
 
@@ -270,12 +277,16 @@ char Lexer::peek() {
 /// =========================================================== ///
 
 Token Lexer::createToken(KTokenType type, KName name, const k_string& text) {
-  return Token::create(type, name, fileId, text, row, col);
+  return Token::create(type, name, fileId, this->text->intern(text), row, col);
 }
 
-Token Lexer::createToken(KTokenType type, KName name, const k_string& text,
-                         const k_value& value) {
-  return Token::create(type, name, fileId, text, value, row, col);
+Token Lexer::createToken(const k_string& text, k_int value) {
+  return Token::createInteger(fileId, this->text->intern(text), value, row,
+                              col);
+}
+
+Token Lexer::createToken(const k_string& text, double value) {
+  return Token::createFloat(fileId, this->text->intern(text), value, row, col);
 }
 
 Token Lexer::getNextToken() {
@@ -437,13 +448,12 @@ Token Lexer::tokenizeLiteral(char initialChar) {
   }
 
   if (literal.find('.') != k_string::npos) {
-    return createToken(KTokenType::LITERAL, KName::Default, literal,
-                       std::stod(literal));
+    return createToken(literal, std::stod(literal));
   } else {
     std::istringstream ss(literal);
     k_int value;
     ss >> value;
-    return createToken(KTokenType::LITERAL, KName::Default, literal, value);
+    return createToken(literal, value);
   }
 }
 
@@ -459,7 +469,7 @@ Token Lexer::tokenizeHexLiteral() {
   k_int value;
   ss >> std::hex >> value;
 
-  return createToken(KTokenType::LITERAL, KName::Default, hexLiteral, value);
+  return createToken(hexLiteral, value);
 }
 
 Token Lexer::tokenizeBinaryLiteral() {
@@ -471,14 +481,13 @@ Token Lexer::tokenizeBinaryLiteral() {
   }
 
   if (binaryLiteral.empty()) {
-    const auto& errorToken = createToken(KTokenType::LITERAL, KName::Default,
-                                         binaryLiteral, static_cast<k_int>(0));
+    const auto& errorToken = createToken(binaryLiteral, static_cast<k_int>(0));
     throw SyntaxError(errorToken, "Invalid binary literal.");
   }
 
   k_int value = std::stoi(binaryLiteral, nullptr, 2);
 
-  return createToken(KTokenType::LITERAL, KName::Default, binaryLiteral, value);
+  return createToken(binaryLiteral, value);
 }
 
 Token Lexer::tokenizeOctalLiteral() {
@@ -490,14 +499,13 @@ Token Lexer::tokenizeOctalLiteral() {
   }
 
   if (octalLiteral.empty()) {
-    const auto& errorToken = createToken(KTokenType::LITERAL, KName::Default,
-                                         octalLiteral, static_cast<k_int>(0));
+    const auto& errorToken = createToken(octalLiteral, static_cast<k_int>(0));
     throw SyntaxError(errorToken, "Invalid octal literal.");
   }
 
   k_int value = std::stoi(octalLiteral, nullptr, 8);
 
-  return createToken(KTokenType::LITERAL, KName::Default, octalLiteral, value);
+  return createToken(octalLiteral, value);
 }
 
 Token Lexer::tokenizeRegex() {
@@ -870,9 +878,9 @@ Token Lexer::tokenizeKeyword(const k_string& keyword) {
   } else if (keyword == Keywords.With) {
     return createToken(KTokenType::LAMBDA, KName::KW_Lambda, keyword);
   } else if (Keywords.is_boolean(keyword)) {
-    return Token::createBoolean(fileId, keyword, row, col);
+    return Token::createBoolean(fileId, text->intern(keyword), row, col);
   } else if (Keywords.is_null(keyword)) {
-    return Token::createNull(fileId, keyword, row, col);
+    return Token::createNull(fileId, text->intern(keyword), row, col);
   }
 
   return tokenizeKeywordSpecific(keyword);
@@ -1135,6 +1143,14 @@ Token Lexer::tokenizeKiwiBuiltin(const k_string& builtin) {
     st = KName::Builtin_List_Each;
   } else if (builtin == ListBuiltins.All) {
     st = KName::Builtin_List_All;
+  } else if (builtin == ListBuiltins.ParallelEach) {
+    st = KName::Builtin_List_ParallelEach;
+  } else if (builtin == ListBuiltins.ParallelMap) {
+    st = KName::Builtin_List_ParallelMap;
+  } else if (builtin == ListBuiltins.ParallelReduce) {
+    st = KName::Builtin_List_ParallelReduce;
+  } else if (builtin == ListBuiltins.ParallelSelect) {
+    st = KName::Builtin_List_ParallelSelect;
   }
 
   return createToken(KTokenType::IDENTIFIER, st, builtin);
@@ -1157,6 +1173,14 @@ Token Lexer::tokenizeListBuiltin(const k_string& builtin) {
     st = KName::Builtin_List_ToH;
   } else if (builtin == ListBuiltins.All) {
     st = KName::Builtin_List_All;
+  } else if (builtin == ListBuiltins.ParallelEach) {
+    st = KName::Builtin_List_ParallelEach;
+  } else if (builtin == ListBuiltins.ParallelMap) {
+    st = KName::Builtin_List_ParallelMap;
+  } else if (builtin == ListBuiltins.ParallelReduce) {
+    st = KName::Builtin_List_ParallelReduce;
+  } else if (builtin == ListBuiltins.ParallelSelect) {
+    st = KName::Builtin_List_ParallelSelect;
   }
 
   return createToken(KTokenType::IDENTIFIER, st, builtin);
@@ -1183,6 +1207,8 @@ Token Lexer::tokenizeBuiltinMethod(const k_string& builtin) {
     return tokenizeMathBuiltin(builtin);
   } else if (TaskBuiltins.is_builtin(builtin)) {
     return tokenizeTaskBuiltin(builtin);
+  } else if (ChannelBuiltins.is_builtin(builtin)) {
+    return tokenizeChannelBuiltin(builtin);
   } else if (PackageBuiltins.is_builtin(builtin)) {
     return tokenizePackageBuiltin(builtin);
   } else if (SysBuiltins.is_builtin(builtin)) {
@@ -1435,16 +1461,46 @@ Token Lexer::tokenizeFileIOBuiltin(const k_string& builtin) {
 Token Lexer::tokenizeTaskBuiltin(const k_string& builtin) {
   auto st = KName::Default;
 
-  if (builtin == TaskBuiltins.TaskBusy) {
+  if (builtin == TaskBuiltins.TaskAwait) {
+    st = KName::Builtin_Task_Await;
+  } else if (builtin == TaskBuiltins.TaskBusy) {
     st = KName::Builtin_Task_Busy;
+  } else if (builtin == TaskBuiltins.TaskCancel) {
+    st = KName::Builtin_Task_Cancel;
   } else if (builtin == TaskBuiltins.TaskList) {
     st = KName::Builtin_Task_List;
+  } else if (builtin == TaskBuiltins.TaskPriority) {
+    st = KName::Builtin_Task_Priority;
   } else if (builtin == TaskBuiltins.TaskResult) {
     st = KName::Builtin_Task_Result;
   } else if (builtin == TaskBuiltins.TaskSleep) {
     st = KName::Builtin_Task_Sleep;
   } else if (builtin == TaskBuiltins.TaskStatus) {
     st = KName::Builtin_Task_Status;
+  } else if (builtin == TaskBuiltins.TaskWaitAll) {
+    st = KName::Builtin_Task_WaitAll;
+  } else if (builtin == TaskBuiltins.TaskWaitAny) {
+    st = KName::Builtin_Task_WaitAny;
+  }
+
+  return createToken(KTokenType::IDENTIFIER, st, builtin);
+}
+
+Token Lexer::tokenizeChannelBuiltin(const k_string& builtin) {
+  auto st = KName::Default;
+
+  if (builtin == ChannelBuiltins.ChannelClose) {
+    st = KName::Builtin_Channel_Close;
+  } else if (builtin == ChannelBuiltins.ChannelCreate) {
+    st = KName::Builtin_Channel_Create;
+  } else if (builtin == ChannelBuiltins.ChannelReceive) {
+    st = KName::Builtin_Channel_Receive;
+  } else if (builtin == ChannelBuiltins.ChannelSelect) {
+    st = KName::Builtin_Channel_Select;
+  } else if (builtin == ChannelBuiltins.ChannelSend) {
+    st = KName::Builtin_Channel_Send;
+  } else if (builtin == ChannelBuiltins.ChannelTryReceive) {
+    st = KName::Builtin_Channel_TryReceive;
   }
 
   return createToken(KTokenType::IDENTIFIER, st, builtin);
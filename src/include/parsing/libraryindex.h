@@ -0,0 +1,283 @@
+#ifndef KIWI_PARSING_LIBRARYINDEX_H
+#define KIWI_PARSING_LIBRARYINDEX_H
+
+#include <sys/stat.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "globals.h"
+#include "parsing/ast.h"
+#include "parsing/optimizer.h"
+#include "parsing/parser.h"
+#include "parsing/snapshot.h"
+#include "tracing/error.h"
+#include "util/file.h"
+
+/*
+ * Knows which library file declares each package and struct, so that a
+ * library file is only parsed and run once a program refers to something
+ * declared in it.
+ *
+ * Only files whose top level holds nothing but package and struct
+ * declarations and `import` or `export` statements are loaded on demand. Any
+ * other file is loaded up front, since its top-level code may do something.
+ *
+ * The index of each library directory is kept in the syntax tree cache, and
+ * only the files that changed since it was written are parsed again.
+ */
+class KLibraryIndex {
+ public:
+  static KLibraryIndex& instance() {
+    static KLibraryIndex index;
+    return index;
+  }
+
+  // Indexes `files`, the library files found in `directory`. Returns the ones
+  // that have to be loaded up front.
+  std::vector<k_string> addLibrary(const k_string& directory,
+                                   const std::vector<k_string>& files) {
+    auto indexPath = KSnapshot::getCachePath(directory, "index");
+    auto saved = readIndex(indexPath);
+    auto changed = saved.size() != files.size();
+    std::vector<k_string> eager;
+    std::vector<const Entry*> indexed;
+
+    for (const auto& file : files) {
+      auto path = File::getAbsolutePath(libraryToken, file);
+      struct stat info;
+      if (::stat(path.c_str(), &info) != 0) {
+        eager.push_back(file);
+        continue;
+      }
+
+      auto modified = KSnapshot::getModified(info);
+      auto size = static_cast<uint64_t>(info.st_size);
+      auto it = saved.find(path);
+      std::unique_ptr<Entry> entry;
+      if (it != saved.end() && it->second->modified == modified &&
+          it->second->size == size) {
+        entry = std::move(it->second);
+      } else {
+        entry = scan(path, modified, size);
+        changed = true;
+      }
+
+      if (!entry->onDemand) {
+        // The host parses it along with the program.
+        entry->program.reset();
+        eager.push_back(file);
+      } else {
+        for (const auto& name : entry->names) {
+          auto& paths = declarations[name];
+          if (paths.empty() || paths.back() != path) {
+            paths.push_back(path);
+          }
+        }
+      }
+
+      indexed.push_back(entry.get());
+      entries[path] = std::move(entry);
+    }
+
+    if (changed) {
+      writeIndex(indexPath, indexed);
+    }
+
+    return eager;
+  }
+
+  // Returns the files that declare `name`, or the package it belongs to, or
+  // null if no library file does.
+  const std::vector<k_string>* find(const k_string& name) const {
+    if (declarations.empty()) {
+      return nullptr;
+    }
+
+    auto end = name.size();
+    while (end != k_string::npos && end > 0) {
+      auto it = declarations.find(name.substr(0, end));
+      if (it != declarations.end()) {
+        return &it->second;
+      }
+      end = name.rfind("::", end - 1);
+    }
+
+    return nullptr;
+  }
+
+  // Returns the syntax tree of a library file, which every interpreter
+  // shares. It is parsed and optimized the first time any interpreter asks
+  // for it.
+  std::shared_ptr<const ASTNode> getProgram(const k_string& path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto& entry = entries.at(path);
+    if (!entry->program) {
+      Parser parser(true);
+      auto program = std::make_shared<ProgramNode>();
+      program->isScript = true;
+      KSnapshot::parseFile(parser, path, *program);
+      entry->program = std::move(program);
+    }
+
+    if (!entry->optimized) {
+      KOptimizer::prepare(*entry->program);
+      entry->optimized = true;
+    }
+
+    return entry->program;
+  }
+
+ private:
+  const Token libraryToken = Token::createExternal();
+
+  struct Entry {
+    k_string path;
+    int64_t modified = 0;
+    uint64_t size = 0;
+    bool onDemand = false;
+    bool optimized = false;
+    std::vector<k_string> names;
+    std::shared_ptr<ProgramNode> program;
+  };
+
+  std::unordered_map<k_string, std::unique_ptr<Entry>> entries;
+  std::unordered_map<k_string, std::vector<k_string>> declarations;
+  std::mutex lock;
+
+  KLibraryIndex() {}
+
+  // Parses a library file to find what it declares. A file with a syntax
+  // error is left to be loaded up front, which reports the error.
+  std::unique_ptr<Entry> scan(const k_string& path, int64_t modified,
+                              uint64_t size) {
+    auto entry = std::make_unique<Entry>();
+    entry->path = path;
+    entry->modified = modified;
+    entry->size = size;
+
+    auto program = std::make_shared<ProgramNode>();
+    program->isScript = true;
+    try {
+      Parser parser(true);
+      KSnapshot::parseFile(parser, path, *program);
+    } catch (const KiwiError&) {
+      return entry;
+    }
+
+    entry->onDemand = true;
+    for (const auto& stmt : program->statements) {
+      switch (stmt->type) {
+        case ASTNodeType::PACKAGE: {
+          const auto* name =
+              static_cast<const PackageNode*>(stmt.get())->packageName.get();
+          if (name->type != ASTNodeType::IDENTIFIER) {
+            entry->onDemand = false;
+            break;
+          }
+          entry->names.push_back(
+              static_cast<const IdentifierNode*>(name)->name);
+          break;
+        }
+
+        case ASTNodeType::STRUCT:
+          entry->names.push_back(
+              static_cast<const StructNode*>(stmt.get())->name);
+          break;
+
+        case ASTNodeType::IMPORT:
+        case ASTNodeType::EXPORT:
+          break;
+
+        default:
+          entry->onDemand = false;
+          break;
+      }
+    }
+
+    entry->program = std::move(program);
+    return entry;
+  }
+
+  // The index is a line per file: its path, modification time, size, whether
+  // it loads on demand, and the names it declares, separated by tabs.
+  static std::unordered_map<k_string, std::unique_ptr<Entry>> readIndex(
+      const k_string& indexPath) {
+    std::unordered_map<k_string, std::unique_ptr<Entry>> saved;
+    if (indexPath.empty()) {
+      return saved;
+    }
+
+    std::ifstream input(indexPath);
+    k_string line;
+    if (!std::getline(input, line) || line != kiwi_version) {
+      return saved;
+    }
+
+    while (std::getline(input, line)) {
+      std::istringstream fields(line);
+      auto entry = std::make_unique<Entry>();
+      k_string modified, size, onDemand, name;
+      if (!std::getline(fields, entry->path, '\t') ||
+          !std::getline(fields, modified, '\t') ||
+          !std::getline(fields, size, '\t') ||
+          !std::getline(fields, onDemand, '\t')) {
+        return {};
+      }
+
+      try {
+        entry->modified = std::stoll(modified);
+        entry->size = std::stoull(size);
+      } catch (const std::exception&) {
+        return {};
+      }
+      entry->onDemand = onDemand == "1";
+      while (std::getline(fields, name, '\t')) {
+        entry->names.push_back(name);
+      }
+      saved[entry->path] = std::move(entry);
+    }
+
+    return saved;
+  }
+
+  static void writeIndex(const k_string& indexPath,
+                         const std::vector<const Entry*>& indexed) {
+    if (indexPath.empty()) {
+      return;
+    }
+
+    std::ostringstream output;
+    output << kiwi_version << '\n';
+    for (const auto* entry : indexed) {
+      output << entry->path << '\t' << entry->modified << '\t' << entry->size
+             << '\t' << (entry->onDemand ? 1 : 0);
+      for (const auto& name : entry->names) {
+        output << '\t' << name;
+      }
+      output << '\n';
+    }
+
+    std::error_code error;
+    auto directory = std::filesystem::path(indexPath).parent_path();
+    std::filesystem::create_directories(directory, error);
+    auto temporaryPath = indexPath + "." + std::to_string(::getpid());
+    {
+      std::ofstream file(temporaryPath, std::ios::trunc);
+      if (!(file << output.str())) {
+        std::filesystem::remove(temporaryPath, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temporaryPath, indexPath, error);
+    if (error) {
+      std::filesystem::remove(temporaryPath, error);
+    }
+  }
+};
+
+#endif
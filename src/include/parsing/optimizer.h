@@ -0,0 +1,656 @@
+#ifndef KIWI_PARSING_OPTIMIZER_H
+#define KIWI_PARSING_OPTIMIZER_H
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "math/functions.h"
+#include "parsing/ast.h"
+#include "tracing/error.h"
+#include "typing/serializer.h"
+#include "typing/value.h"
+#include "globals.h"
+
+/*
+ * Rewrites a program between parsing and running it, so that work whose
+ * result is known from the source alone is done once rather than every time
+ * the code runs.
+ *
+ * - Operators and `to_string()` applied to literals are folded into the
+ *   literal they produce. An operation that would throw is left alone, so it
+ *   still throws when it runs.
+ * - A top-level `const` whose value is a literal is substituted into the
+ *   statements after it. Variables are looked up through the calling frames
+ *   before constants are, so this is only done for a name that no variable,
+ *   parameter, loop alias or struct in the program uses.
+ * - An `if` or ternary whose condition is a literal is replaced by the branch
+ *   it takes.
+ * - A list or hashmap literal made of nothing but literals is built once.
+ *   Each evaluation gets a copy that shares its storage until either side is
+ *   modified.
+ *
+ * The syntax tree cache keeps trees as they were parsed, and they are
+ * optimized every time they are loaded.
+ *
+ * Every tree is optimized through `prepare` just before it first runs. The
+ * script and the library files loaded up front are parsed into one program
+ * and optimized together, so a constant in a library is only substituted if
+ * the script does not bind its name either. Imported files and library files
+ * loaded on demand are separate trees and are optimized on their own.
+ */
+class KOptimizer {
+ public:
+  // Optimizes `program`, unless optimizing was turned off.
+  static void prepare(ProgramNode& program) {
+    if (!NOOPTIMIZEMODE) {
+      KOptimizer().optimize(program);
+    }
+  }
+
+  void optimize(ProgramNode& program) {
+    collecting = true;
+    visitBlock(program.statements);
+    collecting = false;
+    visitBlock(program.statements, true);
+  }
+
+ private:
+  using Block = std::vector<std::unique_ptr<ASTNode>>;
+
+  // Names a variable could be found under, which would hide a constant.
+  std::unordered_set<k_string> bound;
+  std::unordered_map<k_string, int> declarations;
+  std::unordered_map<k_string, KValue> constants;
+  bool collecting = false;
+  int targetDepth = 0;
+
+  // The first pass only collects names. The second rewrites the tree, and
+  // never looks inside assignment targets, which the interpreter reads by
+  // name rather than evaluating.
+  void visitBlock(Block& body, bool isTopLevel = false) {
+    if (collecting) {
+      for (auto& stmt : body) {
+        visit(stmt);
+      }
+      return;
+    }
+
+    Block statements;
+    statements.reserve(body.size());
+    for (size_t i = 0; i < body.size(); ++i) {
+      auto& stmt = body.at(i);
+      visit(stmt);
+
+      if (stmt && stmt->type == ASTNodeType::IF) {
+        auto* ifNode = static_cast<IfNode*>(stmt.get());
+        if (pruneBranches(*ifNode)) {
+          spliceBranch(statements, stmt, isTopLevel, i + 1 == body.size());
+          continue;
+        }
+      } else if (isTopLevel && stmt &&
+                 stmt->type == ASTNodeType::CONST_ASSIGNMENT) {
+        addConstant(static_cast<const ConstAssignmentNode*>(stmt.get()));
+      }
+
+      statements.push_back(std::move(stmt));
+    }
+    body = std::move(statements);
+  }
+
+  void visitTarget(std::unique_ptr<ASTNode>& node) {
+    if (collecting) {
+      ++targetDepth;
+      visit(node);
+      --targetDepth;
+    }
+  }
+
+  void bind(const k_string& name) {
+    if (collecting) {
+      bound.insert(name);
+    }
+  }
+
+  void bind(const std::unique_ptr<ASTNode>& node) {
+    if (node && node->type == ASTNodeType::IDENTIFIER) {
+      bind(static_cast<const IdentifierNode*>(node.get())->name);
+    }
+  }
+
+  void visitParameters(
+      std::vector<std::pair<k_string, std::unique_ptr<ASTNode>>>& parameters) {
+    for (auto& parameter : parameters) {
+      bind(parameter.first);
+      visit(parameter.second);
+    }
+  }
+
+  void visitArguments(Block& arguments) {
+    for (auto& argument : arguments) {
+      visit(argument);
+    }
+  }
+
+  void visit(std::unique_ptr<ASTNode>& node) {
+    if (!node) {
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::PROGRAM:
+        visitBlock(static_cast<ProgramNode*>(node.get())->statements);
+        break;
+
+      case ASTNodeType::IDENTIFIER: {
+        const auto& name = static_cast<IdentifierNode*>(node.get())->name;
+        if (collecting) {
+          if (targetDepth > 0) {
+            bind(name);
+          }
+        } else if (auto it = constants.find(name); it != constants.end()) {
+          replace(node, it->second);
+        }
+      } break;
+
+      case ASTNodeType::BINARY_OPERATION: {
+        auto* binary = static_cast<BinaryOperationNode*>(node.get());
+        visit(binary->left);
+        visit(binary->right);
+        foldBinary(node);
+      } break;
+
+      case ASTNodeType::UNARY_OPERATION: {
+        auto* unary = static_cast<UnaryOperationNode*>(node.get());
+        visit(unary->operand);
+        if (const auto* operand = getLiteral(unary->operand)) {
+          auto value = *operand;
+          fold(node, [&]() {
+            return MathImpl.do_unary_op(node->token, unary->op, value);
+          });
+        }
+      } break;
+
+      case ASTNodeType::TERNARY_OPERATION: {
+        auto* ternary = static_cast<TernaryOperationNode*>(node.get());
+        visit(ternary->evalExpression);
+        visit(ternary->trueExpression);
+        visit(ternary->falseExpression);
+        const auto* condition = getLiteral(ternary->evalExpression);
+        if (!collecting && condition) {
+          auto taken = MathImpl.is_truthy(*condition)
+                           ? std::move(ternary->trueExpression)
+                           : std::move(ternary->falseExpression);
+          if (taken) {
+            node = std::move(taken);
+          }
+        }
+      } break;
+
+      case ASTNodeType::LIST_LITERAL:
+        visitList(static_cast<ListLiteralNode*>(node.get()));
+        break;
+
+      case ASTNodeType::HASH_LITERAL:
+        visitHash(static_cast<HashLiteralNode*>(node.get()));
+        break;
+
+      case ASTNodeType::RANGE_LITERAL: {
+        auto* range = static_cast<RangeLiteralNode*>(node.get());
+        visit(range->rangeStart);
+        visit(range->rangeEnd);
+      } break;
+
+      case ASTNodeType::INDEX: {
+        // A nested index is resolved by looking at the nodes themselves.
+        auto* indexing = static_cast<IndexingNode*>(node.get());
+        visit(indexing->indexedObject);
+        if (indexing->indexExpression &&
+            indexing->indexExpression->type == ASTNodeType::INDEX) {
+          visitTarget(indexing->indexExpression);
+        } else {
+          visit(indexing->indexExpression);
+        }
+      } break;
+
+      case ASTNodeType::SLICE: {
+        auto* slice = static_cast<SliceNode*>(node.get());
+        visit(slice->slicedObject);
+        visit(slice->startExpression);
+        visit(slice->stopExpression);
+        visit(slice->stepExpression);
+      } break;
+
+      case ASTNodeType::RETURN: {
+        auto* ret = static_cast<ReturnNode*>(node.get());
+        visit(ret->returnValue);
+        visit(ret->condition);
+      } break;
+
+      case ASTNodeType::THROW: {
+        auto* thrown = static_cast<ThrowNode*>(node.get());
+        visit(thrown->errorValue);
+        visit(thrown->condition);
+      } break;
+
+      case ASTNodeType::EXIT: {
+        auto* exitNode = static_cast<ExitNode*>(node.get());
+        visit(exitNode->exitValue);
+        visit(exitNode->condition);
+      } break;
+
+      case ASTNodeType::PARSE:
+        visit(static_cast<ParseNode*>(node.get())->parseValue);
+        break;
+
+      case ASTNodeType::NEXT:
+        visit(static_cast<NextNode*>(node.get())->condition);
+        break;
+
+      case ASTNodeType::BREAK:
+        visit(static_cast<BreakNode*>(node.get())->condition);
+        break;
+
+      case ASTNodeType::PACKAGE:
+        visitBlock(static_cast<PackageNode*>(node.get())->body);
+        break;
+
+      case ASTNodeType::STRUCT: {
+        auto* structNode = static_cast<StructNode*>(node.get());
+        bind(structNode->name);
+        visitBlock(structNode->methods);
+      } break;
+
+      case ASTNodeType::PRINT:
+        visit(static_cast<PrintNode*>(node.get())->expression);
+        break;
+
+      case ASTNodeType::PRINTXY: {
+        auto* print = static_cast<PrintXyNode*>(node.get());
+        visit(print->expression);
+        visit(print->x);
+        visit(print->y);
+      } break;
+
+      case ASTNodeType::VARIABLE:
+        visitParameters(
+            static_cast<VariableDeclarationNode*>(node.get())->variables);
+        break;
+
+      case ASTNodeType::FUNCTION: {
+        auto* function = static_cast<FunctionDeclarationNode*>(node.get());
+        visitParameters(function->parameters);
+        visitBlock(function->body);
+      } break;
+
+      case ASTNodeType::LAMBDA: {
+        auto* lambda = static_cast<LambdaNode*>(node.get());
+        visitParameters(lambda->parameters);
+        visitBlock(lambda->body);
+      } break;
+
+      case ASTNodeType::FOR_LOOP: {
+        auto* loop = static_cast<ForLoopNode*>(node.get());
+        bind(loop->valueIterator);
+        bind(loop->indexIterator);
+        visit(loop->dataSet);
+        visitBlock(loop->body);
+      } break;
+
+      case ASTNodeType::WHILE_LOOP: {
+        auto* loop = static_cast<WhileLoopNode*>(node.get());
+        visit(loop->condition);
+        visitBlock(loop->body);
+      } break;
+
+      case ASTNodeType::REPEAT_LOOP: {
+        auto* loop = static_cast<RepeatLoopNode*>(node.get());
+        bind(loop->alias);
+        visit(loop->count);
+        visitBlock(loop->body);
+      } break;
+
+      case ASTNodeType::CASE: {
+        auto* caseNode = static_cast<CaseNode*>(node.get());
+        bind(caseNode->testValueAlias);
+        visit(caseNode->testValue);
+        for (auto& when : caseNode->whenNodes) {
+          visit(when->condition);
+          visitBlock(when->body);
+        }
+        visitBlock(caseNode->elseBody);
+      } break;
+
+      case ASTNodeType::IF:
+        visitIf(static_cast<IfNode*>(node.get()));
+        break;
+
+      case ASTNodeType::TRY: {
+        auto* tryNode = static_cast<TryNode*>(node.get());
+        bind(tryNode->errorType);
+        bind(tryNode->errorMessage);
+        visitBlock(tryNode->tryBody);
+        visitBlock(tryNode->catchBody);
+        visitBlock(tryNode->finallyBody);
+      } break;
+
+      case ASTNodeType::FUNCTION_CALL:
+        visitArguments(static_cast<FunctionCallNode*>(node.get())->arguments);
+        break;
+
+      case ASTNodeType::LAMBDA_CALL: {
+        auto* call = static_cast<LambdaCallNode*>(node.get());
+        visit(call->lambdaNode);
+        visitArguments(call->arguments);
+      } break;
+
+      case ASTNodeType::METHOD_CALL: {
+        auto* call = static_cast<MethodCallNode*>(node.get());
+        visit(call->object);
+        visitArguments(call->arguments);
+        foldToString(node);
+      } break;
+
+      case ASTNodeType::MEMBER_ACCESS:
+        visit(static_cast<MemberAccessNode*>(node.get())->object);
+        break;
+
+      case ASTNodeType::INDEX_ASSIGNMENT: {
+        auto* assignment = static_cast<IndexAssignmentNode*>(node.get());
+        visitTarget(assignment->object);
+        visit(assignment->initializer);
+      } break;
+
+      case ASTNodeType::MEMBER_ASSIGNMENT: {
+        auto* assignment = static_cast<MemberAssignmentNode*>(node.get());
+        visitTarget(assignment->object);
+        visit(assignment->initializer);
+      } break;
+
+      case ASTNodeType::PACK_ASSIGNMENT: {
+        auto* assignment = static_cast<PackAssignmentNode*>(node.get());
+        for (auto& target : assignment->left) {
+          visitTarget(target);
+        }
+        visitArguments(assignment->right);
+      } break;
+
+      case ASTNodeType::CONST_ASSIGNMENT: {
+        auto* assignment = static_cast<ConstAssignmentNode*>(node.get());
+        if (collecting) {
+          ++declarations[assignment->name];
+        }
+        visit(assignment->initializer);
+      } break;
+
+      case ASTNodeType::ASSIGNMENT: {
+        auto* assignment = static_cast<AssignmentNode*>(node.get());
+        bind(assignment->name);
+        visitTarget(assignment->left);
+        visit(assignment->initializer);
+      } break;
+
+      case ASTNodeType::SPAWN:
+        visit(static_cast<SpawnNode*>(node.get())->expression);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void visitIf(IfNode* node) {
+    visit(node->condition);
+    visitBlock(node->body);
+    for (auto& elseif : node->elseifNodes) {
+      visit(elseif->condition);
+      visitBlock(elseif->body);
+    }
+    visitBlock(node->elseBody);
+  }
+
+  void visitList(ListLiteralNode* node) {
+    for (auto& element : node->elements) {
+      visit(element);
+    }
+
+    if (collecting) {
+      return;
+    }
+
+    std::vector<KValue> values;
+    values.reserve(node->elements.size());
+    for (const auto& element : node->elements) {
+      const auto* value = getConstant(element);
+      if (!value) {
+        return;
+      }
+      values.push_back(*value);
+    }
+
+    node->constant = KValue::createList(make_ref<List>(std::move(values)));
+  }
+
+  void visitHash(HashLiteralNode* node) {
+    for (auto& element : node->elements) {
+      visit(element.first);
+      visit(element.second);
+    }
+
+    if (collecting) {
+      return;
+    }
+
+    // Like the interpreter, a repeated key keeps its first position and its
+    // last value.
+    auto hash = make_ref<Hashmap>();
+    for (const auto& element : node->elements) {
+      const auto* key = getConstant(element.first);
+      const auto* value = getConstant(element.second);
+      if (!key || !value) {
+        return;
+      }
+      hash->add(*key, *value);
+    }
+
+    node->constant = KValue::createHashmap(hash);
+  }
+
+  // Drops every branch of `node` whose condition is a literal that does not
+  // hold, and everything after the first one that does. Returns true if that
+  // leaves no condition to test, in which case `node->body` is the branch
+  // taken.
+  bool pruneBranches(IfNode& node) {
+    std::vector<std::unique_ptr<IfNode>> branches;
+    auto first = std::make_unique<IfNode>();
+    first->token = node.token;
+    first->condition = std::move(node.condition);
+    first->body = std::move(node.body);
+    branches.push_back(std::move(first));
+    for (auto& elseif : node.elseifNodes) {
+      branches.push_back(std::move(elseif));
+    }
+    node.elseifNodes.clear();
+
+    std::vector<std::unique_ptr<IfNode>> kept;
+    for (auto& branch : branches) {
+      const auto* condition = getLiteral(branch->condition);
+      if (!condition) {
+        kept.push_back(std::move(branch));
+      } else if (MathImpl.is_truthy(*condition)) {
+        node.elseBody = std::move(branch->body);
+        break;
+      }
+    }
+
+    if (kept.empty()) {
+      node.body = std::move(node.elseBody);
+      node.elseBody.clear();
+      return true;
+    }
+
+    node.condition = std::move(kept.front()->condition);
+    node.body = std::move(kept.front()->body);
+    for (size_t i = 1; i < kept.size(); ++i) {
+      node.elseifNodes.push_back(std::move(kept.at(i)));
+    }
+    return false;
+  }
+
+  // Puts the branch an `if` is known to take in its place. A top-level
+  // `return` ends the statement it is in, so a top-level branch of more than
+  // one statement stays together under an `if true`. The value of a body is
+  // the value of its last statement, and an `if` that runs no statements
+  // leaves an empty value in its place.
+  void spliceBranch(Block& statements, std::unique_ptr<ASTNode>& stmt,
+                    bool isTopLevel, bool isLast) {
+    auto* ifNode = static_cast<IfNode*>(stmt.get());
+    if (isTopLevel && ifNode->body.size() > 1) {
+      ifNode->condition = makeLiteral(KValue::createBoolean(true), stmt->token);
+      statements.push_back(std::move(stmt));
+      return;
+    }
+
+    if (ifNode->body.empty() && isLast) {
+      statements.push_back(makeLiteral(KValue(), stmt->token));
+    }
+
+    for (auto& branchStmt : ifNode->body) {
+      statements.push_back(std::move(branchStmt));
+    }
+  }
+
+  void addConstant(const ConstAssignmentNode* node) {
+    const auto& name = node->name;
+    const auto* value = getLiteral(node->initializer);
+    if (value && declarations[name] == 1 && bound.find(name) == bound.end()) {
+      constants[name] = *value;
+    }
+  }
+
+  void foldBinary(std::unique_ptr<ASTNode>& node) {
+    auto* binary = static_cast<BinaryOperationNode*>(node.get());
+    const auto& op = binary->op;
+    const auto* left = getLiteral(binary->left);
+    if (!left) {
+      return;
+    }
+
+    if (op == KName::Ops_And && !MathImpl.is_truthy(*left)) {
+      replace(node, KValue::createBoolean(false));
+      return;
+    } else if (op == KName::Ops_Or && MathImpl.is_truthy(*left)) {
+      replace(node, KValue::createBoolean(true));
+      return;
+    }
+
+    const auto* right = getLiteral(binary->right);
+    if (!right) {
+      return;
+    }
+
+    // A repeated string could be any length, so it is left until it runs.
+    if (op == KName::Ops_Multiply && (left->isString() || right->isString())) {
+      return;
+    }
+
+    auto leftValue = *left;
+    auto rightValue = *right;
+    fold(node, [&]() {
+      if (leftValue.getType() == rightValue.getType() &&
+          MathImpl.has_numeric_fast_path(op)) {
+        if (leftValue.isInteger()) {
+          return MathImpl.do_integer_op(node->token, op,
+                                        leftValue.getInteger(),
+                                        rightValue.getInteger());
+        } else if (leftValue.isFloat()) {
+          return MathImpl.do_float_op(node->token, op, leftValue.getFloat(),
+                                      rightValue.getFloat());
+        }
+      }
+      return MathImpl.do_binary_op(node->token, op, leftValue, rightValue);
+    });
+  }
+
+  // String interpolation calls `to_string()` on each value it inserts.
+  void foldToString(std::unique_ptr<ASTNode>& node) {
+    auto* call = static_cast<MethodCallNode*>(node.get());
+    if (call->op != KName::Builtin_Kiwi_ToS || !call->arguments.empty()) {
+      return;
+    }
+
+    if (const auto* value = getLiteral(call->object)) {
+      replace(node, KValue::createString(Serializer::serialize(*value)));
+    }
+  }
+
+  template <typename Operation>
+  void fold(std::unique_ptr<ASTNode>& node, Operation operation) {
+    if (collecting) {
+      return;
+    }
+
+    try {
+      auto value = operation();
+      if (isScalar(value)) {
+        replace(node, value);
+      }
+    } catch (const KiwiError&) {
+    }
+  }
+
+  void replace(std::unique_ptr<ASTNode>& node, const KValue& value) {
+    if (!collecting) {
+      node = makeLiteral(value, node->token);
+    }
+  }
+
+  static std::unique_ptr<ASTNode> makeLiteral(const KValue& value,
+                                              const Token& token) {
+    auto literal = std::make_unique<LiteralNode>(value);
+    literal->token = token;
+    return literal;
+  }
+
+  static bool isScalar(const KValue& value) {
+    return value.isInteger() || value.isFloat() || value.isBoolean() ||
+           value.isString() || value.isNull();
+  }
+
+  static const KValue* getLiteral(const std::unique_ptr<ASTNode>& node) {
+    if (!node || node->type != ASTNodeType::LITERAL) {
+      return nullptr;
+    }
+
+    const auto& value = static_cast<const LiteralNode*>(node.get())->value;
+    return isScalar(value) ? &value : nullptr;
+  }
+
+  // The value of a literal, or of a list or hashmap literal that is built
+  // once.
+  static const KValue* getConstant(const std::unique_ptr<ASTNode>& node) {
+    if (!node) {
+      return nullptr;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::LIST_LITERAL: {
+        const auto& value =
+            static_cast<const ListLiteralNode*>(node.get())->constant;
+        return value.isList() ? &value : nullptr;
+      }
+
+      case ASTNodeType::HASH_LITERAL: {
+        const auto& value =
+            static_cast<const HashLiteralNode*>(node.get())->constant;
+        return value.isHashmap() ? &value : nullptr;
+      }
+
+      default:
+        return getLiteral(node);
+    }
+  }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef KIWI_PARSING_PARSER_H
 #define KIWI_PARSING_PARSER_H
 
+#include <deque>
 #include <memory>
 #include <optional>
 
@@ -20,6 +21,13 @@ class Parser {
   std::unique_ptr<ASTNode> parseTokenStreamCollection(
       std::vector<k_stream> streams);
   std::unique_ptr<ASTNode> parseTokenStream(k_stream& stream, bool isScript);
+  bool parseTokenStreamInto(k_stream& stream, ProgramNode& root);
+
+  // The names mangled at the top level, which every file parsed after the one
+  // that declared them sees.
+  std::unordered_map<k_string, k_string>& getTopLevelNames() {
+    return getNameMap();
+  }
 
  private:
   bool rethrow = false;
@@ -92,60 +100,46 @@ class Parser {
 
   // Utility methods to help with token matching and advancing the stream
   // Instead of passing streams everywhere, I'm going to just keep it local to the parser.
-  Token next();
+  const Token& next();
   bool match(KTokenType expectedType);
   bool matchSubType(KName expectedSubType);
   bool lookAhead(std::vector<KName> names);
   void rewind();
   KTokenType tokenType();
   KName tokenName();
-  Token peek();
+  const Token& peek();
 
   Token kToken = Token::createEmpty();
   k_stream kStream;
-  Token getErrorToken();
-  std::stack<std::unordered_map<k_string, k_string>> mangledNameStack;
+  const Token& getErrorToken();
+  // A deque, because callers keep references to scopes while more are pushed.
+  std::deque<std::unordered_map<k_string, k_string>> mangledNameStack;
 
   std::unordered_map<k_string, k_string>& getNameMap() {
     if (mangledNameStack.empty()) {
       return pushNameStack();
     }
 
-    return mangledNameStack.top();
-  }
-
-  bool hasName(const k_string& name) {
-    std::stack<std::unordered_map<k_string, k_string>> nameStack(
-        mangledNameStack);
-    while (!nameStack.empty()) {
-      const auto& names = nameStack.top();
-      if (names.find(name) != names.end()) {
-        return true;
-      }
-      nameStack.pop();
-    }
-
-    return false;
+    return mangledNameStack.back();
   }
 
-  const k_string getName(const k_string& name) {
-    std::stack<std::unordered_map<k_string, k_string>> nameStack(
-        mangledNameStack);
-    while (!nameStack.empty()) {
-      const auto& names = nameStack.top();
-      if (names.find(name) != names.end()) {
-        return names.at(name);
+  // Returns the mangled name `name` has in the innermost scope that declares
+  // it, or null if none does.
+  const k_string* findName(const k_string& name) const {
+    for (auto it = mangledNameStack.rbegin(); it != mangledNameStack.rend();
+         ++it) {
+      auto found = it->find(name);
+      if (found != it->end()) {
+        return &found->second;
       }
-      nameStack.pop();
     }
 
-    return {};
+    return nullptr;
   }
 
   std::unordered_map<k_string, k_string>& pushNameStack() {
-    std::unordered_map<k_string, k_string> emptyMap;
-    mangledNameStack.push(emptyMap);
-    return mangledNameStack.top();
+    mangledNameStack.emplace_back();
+    return mangledNameStack.back();
   }
 
   void popNameStack() {
@@ -153,7 +147,7 @@ class Parser {
       return;
     }
 
-    mangledNameStack.pop();
+    mangledNameStack.pop_back();
   }
 };
 
@@ -165,7 +159,7 @@ KName Parser::tokenName() {
   return kToken.getSubType();
 }
 
-Token Parser::peek() {
+const Token& Parser::peek() {
   return kStream->peek();
 }
 
@@ -174,28 +168,21 @@ void Parser::rewind() {
   kToken = kStream->current();
 }
 
+// Returns true if the tokens `names` follow within a few tokens of the
+// current one.
 bool Parser::lookAhead(std::vector<KName> names) {
-  size_t pos = kStream->position;
-  size_t nameLength = names.size();
-  size_t jumps = pos;
   const size_t jump_threshold = 10;
+  size_t start = kStream->position;
+  size_t nameLength = names.size();
 
-  for (; pos + 1 < kStream->size(); ++pos) {
-    size_t matches = 0;
-
-    for (size_t i = 0; i < nameLength; ++i) {
-      if (kStream->at(pos + i).getSubType() == names.at(i)) {
-        ++matches;
-      } else {
-        --matches;
-      }
+  for (size_t pos = start;
+       pos <= start + jump_threshold && pos + 1 < kStream->size(); ++pos) {
+    size_t i = 0;
+    while (i < nameLength && kStream->at(pos + i).getSubType() == names.at(i)) {
+      ++i;
     }
 
-    if (matches == nameLength) {
-      jumps = pos - jumps;
-      if (jumps > jump_threshold) {
-        return false;
-      }
+    if (i == nameLength) {
       return true;
     }
   }
@@ -203,13 +190,13 @@ bool Parser::lookAhead(std::vector<KName> names) {
   return false;
 }
 
-Token Parser::next() {
+const Token& Parser::next() {
   kStream->next();
   kToken = kStream->current();
   return kToken;
 }
 
-Token Parser::getErrorToken() {
+const Token& Parser::getErrorToken() {
   if (tokenType() != KTokenType::STREAM_END) {
     return kToken;
   }
@@ -262,32 +249,42 @@ std::unique_ptr<ASTNode> Parser::parseTokenStreamCollection(
   auto root = std::make_unique<ProgramNode>();
   bool isRootTokenSet = false;
 
-  for (const auto& stream : streams) {
-    kStream = std::move(stream);
-    kToken = kStream->current();
-
+  for (auto& stream : streams) {
     if (!isRootTokenSet) {
-      root->token = kToken;
+      root->token = stream->current();
       isRootTokenSet = true;
     }
 
-    try {
-      while (tokenType() != KTokenType::STREAM_END) {
-        auto statement = parseStatement();
-        if (statement) {
-          root->statements.push_back(std::move(statement));
-        }
-      }
-    } catch (const KiwiError& e) {
-      if (rethrow) {
-        throw;
-      }
+    parseTokenStreamInto(stream, *root);
+  }
 
-      ErrorHandler::handleError(e);
+  return root;
+}
+
+// Parses one file of a program, appending its statements to `root`. Returns
+// false if the file has a syntax error.
+bool Parser::parseTokenStreamInto(k_stream& stream, ProgramNode& root) {
+  kStream = stream;
+  kToken = kStream->current();
+  root.text.push_back(kStream->text);
+
+  try {
+    while (tokenType() != KTokenType::STREAM_END) {
+      auto statement = parseStatement();
+      if (statement) {
+        root.statements.push_back(std::move(statement));
+      }
+    }
+  } catch (const KiwiError& e) {
+    if (rethrow) {
+      throw;
     }
+
+    ErrorHandler::handleError(e);
+    return false;
   }
 
-  return root;
+  return true;
 }
 
 std::unique_ptr<ASTNode> Parser::parseTokenStream(k_stream& stream,
@@ -297,6 +294,7 @@ std::unique_ptr<ASTNode> Parser::parseTokenStream(k_stream& stream,
 
   auto root = std::make_unique<ProgramNode>();
   root->isScript = isScript;
+  root->text.push_back(kStream->text);
 
   try {
     while (tokenType() != KTokenType::STREAM_END) {
@@ -1439,13 +1437,14 @@ std::unique_ptr<ASTNode> Parser::parseLiteral() {
   }
 
   auto literalNode = std::make_unique<LiteralNode>();
-  literalNode->value = KValue::create(kToken.getValue());
+  literalNode->value = kToken.getValue();
   next();  // Consume literal
   return literalNode;
 }
 
 std::unique_ptr<ASTNode> Parser::parseHashLiteral() {
-  std::map<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>> elements;
+  std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>>
+      elements;
   std::vector<k_string> keys;
 
   match(KTokenType::OPEN_BRACE);  // Consume '{'
@@ -1469,7 +1468,7 @@ std::unique_ptr<ASTNode> Parser::parseHashLiteral() {
     keys.push_back(keyString);
 
     auto value = parseExpression();
-    elements.emplace(std::move(key), std::move(value));
+    elements.emplace_back(std::move(key), std::move(value));
 
     if (tokenType() == KTokenType::COMMA) {
       next();  // Consume ','
@@ -1688,8 +1687,8 @@ std::unique_ptr<ASTNode> Parser::parsePackAssignment(
     }
 
     auto identifierName = kToken.getText();
-    if (hasName(identifierName)) {
-      identifierName = getName(identifierName);
+    if (const auto* mangled = findName(identifierName)) {
+      identifierName = *mangled;
     }
     next();
 
@@ -1847,8 +1846,8 @@ std::unique_ptr<ASTNode> Parser::parseIdentifier(bool packed, bool lenient) {
   auto type = tokenName();
   auto identifierName = (isInstance ? "@" : "") + kToken.getText();
 
-  if (hasName(identifierName)) {
-    identifierName = getName(identifierName);
+  if (const auto* mangled = findName(identifierName)) {
+    identifierName = *mangled;
   }
 
   next();
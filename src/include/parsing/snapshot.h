@@ -0,0 +1,1199 @@
+#ifndef KIWI_PARSING_SNAPSHOT_H
+#define KIWI_PARSING_SNAPSHOT_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "globals.h"
+#include "parsing/ast.h"
+#include "parsing/lexer.h"
+#include "parsing/parser.h"
+#include "tracing/fileregistry.h"
+#include "util/file.h"
+
+const Token snapshotToken = Token::createExternal();
+
+/*
+ * A binary copy of the syntax tree parsed from one source file, so that later
+ * runs can skip lexing and parsing it.
+ *
+ * Snapshots are kept in `$KIWI_CACHE_DIR`, or `$XDG_CACHE_HOME/kiwi`, or
+ * `~/.cache/kiwi`, one per source file. A snapshot is only used while the
+ * file's size and modification time and the interpreter version match the
+ * ones it was written for.
+ *
+ * Top-level `var` declarations mangle names in every file parsed after them,
+ * so a snapshot also records the top-level names it was parsed with and the
+ * ones it left behind. A file is parsed again whenever the files before it
+ * were.
+ *
+ * A snapshot is mapped into memory and read in one pass. The only fixup is
+ * giving its tokens the identifier their file has in this run.
+ */
+class KSnapshot {
+ public:
+  using NameMap = std::unordered_map<k_string, k_string>;
+
+  // Appends the statements of the source file at `path` to `root`, from its
+  // snapshot if it has a current one. Otherwise the file is parsed with
+  // `parser` and, if it has no syntax errors, a snapshot is written for next
+  // time. Returns false if the file is empty.
+  static bool parseFile(Parser& parser, const k_string& path,
+                        ProgramNode& root) {
+    auto& names = parser.getTopLevelNames();
+    KSnapshot snapshot(path, names);
+    if (snapshot.load(root, names)) {
+      return true;
+    }
+
+    auto content = File::readFile(snapshotToken, path);
+    if (content.empty()) {
+      return false;
+    }
+
+    Lexer lexer(path, content);
+    auto tokenStream = lexer.getTokenStream();
+    auto first = root.statements.size();
+    if (parser.parseTokenStreamInto(tokenStream, root)) {
+      snapshot.store(root.statements, first, names);
+    }
+
+    return true;
+  }
+
+  // Returns where the cache keeps a file of the given kind for `key`, or an
+  // empty string if caching is turned off.
+  static k_string getCachePath(const k_string& key, const k_string& kind) {
+    if (NOCACHEMODE) {
+      return "";
+    }
+
+    auto directory = getCacheDirectory();
+    if (directory.empty()) {
+      return "";
+    }
+
+    uint64_t keyHash = 0;
+    hash(keyHash, key);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.",
+                  static_cast<unsigned long long>(keyHash));
+    return File::joinPath(directory, name + kind);
+  }
+
+  static int64_t getModified(const struct stat& info) {
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+           info.st_mtim.tv_nsec;
+  }
+
+ private:
+  static const uint32_t Magic = 0x5453414b;  // "KAST"
+  static const uint32_t Format = 1;
+
+  // Marks a token that belongs to the snapshot's own file.
+  static const int32_t OwnFile = -2;
+  // Stands in for a missing child node.
+  static const uint8_t NoNode = 0xff;
+
+  k_string path;
+  k_string snapshotPath;
+  int64_t modified = 0;
+  uint64_t size = 0;
+  uint64_t namesHash = 0;
+
+  KSnapshot(const k_string& path, const NameMap& names) : path(path) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) {
+      return;
+    }
+
+    modified = getModified(info);
+    size = static_cast<uint64_t>(info.st_size);
+    namesHash = hashNames(names);
+    snapshotPath = getCachePath(path, "kast");
+  }
+
+  static k_string getCacheDirectory() {
+    if (const auto* directory = std::getenv("KIWI_CACHE_DIR")) {
+      return directory;
+    }
+
+    if (const auto* cache = std::getenv("XDG_CACHE_HOME")) {
+      if (*cache != '\0') {
+        return File::joinPath(cache, "kiwi");
+      }
+    }
+
+    if (const auto* home = std::getenv("HOME")) {
+      if (*home != '\0') {
+        return File::joinPath(File::joinPath(home, ".cache"), "kiwi");
+      }
+    }
+
+    return "";
+  }
+
+  // FNV-1a, which gives the same hash in every run.
+  static void hash(uint64_t& seed, const k_string& text) {
+    if (seed == 0) {
+      seed = 0xcbf29ce484222325ULL;
+    }
+
+    for (unsigned char c : text) {
+      seed = (seed ^ c) * 0x100000001b3ULL;
+    }
+    seed = (seed ^ 0xff) * 0x100000001b3ULL;
+  }
+
+  static uint64_t hashNames(const NameMap& names) {
+    std::map<k_string, k_string> sorted(names.begin(), names.end());
+    uint64_t seed = 0;
+    hash(seed, k_string());
+    for (const auto& name : sorted) {
+      hash(seed, name.first);
+      hash(seed, name.second);
+    }
+    return seed;
+  }
+
+  class Writer {
+   public:
+    std::string bytes;
+    bool failed = false;
+
+    explicit Writer(int fileId) : fileId(fileId) {}
+
+    template <typename T>
+    void scalar(T value) {
+      bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void string(const k_string& text) {
+      scalar<uint32_t>(static_cast<uint32_t>(text.size()));
+      bytes.append(text);
+    }
+
+    void names(const NameMap& names) {
+      scalar<uint32_t>(static_cast<uint32_t>(names.size()));
+      for (const auto& name : names) {
+        string(name.first);
+        string(name.second);
+      }
+    }
+
+    void typeHints(const std::unordered_map<k_string, KName>& hints) {
+      scalar<uint32_t>(static_cast<uint32_t>(hints.size()));
+      for (const auto& hint : hints) {
+        string(hint.first);
+        scalar<uint32_t>(static_cast<uint32_t>(hint.second));
+      }
+    }
+
+    void parameters(
+        const std::vector<std::pair<k_string, std::unique_ptr<ASTNode>>>&
+            params) {
+      scalar<uint32_t>(static_cast<uint32_t>(params.size()));
+      for (const auto& param : params) {
+        string(param.first);
+        node(param.second.get());
+      }
+    }
+
+    void token(const Token& token) {
+      auto file = token.getFile();
+      // Most nodes keep the default token, so it gets a single byte.
+      bool external = file == -1 && token.getType() == KTokenType::ENDOFFILE &&
+                      token.getText().empty();
+      scalar<uint8_t>(external ? 0 : 1);
+      if (external) {
+        return;
+      }
+
+      scalar<uint8_t>(static_cast<uint8_t>(token.getType()));
+      scalar<uint32_t>(static_cast<uint32_t>(token.getSubType()));
+      scalar<int32_t>(file == fileId ? OwnFile : file);
+      string(token.getText());
+      scalar<int32_t>(token.getLineNumber());
+      scalar<int32_t>(token.getLinePosition());
+    }
+
+    void value(const KValue& value) {
+      if (value.isNull()) {
+        scalar<uint8_t>(0);
+      } else if (value.isInteger()) {
+        scalar<uint8_t>(1);
+        scalar<k_int>(value.getInteger());
+      } else if (value.isFloat()) {
+        scalar<uint8_t>(2);
+        scalar<double>(value.getFloat());
+      } else if (value.isBoolean()) {
+        scalar<uint8_t>(3);
+        scalar<uint8_t>(value.getBoolean() ? 1 : 0);
+      } else if (value.isString()) {
+        scalar<uint8_t>(4);
+        string(value.getString());
+      } else {
+        failed = true;
+      }
+    }
+
+    template <typename T>
+    void nodes(const std::vector<std::unique_ptr<T>>& list) {
+      scalar<uint32_t>(static_cast<uint32_t>(list.size()));
+      for (const auto& item : list) {
+        node(item.get());
+      }
+    }
+
+    void node(const ASTNode* node);
+
+   private:
+    int fileId;
+  };
+
+  class Reader {
+   public:
+    bool failed = false;
+
+    Reader(const char* data, size_t size, int fileId, KTokenText& text)
+        : data(data), size(size), fileId(fileId), text(text) {}
+
+    template <typename T>
+    T scalar() {
+      T value{};
+      if (pos + sizeof(T) > size) {
+        failed = true;
+        return value;
+      }
+      std::memcpy(&value, data + pos, sizeof(T));
+      pos += sizeof(T);
+      return value;
+    }
+
+    k_string string() {
+      auto length = scalar<uint32_t>();
+      if (pos + length > size) {
+        failed = true;
+        return {};
+      }
+      k_string text(data + pos, length);
+      pos += length;
+      return text;
+    }
+
+    NameMap names() {
+      NameMap names;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        auto name = string();
+        names[name] = string();
+      }
+      return names;
+    }
+
+    std::unordered_map<k_string, KName> typeHints() {
+      std::unordered_map<k_string, KName> hints;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        auto name = string();
+        hints[name] = static_cast<KName>(scalar<uint32_t>());
+      }
+      return hints;
+    }
+
+    std::vector<std::pair<k_string, std::unique_ptr<ASTNode>>> parameters() {
+      std::vector<std::pair<k_string, std::unique_ptr<ASTNode>>> params;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        auto name = string();
+        params.emplace_back(name, node());
+      }
+      return params;
+    }
+
+    Token token() {
+      if (scalar<uint8_t>() == 0) {
+        return astToken;
+      }
+
+      auto type = static_cast<KTokenType>(scalar<uint8_t>());
+      auto subType = static_cast<KName>(scalar<uint32_t>());
+      auto file = scalar<int32_t>();
+      auto tokenText = text.intern(string());
+      auto line = scalar<int32_t>();
+      auto position = scalar<int32_t>();
+      return Token::create(type, subType, file == OwnFile ? fileId : file,
+                           tokenText, line, position);
+    }
+
+    KValue value() {
+      switch (scalar<uint8_t>()) {
+        case 0:
+          return KValue::createNull();
+        case 1:
+          return KValue::createInteger(scalar<k_int>());
+        case 2:
+          return KValue::createFloat(scalar<double>());
+        case 3:
+          return KValue::createBoolean(scalar<uint8_t>() != 0);
+        case 4:
+          return KValue::createString(string());
+        default:
+          failed = true;
+          return {};
+      }
+    }
+
+    std::vector<std::unique_ptr<ASTNode>> nodes() {
+      std::vector<std::unique_ptr<ASTNode>> list;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        list.push_back(node());
+      }
+      return list;
+    }
+
+    // Reads a list of nodes that must all be of one type.
+    template <typename T>
+    std::vector<std::unique_ptr<T>> nodesOf(ASTNodeType type) {
+      std::vector<std::unique_ptr<T>> list;
+      for (auto& item : nodes()) {
+        if (!item || item->type != type) {
+          failed = true;
+          break;
+        }
+        list.emplace_back(static_cast<T*>(item.release()));
+      }
+      return list;
+    }
+
+    std::unique_ptr<ASTNode> node();
+
+   private:
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+    int fileId;
+    KTokenText& text;
+  };
+
+  bool load(ProgramNode& root, NameMap& names) const {
+    if (snapshotPath.empty()) {
+      return false;
+    }
+
+    auto fd = ::open(snapshotPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+      return false;
+    }
+
+    auto fileId = FileRegistry::getInstance().registerFile(path);
+    auto text = std::make_shared<KTokenText>();
+    Reader reader(static_cast<const char*>(mapped),
+                  static_cast<size_t>(info.st_size), fileId, *text);
+
+    bool current = reader.scalar<uint32_t>() == Magic &&
+                   reader.scalar<uint32_t>() == Format &&
+                   reader.string() == kiwi_version &&
+                   reader.string() == path &&
+                   reader.scalar<int64_t>() == modified &&
+                   reader.scalar<uint64_t>() == size &&
+                   reader.scalar<uint64_t>() == namesHash;
+
+    NameMap namesAfter;
+    std::vector<std::unique_ptr<ASTNode>> nodes;
+    if (current) {
+      namesAfter = reader.names();
+      nodes = reader.nodes();
+    }
+
+    ::munmap(mapped, static_cast<size_t>(info.st_size));
+
+    if (!current || reader.failed) {
+      return false;
+    }
+
+    root.text.push_back(std::move(text));
+    for (auto& node : nodes) {
+      root.statements.push_back(std::move(node));
+    }
+    names = std::move(namesAfter);
+    return true;
+  }
+
+  void store(const std::vector<std::unique_ptr<ASTNode>>& statements,
+             size_t first, const NameMap& names) const {
+    if (snapshotPath.empty()) {
+      return;
+    }
+
+    Writer writer(FileRegistry::getInstance().getFileId(path));
+    writer.scalar<uint32_t>(Magic);
+    writer.scalar<uint32_t>(Format);
+    writer.string(kiwi_version);
+    writer.string(path);
+    writer.scalar<int64_t>(modified);
+    writer.scalar<uint64_t>(size);
+    writer.scalar<uint64_t>(namesHash);
+    writer.names(names);
+    writer.scalar<uint32_t>(static_cast<uint32_t>(statements.size() - first));
+    for (size_t i = first; i < statements.size(); ++i) {
+      writer.node(statements[i].get());
+    }
+
+    if (writer.failed) {
+      return;
+    }
+
+    // Write to a file of our own and rename it, so that a run starting at the
+    // same time never reads half a snapshot.
+    std::error_code error;
+    auto directory = File::getParentPath(snapshotToken, snapshotPath);
+    std::filesystem::create_directories(directory, error);
+    auto temporaryPath = snapshotPath + "." + std::to_string(::getpid());
+    {
+      std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+      if (!output.write(writer.bytes.data(), writer.bytes.size())) {
+        std::filesystem::remove(temporaryPath, error);
+        return;
+      }
+    }
+    std::filesystem::rename(temporaryPath, snapshotPath, error);
+    if (error) {
+      std::filesystem::remove(temporaryPath, error);
+    }
+  }
+};
+
+void KSnapshot::Writer::node(const ASTNode* node) {
+  if (node == nullptr) {
+    scalar<uint8_t>(NoNode);
+    return;
+  }
+
+  scalar<uint8_t>(static_cast<uint8_t>(node->type));
+  token(node->token);
+
+  switch (node->type) {
+    case ASTNodeType::ASSIGNMENT: {
+      auto n = static_cast<const AssignmentNode*>(node);
+      this->node(n->left.get());
+      string(n->name);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->initializer.get());
+      break;
+    }
+
+    case ASTNodeType::BINARY_OPERATION: {
+      auto n = static_cast<const BinaryOperationNode*>(node);
+      this->node(n->left.get());
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->right.get());
+      break;
+    }
+
+    case ASTNodeType::BREAK:
+      this->node(static_cast<const BreakNode*>(node)->condition.get());
+      break;
+
+    case ASTNodeType::CASE: {
+      auto n = static_cast<const CaseNode*>(node);
+      this->node(n->testValue.get());
+      this->node(n->testValueAlias.get());
+      nodes(n->elseBody);
+      nodes(n->whenNodes);
+      break;
+    }
+
+    case ASTNodeType::CASE_WHEN: {
+      auto n = static_cast<const CaseWhenNode*>(node);
+      this->node(n->condition.get());
+      nodes(n->body);
+      break;
+    }
+
+    case ASTNodeType::CONST_ASSIGNMENT: {
+      auto n = static_cast<const ConstAssignmentNode*>(node);
+      string(n->name);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->initializer.get());
+      break;
+    }
+
+    case ASTNodeType::EXIT: {
+      auto n = static_cast<const ExitNode*>(node);
+      this->node(n->exitValue.get());
+      this->node(n->condition.get());
+      break;
+    }
+
+    case ASTNodeType::EXPORT:
+      this->node(static_cast<const ExportNode*>(node)->packageName.get());
+      break;
+
+    case ASTNodeType::FOR_LOOP: {
+      auto n = static_cast<const ForLoopNode*>(node);
+      this->node(n->dataSet.get());
+      this->node(n->valueIterator.get());
+      this->node(n->indexIterator.get());
+      nodes(n->body);
+      break;
+    }
+
+    case ASTNodeType::SPAWN:
+      this->node(static_cast<const SpawnNode*>(node)->expression.get());
+      break;
+
+    case ASTNodeType::FUNCTION_CALL: {
+      auto n = static_cast<const FunctionCallNode*>(node);
+      string(n->functionName);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      nodes(n->arguments);
+      break;
+    }
+
+    case ASTNodeType::FUNCTION: {
+      auto n = static_cast<const FunctionDeclarationNode*>(node);
+      string(n->name);
+      parameters(n->parameters);
+      nodes(n->body);
+      typeHints(n->typeHints);
+      scalar<uint32_t>(static_cast<uint32_t>(n->returnTypeHint));
+      scalar<uint8_t>(n->isStatic ? 1 : 0);
+      scalar<uint8_t>(n->isPrivate ? 1 : 0);
+      break;
+    }
+
+    case ASTNodeType::HASH_LITERAL: {
+      auto n = static_cast<const HashLiteralNode*>(node);
+      scalar<uint32_t>(static_cast<uint32_t>(n->elements.size()));
+      for (const auto& element : n->elements) {
+        this->node(element.first.get());
+        this->node(element.second.get());
+      }
+      scalar<uint32_t>(static_cast<uint32_t>(n->keys.size()));
+      for (const auto& key : n->keys) {
+        string(key);
+      }
+      break;
+    }
+
+    case ASTNodeType::IDENTIFIER: {
+      auto n = static_cast<const IdentifierNode*>(node);
+      string(n->name);
+      string(n->package);
+      break;
+    }
+
+    case ASTNodeType::IF: {
+      auto n = static_cast<const IfNode*>(node);
+      this->node(n->condition.get());
+      nodes(n->body);
+      nodes(n->elseBody);
+      nodes(n->elseifNodes);
+      break;
+    }
+
+    case ASTNodeType::IMPORT:
+      this->node(static_cast<const ImportNode*>(node)->packageName.get());
+      break;
+
+    case ASTNodeType::INDEX_ASSIGNMENT: {
+      auto n = static_cast<const IndexAssignmentNode*>(node);
+      this->node(n->object.get());
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->initializer.get());
+      break;
+    }
+
+    case ASTNodeType::INDEX: {
+      auto n = static_cast<const IndexingNode*>(node);
+      this->node(n->indexedObject.get());
+      string(n->name);
+      this->node(n->indexExpression.get());
+      break;
+    }
+
+    case ASTNodeType::LAMBDA: {
+      auto n = static_cast<const LambdaNode*>(node);
+      parameters(n->parameters);
+      nodes(n->body);
+      typeHints(n->typeHints);
+      scalar<uint32_t>(static_cast<uint32_t>(n->returnTypeHint));
+      break;
+    }
+
+    case ASTNodeType::LAMBDA_CALL: {
+      auto n = static_cast<const LambdaCallNode*>(node);
+      this->node(n->lambdaNode.get());
+      nodes(n->arguments);
+      break;
+    }
+
+    case ASTNodeType::LIST_LITERAL:
+      nodes(static_cast<const ListLiteralNode*>(node)->elements);
+      break;
+
+    case ASTNodeType::LITERAL:
+      value(static_cast<const LiteralNode*>(node)->value);
+      break;
+
+    case ASTNodeType::MEMBER_ACCESS: {
+      auto n = static_cast<const MemberAccessNode*>(node);
+      this->node(n->object.get());
+      string(n->memberName);
+      break;
+    }
+
+    case ASTNodeType::MEMBER_ASSIGNMENT: {
+      auto n = static_cast<const MemberAssignmentNode*>(node);
+      this->node(n->object.get());
+      string(n->memberName);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->initializer.get());
+      break;
+    }
+
+    case ASTNodeType::METHOD_CALL: {
+      auto n = static_cast<const MethodCallNode*>(node);
+      this->node(n->object.get());
+      string(n->methodName);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      nodes(n->arguments);
+      break;
+    }
+
+    case ASTNodeType::NEXT:
+      this->node(static_cast<const NextNode*>(node)->condition.get());
+      break;
+
+    case ASTNodeType::NO_OP:
+      break;
+
+    case ASTNodeType::PACK_ASSIGNMENT: {
+      auto n = static_cast<const PackAssignmentNode*>(node);
+      nodes(n->left);
+      nodes(n->right);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      break;
+    }
+
+    case ASTNodeType::PACKAGE: {
+      auto n = static_cast<const PackageNode*>(node);
+      this->node(n->packageName.get());
+      nodes(n->body);
+      break;
+    }
+
+    case ASTNodeType::PARSE:
+      this->node(static_cast<const ParseNode*>(node)->parseValue.get());
+      break;
+
+    case ASTNodeType::PRINT: {
+      auto n = static_cast<const PrintNode*>(node);
+      this->node(n->expression.get());
+      scalar<uint8_t>(n->printNewline ? 1 : 0);
+      scalar<uint8_t>(n->printStdError ? 1 : 0);
+      break;
+    }
+
+    case ASTNodeType::PRINTXY: {
+      auto n = static_cast<const PrintXyNode*>(node);
+      this->node(n->expression.get());
+      this->node(n->x.get());
+      this->node(n->y.get());
+      break;
+    }
+
+    case ASTNodeType::PROGRAM: {
+      auto n = static_cast<const ProgramNode*>(node);
+      nodes(n->statements);
+      scalar<uint8_t>(n->isScript ? 1 : 0);
+      break;
+    }
+
+    case ASTNodeType::RANGE_LITERAL: {
+      auto n = static_cast<const RangeLiteralNode*>(node);
+      this->node(n->rangeStart.get());
+      this->node(n->rangeEnd.get());
+      break;
+    }
+
+    case ASTNodeType::REPEAT_LOOP: {
+      auto n = static_cast<const RepeatLoopNode*>(node);
+      this->node(n->count.get());
+      this->node(n->alias.get());
+      nodes(n->body);
+      break;
+    }
+
+    case ASTNodeType::RETURN: {
+      auto n = static_cast<const ReturnNode*>(node);
+      this->node(n->returnValue.get());
+      this->node(n->condition.get());
+      break;
+    }
+
+    case ASTNodeType::SELF:
+      string(static_cast<const SelfNode*>(node)->name);
+      break;
+
+    case ASTNodeType::SLICE: {
+      auto n = static_cast<const SliceNode*>(node);
+      this->node(n->slicedObject.get());
+      this->node(n->startExpression.get());
+      this->node(n->stopExpression.get());
+      this->node(n->stepExpression.get());
+      break;
+    }
+
+    case ASTNodeType::STRUCT: {
+      auto n = static_cast<const StructNode*>(node);
+      string(n->name);
+      string(n->baseStruct);
+      scalar<uint32_t>(static_cast<uint32_t>(n->interfaces.size()));
+      for (const auto& interface : n->interfaces) {
+        string(interface);
+      }
+      nodes(n->methods);
+      break;
+    }
+
+    case ASTNodeType::TERNARY_OPERATION: {
+      auto n = static_cast<const TernaryOperationNode*>(node);
+      this->node(n->evalExpression.get());
+      this->node(n->trueExpression.get());
+      this->node(n->falseExpression.get());
+      break;
+    }
+
+    case ASTNodeType::THROW: {
+      auto n = static_cast<const ThrowNode*>(node);
+      this->node(n->errorValue.get());
+      this->node(n->condition.get());
+      break;
+    }
+
+    case ASTNodeType::TRY: {
+      auto n = static_cast<const TryNode*>(node);
+      nodes(n->tryBody);
+      nodes(n->catchBody);
+      nodes(n->finallyBody);
+      this->node(n->errorType.get());
+      this->node(n->errorMessage.get());
+      break;
+    }
+
+    case ASTNodeType::UNARY_OPERATION: {
+      auto n = static_cast<const UnaryOperationNode*>(node);
+      scalar<uint32_t>(static_cast<uint32_t>(n->op));
+      this->node(n->operand.get());
+      break;
+    }
+
+    case ASTNodeType::VARIABLE: {
+      auto n = static_cast<const VariableDeclarationNode*>(node);
+      parameters(n->variables);
+      typeHints(n->typeHints);
+      break;
+    }
+
+    case ASTNodeType::WHILE_LOOP: {
+      auto n = static_cast<const WhileLoopNode*>(node);
+      this->node(n->condition.get());
+      nodes(n->body);
+      break;
+    }
+
+    default:
+      failed = true;
+      break;
+  }
+}
+
+std::unique_ptr<ASTNode> KSnapshot::Reader::node() {
+  auto tag = scalar<uint8_t>();
+  if (tag == NoNode || failed) {
+    return nullptr;
+  }
+
+  auto nodeToken = token();
+  std::unique_ptr<ASTNode> result;
+
+  switch (static_cast<ASTNodeType>(tag)) {
+    case ASTNodeType::ASSIGNMENT: {
+      auto left = node();
+      auto name = string();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<AssignmentNode>(std::move(left), name, op,
+                                                node());
+      break;
+    }
+
+    case ASTNodeType::BINARY_OPERATION: {
+      auto left = node();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result =
+          std::make_unique<BinaryOperationNode>(std::move(left), op, node());
+      break;
+    }
+
+    case ASTNodeType::BREAK:
+      result = std::make_unique<BreakNode>(node());
+      break;
+
+    case ASTNodeType::CASE: {
+      auto n = std::make_unique<CaseNode>();
+      n->testValue = node();
+      n->testValueAlias = node();
+      n->elseBody = nodes();
+      n->whenNodes = nodesOf<CaseWhenNode>(ASTNodeType::CASE_WHEN);
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::CASE_WHEN: {
+      auto n = std::make_unique<CaseWhenNode>();
+      n->condition = node();
+      n->body = nodes();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::CONST_ASSIGNMENT: {
+      auto name = string();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<ConstAssignmentNode>(name, op, node());
+      break;
+    }
+
+    case ASTNodeType::EXIT: {
+      auto exitValue = node();
+      result = std::make_unique<ExitNode>(std::move(exitValue), node());
+      break;
+    }
+
+    case ASTNodeType::EXPORT:
+      result = std::make_unique<ExportNode>(node());
+      break;
+
+    case ASTNodeType::FOR_LOOP: {
+      auto n = std::make_unique<ForLoopNode>();
+      n->dataSet = node();
+      n->valueIterator = node();
+      n->indexIterator = node();
+      n->body = nodes();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::SPAWN:
+      result = std::make_unique<SpawnNode>(node());
+      break;
+
+    case ASTNodeType::FUNCTION_CALL: {
+      auto functionName = string();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<FunctionCallNode>(functionName, op, nodes());
+      break;
+    }
+
+    case ASTNodeType::FUNCTION: {
+      auto n = std::make_unique<FunctionDeclarationNode>();
+      n->name = string();
+      n->parameters = parameters();
+      n->body = nodes();
+      n->typeHints = typeHints();
+      n->returnTypeHint = static_cast<KName>(scalar<uint32_t>());
+      n->isStatic = scalar<uint8_t>() != 0;
+      n->isPrivate = scalar<uint8_t>() != 0;
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::HASH_LITERAL: {
+      std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>>
+          elements;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        auto key = node();
+        elements.emplace_back(std::move(key), node());
+      }
+
+      std::vector<k_string> keys;
+      count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        keys.push_back(string());
+      }
+
+      result =
+          std::make_unique<HashLiteralNode>(std::move(elements), std::move(keys));
+      break;
+    }
+
+    case ASTNodeType::IDENTIFIER: {
+      auto n = std::make_unique<IdentifierNode>(string());
+      n->package = string();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::IF: {
+      auto n = std::make_unique<IfNode>();
+      n->condition = node();
+      n->body = nodes();
+      n->elseBody = nodes();
+      n->elseifNodes = nodesOf<IfNode>(ASTNodeType::IF);
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::IMPORT:
+      result = std::make_unique<ImportNode>(node());
+      break;
+
+    case ASTNodeType::INDEX_ASSIGNMENT: {
+      auto object = node();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result =
+          std::make_unique<IndexAssignmentNode>(std::move(object), op, node());
+      break;
+    }
+
+    case ASTNodeType::INDEX: {
+      auto n = std::make_unique<IndexingNode>();
+      n->indexedObject = node();
+      n->name = string();
+      n->indexExpression = node();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::LAMBDA: {
+      auto n = std::make_unique<LambdaNode>();
+      n->parameters = parameters();
+      n->body = nodes();
+      n->typeHints = typeHints();
+      n->returnTypeHint = static_cast<KName>(scalar<uint32_t>());
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::LAMBDA_CALL: {
+      auto lambdaNode = node();
+      result = std::make_unique<LambdaCallNode>(std::move(lambdaNode), nodes());
+      break;
+    }
+
+    case ASTNodeType::LIST_LITERAL:
+      result = std::make_unique<ListLiteralNode>(nodes());
+      break;
+
+    case ASTNodeType::LITERAL:
+      result = std::make_unique<LiteralNode>(value());
+      break;
+
+    case ASTNodeType::MEMBER_ACCESS: {
+      auto object = node();
+      result = std::make_unique<MemberAccessNode>(std::move(object), string());
+      break;
+    }
+
+    case ASTNodeType::MEMBER_ASSIGNMENT: {
+      auto object = node();
+      auto memberName = string();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<MemberAssignmentNode>(std::move(object),
+                                                      memberName, op, node());
+      break;
+    }
+
+    case ASTNodeType::METHOD_CALL: {
+      auto object = node();
+      auto methodName = string();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<MethodCallNode>(std::move(object), methodName,
+                                                op, nodes());
+      break;
+    }
+
+    case ASTNodeType::NEXT:
+      result = std::make_unique<NextNode>(node());
+      break;
+
+    case ASTNodeType::NO_OP:
+      result = std::make_unique<NoOpNode>();
+      break;
+
+    case ASTNodeType::PACK_ASSIGNMENT: {
+      auto left = nodes();
+      auto right = nodes();
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<PackAssignmentNode>(std::move(left),
+                                                    std::move(right), op);
+      break;
+    }
+
+    case ASTNodeType::PACKAGE: {
+      auto n = std::make_unique<PackageNode>(node());
+      n->body = nodes();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::PARSE:
+      result = std::make_unique<ParseNode>(node());
+      break;
+
+    case ASTNodeType::PRINT: {
+      auto expression = node();
+      auto printNewline = scalar<uint8_t>() != 0;
+      auto printStdError = scalar<uint8_t>() != 0;
+      result = std::make_unique<PrintNode>(std::move(expression), printNewline,
+                                           printStdError);
+      break;
+    }
+
+    case ASTNodeType::PRINTXY: {
+      auto expression = node();
+      auto x = node();
+      result = std::make_unique<PrintXyNode>(std::move(expression),
+                                             std::move(x), node());
+      break;
+    }
+
+    case ASTNodeType::PROGRAM: {
+      auto n = std::make_unique<ProgramNode>(nodes());
+      n->isScript = scalar<uint8_t>() != 0;
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::RANGE_LITERAL: {
+      auto rangeStart = node();
+      result = std::make_unique<RangeLiteralNode>(std::move(rangeStart), node());
+      break;
+    }
+
+    case ASTNodeType::REPEAT_LOOP: {
+      auto n = std::make_unique<RepeatLoopNode>();
+      n->count = node();
+      n->alias = node();
+      n->body = nodes();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::RETURN: {
+      auto returnValue = node();
+      result = std::make_unique<ReturnNode>(std::move(returnValue), node());
+      break;
+    }
+
+    case ASTNodeType::SELF:
+      result = std::make_unique<SelfNode>(string());
+      break;
+
+    case ASTNodeType::SLICE: {
+      auto slicedObject = node();
+      auto startExpression = node();
+      auto stopExpression = node();
+      result = std::make_unique<SliceNode>(
+          std::move(slicedObject), std::move(startExpression),
+          std::move(stopExpression), node());
+      break;
+    }
+
+    case ASTNodeType::STRUCT: {
+      auto name = string();
+      auto baseStruct = string();
+      std::vector<k_string> interfaces;
+      auto count = scalar<uint32_t>();
+      for (uint32_t i = 0; i < count && !failed; ++i) {
+        interfaces.push_back(string());
+      }
+      result = std::make_unique<StructNode>(name, baseStruct,
+                                            std::move(interfaces), nodes());
+      break;
+    }
+
+    case ASTNodeType::TERNARY_OPERATION: {
+      auto evalExpression = node();
+      auto trueExpression = node();
+      result = std::make_unique<TernaryOperationNode>(
+          std::move(evalExpression), std::move(trueExpression), node());
+      break;
+    }
+
+    case ASTNodeType::THROW: {
+      auto errorValue = node();
+      result = std::make_unique<ThrowNode>(std::move(errorValue), node());
+      break;
+    }
+
+    case ASTNodeType::TRY: {
+      auto n = std::make_unique<TryNode>();
+      n->tryBody = nodes();
+      n->catchBody = nodes();
+      n->finallyBody = nodes();
+      n->errorType = node();
+      n->errorMessage = node();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::UNARY_OPERATION: {
+      auto op = static_cast<KName>(scalar<uint32_t>());
+      result = std::make_unique<UnaryOperationNode>(op, node());
+      break;
+    }
+
+    case ASTNodeType::VARIABLE: {
+      auto n = std::make_unique<VariableDeclarationNode>();
+      n->variables = parameters();
+      n->typeHints = typeHints();
+      result = std::move(n);
+      break;
+    }
+
+    case ASTNodeType::WHILE_LOOP: {
+      auto n = std::make_unique<WhileLoopNode>();
+      n->condition = node();
+      n->body = nodes();
+      result = std::move(n);
+      break;
+    }
+
+    default:
+      failed = true;
+      return nullptr;
+  }
+
+  result->token = nodeToken;
+  return result;
+}
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef KIWI_PARSING_TOKENS_H
 #define KIWI_PARSING_TOKENS_H
 
+#include <deque>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include "parsing/keywords.h"
 #include "parsing/tokentype.h"
 #include "typing/serializer.h"
@@ -65,55 +68,114 @@ k_string get_token_type_string(KTokenType type) {
   return "UNKNOWN";
 }
 
+/*
+ * The text of the tokens of one source, kept once per distinct string. Tokens
+ * refer to their text here instead of owning a copy, so copying a token, or
+ * keeping one in a syntax tree, never copies a string.
+ *
+ * The lexer that reads a source owns its table, hands it to the token stream,
+ * and the parser hands it to the program it builds, so the text lives exactly
+ * as long as the syntax tree that uses it. A table is only filled by the one
+ * thread reading its source, so it takes no lock.
+ */
+class KTokenText {
+ public:
+  KTokenText() {}
+  KTokenText(const KTokenText&) = delete;
+  KTokenText& operator=(const KTokenText&) = delete;
+
+  const k_string* intern(std::string_view text) {
+    if (text.empty()) {
+      return empty();
+    }
+
+    auto it = index.find(text);
+    if (it != index.end()) {
+      return it->second;
+    }
+
+    const auto* stored = &texts.emplace_back(text);
+    index.emplace(*stored, stored);
+    return stored;
+  }
+
+  // The text of tokens that belong to no source, such as the end of a stream.
+  static const k_string* empty() {
+    static const k_string text;
+    return &text;
+  }
+
+ private:
+  // A deque never moves what it holds, so the index can refer to it.
+  std::deque<k_string> texts;
+  std::unordered_map<std::string_view, const k_string*> index;
+};
+
+using k_token_text = std::shared_ptr<const KTokenText>;
+
 class Token {
  public:
   static Token create(const KTokenType& t, const KName& st, const int& fileId,
-                      const k_string& text, const k_value& v,
-                      const int& lineNumber, const int& linePosition) {
-    Token token(t, st, fileId, text, v, lineNumber, linePosition);
+                      const k_string* text, const int& lineNumber,
+                      const int& linePosition) {
+    return Token(t, st, fileId, text, Literal::Text, lineNumber,
+                 linePosition);
+  }
+
+  static Token createInteger(const int& fileId, const k_string* text,
+                             const k_int& value, const int& lineNumber,
+                             const int& linePosition) {
+    Token token(KTokenType::LITERAL, KName::Default, fileId, text,
+                Literal::Integer, lineNumber, linePosition);
+    token.integer = value;
     return token;
   }
 
-  static Token create(const KTokenType& t, const KName& st, const int& fileId,
-                      const k_string& text, const int& lineNumber,
-                      const int& linePosition) {
-    return create(t, st, fileId, text, text, lineNumber, linePosition);
+  static Token createFloat(const int& fileId, const k_string* text,
+                           const double& value, const int& lineNumber,
+                           const int& linePosition) {
+    Token token(KTokenType::LITERAL, KName::Default, fileId, text,
+                Literal::Float, lineNumber, linePosition);
+    token.number = value;
+    return token;
   }
 
-  static Token createBoolean(const int& fileId, const k_string& text,
+  static Token createBoolean(const int& fileId, const k_string* text,
                              const int& lineNumber, const int& linePosition) {
-    bool value = text == Keywords.True;
+    bool value = *text == Keywords.True;
     auto st = value ? KName::KW_True : KName::KW_False;
-    return create(KTokenType::LITERAL, st, fileId, text, value, lineNumber,
-                  linePosition);
+    Token token(KTokenType::LITERAL, st, fileId, text, Literal::Boolean,
+                lineNumber, linePosition);
+    token.boolean = value;
+    return token;
   }
 
-  static Token createNull(const int& fileId, const k_string& text,
+  static Token createNull(const int& fileId, const k_string* text,
                           const int& lineNumber, const int& linePosition) {
-    k_null value;
-    return create(KTokenType::LITERAL, KName::KW_Null, fileId, text, value,
-                  lineNumber, linePosition);
+    return Token(KTokenType::LITERAL, KName::KW_Null, fileId, text,
+                 Literal::Null, lineNumber, linePosition);
   }
 
   static Token createEmpty() {
-    return create(KTokenType::ENDOFFILE, KName::Default, 0, "", 0, 0);
+    return create(KTokenType::ENDOFFILE, KName::Default, 0,
+                  KTokenText::empty(), 0, 0);
   }
 
   static Token createExternal() {
-    return create(KTokenType::ENDOFFILE, KName::Default, -1, "", 0, 0);
+    return create(KTokenType::ENDOFFILE, KName::Default, -1,
+                  KTokenText::empty(), 0, 0);
   }
 
   static Token createStreamEnd() {
-    return create(KTokenType::STREAM_END, KName::Default, 0, "", 0, 0);
+    return create(KTokenType::STREAM_END, KName::Default, 0,
+                  KTokenText::empty(), 0, 0);
   }
 
   const int& getFile() const { return fileId; }
 
-  const k_string& getText() const { return text; }
+  const k_string& getText() const { return *text; }
 
-  const k_string& getOriginalText() const { return text; }
-
-  void setText(const k_string& newText) { text = newText; }
+  const k_string& getOriginalText() const { return *text; }
 
   const int& getLineNumber() const { return _lineNumber; }
 
@@ -123,27 +185,49 @@ class Token {
 
   KName getSubType() const { return subType; }
 
-  k_value& getValue() { return value; }
+  // The value of a literal token. Any other token's value is its text.
+  KValue getValue() const {
+    switch (literal) {
+      case Literal::Integer:
+        return KValue::createInteger(integer);
+      case Literal::Float:
+        return KValue::createFloat(number);
+      case Literal::Boolean:
+        return KValue::createBoolean(boolean);
+      case Literal::Null:
+        return KValue::createNull();
+      case Literal::Text:
+        break;
+    }
+
+    return KValue::createString(*text);
+  }
 
  private:
+  enum class Literal : uint8_t { Text, Integer, Float, Boolean, Null };
+
   KTokenType type;
   KName subType;
   int fileId;
-  k_string text;
-  k_string originalText;
-  k_value value;
+  const k_string* text;
+  Literal literal;
+  union {
+    k_int integer;
+    double number;
+    bool boolean;
+  };
   int _lineNumber;
   int _linePosition;
 
   Token(const KTokenType& t, const KName& st, const int& fileId,
-        const k_string& text, const k_value& v, const int& lineNumber,
+        const k_string* text, Literal literal, const int& lineNumber,
         const int& linePosition)
       : type(t),
         subType(st),
         fileId(fileId),
         text(text),
-        originalText(text),
-        value(v) {
+        literal(literal),
+        integer(0) {
     _lineNumber = lineNumber;
     _linePosition = linePosition;
   }
@@ -151,24 +235,20 @@ class Token {
 
 class TokenStream {
  public:
-  TokenStream(const std::vector<Token>& tokens) : tokens(tokens) {}
+  TokenStream(std::vector<Token> tokens, k_token_text text)
+      : tokens(std::move(tokens)), text(std::move(text)) {}
   ~TokenStream() { tokens.clear(); }
 
-  Token at(size_t pos) {
+  const Token& at(size_t pos) const {
     if (pos >= tokens.size()) {
-      return Token::createStreamEnd();
+      return getStreamEnd();
     }
-    return tokens.at(pos);
+    return tokens[pos];
   }
 
-  Token current() {
-    if (position >= tokens.size()) {
-      return Token::createStreamEnd();
-    }
-    return tokens.at(position);
-  }
+  const Token& current() const { return at(position); }
 
-  Token previous() { return tokens.at(position - 1); }
+  const Token& previous() const { return tokens.at(position - 1); }
 
   void rewind() {
     if (static_cast<int>(position) - 1 < 0) {
@@ -203,20 +283,22 @@ class TokenStream {
     }
   }
 
-  Token peek() {
-    if (position + 1 < tokens.size()) {
-      return tokens.at(position + 1);
-    } else {
-      return Token::createStreamEnd();
-    }
-  }
+  const Token& peek() const { return at(position + 1); }
 
   bool empty() const { return tokens.empty(); }
   bool canRead() const { return position < tokens.size(); }
 
   std::vector<Token> tokens;
+  // The text the tokens refer to.
+  k_token_text text;
   size_t position = 0;
   size_t size() const { return tokens.size(); }
+
+ private:
+  static const Token& getStreamEnd() {
+    static const Token streamEnd = Token::createStreamEnd();
+    return streamEnd;
+  }
 };
 
 using k_stream = std::shared_ptr<TokenStream>;
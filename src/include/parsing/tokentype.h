@@ -147,6 +147,10 @@ enum KName {
   Builtin_List_Max,
   Builtin_List_Min,
   Builtin_List_None,
+  Builtin_List_ParallelEach,
+  Builtin_List_ParallelMap,
+  Builtin_List_ParallelReduce,
+  Builtin_List_ParallelSelect,
   Builtin_List_Reduce,
   Builtin_List_Select,
   Builtin_List_Sort,
@@ -250,11 +254,22 @@ enum KName {
   Builtin_Sys_EffectiveUserId,
   Builtin_Sys_Exec,
   Builtin_Sys_ExecOut,
+  Builtin_Channel_Close,
+  Builtin_Channel_Create,
+  Builtin_Channel_Receive,
+  Builtin_Channel_Select,
+  Builtin_Channel_Send,
+  Builtin_Channel_TryReceive,
+  Builtin_Task_Await,
   Builtin_Task_Busy,
+  Builtin_Task_Cancel,
   Builtin_Task_List,
+  Builtin_Task_Priority,
   Builtin_Task_Result,
   Builtin_Task_Sleep,
   Builtin_Task_Status,
+  Builtin_Task_WaitAll,
+  Builtin_Task_WaitAny,
   Builtin_Time_AMPM,
   Builtin_Time_Delay,
   Builtin_Time_EpochMilliseconds,
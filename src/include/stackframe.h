@@ -5,6 +5,7 @@
 #include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 #include "parsing/tokens.h"
 #include "tracing/error.h"
 #include "tracing/state.h"
@@ -20,6 +21,8 @@ enum class FrameFlags : uint16_t {
   InTry = 1 << 5,
   InObject = 1 << 6,
   InLambda = 1 << 7,
+  Captured = 1 << 8,
+  WeaklyHeld = 1 << 9,
 };
 
 inline FrameFlags operator|(FrameFlags a, FrameFlags b) {
@@ -37,18 +40,216 @@ inline FrameFlags operator~(FrameFlags a) {
       ~static_cast<std::underlying_type_t<FrameFlags>>(a));
 }
 
+/*
+ * Variables are scoped through the chain of calling frames: a frame sees
+ * everything visible to the frame that called it, and assigning to a name
+ * that is already visible updates it where it lives. Declarations, such as
+ * parameters, `var` and loop iterators, always land in the frame itself.
+ */
 struct CallStackFrame {
   std::unordered_map<k_string, KValue> variables;
+  std::shared_ptr<CallStackFrame> parent;
+  // The caller of a dropped frame that a lambda kept. See releaseClosures().
+  std::weak_ptr<CallStackFrame> keptParent;
   KValue returnValue;
   k_object objectContext;
   FrameFlags flags = FrameFlags::None;
   k_string name;
 
+  // Bumped whenever a declaration adds a variable to this frame, which may
+  // shadow one further up the chain, or a variable is removed, so anything
+  // holding a pointer to a visible variable knows to look it up again.
+  uint32_t variableVersion = 0;
+
   CallStackFrame() {}
   ~CallStackFrame() { variables.clear(); }
 
-  bool hasVariable(const k_string& name) const {
-    return variables.find(name) != variables.end();
+  KValue* findVariable(const k_string& name) {
+    for (auto* frame = this; frame; frame = frame->getParent()) {
+      auto it = frame->variables.find(name);
+      if (it != frame->variables.end()) {
+        return &it->second;
+      }
+    }
+
+    return nullptr;
+  }
+
+  CallStackFrame* getParent() const {
+    return parent ? parent.get() : keptParent.lock().get();
+  }
+
+  bool hasVariable(const k_string& name) {
+    return findVariable(name) != nullptr;
+  }
+
+  KValue& setVariable(const k_string& name, const KValue& value) {
+    auto* variable = findVariable(name);
+    if (!variable) {
+      return addVariable(name) = value;
+    }
+
+    return *variable = value;
+  }
+
+  KValue& defineVariable(const k_string& name, const KValue& value) {
+    auto it = variables.find(name);
+    if (it != variables.end()) {
+      return it->second = value;
+    }
+
+    ++variableVersion;
+    return addVariable(name) = value;
+  }
+
+  // Adds `name`, which must not be in this frame yet, as null. A pooled frame
+  // reuses the nodes of its earlier variables, so this does not allocate.
+  KValue& addVariable(const k_string& name) {
+    if (spareNodes.empty()) {
+      return variables.emplace(name, KValue{}).first->second;
+    }
+
+    auto node = std::move(spareNodes.back());
+    spareNodes.pop_back();
+    node.key() = name;
+    return variables.insert(std::move(node)).position->second;
+  }
+
+  void eraseVariable(const k_string& name) {
+    if (variables.erase(name) > 0) {
+      ++variableVersion;
+    }
+  }
+
+  // Breaks the cycles between this frame and the lambdas created in it, which
+  // would otherwise keep both alive forever once the frame is dropped.
+  //
+  // A lambda that is only reachable from here, through variables and the
+  // lists, hashmaps and objects they hold, cannot be called again, so it lets
+  // go of the frame. One that can also be reached from elsewhere (it was
+  // returned, say) keeps the frame, and the references here get a copy that
+  // does not. A kept frame holds its caller weakly, since the caller may be
+  // what holds the lambda. The object context goes first, as a lambda takes
+  // it from its own caller, and a constructor called here leaves the object
+  // it built in it.
+  void releaseClosures() {
+    objectContext = nullptr;
+
+    Reachability reach;
+    for (const auto& variable : variables) {
+      countReferences(variable.second, reach);
+    }
+    for (const auto& variable : variables) {
+      markReachable(variable.second, false, reach);
+    }
+
+    for (auto& variable : variables) {
+      if (isKept(variable.second, reach)) {
+        variable.second = withoutScope(variable.second);
+      } else {
+        releaseClosures(variable.second, reach);
+      }
+    }
+
+    keptParent = parent;
+    parent.reset();
+  }
+
+  // Frees the variables of kept frames that only lambdas held by one another
+  // keep alive. Such a cycle is left behind when a lambda escapes inside a
+  // container that one of its frame's own variables also holds, and nothing
+  // else can reach either of them once the container is dropped elsewhere.
+  // `frames` holds one reference to each frame.
+  static void collectCycles(
+      const std::vector<std::shared_ptr<CallStackFrame>>& frames) {
+    Reachability reach;
+    std::vector<const LambdaRef*> closures;
+    for (const auto& frame : frames) {
+      frame->forEachRoot([&](const KValue& value) {
+        countReferences(value, reach, &closures);
+      });
+    }
+
+    // A frame is reachable from elsewhere if anything but these lambdas holds
+    // it, or if one of the lambdas holding it is.
+    std::unordered_map<const CallStackFrame*, bool> external;
+    std::unordered_map<const CallStackFrame*, long> held;
+    for (const auto& frame : frames) {
+      held[frame.get()] = 1;
+    }
+    for (const auto* closure : closures) {
+      auto it = held.find(closure->scope.get());
+      if (it != held.end()) {
+        ++it->second;
+      }
+    }
+    for (const auto& frame : frames) {
+      external[frame.get()] = frame.use_count() > held[frame.get()];
+    }
+
+    for (auto changed = true; changed;) {
+      changed = false;
+      for (const auto& frame : frames) {
+        auto outside = external[frame.get()];
+        frame->forEachRoot([&](const KValue& value) {
+          markReachable(value, outside, reach);
+        });
+      }
+
+      for (const auto* closure : closures) {
+        auto it = external.find(closure->scope.get());
+        if (it != external.end() && !it->second &&
+            reach.at(closure).external) {
+          it->second = true;
+          changed = true;
+        }
+      }
+    }
+
+    std::vector<KValue> released;
+    for (const auto& frame : frames) {
+      if (external[frame.get()]) {
+        continue;
+      }
+
+      frame->forEachRoot([&](const KValue& value) {
+        released.push_back(value);
+      });
+      frame->variables.clear();
+      frame->returnValue = {};
+      ++frame->variableVersion;
+    }
+  }
+
+  // Readies a dropped frame that nothing holds for another call. Its bucket
+  // array and a few of its variables' nodes are kept for the next caller.
+  void recycle() {
+    while (!variables.empty() && spareNodes.size() < MaxSpareNodes) {
+      auto node = variables.extract(variables.begin());
+      node.mapped() = {};
+      spareNodes.push_back(std::move(node));
+    }
+
+    variables.clear();
+    parent.reset();
+    keptParent.reset();
+    returnValue = {};
+    objectContext = nullptr;
+    flags = FrameFlags::None;
+    ++variableVersion;
+  }
+
+  // Every visible variable. A name defined more than once resolves to the
+  // nearest definition.
+  std::unordered_map<k_string, KValue> getVisibleVariables() const {
+    std::unordered_map<k_string, KValue> visible;
+    for (auto* frame = this; frame; frame = frame->getParent()) {
+      for (const auto& variable : frame->variables) {
+        visible.emplace(variable.first, variable.second);
+      }
+    }
+
+    return visible;
   }
 
   void setObjectContext(const k_object& object) {
@@ -61,6 +262,237 @@ struct CallStackFrame {
   void setFlag(FrameFlags flag) { flags = flags | flag; }
   void clearFlag(FrameFlags flag) { flags = flags & ~flag; }
   bool isFlagSet(FrameFlags flag) const { return (flags & flag) == flag; }
+
+ private:
+  static constexpr size_t MaxSpareNodes = 16;
+
+  std::vector<std::unordered_map<k_string, KValue>::node_type> spareNodes;
+
+  // For every value reachable from this frame's variables, how many of its
+  // references come from the frame or from other values reachable from it,
+  // and then whether it can be reached without going through the frame. The
+  // storage that copies of a list or hashmap share is a value of its own.
+  struct Reach {
+    uint32_t internal = 0;
+    bool visited = false;
+    bool external = false;
+  };
+  using Reachability = std::unordered_map<const KRefCounted*, Reach>;
+
+  // Calls `visit` with every value this frame holds.
+  template <typename Visit>
+  void forEachRoot(Visit&& visit) const {
+    for (const auto& variable : variables) {
+      visit(variable.second);
+    }
+    visit(returnValue);
+  }
+
+  static const KRefCounted* heapValue(const KValue& value) {
+    if (value.isList()) {
+      return value.getList().get();
+    } else if (value.isHashmap()) {
+      return value.getHashmap().get();
+    } else if (value.isObject()) {
+      return value.getObject().get();
+    } else if (value.isLambda()) {
+      return value.getLambda().get();
+    }
+    return nullptr;
+  }
+
+  // The storage holding the elements of a list or hashmap, or null if there
+  // is none to look into. A range holds no values.
+  static const KRefCounted* storageOf(const KValue& value) {
+    if (value.isList()) {
+      const auto& elements = value.getList()->elements;
+      return elements.range() ? nullptr : elements.storage();
+    }
+    return value.isHashmap() ? value.getHashmap()->storage() : nullptr;
+  }
+
+  // Calls `visit` with every value `value` holds, without storing a range.
+  // Hashmap keys are skipped; a container they hold only looks reachable
+  // from elsewhere, which keeps the frame rather than releasing it.
+  template <typename Visit>
+  static void forEachHeld(const KValue& value, Visit&& visit) {
+    if (value.isList()) {
+      const auto& elements = value.getList()->elements;
+      if (elements.range()) {
+        return;
+      }
+      for (const auto& item : elements) {
+        visit(item);
+      }
+    } else if (value.isHashmap()) {
+      for (const auto& entry : *value.getHashmap()) {
+        visit(entry.value);
+      }
+    } else if (value.isObject()) {
+      for (const auto& slot : value.getObject()->slots) {
+        visit(slot);
+      }
+    }
+  }
+
+  // Also lists every lambda it finds in `closures`, if given.
+  static void countReferences(
+      const KValue& value, Reachability& reach,
+      std::vector<const LambdaRef*>* closures = nullptr) {
+    const auto* heap = heapValue(value);
+    if (!heap || reach[heap].internal++ > 0) {
+      return;
+    } else if (value.isLambda()) {
+      if (closures) {
+        closures->push_back(value.getLambda().get());
+      }
+      return;
+    }
+
+    const auto* storage = storageOf(value);
+    if (storage && reach[storage].internal++ > 0) {
+      return;
+    }
+
+    forEachHeld(value, [&](const KValue& item) {
+      countReferences(item, reach, closures);
+    });
+  }
+
+  // Marks what is referenced from outside the frame, and everything it
+  // holds. A value is visited again only if it turns out to be external.
+  static bool markExternal(const KRefCounted* heap, bool outside,
+                           Reachability& reach) {
+    auto& r = reach[heap];
+    auto external = outside || heap->refCount.load() > r.internal;
+    if (r.visited && (!external || r.external)) {
+      return false;
+    }
+
+    r.visited = true;
+    r.external = r.external || external;
+    return true;
+  }
+
+  static void markReachable(const KValue& value, bool outside,
+                            Reachability& reach) {
+    const auto* heap = heapValue(value);
+    if (!heap || !markExternal(heap, outside, reach) || value.isLambda()) {
+      return;
+    }
+
+    outside = reach[heap].external;
+    if (const auto* storage = storageOf(value)) {
+      if (!markExternal(storage, outside, reach)) {
+        return;
+      }
+      outside = reach[storage].external;
+    }
+
+    forEachHeld(value, [&](const KValue& item) {
+      markReachable(item, outside, reach);
+    });
+  }
+
+  // Whether `value` is a lambda created in this frame that is reachable from
+  // elsewhere. One that is not lets go of the frame here.
+  bool isKept(const KValue& value, const Reachability& reach) {
+    if (!value.isLambda() || value.getLambda()->scope.get() != this) {
+      return false;
+    }
+
+    const auto& closure = value.getLambda();
+    if (reach.at(closure.get()).external) {
+      return true;
+    }
+
+    closure->scope.reset();
+    return false;
+  }
+
+  static KValue withoutScope(const KValue& value) {
+    return KValue::createLambda(make_ref<LambdaRef>(value.getLambda()->lambda));
+  }
+
+  // Replaces kept lambdas in the values only this frame can reach. A list or
+  // hashmap that shares its storage with one held elsewhere is given its own
+  // copy first, so the other holder is left as it was.
+  void releaseClosures(const KValue& value, Reachability& reach) {
+    const auto* heap = heapValue(value);
+    if (!heap || value.isLambda()) {
+      return;
+    }
+
+    auto& r = reach.at(heap);
+    if (r.external || !r.visited) {
+      return;
+    }
+    r.visited = false;
+
+    if (value.isList()) {
+      const auto& list = value.getList();
+      if (list->elements.range()) {
+        return;
+      }
+      for (size_t i = 0; i < list->elements.size(); ++i) {
+        const auto& item = list->elements[i];
+        if (isKept(item, reach)) {
+          auto copy = withoutScope(item);
+          list->mutableElements()[i] = std::move(copy);
+        } else {
+          releaseClosures(item, reach);
+        }
+      }
+    } else if (value.isHashmap()) {
+      const auto& hashmap = value.getHashmap();
+      std::vector<KValue> keys;
+      for (const auto& entry : *hashmap) {
+        if (isKept(entry.value, reach)) {
+          keys.push_back(entry.key);
+        } else {
+          releaseClosures(entry.value, reach);
+        }
+      }
+
+      for (const auto& key : keys) {
+        auto* item = hashmap->find(key);
+        *item = withoutScope(*item);
+      }
+    } else {
+      for (auto& slot : value.getObject()->slots) {
+        if (isKept(slot, reach)) {
+          slot = withoutScope(slot);
+        } else {
+          releaseClosures(slot, reach);
+        }
+      }
+    }
+  }
+};
+
+/*
+ * A variable a loop declares in its frame on every iteration, such as its
+ * iterator. The location of the variable is kept, so it is only looked up
+ * again once the frame's variables have changed.
+ */
+struct LoopVariable {
+  CallStackFrame& frame;
+  const k_string& name;
+  KValue* value = nullptr;
+  uint32_t version = 0;
+
+  LoopVariable(CallStackFrame& frame, const k_string& name)
+      : frame(frame), name(name) {}
+
+  void set(const KValue& newValue) {
+    if (value && version == frame.variableVersion) {
+      *value = newValue;
+      return;
+    }
+
+    value = &frame.defineVariable(name, newValue);
+    version = frame.variableVersion;
+  }
 };
 
 #endif
\ No newline at end of file
@@ -66,6 +66,13 @@ class TaskError : public KiwiError {
       : KiwiError(token, "TaskError", message) {}
 };
 
+class ChannelError : public KiwiError {
+ public:
+  ChannelError(const Token& token,
+               const std::string& message = "A channel error occurred.")
+      : KiwiError(token, "ChannelError", message) {}
+};
+
 class SyntaxError : public KiwiError {
  public:
   SyntaxError(const Token& token,
@@ -54,7 +54,7 @@ struct Serializer {
     return "";
   }
 
-  static bool assert_typematch(KValue v, KName typeName) {
+  static bool assert_typematch(const KValue& v, KName typeName) {
     switch (typeName) {
       case KName::Types_Any:
         return true;
@@ -96,7 +96,7 @@ struct Serializer {
     return false;
   }
 
-  static k_string get_value_type_string(KValue v) {
+  static k_string get_value_type_string(const KValue& v) {
     if (v.isInteger()) {
       return TypeNames.Integer;
     } else if (v.isFloat()) {
@@ -126,13 +126,13 @@ struct Serializer {
     if (rhsValues.isList()) {
       return rhsValues.getList();
     } else {
-      auto newList = std::make_shared<List>();
+      auto newList = make_ref<List>();
       newList->elements.emplace_back(rhsValues);
       return newList;
     }
   }
 
-  static k_string serialize(KValue v, bool wrapStrings = false) {
+  static k_string serialize(const KValue& v, bool wrapStrings = false) {
     std::ostringstream sv;
 
     if (v.isInteger()) {
@@ -145,9 +145,9 @@ struct Serializer {
       sv << Keywords.Null;
     } else if (v.isString()) {
       if (wrapStrings) {
-        sv << "\"" << v.getString() << "\"";
+        sv << "\"" << v.getStringView() << "\"";
       } else {
-        sv << v.getString();
+        sv << v.getStringView();
       }
     } else if (v.isList()) {
       sv << serialize_list(v.getList());
@@ -184,7 +184,7 @@ struct Serializer {
     return sv.str();
   }
 
-  static k_string pretty_serialize(KValue v, int indent = 0) {
+  static k_string pretty_serialize(const KValue& v, int indent = 0) {
     std::ostringstream sv;
 
     if (v.isInteger()) {
@@ -196,7 +196,7 @@ struct Serializer {
     } else if (v.isNull()) {
       sv << Keywords.Null;
     } else if (v.isString()) {
-      sv << "\"" << v.getString() << "\"";
+      sv << "\"" << v.getStringView() << "\"";
     } else if (v.isList()) {
       sv << pretty_serialize_list(v.getList(), indent);
     } else if (v.isHashmap()) {
@@ -288,16 +288,15 @@ struct Serializer {
     k_string indentString(indent + 2, ' ');
 
     bool first = true;
-    auto& keys = hash->keys;
-    for (const auto& key : keys) {
+    for (const auto& entry : *hash) {
       if (!first) {
         sv << "," << std::endl;
       } else {
         first = false;
       }
-      sv << indentString << serialize(key, true) << ": ";
+      sv << indentString << serialize(entry.key, true) << ": ";
 
-      auto v = hash->get(key);
+      const auto& v = entry.value;
       if (v.isHashmap()) {
         sv << pretty_serialize_hash(v.getHashmap(), indent + 2);
       } else if (v.isList()) {
@@ -314,24 +313,24 @@ struct Serializer {
   }
 
   static k_list get_hash_keys_list(const k_hashmap& hash) {
-    auto keys = std::make_shared<List>();
+    auto keys = make_ref<List>();
     auto& elements = keys->elements;
-    elements.reserve(hash->keys.size());
+    elements.reserve(hash->size());
 
-    for (const auto& key : hash->keys) {
-      elements.emplace_back(key);
+    for (const auto& entry : *hash) {
+      elements.emplace_back(entry.key);
     }
 
     return keys;
   }
 
   static k_list get_hash_values_list(const k_hashmap& hash) {
-    auto values = std::make_shared<List>();
+    auto values = make_ref<List>();
     auto& elements = values->elements;
-    elements.reserve(hash->keys.size());
+    elements.reserve(hash->size());
 
-    for (const auto& key : hash->keys) {
-      elements.emplace_back(hash->kvp[key]);
+    for (const auto& entry : *hash) {
+      elements.emplace_back(entry.value);
     }
 
     return values;
@@ -346,11 +345,8 @@ struct Serializer {
     }
   }
 
-  static k_string basic_serialize_lambda(const k_lambda& lambda) {
-    if (lambda->identifier.empty()) {
-      return "[" + TypeNames.Lambda + "]";
-    }
-    return "[" + TypeNames.Lambda + "(identifier=" + lambda->identifier + ")]";
+  static k_string basic_serialize_lambda(const k_lambda&) {
+    return "[" + TypeNames.Lambda + "]";
   }
 
   static k_string serialize_hash(const k_hashmap& hash) {
@@ -358,17 +354,16 @@ struct Serializer {
     sv << "{";
 
     bool first = true;
-    auto& keys = hash->keys;
 
-    for (const auto& key : keys) {
+    for (const auto& entry : *hash) {
       if (!first) {
         sv << ", ";
       } else {
         first = false;
       }
 
-      sv << serialize(key, true) << ": ";
-      auto v = hash->get(key);
+      sv << serialize(entry.key, true) << ": ";
+      const auto& v = entry.value;
 
       if (v.isHashmap()) {
         sv << serialize(v);
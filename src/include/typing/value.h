@@ -2,15 +2,24 @@
 #define KIWI_TYPING_VALUETYPE_H
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 #include "tracing/error.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // ==========================================
 // Kiwi value type enum.
 // ==========================================
@@ -41,6 +50,102 @@ struct Object;
 struct LambdaRef;
 struct StructRef;
 struct Null;
+struct CallStackFrame;
+class KLambda;
+
+// ==========================================
+// Reference counting for heap values.
+// ==========================================
+
+/*
+ * Base of every heap-allocated value. The count lives in the object itself so
+ * a `KValue` can hold one with a single pointer.
+ */
+struct KRefCounted {
+  mutable std::atomic<uint32_t> refCount{0};
+
+  KRefCounted() {}
+  KRefCounted(const KRefCounted&) {}
+  KRefCounted& operator=(const KRefCounted&) { return *this; }
+  virtual ~KRefCounted() {}
+
+  void retain() const { refCount.fetch_add(1, std::memory_order_relaxed); }
+
+  // Whether any other reference to this value exists.
+  bool isShared() const {
+    return refCount.load(std::memory_order_acquire) > 1;
+  }
+
+  void release() const {
+    if (refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+};
+
+// An owning pointer to a `KRefCounted` value.
+template <typename T>
+class KRef {
+ public:
+  KRef() {}
+  KRef(std::nullptr_t) {}
+  explicit KRef(T* ptr) : ptr(ptr) { retain(); }
+  KRef(const KRef& other) : ptr(other.ptr) { retain(); }
+  KRef(KRef&& other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
+  ~KRef() { release(); }
+
+  KRef& operator=(const KRef& other) {
+    KRef(other).swap(*this);
+    return *this;
+  }
+
+  KRef& operator=(KRef&& other) noexcept {
+    KRef(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  static KRef share(KRefCounted* ptr) {
+    KRef ref;
+    ref.ptr = ptr;
+    ref.retain();
+    return ref;
+  }
+
+  T* get() const { return static_cast<T*>(ptr); }
+  T* operator->() const { return get(); }
+  T& operator*() const { return *get(); }
+  explicit operator bool() const { return ptr != nullptr; }
+
+  void reset() { KRef().swap(*this); }
+  void swap(KRef& other) noexcept { std::swap(ptr, other.ptr); }
+
+  bool operator==(const KRef& other) const { return ptr == other.ptr; }
+  bool operator!=(const KRef& other) const { return ptr != other.ptr; }
+  bool operator==(std::nullptr_t) const { return ptr == nullptr; }
+  bool operator!=(std::nullptr_t) const { return ptr != nullptr; }
+
+ private:
+  KRefCounted* ptr = nullptr;
+
+  void retain() const {
+    if (ptr) {
+      ptr->retain();
+    }
+  }
+
+  void release() const {
+    if (ptr) {
+      ptr->release();
+    }
+  }
+
+  friend struct KValue;
+};
+
+template <typename T, typename... Args>
+KRef<T> make_ref(Args&&... args) {
+  return KRef<T>(new T(std::forward<Args>(args)...));
+}
 
 // ==========================================
 // Kiwi types
@@ -48,11 +153,11 @@ struct Null;
 
 typedef long long k_int;
 typedef std::string k_string;
-using k_hashmap = std::shared_ptr<Hashmap>;
-using k_list = std::shared_ptr<List>;
-using k_object = std::shared_ptr<Object>;
-using k_lambda = std::shared_ptr<LambdaRef>;
-using k_struct = std::shared_ptr<StructRef>;
+using k_hashmap = KRef<Hashmap>;
+using k_list = KRef<List>;
+using k_object = KRef<Object>;
+using k_lambda = KRef<LambdaRef>;
+using k_struct = KRef<StructRef>;
 using k_null = std::shared_ptr<Null>;
 
 struct k_pointer {
@@ -92,8 +197,10 @@ using k_value = std::variant<k_int, double, bool, k_string, k_list, k_hashmap,
 // Function prototypes
 // ==========================================
 
-bool same_value(const k_value& v1, const k_value& v2);
+bool same_value(const KValue& v1, const KValue& v2);
 inline void hash_combine(std::size_t& seed, std::size_t hash);
+std::size_t hash_string(std::string_view s);
+std::size_t hash_value(const KValue& value);
 std::size_t hash_hash(const k_hashmap& hash);
 std::size_t hash_list(const k_list& list);
 std::size_t hash_object(const k_object& object);
@@ -102,39 +209,77 @@ std::size_t hash_object(const k_object& object);
 // KValue
 // ==========================================
 
+/*
+ * A Kiwi value in sixteen bytes.
+ *
+ * Integers, floats, booleans, null and pointers are stored inline. Strings of
+ * up to `SmallStringCapacity` bytes are stored inline as well; longer strings
+ * and every container live on the heap behind a single reference-counted
+ * pointer. Heap strings are never modified after creation, so copies share
+ * them.
+ */
 struct KValue {
  public:
-  KValue() {
-    _value = static_cast<k_int>(0);
-    _type = KValueType::_INTEGER;
+  static const size_t SmallStringCapacity = 14;
+
+  KValue() { store<k_int>(0); }
+  KValue(const k_value& value, const KValueType& type) { set(value, type); }
+
+  KValue(const KValue& other) {
+    copyFrom(other);
+    retain();
+  }
+
+  KValue(KValue&& other) noexcept {
+    copyFrom(other);
+    other.clear();
+  }
+
+  ~KValue() { release(); }
+
+  KValue& operator=(const KValue& other) {
+    if (this != &other) {
+      // Retain first: `other` may be owned by the value being released.
+      other.retain();
+      release();
+      copyFrom(other);
+    }
+    return *this;
+  }
+
+  KValue& operator=(KValue&& other) noexcept {
+    if (this != &other) {
+      KValue previous(std::move(*this));
+      copyFrom(other);
+      other.clear();
+    }
+    return *this;
   }
-  KValue(const k_value& value, const KValueType& type)
-      : _value(value), _type(type) {}
 
   static KValue create(const k_value& value) {
     switch (value.index()) {
       case KValueType::_INTEGER:
-        return createInteger(value);
+        return createInteger(std::get<k_int>(value));
       case KValueType::_FLOAT:
-        return createFloat(value);
+        return createFloat(std::get<double>(value));
       case KValueType::_BOOLEAN:
-        return createBoolean(value);
+        return createBoolean(std::get<bool>(value));
       case KValueType::_STRING:
-        return createString(value);
+        return createString(std::get<k_string>(value));
       case KValueType::_LIST:
-        return createList(value);
+        return createList(std::get<k_list>(value));
       case KValueType::_HASHMAP:
-        return createHashmap(value);
+        return createHashmap(std::get<k_hashmap>(value));
       case KValueType::_OBJECT:
-        return createObject(value);
+        return createObject(std::get<k_object>(value));
       case KValueType::_LAMBDA:
-        return createLambda(value);
+        return createLambda(std::get<k_lambda>(value));
       case KValueType::_NONE:
         return createNull();
       case KValueType::_STRUCT:
-        return createStruct(value);
+        return createStruct(std::get<k_struct>(value));
       case KValueType::_POINTER:
-        return createPointer(value);
+        return createPointer(std::get<k_pointer>(value));
       default:
         return {};
     }
@@ -143,58 +288,82 @@ struct KValue {
   static KValue emptyString() { return createString(""); }
 
   static KValue createInteger(const k_int& value) {
-    return {value, KValueType::_INTEGER};
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createInteger(const k_value& value) {
-    return {value, KValueType::_INTEGER};
+  static KValue createFloat(const double& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createFloat(const k_value& value) {
-    return {value, KValueType::_FLOAT};
+  static KValue createBoolean(const bool& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createBoolean(const k_value& value) {
-    return {value, KValueType::_BOOLEAN};
+  static KValue createString(const k_string& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createString(const k_value& value) {
-    return {value, KValueType::_STRING};
+  static KValue createList(const k_list& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createList(const k_value& value) {
-    return {value, KValueType::_LIST};
+  static KValue createHashmap(const k_hashmap& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createHashmap(const k_value& value) {
-    return {value, KValueType::_HASHMAP};
+  static KValue createObject(const k_object& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createObject(const k_value& value) {
-    return {value, KValueType::_OBJECT};
+  static KValue createLambda(const k_lambda& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createLambda(const k_value& value) {
-    return {value, KValueType::_LAMBDA};
+  static KValue createNull(const k_null&) { return createNull(); }
+  static KValue createNull() {
+    KValue result;
+    result._type = KValueType::_NONE;
+    return result;
   }
-  static KValue createNull(const k_value& value) {
-    return {value, KValueType::_NONE};
+  static KValue createStruct(const k_struct& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createNull() {
-    return {std::make_shared<Null>(), KValueType::_NONE};
+  static KValue createPointer(const k_pointer& value) {
+    KValue result;
+    result.setValue(value);
+    return result;
   }
-  static KValue createStruct(const k_value& value) {
-    return {value, KValueType::_STRUCT};
+
+  k_int getInteger() const { return load<k_int>(); }
+  double getFloat() const { return load<double>(); }
+  bool getBoolean() const { return load<bool>(); }
+  k_string getString() const { return k_string(getStringView()); }
+  const k_list& getList() const { return heapRef<List>(); }
+  const k_hashmap& getHashmap() const { return heapRef<Hashmap>(); }
+  const k_object& getObject() const { return heapRef<Object>(); }
+  const k_lambda& getLambda() const { return heapRef<LambdaRef>(); }
+  const k_null& getNull() const {
+    static const k_null null = std::make_shared<Null>();
+    return null;
   }
-  static KValue createPointer(const k_value& value) {
-    return {value, KValueType::_POINTER};
+  const k_struct& getStruct() const { return heapRef<StructRef>(); }
+  const k_pointer getPointer() const {
+    return k_pointer(load<void*>());
   }
+  KValueType getType() const { return static_cast<KValueType>(_type); }
+  const k_value getValue() const;
 
-  k_int getInteger() const { return std::get<k_int>(_value); }
-  double getFloat() const { return std::get<double>(_value); }
-  bool getBoolean() const { return std::get<bool>(_value); }
-  const k_string getString() const { return std::get<k_string>(_value); }
-  const k_list getList() const { return std::get<k_list>(_value); }
-  const k_hashmap getHashmap() const { return std::get<k_hashmap>(_value); }
-  const k_object getObject() const { return std::get<k_object>(_value); }
-  const k_lambda getLambda() const { return std::get<k_lambda>(_value); }
-  const k_null getNull() const { return std::get<k_null>(_value); }
-  const k_struct getStruct() const { return std::get<k_struct>(_value); }
-  const k_pointer getPointer() const { return std::get<k_pointer>(_value); }
-  KValueType getType() const { return _type; }
-  const k_value getValue() const { return _value; }
+  std::string_view getStringView() const;
 
   bool isInteger() const { return _type == KValueType::_INTEGER; }
   bool isFloat() const { return _type == KValueType::_FLOAT; }
@@ -208,74 +377,118 @@ struct KValue {
   bool isStruct() const { return _type == KValueType::_STRUCT; }
   bool isPointer() const { return _type == KValueType::_POINTER; }
 
-  void set(const k_value& value, const KValueType& type) {
-    _value = value;
-    _type = type;
-  }
+  void set(const k_value& value, const KValueType&) { *this = create(value); }
 
-  void setValue(const KValue& value) {
-    _value = value._value;
-    _type = value._type;
-  }
+  void setValue(const KValue& value) { *this = value; }
   void setValue(const k_int& value) {
-    _value = value;
-    _type = KValueType::_INTEGER;
-  }
-  void setValue(const int& value) {
-    _value = static_cast<k_int>(value);
-    _type = KValueType::_INTEGER;
+    release();
+    store(value, KValueType::_INTEGER);
   }
+  void setValue(const int& value) { setValue(static_cast<k_int>(value)); }
   void setValue(const double& value) {
-    _value = value;
-    _type = KValueType::_FLOAT;
+    release();
+    store(value, KValueType::_FLOAT);
   }
   void setValue(const bool& value) {
-    _value = value;
-    _type = KValueType::_BOOLEAN;
+    release();
+    store(value, KValueType::_BOOLEAN);
   }
-  void setValue(const k_string& value) {
-    _value = value;
-    _type = KValueType::_STRING;
+  void setValue(const k_string& value);
+  void setValue(const k_list& value) { setHeap(value, KValueType::_LIST); }
+  void setValue(const k_hashmap& value) {
+    setHeap(value, KValueType::_HASHMAP);
   }
-  void setValue(const k_list& value) {
-    _value = value;
-    _type = KValueType::_LIST;
+  void setValue(const k_object& value) { setHeap(value, KValueType::_OBJECT); }
+  void setValue(const k_lambda& value) { setHeap(value, KValueType::_LAMBDA); }
+  void setValue(const k_null&) {
+    release();
+    store<k_int>(0, KValueType::_NONE);
   }
-  void setValue(const k_hashmap& value) {
-    _value = value;
-    _type = KValueType::_HASHMAP;
+  void setValue(const k_struct& value) { setHeap(value, KValueType::_STRUCT); }
+  void setValue(const k_pointer& value) {
+    release();
+    store(value.ptr, KValueType::_POINTER);
   }
-  void setValue(const k_object& value) {
-    _value = value;
-    _type = KValueType::_OBJECT;
+
+ private:
+  // Marks a value whose payload is a pointer to a `KRefCounted`.
+  static const uint8_t HeapValue = 0xFF;
+
+  alignas(8) char _data[SmallStringCapacity];
+  uint8_t _length = 0;
+  uint8_t _type = KValueType::_INTEGER;
+
+  template <typename T>
+  T load() const {
+    T value;
+    std::memcpy(&value, _data, sizeof(T));
+    return value;
   }
-  void setValue(const k_lambda& value) {
-    _value = value;
-    _type = KValueType::_LAMBDA;
+
+  template <typename T>
+  void store(const T& value) {
+    std::memcpy(_data, &value, sizeof(T));
   }
-  void setValue(const k_null& value) {
-    _value = value;
-    _type = KValueType::_NONE;
+
+  template <typename T>
+  void store(const T& value, KValueType type) {
+    store(value);
+    _length = 0;
+    _type = type;
   }
-  void setValue(const k_struct& value) {
-    _value = value;
-    _type = KValueType::_STRUCT;
+
+  bool isHeap() const { return _length == HeapValue; }
+  KRefCounted* heap() const { return load<KRefCounted*>(); }
+
+  // The payload of a heap value has the same layout as a `KRef`, so container
+  // accessors lend the handle stored in the value instead of retaining a copy.
+  template <typename T>
+  const KRef<T>& heapRef() const {
+    static_assert(sizeof(KRef<T>) == sizeof(KRefCounted*),
+                  "KRef should be a single pointer.");
+    return *reinterpret_cast<const KRef<T>*>(_data);
   }
-  void setValue(const k_pointer& value) {
-    _value = value;
-    _type = KValueType::_POINTER;
+
+  template <typename T>
+  void setHeap(const KRef<T>& value, KValueType type) {
+    auto* ptr = value.ptr;
+    if (ptr) {
+      ptr->retain();
+    }
+    release();
+    store(ptr);
+    _length = HeapValue;
+    _type = type;
   }
 
- private:
-  k_value _value = {};
-  KValueType _type = KValueType::_UNSET;
+  void retain() const {
+    if (isHeap()) {
+      heap()->retain();
+    }
+  }
+
+  void release() {
+    if (isHeap()) {
+      heap()->release();
+      _length = 0;
+    }
+  }
+
+  void copyFrom(const KValue& other) {
+    std::memcpy(_data, other._data, sizeof(_data));
+    _length = other._length;
+    _type = other._type;
+  }
+
+  void clear() {
+    store<k_int>(0, KValueType::_INTEGER);
+  }
 };
 
+static_assert(sizeof(KValue) == 16, "KValue should fit in sixteen bytes.");
+
 inline bool operator==(const KValue& lhs, const KValue& rhs) {
-  if (lhs.getType() != rhs.getType()) {
-    return false;
-  }
-  return same_value(lhs.getValue(), rhs.getValue());
+  return same_value(lhs, rhs);
 }
 
 inline bool operator!=(const KValue& lhs, const KValue& rhs) {
@@ -287,105 +500,868 @@ inline bool operator!=(const KValue& lhs, const KValue& rhs) {
 // ======================================================
 namespace std {
 template <>
-struct hash<k_value> {
-  std::size_t operator()(const k_value& v) const {
-    switch (v.index()) {
-      case KValueType::_INTEGER:
-        return std::hash<k_int>()(std::get<k_int>(v));
-      case KValueType::_FLOAT:
-        return std::hash<double>()(std::get<double>(v));
-      case KValueType::_BOOLEAN:
-        return std::hash<bool>()(std::get<bool>(v));
-      case KValueType::_STRING:
-        return std::hash<k_string>()(std::get<k_string>(v));
-      case KValueType::_LIST:
-        return hash_list(std::get<k_list>(v));
-      case KValueType::_HASHMAP:
-        return hash_hash(std::get<k_hashmap>(v));
-      case KValueType::_OBJECT:
-        return hash_object(std::get<k_object>(v));
-      case KValueType::_LAMBDA:
-      case KValueType::_NONE:
-      case KValueType::_STRUCT:
-        return false;
-      case KValueType::_POINTER:
-        return std::hash<void*>()(std::get<k_pointer>(v).ptr);
-      default:
-        // Fallback for unknown types
-        return 0;
-    }
+struct hash<KValue> {
+  std::size_t operator()(const KValue& kv) const noexcept {
+    return hash_value(kv);
   }
 };
 
 template <>
-struct hash<KValue> {
-  std::size_t operator()(const KValue& kv) const noexcept {
-    return std::hash<k_value>()(kv.getValue());
+struct hash<k_value> {
+  std::size_t operator()(const k_value& v) const {
+    return hash_value(KValue::create(v));
   }
 };
 }  // namespace std
 
 struct Null {};
 
-struct List {
-  std::vector<KValue> elements;
+struct HeapString : KRefCounted {
+  k_string value;
+
+  HeapString(const k_string& value) : value(value) {}
+};
+
+/*
+ * The structural hash of a container, remembered between calls.
+ *
+ * Containers bump `version` whenever they are modified in place; a cached hash
+ * is only used while the version it was computed at is still current. Only
+ * containers that hold no other containers are cached, because a change to a
+ * nested container would not bump the version of its parent.
+ */
+struct KHashCache {
+  uint64_t version = 0;
+  mutable uint64_t hashedVersion = NotHashed;
+  mutable std::size_t hash = 0;
+
+  void changed() { ++version; }
+
+  bool lookup(std::size_t& result) const {
+    if (hashedVersion != version) {
+      return false;
+    }
+    result = hash;
+    return true;
+  }
+
+  void store(std::size_t result) const {
+    hash = result;
+    hashedVersion = version;
+  }
+
+ private:
+  static constexpr uint64_t NotHashed = static_cast<uint64_t>(-1);
+};
+
+bool is_container(const KValue& value);
+bool keeps_frame(const KValue& value);
+
+// An arithmetic sequence of `count` integers starting at `start`.
+struct KRange {
+  k_int start = 0;
+  k_int step = 1;
+  size_t count = 0;
+
+  k_int at(size_t i) const { return start + static_cast<k_int>(i) * step; }
+  k_int last() const { return at(count - 1); }
+
+  // Position of `value` in the range, or -1.
+  k_int indexOf(k_int value) const {
+    auto offset = value - start;
+    if (step == 0 || offset % step != 0) {
+      return -1;
+    }
+
+    auto index = offset / step;
+    return index >= 0 && static_cast<size_t>(index) < count ? index : -1;
+  }
+
+  k_int sum() const {
+    auto n = static_cast<k_int>(count);
+    auto ends = start + last();
+    return n % 2 == 0 ? n / 2 * ends : ends / 2 * n;
+  }
+
+  std::vector<KValue> expand() const {
+    std::vector<KValue> items;
+    items.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      items.emplace_back(KValue::createInteger(at(i)));
+    }
+    return items;
+  }
+};
+
+/*
+ * The elements of a list, shared between copies until one of them changes.
+ *
+ * Copying only takes a reference to the buffer. Every member that can modify
+ * the elements first gives this copy a buffer of its own if the current one is
+ * shared, so a copy costs nothing until it is written to. Element access and
+ * iteration are read-only for that reason; a caller that modifies elements in
+ * place goes through `mutate()`.
+ *
+ * The elements of a range literal start out as a `KRange` and are only stored
+ * once something needs them in memory. `size()`, `get()` and `range()` never
+ * store them, so loops, indexing and the builtins that check `range()` work
+ * on a range of any length without allocating.
+ */
+class KElements {
+ public:
+  using const_iterator = std::vector<KValue>::const_iterator;
+  using iterator = std::vector<KValue>::iterator;
+
+  KElements() {}
+  KElements(std::vector<KValue> values)
+      : buffer(make_ref<Buffer>(std::move(values))) {}
+
+  static KElements fromRange(const KRange& range) {
+    KElements elements;
+    elements.buffer = make_ref<Buffer>();
+    elements.buffer->range = range;
+    elements.buffer->lazy.store(true, std::memory_order_relaxed);
+    return elements;
+  }
+
+  // The range these elements were created from, while it is not yet stored.
+  const KRange* range() const {
+    return buffer && buffer->lazy.load(std::memory_order_acquire)
+               ? &buffer->range
+               : nullptr;
+  }
+
+  const std::vector<KValue>& items() const {
+    if (!buffer) {
+      return none();
+    }
+
+    if (buffer->lazy.load(std::memory_order_acquire)) {
+      buffer->materialize();
+    }
+    return buffer->items;
+  }
+  operator const std::vector<KValue>&() const { return items(); }
+
+  size_t size() const {
+    const auto* r = range();
+    return r ? r->count : items().size();
+  }
+  bool empty() const { return size() == 0; }
+
+  KValue get(size_t i) const {
+    const auto* r = range();
+    return r ? KValue::createInteger(r->at(i)) : items()[i];
+  }
+
+  const_iterator begin() const { return items().begin(); }
+  const_iterator end() const { return items().end(); }
+  const KValue& operator[](size_t i) const { return items()[i]; }
+  const KValue& at(size_t i) const { return items().at(i); }
+  const KValue& front() const { return items().front(); }
+  const KValue& back() const { return items().back(); }
+
+  // Whether no element is a container or a lambda that keeps a frame,
+  // remembered until the next change.
+  bool isFlat() const {
+    if (!buffer || range()) {
+      return true;
+    }
+
+    auto flat = buffer->flat.load(std::memory_order_relaxed);
+    if (flat == Unknown) {
+      flat = Flat;
+      for (const auto& item : buffer->items) {
+        if (is_container(item) || keeps_frame(item)) {
+          flat = Nested;
+          break;
+        }
+      }
+      buffer->flat.store(flat, std::memory_order_relaxed);
+    }
+    return flat == Flat;
+  }
+
+  // Whether another list holds these elements until one of them changes.
+  bool sharesStorage() const { return buffer && buffer->isShared(); }
+
+  // The buffer shared by copies of these elements, if there is one.
+  const KRefCounted* storage() const { return buffer.get(); }
+
+  // The elements, for a caller that is about to modify them in place.
+  std::vector<KValue>& mutate() {
+    if (!buffer) {
+      buffer = make_ref<Buffer>();
+    } else if (buffer->isShared()) {
+      const auto* r = range();
+      buffer = make_ref<Buffer>(r ? r->expand() : buffer->items);
+    } else {
+      items();
+      buffer->flat.store(Unknown, std::memory_order_relaxed);
+    }
+    return buffer->items;
+  }
+
+  void reserve(size_t n) { mutate().reserve(n); }
+  void clear() { mutate().clear(); }
+  void pop_back() { mutate().pop_back(); }
+  void push_back(const KValue& value) { mutate().push_back(value); }
+  void push_back(KValue&& value) { mutate().push_back(std::move(value)); }
+
+  template <typename... Args>
+  KValue& emplace_back(Args&&... args) {
+    return mutate().emplace_back(std::forward<Args>(args)...);
+  }
+
+  // Positions are taken as offsets before the buffer is copied, so iterators
+  // from `begin()` stay usable.
+  template <typename... Args>
+  iterator insert(const_iterator pos, Args&&... args) {
+    auto offset = pos - begin();
+    auto& items = mutate();
+    return items.insert(items.begin() + offset, std::forward<Args>(args)...);
+  }
+
+  iterator erase(const_iterator pos) {
+    auto offset = pos - begin();
+    auto& items = mutate();
+    return items.erase(items.begin() + offset);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    auto offset = first - begin();
+    auto count = last - first;
+    auto& items = mutate();
+    return items.erase(items.begin() + offset,
+                       items.begin() + offset + count);
+  }
+
+ private:
+  static constexpr int8_t Unknown = 0;
+  static constexpr int8_t Flat = 1;
+  static constexpr int8_t Nested = 2;
+
+  struct Buffer : KRefCounted {
+    std::vector<KValue> items;
+    mutable std::atomic<int8_t> flat{Unknown};
+    KRange range;
+    std::atomic<bool> lazy{false};
+
+    Buffer() {}
+    Buffer(std::vector<KValue> items) : items(std::move(items)) {}
+
+    // Stores the elements of `range`. Buffers can be shared between threads,
+    // so the first one to get here does the work for all of them.
+    void materialize() {
+      static std::mutex lock;
+      std::lock_guard<std::mutex> guard(lock);
+      if (lazy.load(std::memory_order_relaxed)) {
+        items = range.expand();
+        lazy.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  KRef<Buffer> buffer;
+
+  static const std::vector<KValue>& none() {
+    static const std::vector<KValue> items;
+    return items;
+  }
+};
+
+struct List : KRefCounted {
+  KElements elements;
+  KHashCache hashCache;
 
   List() {}
-  List(const std::vector<KValue>& values) : elements(values) {}
+  List(std::vector<KValue> values) : elements(std::move(values)) {}
+  List(KElements elements) : elements(std::move(elements)) {}
+
+  // Must be called after `elements` is modified in place.
+  void changed() { hashCache.changed(); }
+
+  // `elements`, for a caller that is about to modify it in place.
+  std::vector<KValue>& mutableElements() {
+    changed();
+    return elements.mutate();
+  }
 };
 
-struct Hashmap {
-  std::unordered_map<KValue, KValue> kvp;
-  std::vector<KValue> keys;
+/*
+ * An insertion-ordered hash table.
+ *
+ * Entries are appended to a dense array, so iteration follows insertion order
+ * and never visits an empty bucket. Lookups go through a separate
+ * open-addressing index in the style of a Swiss table: every bucket has a
+ * control byte holding seven bits of its key's hash, and a probe compares a
+ * whole group of sixteen control bytes at once before it looks at any entry.
+ *
+ * Removing a key leaves a hole in the entry array. Holes are skipped during
+ * iteration and reclaimed the next time the index is rebuilt, which only
+ * happens on insertion, so removing keys while walking the entries is safe.
+ * An insertion rebuilds the index when it is nearly full or when holes
+ * outnumber live entries, so the array stays proportional to the live keys.
+ */
+struct Hashmap : KRefCounted {
+  struct Entry {
+    KValue key;
+    KValue value;
+    uint64_t hash = 0;
+    bool removed = false;
+  };
+
+  class const_iterator {
+   public:
+    const_iterator(const Hashmap* hash, size_t pos) : hash(hash), pos(pos) {}
+
+    const Entry& operator*() const { return hash->entryAt(pos); }
+    const Entry* operator->() const { return &hash->entryAt(pos); }
+
+    const_iterator& operator++() {
+      pos = hash->nextEntry(pos + 1);
+      return *this;
+    }
 
-  int size() const { return keys.size(); }
+    bool operator==(const const_iterator& other) const {
+      return pos == other.pos;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return pos != other.pos;
+    }
 
-  bool hasKey(const KValue& key) const { return kvp.find(key) != kvp.end(); }
+   private:
+    const Hashmap* hash;
+    size_t pos;
+  };
 
-  void add(const KValue& key, KValue value) {
-    if (!hasKey(key)) {
-      keys.emplace_back(key);
+  size_t size() const { return data().count; }
+  bool empty() const { return data().count == 0; }
+
+  const_iterator begin() const { return {this, nextEntry(0)}; }
+  const_iterator end() const { return {this, entryEnd()}; }
+
+  // Position of the first live entry at or after `pos`, or `entryEnd()`.
+  // Positions stay valid until the next insertion.
+  size_t nextEntry(size_t pos) const {
+    const auto& entries = data().entries;
+    while (pos < entries.size() && entries[pos].removed) {
+      ++pos;
+    }
+    return pos;
+  }
+
+  size_t entryEnd() const { return data().entries.size(); }
+  const Entry& entryAt(size_t pos) const { return data().entries[pos]; }
+
+  KHashCache hashCache;
+
+  bool hasKey(const KValue& key) const { return findEntry(key) != NotFound; }
+
+  const KValue* find(const KValue& key) const {
+    auto pos = findEntry(key);
+    return pos == NotFound ? nullptr : &data().entries[pos].value;
+  }
+
+  // The caller may modify the value, so this counts as a change.
+  KValue* find(const KValue& key) {
+    auto pos = findEntry(key);
+    if (pos == NotFound) {
+      return nullptr;
+    }
+    hashCache.changed();
+    return &write().entries[pos].value;
+  }
+
+  // Whether another hashmap holds these entries until one of them changes.
+  bool sharesStorage() const { return table && table->isShared(); }
+
+  // The table shared by copies of this hashmap, if there is one.
+  const KRefCounted* storage() const { return table.get(); }
+
+  // Returns the value for `key`, or a default value if it is missing.
+  KValue get(const KValue& key) const {
+    const auto* value = find(key);
+    return value ? *value : KValue();
+  }
+
+  // Whether no value is a container or a lambda that keeps a frame,
+  // remembered until the next change. Keys are not considered, because
+  // nothing can modify a key through a hashmap.
+  bool isFlat() const {
+    if (!table) {
+      return true;
+    }
+
+    auto flat = table->flat.load(std::memory_order_relaxed);
+    if (flat == Unknown) {
+      flat = Flat;
+      for (const auto& entry : table->entries) {
+        if (!entry.removed &&
+            (is_container(entry.value) || keeps_frame(entry.value))) {
+          flat = Nested;
+          break;
+        }
+      }
+      table->flat.store(flat, std::memory_order_relaxed);
     }
-    kvp[key] = value;
+    return flat == Flat;
   }
 
-  KValue get(const KValue& key) { return kvp[key]; }
+  void add(const KValue& key, KValue value) {
+    hashCache.changed();
+    auto hash = mix(hash_value(key));
+    auto pos = findEntry(key, hash);
+    auto& t = write();
+    if (pos != NotFound) {
+      t.entries[pos].value = std::move(value);
+      return;
+    }
+
+    // Removed entries reuse their buckets, so the load check alone would let
+    // the entry array grow without bound under add/remove churn. Compact it
+    // once the holes outnumber the live entries.
+    auto removed = t.entries.size() - t.count;
+    if ((t.usedBuckets + 1) * 8 > t.control.size() * 7 ||
+        removed > std::max(t.count, GroupSize)) {
+      rebuild(t.count + 1);
+    }
+
+    auto bucket = findFreeBucket(hash);
+    if (t.control[bucket] == EmptyControl) {
+      ++t.usedBuckets;
+    }
+
+    t.control[bucket] = fragment(hash);
+    t.buckets[bucket] = static_cast<uint32_t>(t.entries.size());
+    t.entries.push_back({key, std::move(value), hash, false});
+    ++t.count;
+  }
 
   void remove(const KValue& key) {
-    kvp.erase(key);
-    auto newEnd = std::remove(keys.begin(), keys.end(), key);
-    keys.erase(newEnd, keys.end());
+    auto hash = mix(hash_value(key));
+    auto bucket = findBucket(key, hash);
+    if (bucket == NotFound) {
+      return;
+    }
+
+    hashCache.changed();
+    auto& t = write();
+    auto& entry = t.entries[t.buckets[bucket]];
+    entry.key = KValue();
+    entry.value = KValue();
+    entry.removed = true;
+    t.control[bucket] = RemovedControl;
+    --t.count;
+  }
+
+  void clear() {
+    hashCache.changed();
+    table.reset();
   }
 
   void merge(const k_hashmap& other) {
-    for (const auto& key : other->keys) {
-      add(key, other->kvp[key]);
+    for (const auto& entry : *other) {
+      add(entry.key, entry.value);
+    }
+  }
+
+ private:
+  static constexpr size_t GroupSize = 16;
+  static constexpr size_t NotFound = static_cast<size_t>(-1);
+  static constexpr uint8_t EmptyControl = 0x80;
+  static constexpr uint8_t RemovedControl = 0xFE;
+  static constexpr int8_t Unknown = 0;
+  static constexpr int8_t Flat = 1;
+  static constexpr int8_t Nested = 2;
+
+  // The entries and index, shared between copies of a hashmap until one of
+  // them changes.
+  struct Table : KRefCounted {
+    std::vector<Entry> entries;
+    std::vector<uint8_t> control;
+    std::vector<uint32_t> buckets;
+    size_t count = 0;
+    size_t usedBuckets = 0;
+    mutable std::atomic<int8_t> flat{Unknown};
+
+    Table() {}
+    Table(const Table& other)
+        : KRefCounted(),
+          entries(other.entries),
+          control(other.control),
+          buckets(other.buckets),
+          count(other.count),
+          usedBuckets(other.usedBuckets) {}
+  };
+
+  KRef<Table> table;
+
+  const Table& data() const {
+    static const Table empty;
+    return table ? *table : empty;
+  }
+
+  // The table, for a caller that is about to modify it. A shared table is
+  // copied first; entry positions and buckets stay the same.
+  Table& write() {
+    if (!table) {
+      table = make_ref<Table>();
+    } else if (table->isShared()) {
+      table = make_ref<Table>(*table);
+    } else {
+      table->flat.store(Unknown, std::memory_order_relaxed);
+    }
+    return *table;
+  }
+
+  // `hash_value` leaves integers unmixed, so spread every bit across the word
+  // before it is split into a group index and a control fragment.
+  static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static uint8_t fragment(uint64_t hash) {
+    return static_cast<uint8_t>(hash & 0x7F);
+  }
+
+  // A bit mask of the bytes in a group of control bytes equal to `byte`.
+  static uint32_t matchGroup(const uint8_t* group, uint8_t byte) {
+#ifdef __SSE2__
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    auto wanted = _mm_set1_epi8(static_cast<char>(byte));
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, wanted)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GroupSize; ++i) {
+      if (group[i] == byte) {
+        mask |= 1u << i;
+      }
+    }
+    return mask;
+#endif
+  }
+
+  static int lowestBit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while ((mask & 1u) == 0) {
+      mask >>= 1;
+      ++bit;
+    }
+    return bit;
+#endif
+  }
+
+  size_t findEntry(const KValue& key) const {
+    return findEntry(key, mix(hash_value(key)));
+  }
+
+  size_t findEntry(const KValue& key, uint64_t hash) const {
+    auto bucket = findBucket(key, hash);
+    return bucket == NotFound ? NotFound : data().buckets[bucket];
+  }
+
+  // Walks the groups on the probe sequence of `hash` and returns the bucket
+  // holding `key`. A group with an empty bucket ends the probe.
+  size_t findBucket(const KValue& key, uint64_t hash) const {
+    const auto& t = data();
+    const auto& control = t.control;
+    if (control.empty()) {
+      return NotFound;
+    }
+
+    auto groupMask = control.size() / GroupSize - 1;
+    auto group = (hash >> 7) & groupMask;
+    auto wanted = fragment(hash);
+
+    for (size_t step = 1;; ++step) {
+      const auto* bytes = control.data() + group * GroupSize;
+      auto matches = matchGroup(bytes, wanted);
+
+      while (matches) {
+        auto bucket = group * GroupSize + lowestBit(matches);
+        const auto& entry = t.entries[t.buckets[bucket]];
+        if (entry.hash == hash && same_value(entry.key, key)) {
+          return bucket;
+        }
+        matches &= matches - 1;
+      }
+
+      if (matchGroup(bytes, EmptyControl)) {
+        return NotFound;
+      }
+
+      group = (group + step) & groupMask;
+    }
+  }
+
+  size_t findFreeBucket(uint64_t hash) const {
+    const auto& control = data().control;
+    auto groupMask = control.size() / GroupSize - 1;
+    auto group = (hash >> 7) & groupMask;
+
+    for (size_t step = 1;; ++step) {
+      const auto* bytes = control.data() + group * GroupSize;
+      auto free = matchGroup(bytes, EmptyControl) |
+                  matchGroup(bytes, RemovedControl);
+      if (free) {
+        return group * GroupSize + lowestBit(free);
+      }
+
+      group = (group + step) & groupMask;
+    }
+  }
+
+  // Drops removed entries and rebuilds the index for `needed` keys. The new
+  // index is left less than half full so that rebuilds stay rare when keys are
+  // added and removed at the same rate. The table must not be shared.
+  void rebuild(size_t needed) {
+    auto& t = *table;
+    auto& entries = t.entries;
+    if (t.count != entries.size()) {
+      size_t live = 0;
+      for (size_t i = 0; i < entries.size(); ++i) {
+        if (!entries[i].removed) {
+          if (live != i) {
+            entries[live] = std::move(entries[i]);
+          }
+          ++live;
+        }
+      }
+      entries.resize(live);
+    }
+
+    size_t capacity = GroupSize;
+    while (needed * 16 > capacity * 7) {
+      capacity *= 2;
+    }
+
+    t.control.assign(capacity, EmptyControl);
+    t.buckets.assign(capacity, 0);
+    t.usedBuckets = entries.size();
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      auto bucket = findFreeBucket(entries[i].hash);
+      t.control[bucket] = fragment(entries[i].hash);
+      t.buckets[bucket] = static_cast<uint32_t>(i);
+    }
+  }
+};
+
+/*
+ * The layout shared by objects that gained the same instance variables in the
+ * same order.
+ *
+ * A shape maps each instance variable name to a slot in an object's value
+ * array. Adding a variable moves the object to a child shape, and objects that
+ * add the same variables in the same order share the same chain of shapes, so
+ * a struct's instances normally all end up with one shape. Shapes are never
+ * modified once created, except for the table of children.
+ */
+class KShape {
+ public:
+  static const std::shared_ptr<KShape>& root() {
+    static const std::shared_ptr<KShape> empty(new KShape());
+    return empty;
+  }
+
+  uint32_t getId() const { return id; }
+  size_t size() const { return names.size(); }
+  const k_string& getName(size_t slot) const { return names[slot]; }
+
+  int find(const k_string& name) const {
+    auto it = slots.find(name);
+    return it == slots.end() ? -1 : it->second;
+  }
+
+  // The shape this one becomes when `name` is added.
+  std::shared_ptr<KShape> withVariable(const k_string& name) {
+    std::lock_guard<std::mutex> guard(transitionsLock);
+    auto& child = transitions[name];
+    if (!child) {
+      child.reset(new KShape(*this, name));
     }
+    return child;
+  }
+
+ private:
+  uint32_t id;
+  std::unordered_map<k_string, int> slots;
+  std::vector<k_string> names;
+  std::mutex transitionsLock;
+  std::unordered_map<k_string, std::shared_ptr<KShape>> transitions;
+
+  KShape() : id(nextId()) {}
+
+  KShape(const KShape& parent, const k_string& name)
+      : id(nextId()), slots(parent.slots), names(parent.names) {
+    slots[name] = static_cast<int>(names.size());
+    names.push_back(name);
+  }
+
+  static uint32_t nextId() {
+    // Zero is reserved for an empty `KInlineCache`.
+    static std::atomic<uint32_t> counter{1};
+    return counter.fetch_add(1, std::memory_order_relaxed);
   }
 };
 
-struct Object {
+/*
+ * Remembers where the last object seen by an instance variable access kept
+ * that variable. The shape id and slot are packed into one word so that
+ * threads sharing a syntax tree never see one without the other.
+ */
+struct KInlineCache {
+  mutable std::atomic<uint64_t> entry{0};
+
+  KInlineCache() {}
+  KInlineCache(const KInlineCache&) {}
+  KInlineCache& operator=(const KInlineCache&) { return *this; }
+};
+
+struct Object : KRefCounted {
   k_string identifier;
   k_string structName;
-  std::unordered_map<k_string, KValue> instanceVariables;
+  std::shared_ptr<KShape> shape = KShape::root();
+  std::vector<KValue> slots;
+
+  size_t size() const { return slots.size(); }
+  const k_string& getVariableName(size_t slot) const {
+    return shape->getName(slot);
+  }
 
   bool hasVariable(const k_string& name) const {
-    return instanceVariables.find(name) != instanceVariables.end();
+    return shape->find(name) >= 0;
   }
-};
 
-struct LambdaRef {
-  k_string identifier;
+  const KValue* findVariable(const k_string& name) const {
+    auto slot = shape->find(name);
+    return slot < 0 ? nullptr : &slots[slot];
+  }
+
+  KValue* findVariable(const k_string& name) {
+    auto slot = shape->find(name);
+    return slot < 0 ? nullptr : &slots[slot];
+  }
+
+  // Like `findVariable`, but skips the name lookup when this object has the
+  // same shape as the last one `cache` saw.
+  KValue* findVariable(const k_string& name, const KInlineCache& cache) {
+    auto cached = cache.entry.load(std::memory_order_relaxed);
+    if (static_cast<uint32_t>(cached >> 32) == shape->getId()) {
+      return &slots[static_cast<uint32_t>(cached)];
+    }
+
+    auto slot = shape->find(name);
+    if (slot < 0) {
+      return nullptr;
+    }
 
-  LambdaRef(const k_string& identifier) : identifier(identifier) {}
+    cache.entry.store(static_cast<uint64_t>(shape->getId()) << 32 |
+                          static_cast<uint32_t>(slot),
+                      std::memory_order_relaxed);
+    return &slots[slot];
+  }
+
+  // Returns the variable called `name`, adding it if it does not exist.
+  KValue& variable(const k_string& name) {
+    auto* value = findVariable(name);
+    return value ? *value : addVariable(name);
+  }
+
+  KValue& variable(const k_string& name, const KInlineCache& cache) {
+    auto* value = findVariable(name, cache);
+    return value ? *value : addVariable(name);
+  }
+
+ private:
+  KValue& addVariable(const k_string& name) {
+    shape = shape->withVariable(name);
+    slots.emplace_back();
+    return slots.back();
+  }
+};
+
+/*
+ * A lambda value. The lambda itself is shared by every copy of the value and
+ * never changes once created. `scope` is the frame the lambda was created in,
+ * which a call falls back to once that frame has left the call stack.
+ */
+struct LambdaRef : KRefCounted {
+  std::shared_ptr<const KLambda> lambda;
+  std::shared_ptr<CallStackFrame> scope;
+
+  LambdaRef(std::shared_ptr<const KLambda> lambda,
+            std::shared_ptr<CallStackFrame> scope = nullptr)
+      : lambda(std::move(lambda)), scope(std::move(scope)) {}
 };
 
-struct StructRef {
+struct StructRef : KRefCounted {
   k_string identifier;
 
   StructRef(const k_string& identifier) : identifier(identifier) {}
 };
 
+std::string_view KValue::getStringView() const {
+  if (isHeap()) {
+    return static_cast<const HeapString*>(heap())->value;
+  }
+  return std::string_view(_data, _length);
+}
+
+void KValue::setValue(const k_string& value) {
+  if (value.size() <= SmallStringCapacity) {
+    release();
+    std::memcpy(_data, value.data(), value.size());
+    _length = static_cast<uint8_t>(value.size());
+    _type = KValueType::_STRING;
+    return;
+  }
+
+  auto* ptr = new HeapString(value);
+  ptr->retain();
+  release();
+  store<KRefCounted*>(ptr);
+  _length = HeapValue;
+  _type = KValueType::_STRING;
+}
+
+const k_value KValue::getValue() const {
+  switch (_type) {
+    case KValueType::_INTEGER:
+      return getInteger();
+    case KValueType::_FLOAT:
+      return getFloat();
+    case KValueType::_BOOLEAN:
+      return getBoolean();
+    case KValueType::_STRING:
+      return getString();
+    case KValueType::_LIST:
+      return getList();
+    case KValueType::_HASHMAP:
+      return getHashmap();
+    case KValueType::_OBJECT:
+      return getObject();
+    case KValueType::_LAMBDA:
+      return getLambda();
+    case KValueType::_STRUCT:
+      return getStruct();
+    case KValueType::_POINTER:
+      return getPointer();
+    default:
+      return getNull();
+  }
+}
+
 inline void hash_combine(std::size_t& seed, std::size_t hash) {
   seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 }
@@ -397,53 +1373,182 @@ struct SliceIndex {
   bool isSlice = false;
 };
 
+// Mixes two words into one by folding their 128-bit product.
+inline uint64_t hash_fold(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  __extension__ typedef unsigned __int128 uint128;
+  auto product = static_cast<uint128>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+  a ^= b;
+  a *= 0x9e3779b97f4a7c15ULL;
+  return a ^ (a >> 32);
+#endif
+}
+
+/*
+ * Hashes a string sixteen bytes at a time. Short strings, which are most
+ * hashmap keys, are read with at most two loads and never enter the loop.
+ */
+std::size_t hash_string(std::string_view s) {
+  static const uint64_t k0 = 0xa0761d6478bd642fULL;
+  static const uint64_t k1 = 0xe7037ed1a0b428dbULL;
+
+  auto read64 = [](const char* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+  };
+  auto read32 = [](const char* p) {
+    uint32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return static_cast<uint64_t>(word);
+  };
+
+  const auto* p = s.data();
+  auto n = s.size();
+  auto seed = k0 ^ n;
+
+  while (n > 16) {
+    seed = hash_fold(read64(p) ^ k1, read64(p + 8) ^ seed);
+    p += 16;
+    n -= 16;
+  }
+
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (n >= 8) {
+    a = read64(p);
+    b = read64(p + n - 8);
+  } else if (n >= 4) {
+    a = read32(p);
+    b = read32(p + n - 4);
+  } else if (n > 0) {
+    a = (static_cast<uint64_t>(static_cast<uint8_t>(p[0])) << 16) |
+        (static_cast<uint64_t>(static_cast<uint8_t>(p[n >> 1])) << 8) |
+        static_cast<uint8_t>(p[n - 1]);
+  }
+
+  return hash_fold(hash_fold(a ^ k1, b ^ seed) ^ k0, s.size() ^ k1);
+}
+
+std::size_t hash_value(const KValue& value) {
+  switch (value.getType()) {
+    case KValueType::_INTEGER:
+      return std::hash<k_int>()(value.getInteger());
+    case KValueType::_FLOAT:
+      return std::hash<double>()(value.getFloat());
+    case KValueType::_BOOLEAN:
+      return std::hash<bool>()(value.getBoolean());
+    case KValueType::_STRING:
+      return hash_string(value.getStringView());
+    case KValueType::_LIST:
+      return hash_list(value.getList());
+    case KValueType::_HASHMAP:
+      return hash_hash(value.getHashmap());
+    case KValueType::_OBJECT:
+      return hash_object(value.getObject());
+    case KValueType::_LAMBDA:
+    case KValueType::_NONE:
+    case KValueType::_STRUCT:
+      return false;
+    case KValueType::_POINTER:
+      return std::hash<void*>()(value.getPointer().ptr);
+    default:
+      // Fallback for unknown types
+      return 0;
+  }
+}
+
+bool is_container(const KValue& value) {
+  switch (value.getType()) {
+    case KValueType::_LIST:
+    case KValueType::_HASHMAP:
+    case KValueType::_OBJECT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether `value` is a lambda that holds the frame it was created in. A
+// container holding one is not flat, so that a clone gets a copy of the
+// lambda without the frame.
+bool keeps_frame(const KValue& value) {
+  return value.isLambda() && value.getLambda()->scope != nullptr;
+}
+
 std::size_t hash_list(const k_list& list) {
   std::size_t seed = 0;
+  if (list->hashCache.lookup(seed)) {
+    return seed;
+  }
+
+  bool flat = true;
   for (const auto& elem : list->elements) {
-    hash_combine(seed, std::hash<k_value>()(elem.getValue()));
+    hash_combine(seed, hash_value(elem));
+    flat = flat && !is_container(elem);
+  }
+
+  if (flat) {
+    list->hashCache.store(seed);
   }
   return seed;
 }
 
+// Entries are summed so that equal hashmaps hash alike whatever order their
+// keys were added in.
 std::size_t hash_hash(const k_hashmap& hash) {
   std::size_t seed = 0;
-  for (const auto& pair : hash->kvp) {
-    hash_combine(seed, std::hash<k_value>()(pair.first.getValue()));
-    hash_combine(seed, std::hash<k_value>()(pair.second.getValue()));
+  if (hash->hashCache.lookup(seed)) {
+    return seed;
+  }
+
+  bool flat = true;
+  for (const auto& entry : *hash) {
+    std::size_t pair = 0;
+    hash_combine(pair, hash_value(entry.key));
+    hash_combine(pair, hash_value(entry.value));
+    seed += pair;
+    flat = flat && !is_container(entry.key) && !is_container(entry.value);
+  }
+
+  if (flat) {
+    hash->hashCache.store(seed);
   }
   return seed;
 }
 
+// Instance variables are summed for the same reason as hashmap entries.
 std::size_t hash_object(const k_object& object) {
-  auto seed = std::hash<k_string>()(object->structName);
-  for (const auto& pair : object->instanceVariables) {
-    hash_combine(seed, std::hash<k_string>()(pair.first));
-    hash_combine(seed, std::hash<k_value>()(pair.second.getValue()));
+  auto seed = hash_string(object->structName);
+  for (size_t i = 0; i < object->size(); ++i) {
+    std::size_t variable = 0;
+    hash_combine(variable, hash_string(object->getVariableName(i)));
+    hash_combine(variable, hash_value(object->slots[i]));
+    seed += variable;
   }
   return seed;
 }
 
 struct ValueComparator {
-  bool operator()(const KValue& lhsValue, const KValue& rhsValue) const {
-    const auto& lhs = lhsValue.getValue();
-    const auto& rhs = rhsValue.getValue();
-
-    if (lhs.index() != rhs.index()) {
-      return lhs.index() < rhs.index();
+  bool operator()(const KValue& lhs, const KValue& rhs) const {
+    if (lhs.getType() != rhs.getType()) {
+      return lhs.getType() < rhs.getType();
     }
 
-    switch (lhs.index()) {
+    switch (lhs.getType()) {
       case KValueType::_INTEGER:
-        return *std::get_if<k_int>(&lhs) < *std::get_if<k_int>(&rhs);
+        return lhs.getInteger() < rhs.getInteger();
       case KValueType::_FLOAT:
-        return *std::get_if<double>(&lhs) < *std::get_if<double>(&rhs);
+        return lhs.getFloat() < rhs.getFloat();
       case KValueType::_BOOLEAN:
-        return *std::get_if<bool>(&lhs) < *std::get_if<bool>(&rhs);
+        return lhs.getBoolean() < rhs.getBoolean();
       case KValueType::_STRING:
-        return *std::get_if<k_string>(&lhs) < *std::get_if<k_string>(&rhs);
+        return lhs.getStringView() < rhs.getStringView();
       default:
-        auto lhs_hash = std::hash<k_value>()(lhs);
-        auto rhs_hash = std::hash<k_value>()(rhs);
+        auto lhs_hash = hash_value(lhs);
+        auto rhs_hash = hash_value(rhs);
         if (lhs_hash != rhs_hash) {
           return lhs_hash < rhs_hash;
         }
@@ -454,15 +1559,23 @@ struct ValueComparator {
 };
 
 void sort_list(List& list) {
-  std::sort(list.elements.begin(), list.elements.end(), ValueComparator());
+  auto& elements = list.mutableElements();
+  std::sort(elements.begin(), elements.end(), ValueComparator());
 }
 
 KValue clone_value(const KValue& original);
 k_hashmap clone_hash(const k_hashmap& original);
 k_list clone_list(const k_list& original);
 
+// A flat container is cloned by sharing its storage, which is only copied when
+// either side is modified. A nested one also clones each element, so that the
+// two never share a container and no lambda in the clone keeps a frame.
 k_list clone_list(const k_list& original) {
-  k_list clone = std::make_shared<List>();
+  if (original->elements.isFlat()) {
+    return make_ref<List>(*original);
+  }
+
+  k_list clone = make_ref<List>();
   auto& cloneElements = clone->elements;
   auto& elements = original->elements;
   cloneElements.reserve(elements.size());
@@ -473,10 +1586,13 @@ k_list clone_list(const k_list& original) {
 }
 
 k_hashmap clone_hash(const k_hashmap& original) {
-  k_hashmap clone = std::make_shared<Hashmap>();
-  auto& keys = original->keys;
-  for (const auto& key : keys) {
-    clone->add(key, clone_value(original->get(key)));
+  if (original->isFlat()) {
+    return make_ref<Hashmap>(*original);
+  }
+
+  k_hashmap clone = make_ref<Hashmap>();
+  for (const auto& entry : *original) {
+    clone->add(entry.key, clone_value(entry.value));
   }
   return clone;
 }
@@ -490,103 +1606,198 @@ KValue clone_value(const KValue& original) {
     case KValueType::_BOOLEAN:
       return KValue::createBoolean(original.getBoolean());
     case KValueType::_STRING:
-      return KValue::createString(original.getString());
+      return original;
     case KValueType::_LIST:
       return KValue::createList(clone_list(original.getList()));
     case KValueType::_HASHMAP:
       return KValue::createHashmap(clone_hash(original.getHashmap()));
-    case KValueType::_OBJECT:
-      return KValue::createObject(
-          std::make_shared<Object>(*original.getObject()));
+    case KValueType::_OBJECT: {
+      auto clone = make_ref<Object>(*original.getObject());
+      for (auto& slot : clone->slots) {
+        if (keeps_frame(slot)) {
+          slot = clone_value(slot);
+        }
+      }
+      return KValue::createObject(clone);
+    }
     case KValueType::_LAMBDA:
+      // A copy may be handed to another task, so it does not keep the frame
+      // of the interpreter it came from.
       return KValue::createLambda(
-          std::make_shared<LambdaRef>(*original.getLambda()));
+          make_ref<LambdaRef>(original.getLambda()->lambda));
     case KValueType::_NONE:
       return KValue::createNull();
     case KValueType::_STRUCT:
       return KValue::createStruct(
-          std::make_shared<StructRef>(*original.getStruct()));
+          make_ref<StructRef>(*original.getStruct()));
     default:
       throw std::runtime_error("Unsupported type for cloning");
   }
 }
 
-bool same_value(const k_value& v1, const k_value& v2) {
-  if (v1.index() != v2.index()) {
+// Two containers with cached hashes that differ cannot be equal.
+bool hashes_differ(const KHashCache& lhs, const KHashCache& rhs) {
+  std::size_t lhsHash = 0;
+  std::size_t rhsHash = 0;
+  return lhs.lookup(lhsHash) && rhs.lookup(rhsHash) && lhsHash != rhsHash;
+}
+
+bool same_list(const k_list& lhs, const k_list& rhs) {
+  if (lhs == rhs) {
+    return true;
+  }
+
+  const auto& lhsElements = lhs->elements;
+  const auto& rhsElements = rhs->elements;
+  if (lhsElements.size() != rhsElements.size() ||
+      hashes_differ(lhs->hashCache, rhs->hashCache)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < lhsElements.size(); ++i) {
+    if (!same_value(lhsElements[i], rhsElements[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Hashmaps are equal when they hold the same entries, in any order.
+bool same_hash(const k_hashmap& lhs, const k_hashmap& rhs) {
+  if (lhs == rhs) {
+    return true;
+  }
+
+  if (lhs->size() != rhs->size() ||
+      hashes_differ(lhs->hashCache, rhs->hashCache)) {
+    return false;
+  }
+
+  const Hashmap& other = *rhs;
+  for (const auto& entry : *lhs) {
+    const auto* value = other.find(entry.key);
+    if (!value || !same_value(entry.value, *value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool same_object(const k_object& lhs, const k_object& rhs) {
+  if (lhs == rhs) {
+    return true;
+  }
+
+  if (lhs->structName != rhs->structName || lhs->size() != rhs->size()) {
     return false;
   }
 
-  switch (v1.index()) {
+  // Objects built the same way share a shape, so their slots line up.
+  if (lhs->shape == rhs->shape) {
+    for (size_t i = 0; i < lhs->size(); ++i) {
+      if (!same_value(lhs->slots[i], rhs->slots[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Object& other = *rhs;
+  for (size_t i = 0; i < lhs->size(); ++i) {
+    const auto* value = other.findVariable(lhs->getVariableName(i));
+    if (!value || !same_value(lhs->slots[i], *value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool same_value(const KValue& v1, const KValue& v2) {
+  if (v1.getType() != v2.getType()) {
+    return false;
+  }
+
+  switch (v1.getType()) {
     case KValueType::_INTEGER:
-      return *std::get_if<k_int>(&v1) == *std::get_if<k_int>(&v2);
+      return v1.getInteger() == v2.getInteger();
     case KValueType::_FLOAT:
-      return *std::get_if<double>(&v1) == *std::get_if<double>(&v2);
+      return v1.getFloat() == v2.getFloat();
     case KValueType::_BOOLEAN:
-      return *std::get_if<bool>(&v1) == *std::get_if<bool>(&v2);
+      return v1.getBoolean() == v2.getBoolean();
     case KValueType::_STRING:
-      return *std::get_if<k_string>(&v1) == *std::get_if<k_string>(&v2);
+      return v1.getStringView() == v2.getStringView();
+    case KValueType::_LIST:
+      return same_list(v1.getList(), v2.getList());
+    case KValueType::_HASHMAP:
+      return same_hash(v1.getHashmap(), v2.getHashmap());
+    case KValueType::_OBJECT:
+      return same_object(v1.getObject(), v2.getObject());
+    case KValueType::_LAMBDA:
+      return v1.getLambda()->lambda == v2.getLambda()->lambda;
+    case KValueType::_STRUCT:
+      return v1.getStruct()->identifier == v2.getStruct()->identifier;
+    case KValueType::_POINTER:
+      return v1.getPointer().ptr == v2.getPointer().ptr;
     default:
-      return std::hash<k_value>()(v1) == std::hash<k_value>()(v2);
+      return true;
   }
 }
 
-bool lt_value(const k_value& lhs, const k_value& rhs) {
-  if (lhs.index() != rhs.index()) {
-    return lhs.index() < rhs.index();
+bool lt_value(const KValue& lhs, const KValue& rhs) {
+  if (lhs.getType() != rhs.getType()) {
+    return lhs.getType() < rhs.getType();
   }
 
-  switch (lhs.index()) {
+  switch (lhs.getType()) {
     case KValueType::_INTEGER:
-      return std::get<k_int>(lhs) < std::get<k_int>(rhs);
+      return lhs.getInteger() < rhs.getInteger();
     case KValueType::_FLOAT:
-      return std::get<double>(lhs) < std::get<double>(rhs);
+      return lhs.getFloat() < rhs.getFloat();
     case KValueType::_BOOLEAN:
-      return std::get<bool>(lhs) < std::get<bool>(rhs);
+      return lhs.getBoolean() < rhs.getBoolean();
     case KValueType::_STRING:
-      return std::get<k_string>(lhs) < std::get<k_string>(rhs);
+      return lhs.getStringView() < rhs.getStringView();
     case KValueType::_LIST:
-      return hash_list(std::get<k_list>(lhs)) <
-             hash_list(std::get<k_list>(rhs));
+      return hash_list(lhs.getList()) < hash_list(rhs.getList());
     case KValueType::_HASHMAP:
-      return hash_hash(std::get<k_hashmap>(lhs)) <
-             hash_hash(std::get<k_hashmap>(rhs));
+      return hash_hash(lhs.getHashmap()) < hash_hash(rhs.getHashmap());
     case KValueType::_OBJECT:
-      return hash_object(std::get<k_object>(lhs)) <
-             hash_object(std::get<k_object>(rhs));
+      return hash_object(lhs.getObject()) < hash_object(rhs.getObject());
     default:
       return false;
   }
 }
 
-bool gt_value(const k_value& lhs, const k_value& rhs) {
-  if (lhs.index() != rhs.index()) {
-    return lhs.index() < rhs.index();
+bool gt_value(const KValue& lhs, const KValue& rhs) {
+  if (lhs.getType() != rhs.getType()) {
+    return lhs.getType() < rhs.getType();
   }
 
-  switch (lhs.index()) {
+  switch (lhs.getType()) {
     case KValueType::_INTEGER:
-      return std::get<k_int>(lhs) > std::get<k_int>(rhs);
+      return lhs.getInteger() > rhs.getInteger();
     case KValueType::_FLOAT:
-      return std::get<double>(lhs) > std::get<double>(rhs);
+      return lhs.getFloat() > rhs.getFloat();
     case KValueType::_BOOLEAN:
-      return std::get<bool>(lhs) > std::get<bool>(rhs);
+      return lhs.getBoolean() > rhs.getBoolean();
     case KValueType::_STRING:
-      return std::get<k_string>(lhs) > std::get<k_string>(rhs);
+      return lhs.getStringView() > rhs.getStringView();
     case KValueType::_LIST:
-      return hash_list(std::get<k_list>(lhs)) >
-             hash_list(std::get<k_list>(rhs));
+      return hash_list(lhs.getList()) > hash_list(rhs.getList());
     case KValueType::_HASHMAP:
-      return hash_hash(std::get<k_hashmap>(lhs)) >
-             hash_hash(std::get<k_hashmap>(rhs));
+      return hash_hash(lhs.getHashmap()) > hash_hash(rhs.getHashmap());
     case KValueType::_OBJECT:
-      return hash_object(std::get<k_object>(lhs)) >
-             hash_object(std::get<k_object>(rhs));
+      return hash_object(lhs.getObject()) > hash_object(rhs.getObject());
     default:
       return false;
   }
 }
 
 KValue sum_listvalue(k_list list) {
+  if (const auto* range = list->elements.range()) {
+    return KValue::createInteger(range->sum());
+  }
+
   double sum = 0;
   bool isFloatResult = false;
 
@@ -608,6 +1819,9 @@ KValue sum_listvalue(k_list list) {
 
 KValue min_listvalue(k_list list) {
   const auto& elements = list->elements;
+  if (const auto* range = elements.range()) {
+    return KValue::createInteger(std::min(range->start, range->last()));
+  }
 
   if (elements.empty()) {
     return {};
@@ -615,7 +1829,7 @@ KValue min_listvalue(k_list list) {
 
   auto minValue = elements.at(0);
   for (const auto& val : elements) {
-    if (lt_value(val.getValue(), minValue.getValue())) {
+    if (lt_value(val, minValue)) {
       minValue = val;
     }
   }
@@ -625,6 +1839,9 @@ KValue min_listvalue(k_list list) {
 
 KValue max_listvalue(k_list list) {
   const auto& elements = list->elements;
+  if (const auto* range = elements.range()) {
+    return KValue::createInteger(std::max(range->start, range->last()));
+  }
 
   if (elements.empty()) {
     return {};
@@ -632,7 +1849,7 @@ KValue max_listvalue(k_list list) {
 
   auto maxValue = elements.at(0);
   for (const auto& val : elements) {
-    if (gt_value(val.getValue(), maxValue.getValue())) {
+    if (gt_value(val, maxValue)) {
       maxValue = val;
     }
   }
@@ -640,14 +1857,19 @@ KValue max_listvalue(k_list list) {
   return maxValue;
 }
 
-KValue indexof_listvalue(const k_list& list, const k_value& value) {
+KValue indexof_listvalue(const k_list& list, const KValue& value) {
   const auto& elements = list->elements;
+  if (const auto* range = elements.range()) {
+    return KValue::createInteger(
+        value.isInteger() ? range->indexOf(value.getInteger()) : -1);
+  }
+
   if (elements.empty()) {
     return KValue::createInteger(-1);
   }
 
   for (size_t i = 0; i < elements.size(); ++i) {
-    if (same_value(elements.at(i).getValue(), value)) {
+    if (same_value(elements.at(i), value)) {
       return KValue::createInteger(i);
     }
   }
@@ -655,14 +1877,14 @@ KValue indexof_listvalue(const k_list& list, const k_value& value) {
   return KValue::createInteger(-1);
 }
 
-KValue lastindexof_listvalue(const k_list& list, const k_value& value) {
+KValue lastindexof_listvalue(const k_list& list, const KValue& value) {
   const auto& elements = list->elements;
   if (elements.empty()) {
     return KValue::createInteger(-1);
   }
 
   for (size_t i = elements.size(); i-- > 0;) {
-    if (same_value(elements.at(i).getValue(), value)) {
+    if (same_value(elements.at(i), value)) {
       return KValue::createInteger(i);
     }
   }
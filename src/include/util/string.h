@@ -6,6 +6,7 @@
 #include <cctype>
 #include <memory>
 #include <regex>
+#include <string_view>
 #include "typing/value.h"
 
 static const k_string base64_chars =
@@ -20,7 +21,7 @@ class String {
   /// @param s The string to search.
   /// @param beginning The string to find.
   /// @return Boolean indicating existence.
-  static bool beginsWith(const k_string& s, const k_string& beginning) {
+  static bool beginsWith(std::string_view s, std::string_view beginning) {
     return s.size() > beginning.size() &&
            s.substr(0, beginning.size()) == beginning;
   }
@@ -29,19 +30,19 @@ class String {
   /// @param s The string to search.
   /// @param beginning The string to find.
   /// @return Boolean indicating existence.
-  static bool contains(const k_string& s, const k_string& search) {
-    if (search == "") {
+  static bool contains(std::string_view s, std::string_view search) {
+    if (search.empty()) {
       return false;
     }
 
-    return s.find(search) != k_string::npos;
+    return s.find(search) != std::string_view::npos;
   }
 
   /// @brief Check if a string ends with another string.
   /// @param s The string to search.
   /// @param beginning The string to find.
   /// @return Boolean indicating existence.
-  static bool endsWith(const k_string& s, const k_string& end) {
+  static bool endsWith(std::string_view s, std::string_view end) {
     return s.size() > end.size() && s.substr(s.size() - end.size()) == end;
   }
 
@@ -49,7 +50,7 @@ class String {
   /// @param haystack The string to search.
   /// @param needle The target to find in the haystack.
   /// @return The number of occurrences of a string within a string.
-  static k_int count(const k_string& haystack, const k_string& needle) {
+  static k_int count(std::string_view haystack, std::string_view needle) {
     if (needle.empty()) {
       return 0;
     }
@@ -57,7 +58,7 @@ class String {
     std::size_t count = 0;
     std::size_t pos = haystack.find(needle);
 
-    while (pos != k_string::npos) {
+    while (pos != std::string_view::npos) {
       ++count;
       pos = haystack.find(needle, pos + needle.size());
     }
@@ -105,7 +106,7 @@ class String {
       results.emplace_back(KValue::createString(input.substr(start)));
     }
 
-    return std::make_shared<List>(results);
+    return make_ref<List>(results);
   }
 
   /// @brief Returns a list of capture groups.
@@ -123,7 +124,7 @@ class String {
       }
     }
 
-    return std::make_shared<List>(results);
+    return make_ref<List>(results);
   }
 
   /// @brief Tests whether the entire string conforms to a regular expression pattern.
@@ -199,7 +200,7 @@ class String {
       matches.emplace_back(KValue::createString(match.str()));
     }
 
-    return std::make_shared<List>(matches);
+    return make_ref<List>(matches);
   }
 
   static std::vector<k_string> split(const k_string& str,
@@ -330,9 +331,9 @@ class String {
   /// @param s The string to search.
   /// @param search The string to find.
   /// @return Integer containing the index of a substring. Returns -1 if not found.
-  static int indexOf(const k_string& s, const k_string& search) {
+  static int indexOf(std::string_view s, std::string_view search) {
     size_t index = s.find(search);
-    if (index != k_string::npos) {
+    if (index != std::string_view::npos) {
       return index;
     }
 
@@ -343,9 +344,9 @@ class String {
   /// @param s The string to search.
   /// @param search The string to find.
   /// @return Integer containing the last index of a substring. Returns -1 if not found.
-  static int lastIndexOf(const k_string& s, const k_string& search) {
+  static int lastIndexOf(std::string_view s, std::string_view search) {
     size_t index = s.rfind(search);
-    if (index != k_string::npos) {
+    if (index != std::string_view::npos) {
       return static_cast<int>(index);
     }
 
@@ -0,0 +1,133 @@
+#ifndef KIWI_VM_BYTECODE_H
+#define KIWI_VM_BYTECODE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "parsing/ast.h"
+#include "typing/value.h"
+
+// Every opcode understood by the VM. The list is expanded into the enum
+// below and into the dispatch table used by `KInterpreter::execute`.
+#define KIWI_OPCODES(X) \
+  X(Nop)                \
+  X(LoadConst)          \
+  X(LoadCopy)           \
+  X(LoadVar)            \
+  X(Move)               \
+  X(CacheLoad)          \
+  X(CacheStore)         \
+  X(Eval)               \
+  X(EvalStmt)           \
+  X(Assign)             \
+  X(StoreVar)           \
+  X(Unary)              \
+  X(Binary)             \
+  X(BinaryInteger)      \
+  X(BinaryFloat)        \
+  X(BinaryConcat)       \
+  X(BinaryGeneric)      \
+  X(Index)              \
+  X(MakeList)           \
+  X(Print)              \
+  X(Jump)               \
+  X(JumpIfFalse)        \
+  X(JumpIfTrue)         \
+  X(Loop)               \
+  X(LoopEnter)          \
+  X(LoopExit)           \
+  X(SafeCheck)          \
+  X(IterPrepare)        \
+  X(IterNext)           \
+  X(IterEnd)            \
+  X(RepeatPrepare)      \
+  X(RepeatNext)         \
+  X(RepeatEnd)          \
+  X(CallCheck)          \
+  X(Call)               \
+  X(MethodCheck)        \
+  X(MethodCall)         \
+  X(Return)             \
+  X(Halt)
+
+enum class KOpCode : uint8_t {
+#define KIWI_OPCODE_ENUM(name) name,
+  KIWI_OPCODES(KIWI_OPCODE_ENUM)
+#undef KIWI_OPCODE_ENUM
+};
+
+/*
+ * A single register-machine instruction.
+ *
+ * Operands `a` through `d` are register indices, variable slots, constant
+ * indices or jump targets depending on the opcode. `node` points back into
+ * the syntax tree the chunk was compiled from; it supplies the token for error
+ * reporting and the tree-walker fallback for anything the compiler does not
+ * lower.
+ *
+ * A `Binary` instruction replaces its opcode with a form specialized for the
+ * operand types it first sees, and with `BinaryGeneric` once that guess turns
+ * out wrong. Chunks can be shared by interpreters on other threads, so the
+ * opcode is atomic; relaxed loads and stores compile to plain moves.
+ */
+struct KInstruction {
+  mutable std::atomic<KOpCode> op{KOpCode::Nop};
+  int a = -1;
+  int b = -1;
+  int c = -1;
+  int d = -1;
+  const ASTNode* node = nullptr;
+
+  KInstruction() {}
+  KInstruction(KOpCode op, int a, int b, int c, int d, const ASTNode* node)
+      : op(op), a(a), b(b), c(c), d(d), node(node) {}
+  KInstruction(const KInstruction& other)
+      : op(other.getOp()),
+        a(other.a),
+        b(other.b),
+        c(other.c),
+        d(other.d),
+        node(other.node) {}
+
+  KInstruction& operator=(const KInstruction& other) {
+    op.store(other.getOp(), std::memory_order_relaxed);
+    a = other.a;
+    b = other.b;
+    c = other.c;
+    d = other.d;
+    node = other.node;
+    return *this;
+  }
+
+  KOpCode getOp() const { return op.load(std::memory_order_relaxed); }
+
+  void setOp(KOpCode newOp) const {
+    op.store(newOp, std::memory_order_relaxed);
+  }
+};
+
+// Jump targets for `break` and `next` when they are signalled by a statement
+// that was handed to the tree walker.
+struct KLoopTargets {
+  int breakTarget = -1;
+  int nextTarget = -1;
+};
+
+/*
+ * Compiled body of a function, lambda or program.
+ *
+ * Register 0 always holds the value of the last executed statement, which is
+ * the implicit result of a body. Every variable name the body reads or writes
+ * is resolved to a slot in `names`; at run time a slot caches the location of
+ * that variable in the frame so repeated accesses skip the name lookup. A
+ * chunk borrows the tree it was compiled from, so it must not outlive it.
+ */
+struct KChunk {
+  std::vector<KInstruction> code;
+  std::vector<KValue> constants;
+  std::vector<k_string> names;
+  std::vector<KLoopTargets> loops;
+  int numRegisters = 1;
+};
+
+#endif
@@ -0,0 +1,1152 @@
+#ifndef KIWI_VM_COMPILER_H
+#define KIWI_VM_COMPILER_H
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "parsing/ast.h"
+#include "typing/value.h"
+#include "vm/bytecode.h"
+
+/*
+ * Lowers function, lambda and program bodies into a `KChunk`.
+ *
+ * Control flow, arithmetic, variable access, assignment and calls are lowered
+ * into register instructions. Anything else is emitted as an `Eval` or
+ * `EvalStmt` instruction that hands the node back to the tree walker, so every
+ * construct the parser produces can be compiled.
+ *
+ * Loops get two more things:
+ *
+ * - An expression in a loop that is built from names the loop never assigns,
+ *   operators and read-only builtins is kept in a register the first time it
+ *   is evaluated. The interpreter counts the points where code the compiler
+ *   cannot see might have changed something, such as a call or a builtin
+ *   that modifies its receiver, and a kept value is only used while that
+ *   count has not moved.
+ * - The counter of a `repeat` and the iterators of a `for` stay in registers
+ *   when the body is compiled throughout and nothing in it can look them up
+ *   by name. They are never stored in the frame.
+ */
+class KCompiler {
+ public:
+  std::shared_ptr<KChunk> compileBody(
+      const std::vector<std::unique_ptr<ASTNode>>& body) {
+    begin(false);
+
+    for (const auto& stmt : body) {
+      compileStatement(stmt.get());
+    }
+
+    return end();
+  }
+
+  std::shared_ptr<KChunk> compileProgram(const ProgramNode* node) {
+    begin(true);
+
+    // A top-level `return` ends the statement it appears in.
+    for (const auto& stmt : node->statements) {
+      returnJumps.clear();
+      compileStatement(stmt.get());
+      patchAll(returnJumps, here());
+    }
+
+    return end();
+  }
+
+ private:
+  struct LoopContext {
+    int loopIndex;
+    std::vector<int> breakJumps;
+    std::vector<int> nextJumps;
+  };
+
+  // What the body of a loop does to the names it uses.
+  struct LoopScan {
+    // Names the compiled body assigns, and the variables of nested loops.
+    std::unordered_set<k_string> written;
+    // Names in the arguments of a method call, which the tree walker looks up
+    // itself when the receiver is an object or a struct.
+    std::unordered_set<k_string> evaluated;
+    // Whether everything in the body is compiled, with no call that could see
+    // this frame.
+    bool closed = true;
+    int argumentDepth = 0;
+  };
+
+  std::shared_ptr<KChunk> chunk;
+  std::vector<LoopContext> loops;
+  std::vector<int> returnJumps;
+  std::unordered_map<k_string, int> slots;
+  // Loop variables held in registers, and loop-invariant expressions with the
+  // pair of registers that keeps their value.
+  std::unordered_map<k_string, int> registerVariables;
+  std::unordered_map<const ASTNode*, int> invariants;
+  bool programMode = false;
+  int nextRegister = 1;
+
+  static const int NullConstant = 0;
+
+  void begin(bool isProgram) {
+    chunk = std::make_shared<KChunk>();
+    chunk->constants.emplace_back();
+    loops.clear();
+    returnJumps.clear();
+    slots.clear();
+    registerVariables.clear();
+    invariants.clear();
+    programMode = isProgram;
+    nextRegister = 1;
+  }
+
+  std::shared_ptr<KChunk> end() {
+    emit(KOpCode::Halt);
+    return std::move(chunk);
+  }
+
+  int here() const { return static_cast<int>(chunk->code.size()); }
+
+  int emit(KOpCode op, int a = -1, int b = -1, int c = -1,
+           const ASTNode* node = nullptr) {
+    return emit(op, a, b, c, -1, node);
+  }
+
+  int emit(KOpCode op, int a, int b, int c, int d, const ASTNode* node) {
+    chunk->code.emplace_back(op, a, b, c, d, node);
+    return here() - 1;
+  }
+
+  int allocate(int count = 1) {
+    auto reg = nextRegister;
+    nextRegister += count;
+    if (nextRegister > chunk->numRegisters) {
+      chunk->numRegisters = nextRegister;
+    }
+    return reg;
+  }
+
+  void release(int mark) { nextRegister = mark; }
+
+  int resolveSlot(const k_string& name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) {
+      return it->second;
+    }
+
+    auto slot = static_cast<int>(chunk->names.size());
+    chunk->names.emplace_back(name);
+    slots[name] = slot;
+    return slot;
+  }
+
+  int resolveSlot(const std::unique_ptr<ASTNode>& identifier) {
+    if (!identifier) {
+      return -1;
+    }
+
+    const auto* name = static_cast<const IdentifierNode*>(identifier.get());
+    return resolveSlot(name->name);
+  }
+
+  static bool isInstanceVariable(const k_string& name) {
+    return !name.empty() && name.at(0) == '@';
+  }
+
+  int addConstant(const KValue& value) {
+    chunk->constants.emplace_back(value);
+    return static_cast<int>(chunk->constants.size()) - 1;
+  }
+
+  void patch(int at, int target) {
+    auto& instruction = chunk->code.at(at);
+    switch (instruction.getOp()) {
+      case KOpCode::Jump:
+      case KOpCode::Loop:
+        instruction.a = target;
+        break;
+
+      case KOpCode::JumpIfFalse:
+      case KOpCode::JumpIfTrue:
+      case KOpCode::CallCheck:
+      case KOpCode::Return:
+        instruction.b = target;
+        break;
+
+      default:
+        instruction.c = target;
+        break;
+    }
+  }
+
+  void patchAll(const std::vector<int>& jumps, int target) {
+    for (const auto& jump : jumps) {
+      patch(jump, target);
+    }
+  }
+
+  int currentLoop() const {
+    return loops.empty() ? -1 : loops.back().loopIndex;
+  }
+
+  void beginLoop(int nextTarget) {
+    KLoopTargets targets;
+    targets.nextTarget = nextTarget;
+    chunk->loops.emplace_back(targets);
+    loops.push_back({static_cast<int>(chunk->loops.size()) - 1, {}, {}});
+  }
+
+  void endLoop(int breakTarget) {
+    auto& loop = loops.back();
+    chunk->loops.at(loop.loopIndex).breakTarget = breakTarget;
+    patchAll(loop.breakJumps, breakTarget);
+    patchAll(loop.nextJumps, chunk->loops.at(loop.loopIndex).nextTarget);
+    loops.pop_back();
+  }
+
+  void compileBlock(const std::vector<std::unique_ptr<ASTNode>>& body) {
+    for (const auto& stmt : body) {
+      compileStatement(stmt.get());
+    }
+  }
+
+  void compileStatement(const ASTNode* node) {
+    if (!node) {
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::IF:
+        compileIf(static_cast<const IfNode*>(node));
+        break;
+
+      case ASTNodeType::WHILE_LOOP:
+        compileWhile(static_cast<const WhileLoopNode*>(node));
+        break;
+
+      case ASTNodeType::FOR_LOOP:
+        compileFor(static_cast<const ForLoopNode*>(node));
+        break;
+
+      case ASTNodeType::REPEAT_LOOP:
+        compileRepeat(static_cast<const RepeatLoopNode*>(node));
+        break;
+
+      case ASTNodeType::BREAK:
+        if (loops.empty()) {
+          compileFallbackStatement(node);
+        } else {
+          compileLoopControl(static_cast<const BreakNode*>(node)->condition,
+                             loops.back().breakJumps);
+        }
+        break;
+
+      case ASTNodeType::NEXT:
+        if (loops.empty()) {
+          compileFallbackStatement(node);
+        } else {
+          compileLoopControl(static_cast<const NextNode*>(node)->condition,
+                             loops.back().nextJumps);
+        }
+        break;
+
+      case ASTNodeType::RETURN:
+        compileReturn(static_cast<const ReturnNode*>(node));
+        break;
+
+      case ASTNodeType::ASSIGNMENT:
+      case ASTNodeType::PRINT:
+      case ASTNodeType::FUNCTION_CALL:
+      case ASTNodeType::METHOD_CALL:
+      case ASTNodeType::LITERAL:
+      case ASTNodeType::IDENTIFIER:
+      case ASTNodeType::BINARY_OPERATION:
+      case ASTNodeType::UNARY_OPERATION:
+      case ASTNodeType::TERNARY_OPERATION:
+      case ASTNodeType::LIST_LITERAL:
+      case ASTNodeType::INDEX:
+        compileExpression(node, 0);
+        break;
+
+      default:
+        compileFallbackStatement(node);
+        break;
+    }
+  }
+
+  void compileFallbackStatement(const ASTNode* node) {
+    auto at = emit(KOpCode::EvalStmt, 0, currentLoop(), -1, node);
+    if (programMode) {
+      returnJumps.push_back(at);
+    }
+  }
+
+  void compileIf(const IfNode* node) {
+    std::vector<int> endJumps;
+    emit(KOpCode::LoadConst, 0, NullConstant);
+
+    auto mark = nextRegister;
+    auto condition = allocate();
+    compileExpression(node->condition.get(), condition);
+    auto skip = emit(KOpCode::JumpIfFalse, condition);
+    release(mark);
+
+    compileBlock(node->body);
+
+    for (const auto& elseif : node->elseifNodes) {
+      endJumps.push_back(emit(KOpCode::Jump));
+      patch(skip, here());
+
+      condition = allocate();
+      compileExpression(elseif->condition.get(), condition);
+      skip = emit(KOpCode::JumpIfFalse, condition);
+      release(mark);
+
+      compileBlock(elseif->body);
+    }
+
+    if (!node->elseBody.empty()) {
+      endJumps.push_back(emit(KOpCode::Jump));
+      patch(skip, here());
+      compileBlock(node->elseBody);
+    } else {
+      patch(skip, here());
+    }
+
+    patchAll(endJumps, here());
+  }
+
+  void compileWhile(const WhileLoopNode* node) {
+    LoopScan scan;
+    scanExpression(node->condition.get(), scan);
+    scanBlock(node->body, scan);
+
+    auto mark = nextRegister;
+    auto iterations = allocate();
+    emit(KOpCode::LoopEnter, iterations, -1, -1, node);
+    auto hoisted = hoistInvariants(node->condition.get(), node->body, scan);
+
+    auto start = here();
+    auto condition = allocate();
+    compileExpression(node->condition.get(), condition);
+    auto exit = emit(KOpCode::JumpIfFalse, condition);
+    emit(KOpCode::SafeCheck, iterations, -1, -1, node);
+
+    beginLoop(start);
+    compileBlock(node->body);
+    emit(KOpCode::Loop, start, -1, -1, node);
+
+    patch(exit, here());
+    endLoop(here());
+    emit(KOpCode::LoopExit, -1, -1, -1, node);
+    forgetInvariants(hoisted);
+    release(mark);
+  }
+
+  void compileFor(const ForLoopNode* node) {
+    LoopScan scan;
+    scanBlock(node->body, scan);
+    auto unboxed =
+        canUnbox(node->valueIterator, scan) &&
+        (!node->indexIterator || canUnbox(node->indexIterator, scan));
+    addWritten(node->valueIterator, scan);
+    addWritten(node->indexIterator, scan);
+
+    // The iteration index lives in the register after the data set. Iterators
+    // kept in registers follow it.
+    auto mark = nextRegister;
+    auto dataSet = allocate(unboxed ? 4 : 2);
+    compileExpression(node->dataSet.get(), dataSet);
+    auto hoisted = hoistInvariants(nullptr, node->body, scan);
+    emit(KOpCode::IterPrepare, dataSet, -1, -1, node);
+
+    auto start = unboxed ? emit(KOpCode::IterNext, dataSet, -1, -1, -1, node)
+                         : emit(KOpCode::IterNext, dataSet,
+                                resolveSlot(node->valueIterator), -1,
+                                resolveSlot(node->indexIterator), node);
+    if (unboxed) {
+      bindRegister(node->valueIterator, dataSet + 2);
+      bindRegister(node->indexIterator, dataSet + 3);
+    }
+
+    beginLoop(start);
+    compileBlock(node->body);
+    emit(KOpCode::Loop, start, -1, -1, node);
+
+    patch(start, here());
+    endLoop(here());
+    emit(KOpCode::IterEnd, -1, -1, -1, node);
+    unbindRegister(node->valueIterator);
+    unbindRegister(node->indexIterator);
+    forgetInvariants(hoisted);
+    release(mark);
+  }
+
+  void compileRepeat(const RepeatLoopNode* node) {
+    LoopScan scan;
+    scanBlock(node->body, scan);
+    auto unboxed = node->alias && canUnbox(node->alias, scan);
+    addWritten(node->alias, scan);
+
+    // The counter lives in the register after the count, and is the alias
+    // when that is kept in a register.
+    auto mark = nextRegister;
+    auto count = allocate(2);
+    compileExpression(node->count.get(), count);
+    auto hoisted = hoistInvariants(nullptr, node->body, scan);
+    emit(KOpCode::RepeatPrepare, count, -1, -1, node);
+
+    auto start = emit(KOpCode::RepeatNext, count,
+                      unboxed ? -1 : resolveSlot(node->alias), -1, node);
+    if (unboxed) {
+      bindRegister(node->alias, count + 1);
+    }
+
+    beginLoop(start);
+    compileBlock(node->body);
+    emit(KOpCode::Loop, start, -1, -1, node);
+
+    patch(start, here());
+    endLoop(here());
+    emit(KOpCode::RepeatEnd, -1, -1, -1, node);
+    unbindRegister(node->alias);
+    forgetInvariants(hoisted);
+    release(mark);
+  }
+
+  static const k_string* getName(const std::unique_ptr<ASTNode>& identifier) {
+    if (!identifier || identifier->type != ASTNodeType::IDENTIFIER) {
+      return nullptr;
+    }
+    return &static_cast<const IdentifierNode*>(identifier.get())->name;
+  }
+
+  // A loop variable can be kept in a register if only compiled code in the
+  // body reads it, and nothing there assigns it.
+  static bool canUnbox(const std::unique_ptr<ASTNode>& identifier,
+                       const LoopScan& scan) {
+    const auto* name = getName(identifier);
+    return scan.closed && name && !isInstanceVariable(*name) &&
+           scan.written.find(*name) == scan.written.end() &&
+           scan.evaluated.find(*name) == scan.evaluated.end();
+  }
+
+  static void addWritten(const std::unique_ptr<ASTNode>& identifier,
+                         LoopScan& scan) {
+    if (const auto* name = getName(identifier)) {
+      scan.written.insert(*name);
+    }
+  }
+
+  void bindRegister(const std::unique_ptr<ASTNode>& identifier, int reg) {
+    if (const auto* name = getName(identifier)) {
+      registerVariables[*name] = reg;
+    }
+  }
+
+  void unbindRegister(const std::unique_ptr<ASTNode>& identifier) {
+    if (const auto* name = getName(identifier)) {
+      registerVariables.erase(*name);
+    }
+  }
+
+  // Follows the statements and expressions that `compileStatement` and
+  // `compileExpression` lower. Anything they hand to the tree walker leaves
+  // the loop open.
+  void scanBlock(const std::vector<std::unique_ptr<ASTNode>>& body,
+                 LoopScan& scan) {
+    for (const auto& stmt : body) {
+      scanStatement(stmt.get(), scan);
+    }
+  }
+
+  void scanStatement(const ASTNode* node, LoopScan& scan) {
+    if (!node) {
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::IF: {
+        const auto* ifNode = static_cast<const IfNode*>(node);
+        scanExpression(ifNode->condition.get(), scan);
+        scanBlock(ifNode->body, scan);
+        for (const auto& elseif : ifNode->elseifNodes) {
+          scanExpression(elseif->condition.get(), scan);
+          scanBlock(elseif->body, scan);
+        }
+        scanBlock(ifNode->elseBody, scan);
+      } break;
+
+      case ASTNodeType::WHILE_LOOP: {
+        const auto* loop = static_cast<const WhileLoopNode*>(node);
+        scanExpression(loop->condition.get(), scan);
+        scanBlock(loop->body, scan);
+      } break;
+
+      case ASTNodeType::FOR_LOOP: {
+        const auto* loop = static_cast<const ForLoopNode*>(node);
+        addWritten(loop->valueIterator, scan);
+        addWritten(loop->indexIterator, scan);
+        scanExpression(loop->dataSet.get(), scan);
+        scanBlock(loop->body, scan);
+      } break;
+
+      case ASTNodeType::REPEAT_LOOP: {
+        const auto* loop = static_cast<const RepeatLoopNode*>(node);
+        addWritten(loop->alias, scan);
+        scanExpression(loop->count.get(), scan);
+        scanBlock(loop->body, scan);
+      } break;
+
+      case ASTNodeType::BREAK:
+        scanExpression(static_cast<const BreakNode*>(node)->condition.get(),
+                       scan);
+        break;
+
+      case ASTNodeType::NEXT:
+        scanExpression(static_cast<const NextNode*>(node)->condition.get(),
+                       scan);
+        break;
+
+      case ASTNodeType::RETURN: {
+        const auto* ret = static_cast<const ReturnNode*>(node);
+        scanExpression(ret->condition.get(), scan);
+        scanExpression(ret->returnValue.get(), scan);
+      } break;
+
+      case ASTNodeType::ASSIGNMENT:
+      case ASTNodeType::PRINT:
+      case ASTNodeType::FUNCTION_CALL:
+      case ASTNodeType::METHOD_CALL:
+      case ASTNodeType::LITERAL:
+      case ASTNodeType::IDENTIFIER:
+      case ASTNodeType::BINARY_OPERATION:
+      case ASTNodeType::UNARY_OPERATION:
+      case ASTNodeType::TERNARY_OPERATION:
+      case ASTNodeType::LIST_LITERAL:
+      case ASTNodeType::INDEX:
+        scanExpression(node, scan);
+        break;
+
+      default:
+        scan.closed = false;
+        break;
+    }
+  }
+
+  void scanExpression(const ASTNode* node, LoopScan& scan) {
+    if (!node) {
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::LITERAL:
+        break;
+
+      case ASTNodeType::IDENTIFIER:
+        if (scan.argumentDepth > 0) {
+          scan.evaluated.insert(static_cast<const IdentifierNode*>(node)->name);
+        }
+        break;
+
+      case ASTNodeType::BINARY_OPERATION: {
+        const auto* binary = static_cast<const BinaryOperationNode*>(node);
+        scanExpression(binary->left.get(), scan);
+        scanExpression(binary->right.get(), scan);
+      } break;
+
+      case ASTNodeType::UNARY_OPERATION:
+        scanExpression(
+            static_cast<const UnaryOperationNode*>(node)->operand.get(), scan);
+        break;
+
+      case ASTNodeType::TERNARY_OPERATION: {
+        const auto* ternary = static_cast<const TernaryOperationNode*>(node);
+        scanExpression(ternary->evalExpression.get(), scan);
+        scanExpression(ternary->trueExpression.get(), scan);
+        scanExpression(ternary->falseExpression.get(), scan);
+      } break;
+
+      case ASTNodeType::LIST_LITERAL: {
+        const auto* list = static_cast<const ListLiteralNode*>(node);
+        if (!list->constant.isList()) {
+          for (const auto& element : list->elements) {
+            scanExpression(element.get(), scan);
+          }
+        }
+      } break;
+
+      case ASTNodeType::HASH_LITERAL:
+        if (!static_cast<const HashLiteralNode*>(node)->constant.isHashmap()) {
+          scan.closed = false;
+        }
+        break;
+
+      case ASTNodeType::INDEX: {
+        const auto* indexing = static_cast<const IndexingNode*>(node);
+        if (!isCompiledIndex(indexing)) {
+          scan.closed = false;
+          break;
+        }
+        scanExpression(indexing->indexedObject.get(), scan);
+        scanExpression(indexing->indexExpression.get(), scan);
+      } break;
+
+      case ASTNodeType::ASSIGNMENT: {
+        const auto* assignment = static_cast<const AssignmentNode*>(node);
+        scan.written.insert(assignment->name);
+        scanExpression(assignment->initializer.get(), scan);
+      } break;
+
+      case ASTNodeType::PRINT:
+        scanExpression(static_cast<const PrintNode*>(node)->expression.get(),
+                       scan);
+        break;
+
+      case ASTNodeType::FUNCTION_CALL:
+        // The callee sees this frame.
+        scan.closed = false;
+        for (const auto& argument :
+             static_cast<const FunctionCallNode*>(node)->arguments) {
+          scanExpression(argument.get(), scan);
+        }
+        break;
+
+      case ASTNodeType::METHOD_CALL: {
+        // A builtin that is not read-only may call a lambda.
+        const auto* call = static_cast<const MethodCallNode*>(node);
+        if (!isReadOnlyMethod(call->op)) {
+          scan.closed = false;
+        }
+        scanExpression(call->object.get(), scan);
+        ++scan.argumentDepth;
+        for (const auto& argument : call->arguments) {
+          scanExpression(argument.get(), scan);
+        }
+        --scan.argumentDepth;
+      } break;
+
+      default:
+        scan.closed = false;
+        break;
+    }
+  }
+
+  // Builtin methods that only read their receiver and arguments, and never
+  // call back into the program.
+  static bool isReadOnlyMethod(const KName& op) {
+    switch (op) {
+      case KName::Builtin_Kiwi_BeginsWith:
+      case KName::Builtin_Kiwi_Chars:
+      case KName::Builtin_Kiwi_Contains:
+      case KName::Builtin_Kiwi_Empty:
+      case KName::Builtin_Kiwi_EndsWith:
+      case KName::Builtin_Kiwi_First:
+      case KName::Builtin_Kiwi_Get:
+      case KName::Builtin_Kiwi_HasKey:
+      case KName::Builtin_Kiwi_IndexOf:
+      case KName::Builtin_Kiwi_Keys:
+      case KName::Builtin_Kiwi_Last:
+      case KName::Builtin_Kiwi_LastIndexOf:
+      case KName::Builtin_Kiwi_LeftTrim:
+      case KName::Builtin_Kiwi_Lowercase:
+      case KName::Builtin_Kiwi_RightTrim:
+      case KName::Builtin_Kiwi_Size:
+      case KName::Builtin_Kiwi_Substring:
+      case KName::Builtin_Kiwi_ToD:
+      case KName::Builtin_Kiwi_ToI:
+      case KName::Builtin_Kiwi_ToS:
+      case KName::Builtin_Kiwi_Trim:
+      case KName::Builtin_Kiwi_Type:
+      case KName::Builtin_Kiwi_Uppercase:
+      case KName::Builtin_Kiwi_Values:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  static bool isCompiledIndex(const IndexingNode* node) {
+    return node->indexedObject && node->indexExpression &&
+           node->indexExpression->type != ASTNodeType::INDEX;
+  }
+
+  // Whether `node` has the same value every time the loop evaluates it, as
+  // long as nothing the compiler cannot see has run in between.
+  bool isInvariant(const ASTNode* node, const LoopScan& scan) const {
+    if (!node) {
+      return false;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::LITERAL:
+        return true;
+
+      case ASTNodeType::IDENTIFIER: {
+        const auto& name = static_cast<const IdentifierNode*>(node)->name;
+        return scan.written.find(name) == scan.written.end() &&
+               registerVariables.find(name) == registerVariables.end();
+      }
+
+      case ASTNodeType::BINARY_OPERATION: {
+        const auto* binary = static_cast<const BinaryOperationNode*>(node);
+        return isInvariant(binary->left.get(), scan) &&
+               isInvariant(binary->right.get(), scan);
+      }
+
+      case ASTNodeType::UNARY_OPERATION:
+        return isInvariant(
+            static_cast<const UnaryOperationNode*>(node)->operand.get(), scan);
+
+      case ASTNodeType::INDEX: {
+        const auto* indexing = static_cast<const IndexingNode*>(node);
+        return isCompiledIndex(indexing) &&
+               isInvariant(indexing->indexedObject.get(), scan) &&
+               isInvariant(indexing->indexExpression.get(), scan);
+      }
+
+      case ASTNodeType::METHOD_CALL: {
+        const auto* call = static_cast<const MethodCallNode*>(node);
+        if (!isReadOnlyMethod(call->op) ||
+            !isInvariant(call->object.get(), scan)) {
+          return false;
+        }
+        for (const auto& argument : call->arguments) {
+          if (!isInvariant(argument.get(), scan)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      default:
+        return false;
+    }
+  }
+
+  // Gives each invariant expression in a loop a pair of registers, and clears
+  // them before the loop starts. An expression already kept by an enclosing
+  // loop stays with it.
+  std::vector<const ASTNode*> hoistInvariants(
+      const ASTNode* condition,
+      const std::vector<std::unique_ptr<ASTNode>>& body,
+      const LoopScan& scan) {
+    std::vector<const ASTNode*> hoisted;
+    hoistExpression(condition, scan, hoisted);
+    hoistBlock(body, scan, hoisted);
+
+    for (const auto* node : hoisted) {
+      emit(KOpCode::LoadConst, invariants[node] + 1, NullConstant);
+    }
+    return hoisted;
+  }
+
+  void forgetInvariants(const std::vector<const ASTNode*>& hoisted) {
+    for (const auto* node : hoisted) {
+      invariants.erase(node);
+    }
+  }
+
+  void hoistBlock(const std::vector<std::unique_ptr<ASTNode>>& body,
+                  const LoopScan& scan, std::vector<const ASTNode*>& hoisted) {
+    for (const auto& stmt : body) {
+      hoistStatement(stmt.get(), scan, hoisted);
+    }
+  }
+
+  void hoistStatement(const ASTNode* node, const LoopScan& scan,
+                      std::vector<const ASTNode*>& hoisted) {
+    if (!node) {
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::IF: {
+        const auto* ifNode = static_cast<const IfNode*>(node);
+        hoistExpression(ifNode->condition.get(), scan, hoisted);
+        hoistBlock(ifNode->body, scan, hoisted);
+        for (const auto& elseif : ifNode->elseifNodes) {
+          hoistExpression(elseif->condition.get(), scan, hoisted);
+          hoistBlock(elseif->body, scan, hoisted);
+        }
+        hoistBlock(ifNode->elseBody, scan, hoisted);
+      } break;
+
+      case ASTNodeType::WHILE_LOOP: {
+        const auto* loop = static_cast<const WhileLoopNode*>(node);
+        hoistExpression(loop->condition.get(), scan, hoisted);
+        hoistBlock(loop->body, scan, hoisted);
+      } break;
+
+      case ASTNodeType::FOR_LOOP: {
+        const auto* loop = static_cast<const ForLoopNode*>(node);
+        hoistExpression(loop->dataSet.get(), scan, hoisted);
+        hoistBlock(loop->body, scan, hoisted);
+      } break;
+
+      case ASTNodeType::REPEAT_LOOP: {
+        const auto* loop = static_cast<const RepeatLoopNode*>(node);
+        hoistExpression(loop->count.get(), scan, hoisted);
+        hoistBlock(loop->body, scan, hoisted);
+      } break;
+
+      case ASTNodeType::BREAK:
+        hoistExpression(static_cast<const BreakNode*>(node)->condition.get(),
+                        scan, hoisted);
+        break;
+
+      case ASTNodeType::NEXT:
+        hoistExpression(static_cast<const NextNode*>(node)->condition.get(),
+                        scan, hoisted);
+        break;
+
+      case ASTNodeType::RETURN: {
+        const auto* ret = static_cast<const ReturnNode*>(node);
+        hoistExpression(ret->condition.get(), scan, hoisted);
+        hoistExpression(ret->returnValue.get(), scan, hoisted);
+      } break;
+
+      case ASTNodeType::ASSIGNMENT:
+      case ASTNodeType::PRINT:
+      case ASTNodeType::FUNCTION_CALL:
+      case ASTNodeType::METHOD_CALL:
+      case ASTNodeType::BINARY_OPERATION:
+      case ASTNodeType::UNARY_OPERATION:
+      case ASTNodeType::TERNARY_OPERATION:
+      case ASTNodeType::LIST_LITERAL:
+      case ASTNodeType::INDEX:
+        hoistExpression(node, scan, hoisted);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void hoistExpression(const ASTNode* node, const LoopScan& scan,
+                       std::vector<const ASTNode*>& hoisted) {
+    if (!node || node->type == ASTNodeType::LITERAL ||
+        invariants.find(node) != invariants.end()) {
+      return;
+    }
+
+    if (isInvariant(node, scan)) {
+      invariants[node] = allocate(2);
+      hoisted.push_back(node);
+      return;
+    }
+
+    switch (node->type) {
+      case ASTNodeType::BINARY_OPERATION: {
+        const auto* binary = static_cast<const BinaryOperationNode*>(node);
+        hoistExpression(binary->left.get(), scan, hoisted);
+        hoistExpression(binary->right.get(), scan, hoisted);
+      } break;
+
+      case ASTNodeType::UNARY_OPERATION:
+        hoistExpression(
+            static_cast<const UnaryOperationNode*>(node)->operand.get(), scan,
+            hoisted);
+        break;
+
+      case ASTNodeType::TERNARY_OPERATION: {
+        const auto* ternary = static_cast<const TernaryOperationNode*>(node);
+        hoistExpression(ternary->evalExpression.get(), scan, hoisted);
+        hoistExpression(ternary->trueExpression.get(), scan, hoisted);
+        hoistExpression(ternary->falseExpression.get(), scan, hoisted);
+      } break;
+
+      case ASTNodeType::LIST_LITERAL: {
+        const auto* list = static_cast<const ListLiteralNode*>(node);
+        if (!list->constant.isList()) {
+          for (const auto& element : list->elements) {
+            hoistExpression(element.get(), scan, hoisted);
+          }
+        }
+      } break;
+
+      case ASTNodeType::INDEX: {
+        const auto* indexing = static_cast<const IndexingNode*>(node);
+        if (isCompiledIndex(indexing)) {
+          hoistExpression(indexing->indexedObject.get(), scan, hoisted);
+          hoistExpression(indexing->indexExpression.get(), scan, hoisted);
+        }
+      } break;
+
+      case ASTNodeType::ASSIGNMENT:
+        hoistExpression(
+            static_cast<const AssignmentNode*>(node)->initializer.get(), scan,
+            hoisted);
+        break;
+
+      case ASTNodeType::PRINT:
+        hoistExpression(static_cast<const PrintNode*>(node)->expression.get(),
+                        scan, hoisted);
+        break;
+
+      case ASTNodeType::FUNCTION_CALL:
+        for (const auto& argument :
+             static_cast<const FunctionCallNode*>(node)->arguments) {
+          hoistExpression(argument.get(), scan, hoisted);
+        }
+        break;
+
+      case ASTNodeType::METHOD_CALL: {
+        const auto* call = static_cast<const MethodCallNode*>(node);
+        hoistExpression(call->object.get(), scan, hoisted);
+        for (const auto& argument : call->arguments) {
+          hoistExpression(argument.get(), scan, hoisted);
+        }
+      } break;
+
+      default:
+        break;
+    }
+  }
+
+  void compileLoopControl(const std::unique_ptr<ASTNode>& condition,
+                          std::vector<int>& jumps) {
+    if (!condition) {
+      jumps.push_back(emit(KOpCode::Jump));
+      return;
+    }
+
+    auto mark = nextRegister;
+    auto reg = allocate();
+    compileExpression(condition.get(), reg);
+    jumps.push_back(emit(KOpCode::JumpIfTrue, reg));
+    release(mark);
+  }
+
+  void compileReturn(const ReturnNode* node) {
+    auto mark = nextRegister;
+    auto skip = -1;
+
+    if (node->condition) {
+      auto condition = allocate();
+      compileExpression(node->condition.get(), condition);
+      skip = emit(KOpCode::JumpIfFalse, condition);
+    }
+
+    auto value = -1;
+    if (node->returnValue) {
+      value = allocate();
+      compileExpression(node->returnValue.get(), value);
+    }
+
+    auto at = emit(KOpCode::Return, value, -1, -1, node);
+    if (programMode) {
+      returnJumps.push_back(at);
+    }
+
+    if (skip != -1) {
+      patch(skip, here());
+      emit(KOpCode::LoadConst, 0, NullConstant);
+    }
+
+    release(mark);
+  }
+
+  void compileExpression(const ASTNode* node, int dst) {
+    if (!node) {
+      emit(KOpCode::LoadConst, dst, NullConstant);
+      return;
+    }
+
+    if (auto it = invariants.find(node); it != invariants.end()) {
+      auto cache = it->second;
+      invariants.erase(it);
+      compileInvariant(node, dst, cache);
+      return;
+    }
+
+    auto mark = nextRegister;
+
+    switch (node->type) {
+      case ASTNodeType::LITERAL: {
+        const auto* literal = static_cast<const LiteralNode*>(node);
+        emit(KOpCode::LoadConst, dst, addConstant(literal->value));
+      } break;
+
+      case ASTNodeType::IDENTIFIER: {
+        const auto& name = static_cast<const IdentifierNode*>(node)->name;
+        if (auto it = registerVariables.find(name);
+            it != registerVariables.end()) {
+          emit(KOpCode::Move, dst, it->second);
+          break;
+        }
+
+        auto slot = isInstanceVariable(name) ? -1 : resolveSlot(name);
+        emit(KOpCode::LoadVar, dst, slot, -1, node);
+      } break;
+
+      case ASTNodeType::BINARY_OPERATION:
+        compileBinary(static_cast<const BinaryOperationNode*>(node), dst);
+        break;
+
+      case ASTNodeType::UNARY_OPERATION: {
+        const auto* unary = static_cast<const UnaryOperationNode*>(node);
+        compileExpression(unary->operand.get(), dst);
+        emit(KOpCode::Unary, dst, dst, -1, node);
+      } break;
+
+      case ASTNodeType::TERNARY_OPERATION: {
+        const auto* ternary = static_cast<const TernaryOperationNode*>(node);
+        compileExpression(ternary->evalExpression.get(), dst);
+        auto otherwise = emit(KOpCode::JumpIfFalse, dst);
+        compileExpression(ternary->trueExpression.get(), dst);
+        auto done = emit(KOpCode::Jump);
+        patch(otherwise, here());
+        compileExpression(ternary->falseExpression.get(), dst);
+        patch(done, here());
+      } break;
+
+      case ASTNodeType::LIST_LITERAL: {
+        const auto* list = static_cast<const ListLiteralNode*>(node);
+        if (list->constant.isList()) {
+          emit(KOpCode::LoadCopy, dst, addConstant(list->constant));
+          break;
+        }
+
+        const auto& elements = list->elements;
+        auto count = static_cast<int>(elements.size());
+        auto base = allocate(count);
+        for (int i = 0; i < count; ++i) {
+          compileExpression(elements.at(i).get(), base + i);
+        }
+        emit(KOpCode::MakeList, dst, base, count, node);
+      } break;
+
+      case ASTNodeType::HASH_LITERAL: {
+        const auto* hash = static_cast<const HashLiteralNode*>(node);
+        if (hash->constant.isHashmap()) {
+          emit(KOpCode::LoadCopy, dst, addConstant(hash->constant));
+        } else {
+          emit(KOpCode::Eval, dst, -1, -1, node);
+        }
+      } break;
+
+      case ASTNodeType::INDEX: {
+        const auto* indexing = static_cast<const IndexingNode*>(node);
+        if (!isCompiledIndex(indexing)) {
+          emit(KOpCode::Eval, dst, -1, -1, node);
+          break;
+        }
+
+        auto index = allocate();
+        compileExpression(indexing->indexedObject.get(), dst);
+        compileExpression(indexing->indexExpression.get(), index);
+        emit(KOpCode::Index, dst, dst, index, node);
+      } break;
+
+      case ASTNodeType::ASSIGNMENT: {
+        const auto* assignment = static_cast<const AssignmentNode*>(node);
+        const auto& name = assignment->name;
+        compileExpression(assignment->initializer.get(), dst);
+
+        if (isInstanceVariable(name) || name == Keywords.Global ||
+            (assignment->left &&
+             assignment->left->type == ASTNodeType::SELF)) {
+          emit(KOpCode::Assign, dst, dst, -1, node);
+        } else {
+          emit(KOpCode::StoreVar, dst, resolveSlot(name), -1, node);
+        }
+      } break;
+
+      case ASTNodeType::PRINT: {
+        auto value = allocate();
+        compileExpression(static_cast<const PrintNode*>(node)->expression.get(),
+                          value);
+        emit(KOpCode::Print, value, dst, -1, node);
+      } break;
+
+      case ASTNodeType::FUNCTION_CALL:
+        compileFunctionCall(static_cast<const FunctionCallNode*>(node), dst);
+        break;
+
+      case ASTNodeType::METHOD_CALL:
+        compileMethodCall(static_cast<const MethodCallNode*>(node), dst);
+        break;
+
+      default:
+        emit(KOpCode::Eval, dst, -1, -1, node);
+        break;
+    }
+
+    release(mark);
+  }
+
+  // Skips evaluating a loop-invariant expression while the value kept in
+  // `cache` is still good. Only a name or an element is kept if it holds a
+  // list or hashmap, since any other expression builds a new one each time.
+  void compileInvariant(const ASTNode* node, int dst, int cache) {
+    auto load = emit(KOpCode::CacheLoad, dst, cache, -1, node);
+    compileExpression(node, dst);
+    auto shared = node->type == ASTNodeType::IDENTIFIER ||
+                  node->type == ASTNodeType::INDEX;
+    emit(KOpCode::CacheStore, dst, cache, shared ? 1 : 0, node);
+    patch(load, here());
+  }
+
+  void compileBinary(const BinaryOperationNode* node, int dst) {
+    const auto& op = node->op;
+
+    if (op == KName::Ops_And || op == KName::Ops_Or) {
+      compileExpression(node->left.get(), dst);
+      auto shortCircuit = emit(
+          op == KName::Ops_And ? KOpCode::JumpIfFalse : KOpCode::JumpIfTrue,
+          dst);
+
+      auto right = allocate();
+      compileExpression(node->right.get(), right);
+      emit(KOpCode::Binary, dst, dst, right, node);
+      auto done = emit(KOpCode::Jump);
+
+      patch(shortCircuit, here());
+      emit(KOpCode::LoadConst, dst,
+           addConstant(KValue::createBoolean(op == KName::Ops_Or)));
+      patch(done, here());
+      return;
+    }
+
+    auto right = allocate();
+    compileExpression(node->left.get(), dst);
+    compileExpression(node->right.get(), right);
+    emit(KOpCode::Binary, dst, dst, right, node);
+  }
+
+  // The callee is resolved before any argument is evaluated. Lambdas and
+  // struct methods are left to the tree walker.
+  void compileFunctionCall(const FunctionCallNode* node, int dst) {
+    auto check = emit(KOpCode::CallCheck, dst, -1, -1, node);
+
+    auto count = static_cast<int>(node->arguments.size());
+    auto base = allocate(count);
+    for (int i = 0; i < count; ++i) {
+      compileExpression(node->arguments.at(i).get(), base + i);
+    }
+
+    emit(KOpCode::Call, dst, base, count, node);
+    patch(check, here());
+  }
+
+  // Objects and structs receive their arguments unevaluated, so only builtin
+  // receivers have their arguments lowered.
+  void compileMethodCall(const MethodCallNode* node, int dst) {
+    auto count = static_cast<int>(node->arguments.size());
+    auto base = allocate(1 + count);
+    compileExpression(node->object.get(), base);
+    auto check = emit(KOpCode::MethodCheck, dst, base, -1, node);
+
+    for (int i = 0; i < count; ++i) {
+      compileExpression(node->arguments.at(i).get(), base + 1 + i);
+    }
+
+    emit(KOpCode::MethodCall, dst, base, count,
+         isReadOnlyMethod(node->op) ? 1 : 0, node);
+    patch(check, here());
+  }
+};
+
+#endif